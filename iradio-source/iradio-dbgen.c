@@ -0,0 +1,138 @@
+/*
+ * This file is a part of MAFW
+ *
+ * Copyright (C) 2007, 2008, 2009 Nokia Corporation, all rights reserved.
+ *
+ * Contact: Visa Smolander <visa.smolander@nokia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+/*
+ * iradio-dbgen: compiles the vendor bookmark files into a database image
+ * at build time.  The source copies the image on its first start instead
+ * of parsing the files, see import_db_image().
+ *
+ * The image is made by the same vendor setup that runs on the device, so
+ * it also records the state of every vendor file, and the first vendor
+ * setup on the device has nothing left to do.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <libmafw/mafw.h>
+
+#include "mafw-iradio-source.h"
+#include "mafw-iradio-db.h"
+#include "mafw-iradio-vendor-setup.h"
+
+static gchar *icon_dir;
+
+static const GOptionEntry options[] = {
+	{ "icon-dir", 'i', 0, G_OPTION_ARG_FILENAME, &icon_dir,
+	  "Directory of the vendor icons on the device", "DIR" },
+	{ NULL }
+};
+
+struct dbgen {
+	GMainLoop *loop;
+	guint changed;
+};
+
+static void setup_done(MafwIradioSource *self, guint changed,
+		       struct dbgen *dbgen)
+{
+	dbgen->changed = changed;
+	g_main_loop_quit(dbgen->loop);
+}
+
+int main(int argc, char **argv)
+{
+	MafwIradioVendorSetup *setup;
+	MafwIradioSource *source;
+	GOptionContext *context;
+	GError *error = NULL;
+	struct dbgen dbgen;
+	gchar *journal;
+
+#if !GLIB_CHECK_VERSION(2,35,0)
+	g_type_init();
+#endif
+	context = g_option_context_new("VENDOR-DIR IMAGE");
+	g_option_context_set_summary(context,
+		"Writes the bookmarks of the vendor files in VENDOR-DIR into "
+		"a database image\nthat the internet radio source copies on "
+		"its first start.");
+	g_option_context_add_main_entries(context, options, NULL);
+	if (!g_option_context_parse(context, &argc, &argv, &error))
+	{
+		fprintf(stderr, "%s\n", error->message);
+		return 2;
+	}
+	if (argc != 3)
+	{
+		gchar *help;
+
+		help = g_option_context_get_help(context, TRUE, NULL);
+		fputs(help, stderr);
+		g_free(help);
+		return 2;
+	}
+	g_option_context_free(context);
+
+	/* Icons are referred to where the device has them */
+	vendor_icon_path = icon_dir ? icon_dir : vendor_setup_path;
+
+	journal = g_strconcat(argv[2], "-journal", NULL);
+	g_unlink(argv[2]);
+	g_unlink(journal);
+	g_free(journal);
+	g_setenv("MAFW_DB", argv[2], TRUE);
+	g_unsetenv(MAFW_IRADIO_DB_ENV);
+
+	/* Neither the build host's vendor files nor the image itself */
+	vendor_setup_path = "/nonexistent";
+	db_image_path = "/nonexistent";
+	source = MAFW_IRADIO_SOURCE(mafw_iradio_source_new());
+
+	vendor_setup_path = argv[1];
+	dbgen.loop = g_main_loop_new(NULL, FALSE);
+	dbgen.changed = 0;
+	setup = mafw_iradio_vendor_setup_start(
+			source, (MafwIradioVendorSetupDoneCb)setup_done,
+			&dbgen);
+	if (setup == NULL)
+	{
+		fprintf(stderr, "No vendor files in %s\n", argv[1]);
+		return 1;
+	}
+	g_main_loop_run(dbgen.loop);
+
+	printf("%u bookmarks written to %s\n", dbgen.changed, argv[2]);
+
+	g_main_loop_unref(dbgen.loop);
+	g_object_unref(source);
+	g_free(icon_dir);
+	return 0;
+}
+
+/* vi: set noexpandtab ts=8 sw=8 cino=t0,(0: */
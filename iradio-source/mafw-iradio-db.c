@@ -0,0 +1,1457 @@
+/*
+ * This file is a part of MAFW
+ *
+ * Copyright (C) 2007, 2008, 2009 Nokia Corporation, all rights reserved.
+ *
+ * Contact: Visa Smolander <visa.smolander@nokia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#include <string.h>
+#include <libmafw/mafw-db.h>
+
+#include "mafw-iradio-db.h"
+
+/* Milliseconds to wait for a lock held by another process */
+#define BUSY_TIMEOUT 5000
+
+/* Pragmas of the private connection: readers do not block the writer and
+   vice versa */
+static const gchar *const private_pragmas[] = {
+	"PRAGMA journal_mode = WAL",
+	"PRAGMA temp_store = MEMORY",
+	NULL
+};
+
+/* How often commits are synced in each profile, see MafwIradioDbProfile */
+static const struct {
+	const gchar *name;
+	const gchar *pragma;
+} profiles[] = {
+	[MAFW_IRADIO_DB_STRICT] = { "strict", "PRAGMA synchronous = FULL" },
+	[MAFW_IRADIO_DB_BALANCED] = { "balanced",
+				      "PRAGMA synchronous = NORMAL" },
+	[MAFW_IRADIO_DB_RELAXED] = { "relaxed", "PRAGMA synchronous = OFF" },
+};
+
+static MafwIradioDbProfile profile = MAFW_IRADIO_DB_BALANCED;
+
+static sqlite3 *private_db;
+static gboolean private_checked;
+/* Thread owning libmafw's connection, and its main context */
+static GThread *shared_owner;
+static GMainContext *shared_context;
+/* Read-only connection of the private database; in WAL mode it reads the
+   last commit while private_db is writing */
+static sqlite3 *reader_db;
+/* Held by the thread in a read transaction of reader_db, which is the
+   connection's own, from mafw_iradio_db_read_begin() to the end */
+static GRecMutex read_lock;
+static guint read_depth;
+
+/* Serializes the threads using private_db.  A transaction holds it from
+   mafw_iradio_db_begin() to the commit or rollback. */
+static GRecMutex db_lock;
+/* Threads blocked on db_lock, for which the worker ends its group early */
+static gint lock_waiters;
+static GThread *transaction_owner;
+/* Nested transactions are savepoints of the outermost one */
+static guint transaction_depth;
+
+/**
+ * Opens the private database if MAFW_IRADIO_DB asks for one.
+ */
+static void open_private_db(void)
+{
+	const gchar *path;
+	guint i;
+
+	private_checked = TRUE;
+	path = g_getenv(MAFW_IRADIO_DB_ENV);
+	if (path == NULL || path[0] == '\0')
+	{
+		shared_owner = g_thread_self();
+		shared_context = g_main_context_ref_thread_default();
+		return;
+	}
+
+	if (sqlite3_open(path, &private_db) != SQLITE_OK)
+	{
+		g_critical("Unable to open %s: %s", path,
+			   sqlite3_errmsg(private_db));
+		sqlite3_close(private_db);
+		private_db = NULL;
+		return;
+	}
+
+	sqlite3_busy_timeout(private_db, BUSY_TIMEOUT);
+	for (i = 0; private_pragmas[i]; i++)
+	{
+		if (sqlite3_exec(private_db, private_pragmas[i], NULL, NULL,
+				 NULL) != SQLITE_OK)
+			g_warning("%s: %s", private_pragmas[i],
+				  sqlite3_errmsg(private_db));
+	}
+	if (sqlite3_exec(private_db, profiles[profile].pragma, NULL, NULL,
+			 NULL) != SQLITE_OK)
+		g_warning("%s: %s", profiles[profile].pragma,
+			  sqlite3_errmsg(private_db));
+
+	if (sqlite3_open_v2(path, &reader_db, SQLITE_OPEN_READONLY, NULL)
+	    != SQLITE_OK)
+	{
+		/* Reads go through private_db then */
+		g_warning("Unable to open %s for reading: %s", path,
+			  sqlite3_errmsg(reader_db));
+		sqlite3_close(reader_db);
+		reader_db = NULL;
+	}
+	else
+		sqlite3_busy_timeout(reader_db, BUSY_TIMEOUT);
+	g_debug("Using the database %s", path);
+}
+
+/**
+ * mafw_iradio_db_use_shared:
+ *
+ * Closes the private database, so that the iradio tables stay in the shared
+ * one from now on.  Only for the start, before statements of the private
+ * database are kept or jobs are queued.
+ */
+void mafw_iradio_db_use_shared(void)
+{
+	if (!mafw_iradio_db_is_private())
+		return;
+
+	if (reader_db)
+		sqlite3_close(reader_db);
+	reader_db = NULL;
+	if (sqlite3_close(private_db) != SQLITE_OK)
+		g_critical("Unable to close the iradio database: %s",
+			   sqlite3_errmsg(private_db));
+	private_db = NULL;
+	shared_owner = g_thread_self();
+	shared_context = g_main_context_ref_thread_default();
+	g_debug("Using the shared database");
+}
+
+/**
+ * mafw_iradio_db_is_private:
+ *
+ * Returns: TRUE if the iradio tables are in a database of their own.
+ */
+gboolean mafw_iradio_db_is_private(void)
+{
+	if (!private_checked)
+		open_private_db();
+	return private_db != NULL;
+}
+
+/**
+ * mafw_iradio_db_get:
+ *
+ * Returns: the connection of the iradio tables.
+ */
+sqlite3 *mafw_iradio_db_get(void)
+{
+	return mafw_iradio_db_is_private() ? private_db : mafw_db_get();
+}
+
+/**
+ * mafw_iradio_db_path:
+ *
+ * Returns: the newly allocated path of the database of the iradio tables.
+ */
+gchar *mafw_iradio_db_path(void)
+{
+	const gchar *path;
+
+	if (mafw_iradio_db_is_private())
+		return g_strdup(g_getenv(MAFW_IRADIO_DB_ENV));
+
+	path = g_getenv("MAFW_DB");
+	if (path != NULL)
+		return g_strdup(path);
+	/* Where libmafw keeps it by default */
+	return g_build_filename(g_get_home_dir(), ".mafw.db", NULL);
+}
+
+/**
+ * mafw_iradio_db_prepare:
+ *
+ * @query: An SQL statement
+ *
+ * Returns: the prepared statement.  It is a programming error if @query
+ * does not compile.
+ */
+sqlite3_stmt *mafw_iradio_db_prepare(const gchar *query)
+{
+	sqlite3_stmt *stmt;
+
+	if (!mafw_iradio_db_is_private())
+		return mafw_db_prepare(query);
+
+	if (sqlite3_prepare_v2(private_db, query, -1, &stmt, NULL)
+	    != SQLITE_OK)
+		g_error("%s: %s", query, sqlite3_errmsg(private_db));
+	return stmt;
+}
+
+/**
+ * mafw_iradio_db_prepare_read:
+ *
+ * @query: An SQL query
+ *
+ * Prepares a query on the reader connection of the private database.  It
+ * sees what was committed when it started, and neither waits for nor sees
+ * the transaction being written.  Queries that must see the changes of the
+ * current write transaction use mafw_iradio_db_prepare() instead.
+ *
+ * Returns: the prepared statement.  It is a programming error if @query
+ * does not compile.
+ */
+sqlite3_stmt *mafw_iradio_db_prepare_read(const gchar *query)
+{
+	sqlite3_stmt *stmt;
+
+	if (!mafw_iradio_db_is_private() || reader_db == NULL)
+		return mafw_iradio_db_prepare(query);
+
+	if (sqlite3_prepare_v2(reader_db, query, -1, &stmt, NULL)
+	    != SQLITE_OK)
+		g_error("%s: %s", query, sqlite3_errmsg(reader_db));
+	return stmt;
+}
+
+static void wake_worker(void);
+
+static void lock_db(void)
+{
+	if (!mafw_iradio_db_is_private() || g_rec_mutex_trylock(&db_lock))
+		return;
+
+	/* Most likely the worker, waiting for more writes to group */
+	g_atomic_int_inc(&lock_waiters);
+	wake_worker();
+	g_rec_mutex_lock(&db_lock);
+	g_atomic_int_add(&lock_waiters, -1);
+}
+
+static void unlock_db(void)
+{
+	if (mafw_iradio_db_is_private())
+		g_rec_mutex_unlock(&db_lock);
+}
+
+/**
+ * Steps @stmt on a private connection and reports errors.  Statements of
+ * the writing connection step under the lock, so that they do not run in
+ * the middle of another thread's transaction.
+ */
+static gint step(sqlite3_stmt *stmt, gboolean fatal)
+{
+	gboolean writer;
+	gint result;
+
+	writer = sqlite3_db_handle(stmt) == private_db;
+	if (writer)
+		lock_db();
+	result = sqlite3_step(stmt);
+	if (writer)
+		unlock_db();
+	if (result != SQLITE_ROW && result != SQLITE_DONE)
+	{
+		if (fatal)
+			g_error("Database error: %s",
+				sqlite3_errmsg(sqlite3_db_handle(stmt)));
+		g_critical("Database error: %s",
+			   sqlite3_errmsg(sqlite3_db_handle(stmt)));
+	}
+	return result;
+}
+
+/**
+ * mafw_iradio_db_select:
+ *
+ * @stmt: A query
+ * @fatal: Whether errors abort the process
+ *
+ * Returns: SQLITE_ROW while @stmt returns rows, then SQLITE_DONE.  The
+ * caller resets @stmt.
+ */
+gint mafw_iradio_db_select(sqlite3_stmt *stmt, gboolean fatal)
+{
+	if (!mafw_iradio_db_is_private())
+		return mafw_db_select(stmt, fatal);
+	return step(stmt, fatal);
+}
+
+/**
+ * mafw_iradio_db_change:
+ *
+ * @stmt: An INSERT or UPDATE statement
+ * @fatal: Whether errors abort the process
+ *
+ * Executes and resets @stmt.
+ *
+ * Returns: SQLITE_DONE if successful.
+ */
+gint mafw_iradio_db_change(sqlite3_stmt *stmt, gboolean fatal)
+{
+	gint result;
+
+	if (!mafw_iradio_db_is_private())
+		return mafw_db_change(stmt, fatal);
+
+	lock_db();
+	result = step(stmt, fatal);
+	sqlite3_reset(stmt);
+	unlock_db();
+	return result;
+}
+
+/**
+ * mafw_iradio_db_delete:
+ *
+ * @stmt: A DELETE statement
+ *
+ * Executes and resets @stmt.
+ *
+ * Returns: SQLITE_DONE if successful.
+ */
+gint mafw_iradio_db_delete(sqlite3_stmt *stmt)
+{
+	if (!mafw_iradio_db_is_private())
+		return mafw_db_delete(stmt);
+	return mafw_iradio_db_change(stmt, FALSE);
+}
+
+/**
+ * mafw_iradio_db_exec:
+ *
+ * @query: SQL statements without parameters
+ *
+ * Returns: SQLITE_OK if successful.
+ */
+gint mafw_iradio_db_exec(const gchar *query)
+{
+	gint result;
+
+	if (!mafw_iradio_db_is_private())
+		return mafw_db_exec(query);
+
+	lock_db();
+	result = sqlite3_exec(private_db, query, NULL, NULL, NULL);
+	if (result != SQLITE_OK)
+		g_critical("%s: %s", query, sqlite3_errmsg(private_db));
+	unlock_db();
+	return result;
+}
+
+/**
+ * mafw_iradio_db_nchanges:
+ *
+ * Returns: the number of rows changed by the last statement.
+ */
+gint mafw_iradio_db_nchanges(void)
+{
+	if (!mafw_iradio_db_is_private())
+		return mafw_db_nchanges();
+	return sqlite3_changes(private_db);
+}
+
+/**
+ * mafw_iradio_db_begin:
+ *
+ * Opens a transaction.  On the private database the calling thread has the
+ * connection to itself until mafw_iradio_db_commit() succeeds or
+ * mafw_iradio_db_rollback() is called.  A transaction opened inside
+ * another one is a savepoint: its commit or rollback only ends it, and
+ * the changes are stored with the outer transaction.
+ *
+ * Returns: FALSE on database error
+ */
+gboolean mafw_iradio_db_begin(void)
+{
+	if (!mafw_iradio_db_is_private())
+		return mafw_db_begin();
+
+	lock_db();
+	if (mafw_iradio_db_exec(transaction_depth ? "SAVEPOINT nested"
+						  : "BEGIN") != SQLITE_OK)
+	{
+		unlock_db();
+		return FALSE;
+	}
+	transaction_owner = g_thread_self();
+	transaction_depth++;
+	return TRUE;
+}
+
+gboolean mafw_iradio_db_commit(void)
+{
+	if (!mafw_iradio_db_is_private())
+		return mafw_db_commit();
+
+	g_return_val_if_fail(transaction_owner == g_thread_self(), FALSE);
+	/* A failed commit is rolled back by the caller */
+	if (mafw_iradio_db_exec(transaction_depth > 1 ? "RELEASE nested"
+						      : "COMMIT") != SQLITE_OK)
+		return FALSE;
+	if (--transaction_depth == 0)
+		transaction_owner = NULL;
+	unlock_db();
+	return TRUE;
+}
+
+void mafw_iradio_db_rollback(void)
+{
+	if (!mafw_iradio_db_is_private())
+	{
+		mafw_db_rollback();
+		return;
+	}
+
+	/* Callers roll back after a failed begin too */
+	if (transaction_owner != g_thread_self())
+		return;
+	if (transaction_depth > 1)
+		mafw_iradio_db_exec("ROLLBACK TO nested; RELEASE nested");
+	else
+		mafw_iradio_db_exec("ROLLBACK");
+	if (--transaction_depth == 0)
+		transaction_owner = NULL;
+	unlock_db();
+}
+
+/**
+ * mafw_iradio_db_read_begin:
+ *
+ * Makes the following queries prepared with mafw_iradio_db_prepare_read()
+ * read the same commit, until mafw_iradio_db_read_end().  The calls nest,
+ * and other threads wait to begin theirs.  Without a reader connection
+ * every query reads the current state anyway.
+ */
+void mafw_iradio_db_read_begin(void)
+{
+	if (!mafw_iradio_db_is_private() || reader_db == NULL)
+		return;
+	g_rec_mutex_lock(&read_lock);
+	if (read_depth++ == 0 &&
+	    sqlite3_exec(reader_db, "BEGIN", NULL, NULL, NULL) != SQLITE_OK)
+		g_critical("BEGIN: %s", sqlite3_errmsg(reader_db));
+}
+
+void mafw_iradio_db_read_end(void)
+{
+	if (!mafw_iradio_db_is_private() || reader_db == NULL)
+		return;
+	g_return_if_fail(read_depth > 0);
+	/* Statements of the transaction must have been reset, or the
+	   reader keeps the WAL from being checkpointed */
+	if (--read_depth == 0 &&
+	    sqlite3_exec(reader_db, "COMMIT", NULL, NULL, NULL) != SQLITE_OK)
+		g_critical("COMMIT: %s", sqlite3_errmsg(reader_db));
+	g_rec_mutex_unlock(&read_lock);
+}
+
+/*---------------------------------------------------------------------------
+  Durability
+  ---------------------------------------------------------------------------*/
+
+/**
+ * mafw_iradio_db_parse_profile:
+ *
+ * @name: "strict", "balanced" or "relaxed"
+ * @result: Return location for the profile
+ *
+ * Returns: FALSE if @name is not a profile
+ */
+gboolean mafw_iradio_db_parse_profile(const gchar *name,
+				      MafwIradioDbProfile *result)
+{
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS(profiles); i++)
+	{
+		if (!strcmp(name, profiles[i].name))
+		{
+			*result = i;
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+MafwIradioDbProfile mafw_iradio_db_get_profile(void)
+{
+	return profile;
+}
+
+/**
+ * mafw_iradio_db_set_profile:
+ *
+ * @new_profile: The durability of the private database
+ *
+ * Applies @new_profile to the private database.  The shared MAFW database
+ * is left as libmafw set it up, always strict, since its connection is
+ * not ours alone.
+ */
+void mafw_iradio_db_set_profile(MafwIradioDbProfile new_profile)
+{
+	g_return_if_fail(new_profile < G_N_ELEMENTS(profiles));
+
+	if (!mafw_iradio_db_is_private())
+		return;
+	profile = new_profile;
+	/* The level can't be changed in a transaction */
+	lock_db();
+	mafw_iradio_db_exec(profiles[profile].pragma);
+	unlock_db();
+	g_debug("Database profile: %s", profiles[profile].name);
+}
+
+/**
+ * mafw_iradio_db_checkpoint:
+ *
+ * Copies the commits from the write-ahead log into the database and syncs
+ * both, even in the relaxed profile.  Up to this point, commits of the
+ * relaxed profile survive a crash of the process, but not of the system.
+ */
+void mafw_iradio_db_checkpoint(void)
+{
+	if (!mafw_iradio_db_is_private())
+		return;
+
+	lock_db();
+	if (transaction_depth)
+	{
+		/* The synchronous level can't change until it's over */
+		unlock_db();
+		g_warning("Checkpoint in a transaction");
+		return;
+	}
+	if (profile == MAFW_IRADIO_DB_RELAXED)
+		mafw_iradio_db_exec(profiles[MAFW_IRADIO_DB_STRICT].pragma);
+	if (sqlite3_wal_checkpoint_v2(private_db, NULL,
+				      SQLITE_CHECKPOINT_PASSIVE, NULL, NULL)
+	    != SQLITE_OK)
+		g_warning("Checkpoint: %s", sqlite3_errmsg(private_db));
+	if (profile == MAFW_IRADIO_DB_RELAXED)
+		mafw_iradio_db_exec(profiles[profile].pragma);
+	unlock_db();
+}
+
+/*---------------------------------------------------------------------------
+  Worker thread
+  ---------------------------------------------------------------------------*/
+
+struct job {
+	MafwIradioDbFunc func;
+	/* Set for writes that may be committed in a group */
+	MafwIradioDbFunc failed;
+	MafwIradioDbFunc done;
+	gpointer data;
+	GMainContext *context;
+	MafwIradioDbPriority priority;
+	/* Monotonic times it was queued and run at */
+	gint64 queued;
+	gint64 started;
+	/* In the queue of the worker, in the dispatch queue of the context,
+	   or in the pool */
+	GList link;
+};
+
+/* Interactive jobs in a row before a waiting bulk job gets its turn */
+#define INTERACTIVE_RUN 8
+
+/*
+ * Jobs are submitted from any thread to a lock-free stack per priority,
+ * the last one first, and taken from there by the owner of the database
+ * alone: the worker of the private database, or the thread that opened
+ * the shared one.  The owner keeps them in order in queued_jobs.
+ */
+static GList *submitted_jobs[MAFW_IRADIO_DB_N_PRIORITIES];
+static GQueue queued_jobs[MAFW_IRADIO_DB_N_PRIORITIES];
+static guint queue_run;
+/* Nesting of mafw_iradio_db_run() calls made by the owner itself */
+static guint direct_runs;
+
+static GThread *worker;
+/* Set on the worker, which may run jobs before worker is */
+static GPrivate in_worker;
+/* The worker sleeps on wake_cond when it has nothing to do */
+static GMutex wake_lock;
+static GCond wake_cond;
+static gint worker_idle;
+
+/* Runs the jobs submitted to the shared database from other threads */
+static GSource *shared_runner;
+/* Jobs queued and not committed yet */
+static gint pending_jobs;
+
+/* Limits of a group of writes, see mafw_iradio_db_set_group_commit() */
+static gint group_latency = MAFW_IRADIO_DB_GROUP_LATENCY;
+static gint group_size = MAFW_IRADIO_DB_GROUP_SIZE;
+
+/* Jobs kept for reuse, so that bursts of requests do not churn malloc */
+#define JOB_POOL_SIZE 256
+
+static GMutex pool_lock;
+static GList *job_pool;
+static guint job_pool_size;
+
+static GMutex stats_lock;
+static MafwIradioDbStats stats[MAFW_IRADIO_DB_N_PRIORITIES];
+
+/**
+ * Accounts @job, which is being completed, in the statistics of its class.
+ */
+static void account_job(struct job *job)
+{
+	MafwIradioDbStats *totals = &stats[job->priority];
+	gint64 wait, latency;
+
+	wait = job->started - job->queued;
+	latency = g_get_monotonic_time() - job->queued;
+
+	g_mutex_lock(&stats_lock);
+	totals->jobs++;
+	totals->wait += wait;
+	totals->max_wait = MAX(totals->max_wait, wait);
+	totals->latency += latency;
+	totals->max_latency = MAX(totals->max_latency, latency);
+	g_mutex_unlock(&stats_lock);
+}
+
+/**
+ * Takes the next job of @queues, one per priority.  Interactive jobs come
+ * first, but no more than INTERACTIVE_RUN of them in a row while bulk jobs
+ * wait, so that those are not starved.  @run counts the interactive jobs
+ * taken since the last bulk one.
+ *
+ * Returns: the link of the job, or NULL if @queues are empty.
+ */
+static GList *pop_job(GQueue *queues, guint *run)
+{
+	GQueue *interactive = &queues[MAFW_IRADIO_DB_INTERACTIVE];
+	GQueue *bulk = &queues[MAFW_IRADIO_DB_BULK];
+
+	if (g_queue_is_empty(bulk))
+	{
+		*run = 0;
+		return g_queue_pop_head_link(interactive);
+	}
+	if (!g_queue_is_empty(interactive) && *run < INTERACTIVE_RUN)
+	{
+		++*run;
+		return g_queue_pop_head_link(interactive);
+	}
+	*run = 0;
+	return g_queue_pop_head_link(bulk);
+}
+
+static struct job *new_job(void)
+{
+	GList *link;
+
+	g_mutex_lock(&pool_lock);
+	link = job_pool;
+	if (link)
+	{
+		job_pool = link->next;
+		job_pool_size--;
+	}
+	g_mutex_unlock(&pool_lock);
+
+	return link ? link->data : g_new(struct job, 1);
+}
+
+static void free_job(struct job *job)
+{
+	g_main_context_unref(job->context);
+
+	g_mutex_lock(&pool_lock);
+	if (job_pool_size < JOB_POOL_SIZE)
+	{
+		job->link.data = job;
+		job->link.next = job_pool;
+		job_pool = &job->link;
+		job_pool_size++;
+		job = NULL;
+	}
+	g_mutex_unlock(&pool_lock);
+	g_free(job);
+}
+
+/*
+ * Completed jobs wait in one queue per main context, drained by a single
+ * source rather than an idle source each.  The queue goes away once it is
+ * empty.
+ */
+
+/* Microseconds of done functions run per dispatch of a queue */
+#define DISPATCH_BUDGET 5000
+
+struct dispatch_queue {
+	GSource source;
+	GMainContext *context;
+	GQueue jobs[MAFW_IRADIO_DB_N_PRIORITIES];
+	guint run;
+};
+
+/* Dispatch queues by context, and the queues themselves */
+static GMutex dispatch_lock;
+static GHashTable *dispatch_queues;
+
+static gboolean dispatch_jobs(GSource *source, GSourceFunc unused,
+			      gpointer unused_data)
+{
+	struct dispatch_queue *queue = (struct dispatch_queue *)source;
+	gint64 deadline;
+	GList *link;
+	struct job *job;
+
+	deadline = g_get_monotonic_time() + DISPATCH_BUDGET;
+	do
+	{
+		g_mutex_lock(&dispatch_lock);
+		link = pop_job(queue->jobs, &queue->run);
+		if (link == NULL)
+		{
+			g_hash_table_remove(dispatch_queues, queue->context);
+			g_mutex_unlock(&dispatch_lock);
+			return FALSE;
+		}
+		g_mutex_unlock(&dispatch_lock);
+
+		job = link->data;
+		account_job(job);
+		job->done(job->data);
+		free_job(job);
+	} while (g_get_monotonic_time() < deadline);
+
+	/* The rest in the next main loop iteration */
+	return TRUE;
+}
+
+static GSourceFuncs dispatch_funcs = {
+	NULL, NULL, dispatch_jobs, NULL
+};
+
+/**
+ * Calls the done function of @job in idle, in the main context of the
+ * thread that queued it, after those of the jobs completed before.
+ */
+static void complete_job(struct job *job)
+{
+	struct dispatch_queue *queue;
+	gint i;
+
+	if (job->done == NULL)
+	{
+		account_job(job);
+		free_job(job);
+		return;
+	}
+
+	g_mutex_lock(&dispatch_lock);
+	if (dispatch_queues == NULL)
+		dispatch_queues = g_hash_table_new(NULL, NULL);
+	queue = g_hash_table_lookup(dispatch_queues, job->context);
+	if (queue == NULL)
+	{
+		queue = (struct dispatch_queue *)g_source_new(
+			&dispatch_funcs, sizeof(struct dispatch_queue));
+		queue->context = job->context;
+		for (i = 0; i < MAFW_IRADIO_DB_N_PRIORITIES; i++)
+			g_queue_init(&queue->jobs[i]);
+		queue->run = 0;
+		g_source_set_priority(&queue->source, G_PRIORITY_DEFAULT_IDLE);
+		/* Always ready, until it is removed */
+		g_source_set_ready_time(&queue->source, 0);
+		g_hash_table_insert(dispatch_queues, job->context, queue);
+		g_source_attach(&queue->source, job->context);
+		g_source_unref(&queue->source);
+	}
+	job->link.data = job;
+	g_queue_push_tail_link(&queue->jobs[job->priority], &job->link);
+	g_mutex_unlock(&dispatch_lock);
+}
+
+/**
+ * Commits the writes of @group, and completes them in the order they were
+ * queued.  If the commit fails, none of them is stored.
+ */
+static void commit_group(GSList *group)
+{
+	GSList *node;
+
+	if (!group)
+		return;
+
+	if (!mafw_iradio_db_commit())
+	{
+		mafw_iradio_db_rollback();
+		for (node = group; node; node = node->next)
+		{
+			struct job *job = node->data;
+
+			job->failed(job->data);
+		}
+	}
+
+	group = g_slist_reverse(group);
+	for (node = group; node; node = node->next)
+	{
+		g_atomic_int_add(&pending_jobs, -1);
+		complete_job(node->data);
+	}
+	g_slist_free(group);
+}
+
+/**
+ * Pushes @job on the stack of its priority, from any thread.
+ */
+static void submit_job(struct job *job)
+{
+	GList **stack = &submitted_jobs[job->priority];
+	GList *head;
+
+	job->link.data = job;
+	job->link.prev = NULL;
+	do
+	{
+		head = g_atomic_pointer_get(stack);
+		job->link.next = head;
+	} while (!g_atomic_pointer_compare_and_exchange(stack, head,
+							&job->link));
+}
+
+static gboolean jobs_submitted(void)
+{
+	gint i;
+
+	for (i = 0; i < MAFW_IRADIO_DB_N_PRIORITIES; i++)
+		if (g_atomic_pointer_get(&submitted_jobs[i]))
+			return TRUE;
+	return FALSE;
+}
+
+/**
+ * Moves the submitted jobs to the end of queued_jobs, in the order they
+ * were submitted.  Only the owner of the database calls it.
+ */
+static void take_submitted_jobs(void)
+{
+	GList *head, *link, *next;
+	GQueue batch;
+	gint i;
+
+	for (i = 0; i < MAFW_IRADIO_DB_N_PRIORITIES; i++)
+	{
+		do
+			head = g_atomic_pointer_get(&submitted_jobs[i]);
+		while (head && !g_atomic_pointer_compare_and_exchange(
+				&submitted_jobs[i], head, NULL));
+
+		/* The stack is the last one first */
+		g_queue_init(&batch);
+		for (link = head; link; link = next)
+		{
+			next = link->next;
+			link->next = NULL;
+			g_queue_push_head_link(&batch, link);
+		}
+		if (g_queue_is_empty(&batch))
+			continue;
+		if (g_queue_is_empty(&queued_jobs[i]))
+		{
+			queued_jobs[i] = batch;
+			continue;
+		}
+		queued_jobs[i].tail->next = batch.head;
+		batch.head->prev = queued_jobs[i].tail;
+		queued_jobs[i].tail = batch.tail;
+		queued_jobs[i].length += batch.length;
+	}
+}
+
+/**
+ * Wakes the worker if it is waiting for jobs, from any thread.
+ */
+static void wake_worker(void)
+{
+	g_mutex_lock(&wake_lock);
+	g_cond_signal(&wake_cond);
+	g_mutex_unlock(&wake_lock);
+}
+
+/**
+ * Waits for the next job of the worker, until the monotonic time @deadline
+ * if it is not negative, or until another thread waits for the database.
+ *
+ * Returns: the job, or NULL if the deadline passed first.
+ */
+static struct job *next_job(gint64 deadline)
+{
+	GList *link;
+	gboolean timeout = FALSE;
+
+	for (;;)
+	{
+		take_submitted_jobs();
+		link = pop_job(queued_jobs, &queue_run);
+		if (link || timeout)
+			break;
+
+		/* Submitters see worker_idle, or the worker their job, and
+		   lock_db() sees the worker waiting, or the worker it */
+		g_mutex_lock(&wake_lock);
+		g_atomic_int_set(&worker_idle, TRUE);
+		if (deadline >= 0 && g_atomic_int_get(&lock_waiters))
+			timeout = TRUE;
+		else if (!jobs_submitted())
+		{
+			if (deadline < 0)
+				g_cond_wait(&wake_cond, &wake_lock);
+			else
+				timeout = !g_cond_wait_until(&wake_cond,
+							     &wake_lock,
+							     deadline);
+		}
+		g_atomic_int_set(&worker_idle, FALSE);
+		g_mutex_unlock(&wake_lock);
+	}
+
+	if (link == NULL)
+		return NULL;
+	((struct job *)link->data)->started = g_get_monotonic_time();
+	return link->data;
+}
+
+/**
+ * Runs the next job submitted to the shared database from another thread,
+ * on its owner.
+ *
+ * Returns: FALSE if there was none.
+ */
+static gboolean run_shared_job(void)
+{
+	GList *link;
+	struct job *job;
+
+	take_submitted_jobs();
+	link = pop_job(queued_jobs, &queue_run);
+	if (link == NULL)
+		return FALSE;
+
+	job = link->data;
+	job->started = g_get_monotonic_time();
+	job->func(job->data);
+	g_atomic_int_add(&pending_jobs, -1);
+	complete_job(job);
+	return TRUE;
+}
+
+/**
+ * Runs the jobs submitted to the shared database from other threads, on
+ * its owner.
+ */
+static gboolean run_shared_jobs(GSource *source, GSourceFunc unused,
+				gpointer unused_data)
+{
+	gint64 deadline;
+
+	deadline = g_get_monotonic_time() + DISPATCH_BUDGET;
+	do
+	{
+		if (run_shared_job())
+			continue;
+
+		/* Until the next submission */
+		g_source_set_ready_time(source, -1);
+		if (!jobs_submitted())
+			return TRUE;
+		g_source_set_ready_time(source, 0);
+	} while (g_get_monotonic_time() < deadline);
+
+	return TRUE;
+}
+
+static GSourceFuncs shared_runner_funcs = {
+	NULL, NULL, run_shared_jobs, NULL
+};
+
+static gpointer worker_main(gpointer unused)
+{
+	/* Writes of the open transaction, the last one first */
+	GSList *group = NULL;
+	guint grouped = 0;
+	gint64 deadline = 0;
+	struct job *job;
+
+	g_private_set(&in_worker, GINT_TO_POINTER(TRUE));
+	for (;;)
+	{
+		if (group)
+		{
+			gint64 now = g_get_monotonic_time();
+
+			/* The group holds db_lock, which another thread
+			   may be waiting for */
+			job = now < deadline &&
+				!g_atomic_int_get(&lock_waiters) ?
+				next_job(deadline) : NULL;
+		}
+		else
+			job = next_job(-1);
+
+		if (job && job->failed &&
+		    (group || (g_atomic_int_get(&group_latency) > 0 &&
+			       mafw_iradio_db_begin())))
+		{
+			/* Each write is a savepoint of the group */
+			if (!group)
+			{
+				deadline = g_get_monotonic_time() + 1000 *
+					g_atomic_int_get(&group_latency);
+				grouped = 0;
+			}
+			job->func(job->data);
+			group = g_slist_prepend(group, job);
+			if (++grouped >= g_atomic_int_get(&group_size))
+			{
+				commit_group(group);
+				group = NULL;
+			}
+			continue;
+		}
+
+		/* Late enough, or the next job must see the writes */
+		commit_group(group);
+		group = NULL;
+		if (job)
+		{
+			job->func(job->data);
+			g_atomic_int_add(&pending_jobs, -1);
+			complete_job(job);
+		}
+	}
+	return NULL;
+}
+
+/**
+ * mafw_iradio_db_queue:
+ *
+ * @priority: Class of the request
+ * @func: Function doing the database work of a request
+ * @done: Function completing the request, in idle, or NULL
+ * @data: Passed to both
+ *
+ * Runs @func on the thread that owns the private database, so that slow
+ * writes do not stall the main loop, then @done in the thread-default
+ * main context of the caller.  The jobs of a @priority run one after the
+ * other in the order they were queued, and their @done functions are
+ * called in the same order.  Interactive jobs go ahead of bulk ones, which
+ * still get a turn every few jobs.  With the shared database @func runs
+ * right away if called from the thread that opened it, and on that
+ * thread, in idle, otherwise.
+ */
+static void queue_job(MafwIradioDbPriority priority, MafwIradioDbFunc func,
+		      MafwIradioDbFunc failed, MafwIradioDbFunc done,
+		      gpointer data)
+{
+	struct job *job;
+
+	job = new_job();
+	job->func = func;
+	job->failed = failed;
+	job->done = done;
+	job->data = data;
+	job->context = g_main_context_ref_thread_default();
+	job->priority = priority;
+	job->queued = g_get_monotonic_time();
+
+	if (!mafw_iradio_db_is_private() && g_thread_self() == shared_owner)
+	{
+		job->started = job->queued;
+		func(data);
+		complete_job(job);
+		return;
+	}
+
+	g_atomic_int_inc(&pending_jobs);
+	submit_job(job);
+	if (!mafw_iradio_db_is_private())
+	{
+		if (g_once_init_enter(&shared_runner))
+		{
+			GSource *runner;
+
+			runner = g_source_new(&shared_runner_funcs,
+					      sizeof(GSource));
+			g_source_set_priority(runner, G_PRIORITY_DEFAULT_IDLE);
+			g_source_attach(runner, shared_context);
+			g_once_init_leave(&shared_runner, runner);
+		}
+		g_source_set_ready_time(shared_runner, 0);
+		return;
+	}
+
+	if (g_once_init_enter(&worker))
+		g_once_init_leave(&worker, g_thread_new("iradio-db",
+							worker_main, NULL));
+	else if (g_atomic_int_get(&worker_idle))
+		wake_worker();
+}
+
+void mafw_iradio_db_queue(MafwIradioDbPriority priority,
+			  MafwIradioDbFunc func, MafwIradioDbFunc done,
+			  gpointer data)
+{
+	g_return_if_fail(priority < MAFW_IRADIO_DB_N_PRIORITIES);
+
+	queue_job(priority, func, NULL, done, data);
+}
+
+/**
+ * mafw_iradio_db_queue_write:
+ *
+ * @priority: Class of the request
+ * @func: Function storing the write of a request in a transaction
+ * @failed: Function marking the request failed
+ * @done: Function completing the request, in idle
+ * @data: Passed to all three
+ *
+ * Like mafw_iradio_db_queue(), but consecutive writes share a transaction,
+ * and so the cost of its commit.  The group is committed when the first of
+ * them has waited long enough, when it is full, or when a job of
+ * another kind is next, which then sees the writes.  @done is called only
+ * once the group has been committed.  If that fails, @failed is called on
+ * the database thread before it.
+ */
+void mafw_iradio_db_queue_write(MafwIradioDbPriority priority,
+				MafwIradioDbFunc func,
+				MafwIradioDbFunc failed, MafwIradioDbFunc done,
+				gpointer data)
+{
+	g_return_if_fail(priority < MAFW_IRADIO_DB_N_PRIORITIES);
+
+	queue_job(priority, func, failed, done, data);
+}
+
+/**
+ * mafw_iradio_db_set_group_commit:
+ *
+ * @latency: Milliseconds a write may wait for others, 0 commits every
+ * write by itself
+ * @size: Writes committed together at most
+ *
+ * Sets the limits of the groups made by mafw_iradio_db_queue_write().
+ */
+void mafw_iradio_db_set_group_commit(guint latency, guint size)
+{
+	g_return_if_fail(size > 0);
+
+	g_atomic_int_set(&group_latency, latency);
+	g_atomic_int_set(&group_size, size);
+}
+
+/* A job some thread waits for */
+struct waited_job {
+	MafwIradioDbFunc func;
+	gpointer data;
+	GMutex mutex;
+	GCond cond;
+	gboolean done;
+};
+
+static void run_waited_job(struct waited_job *waited)
+{
+	if (waited->func)
+		waited->func(waited->data);
+	g_mutex_lock(&waited->mutex);
+	waited->done = TRUE;
+	g_cond_signal(&waited->cond);
+	g_mutex_unlock(&waited->mutex);
+}
+
+/**
+ * Queues @func as a job of @priority and waits until it has run.  Not a
+ * write, so an open group is committed before it.
+ */
+static void queue_and_wait(MafwIradioDbPriority priority,
+			   MafwIradioDbFunc func, gpointer data)
+{
+	struct waited_job waited;
+
+	waited.func = func;
+	waited.data = data;
+	waited.done = FALSE;
+	g_mutex_init(&waited.mutex);
+	g_cond_init(&waited.cond);
+	queue_job(priority, (MafwIradioDbFunc)run_waited_job, NULL, NULL,
+		  &waited);
+	g_mutex_lock(&waited.mutex);
+	while (!waited.done)
+		g_cond_wait(&waited.cond, &waited.mutex);
+	g_mutex_unlock(&waited.mutex);
+	g_cond_clear(&waited.cond);
+	g_mutex_clear(&waited.mutex);
+}
+
+/**
+ * mafw_iradio_db_run:
+ *
+ * @priority: Class of the work
+ * @func: Function doing database work
+ * @data: Passed to @func
+ *
+ * Runs @func like mafw_iradio_db_queue() and waits until it has run, for
+ * callers that have their own thread to block.  Called on the database
+ * thread, or on the thread that opened the shared database, it runs @func
+ * right away.  @func must not leave a transaction open.
+ */
+void mafw_iradio_db_run(MafwIradioDbPriority priority, MafwIradioDbFunc func,
+			gpointer data)
+{
+	g_return_if_fail(priority < MAFW_IRADIO_DB_N_PRIORITIES);
+	g_return_if_fail(func != NULL);
+
+	if (mafw_iradio_db_is_worker() ||
+	    (!mafw_iradio_db_is_private() && g_thread_self() == shared_owner))
+	{
+		direct_runs++;
+		func(data);
+		direct_runs--;
+		return;
+	}
+	queue_and_wait(priority, func, data);
+}
+
+/**
+ * mafw_iradio_db_interactive_pending:
+ *
+ * Called from a bulk job, tells whether it should stop early and queue
+ * the rest of its work again, so that interactive requests get their
+ * turn.  Jobs cannot be overtaken while their caller waits for them on
+ * the database thread itself.
+ *
+ * Returns: TRUE if interactive jobs are waiting for the calling job.
+ */
+gboolean mafw_iradio_db_interactive_pending(void)
+{
+	if (direct_runs > 0)
+		return FALSE;
+	if (mafw_iradio_db_is_private() ? !mafw_iradio_db_is_worker() :
+	    g_thread_self() != shared_owner)
+		return FALSE;
+
+	return g_atomic_pointer_get(&submitted_jobs[
+					    MAFW_IRADIO_DB_INTERACTIVE]) ||
+		!g_queue_is_empty(&queued_jobs[MAFW_IRADIO_DB_INTERACTIVE]);
+}
+
+/**
+ * mafw_iradio_db_flush:
+ *
+ * Waits until the jobs queued so far have run and their writes have been
+ * committed.  Their @done functions may not have been called yet.  With
+ * the shared database the jobs of other threads are run right away on the
+ * thread that opened it; other threads wait for its main loop to run them.
+ */
+void mafw_iradio_db_flush(void)
+{
+	gint priority;
+
+	if (mafw_iradio_db_is_private())
+	{
+		if (worker == NULL)
+			return;
+	}
+	else if (g_thread_self() == shared_owner)
+	{
+		/* Nothing else would run them while the owner waits */
+		while (run_shared_job())
+			;
+		return;
+	}
+
+	/* Jobs are only in order within their class, so each is flushed */
+	for (priority = 0; priority < MAFW_IRADIO_DB_N_PRIORITIES; priority++)
+		queue_and_wait(priority, NULL, NULL);
+}
+
+/**
+ * mafw_iradio_db_is_worker:
+ *
+ * Returns: TRUE if called from a function queued with
+ * mafw_iradio_db_queue() on the database thread.
+ */
+gboolean mafw_iradio_db_is_worker(void)
+{
+	return g_private_get(&in_worker) != NULL;
+}
+
+/**
+ * mafw_iradio_db_pending:
+ *
+ * Returns: TRUE if jobs queued with mafw_iradio_db_queue() have not run yet.
+ */
+gboolean mafw_iradio_db_pending(void)
+{
+	return g_atomic_int_get(&pending_jobs) > 0;
+}
+
+/**
+ * mafw_iradio_db_get_stats:
+ *
+ * @priority: Class of requests
+ * @result: Where to store the statistics of the jobs of @priority
+ * completed since the last mafw_iradio_db_reset_stats()
+ */
+void mafw_iradio_db_get_stats(MafwIradioDbPriority priority,
+			      MafwIradioDbStats *result)
+{
+	g_return_if_fail(priority < MAFW_IRADIO_DB_N_PRIORITIES);
+	g_return_if_fail(result != NULL);
+
+	g_mutex_lock(&stats_lock);
+	*result = stats[priority];
+	g_mutex_unlock(&stats_lock);
+}
+
+void mafw_iradio_db_reset_stats(void)
+{
+	g_mutex_lock(&stats_lock);
+	memset(stats, 0, sizeof(stats));
+	g_mutex_unlock(&stats_lock);
+}
+
+/*---------------------------------------------------------------------------
+  Migration
+  ---------------------------------------------------------------------------*/
+
+/**
+ * Copies the rows of @table from the shared database into the private
+ * one, column by column.
+ *
+ * Returns: the number of rows copied, or -1 on error.
+ */
+static gint copy_shared_table(const gchar *table)
+{
+	sqlite3_stmt *select, *insert;
+	GString *query;
+	gint columns, i;
+	gint rows = 0;
+
+	query = g_string_new(NULL);
+	g_string_printf(query, "SELECT * FROM %s", table);
+	select = mafw_db_try_prepare(query->str);
+	if (select == NULL)
+	{
+		/* Nothing to migrate */
+		g_string_free(query, TRUE);
+		return 0;
+	}
+
+	/* By name, the private table may have gained columns since */
+	columns = sqlite3_column_count(select);
+	g_string_printf(query, "INSERT INTO %s(", table);
+	for (i = 0; i < columns; i++)
+		g_string_append_printf(query, i ? ", \"%s\"" : "\"%s\"",
+				       sqlite3_column_name(select, i));
+	g_string_append(query, ") VALUES(?");
+	for (i = 1; i < columns; i++)
+		g_string_append(query, ", ?");
+	g_string_append(query, ")");
+	insert = mafw_iradio_db_prepare(query->str);
+	g_string_free(query, TRUE);
+
+	while (rows >= 0 && mafw_db_select(select, FALSE) == SQLITE_ROW)
+	{
+		for (i = 0; i < columns; i++)
+			sqlite3_bind_value(insert, i + 1,
+					   sqlite3_column_value(select, i));
+		if (mafw_iradio_db_change(insert, FALSE) == SQLITE_DONE)
+			rows++;
+		else
+			rows = -1;
+	}
+	sqlite3_finalize(insert);
+	sqlite3_finalize(select);
+	return rows;
+}
+
+/**
+ * mafw_iradio_db_migrate:
+ *
+ * @tables: NULL-terminated list of tables
+ *
+ * Moves the rows of @tables from the shared MAFW database into the private
+ * one, where the tables must exist and be empty, in one transaction.  The
+ * tables are then dropped from the shared database, so this happens only
+ * once.
+ *
+ * Returns: the number of rows moved, or -1 if they could not be, and are
+ * still in the shared database alone.
+ */
+gint mafw_iradio_db_migrate(const gchar *const *tables)
+{
+	gint rows = 0;
+	guint i;
+
+	g_return_val_if_fail(mafw_iradio_db_is_private(), -1);
+
+	if (!mafw_iradio_db_begin())
+		return -1;
+	for (i = 0; tables[i]; i++)
+	{
+		gint copied;
+
+		copied = copy_shared_table(tables[i]);
+		if (copied < 0)
+		{
+			g_warning("Unable to migrate %s", tables[i]);
+			mafw_iradio_db_rollback();
+			return -1;
+		}
+		rows += copied;
+	}
+	if (!mafw_iradio_db_commit())
+	{
+		mafw_iradio_db_rollback();
+		return -1;
+	}
+
+	for (i = 0; tables[i]; i++)
+	{
+		gchar *query;
+
+		query = g_strdup_printf("DROP TABLE IF EXISTS %s", tables[i]);
+		mafw_db_exec(query);
+		g_free(query);
+	}
+	if (rows > 0)
+		g_debug("%d rows moved to the iradio database", rows);
+
+	return rows;
+}
+
+/* vi: set noexpandtab ts=8 sw=8 cino=t0,(0: */
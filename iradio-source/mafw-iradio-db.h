@@ -0,0 +1,161 @@
+/*
+ * This file is a part of MAFW
+ *
+ * Copyright (C) 2007, 2008, 2009 Nokia Corporation, all rights reserved.
+ *
+ * Contact: Visa Smolander <visa.smolander@nokia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#ifndef MAFW_IRADIO_DB_H
+#define MAFW_IRADIO_DB_H
+
+#include <glib.h>
+#include <libmafw/mafw-db.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Database connection of the iradio tables.  By default it is the
+ * connection libmafw shares between the plugins of the process.  If the
+ * MAFW_IRADIO_DB environment variable names a file, the source keeps its
+ * tables there, on a connection of its own.
+ *
+ * These replace the connection-level mafw_db_*() calls.  Statements are
+ * bound and read with the mafw_db_bind_*() and mafw_db_column_*() macros
+ * either way.
+ *
+ * The private database is in WAL mode and has a second, read-only
+ * connection for browsing, so that long imports on the writing connection
+ * do not hold up or show through the queries of the clients.
+ */
+
+#define MAFW_IRADIO_DB_ENV "MAFW_IRADIO_DB"
+/* Durability profile of the private database, see MafwIradioDbProfile */
+#define MAFW_IRADIO_DB_PROFILE_ENV "MAFW_IRADIO_DB_PROFILE"
+
+/**
+ * MafwIradioDbProfile:
+ * @MAFW_IRADIO_DB_STRICT: Every commit is synced
+ * @MAFW_IRADIO_DB_BALANCED: Commits are synced at checkpoints.  A crash of
+ * the system may lose the last commits, but never corrupts the database.
+ * @MAFW_IRADIO_DB_RELAXED: Nothing is synced but the periodic checkpoints
+ * made with mafw_iradio_db_checkpoint(), every 30 seconds by the source.
+ * Commits are written to the write-ahead log, so they survive a crash of
+ * the process, but a crash of the system may lose those made since the
+ * last checkpoint or corrupt the database.
+ *
+ * The profiles only apply to the private database.
+ */
+typedef enum {
+	MAFW_IRADIO_DB_STRICT,
+	MAFW_IRADIO_DB_BALANCED,
+	MAFW_IRADIO_DB_RELAXED
+} MafwIradioDbProfile;
+
+sqlite3 *mafw_iradio_db_get(void);
+gboolean mafw_iradio_db_is_private(void);
+void mafw_iradio_db_use_shared(void);
+gchar *mafw_iradio_db_path(void);
+
+sqlite3_stmt *mafw_iradio_db_prepare(const gchar *query);
+sqlite3_stmt *mafw_iradio_db_prepare_read(const gchar *query);
+gint mafw_iradio_db_select(sqlite3_stmt *stmt, gboolean fatal);
+gint mafw_iradio_db_change(sqlite3_stmt *stmt, gboolean fatal);
+gint mafw_iradio_db_delete(sqlite3_stmt *stmt);
+gint mafw_iradio_db_exec(const gchar *query);
+gint mafw_iradio_db_nchanges(void);
+
+gboolean mafw_iradio_db_begin(void);
+gboolean mafw_iradio_db_commit(void);
+void mafw_iradio_db_rollback(void);
+
+void mafw_iradio_db_read_begin(void);
+void mafw_iradio_db_read_end(void);
+
+/*
+ * Requests of the clients are served by a thread of their own when the
+ * database is private, or by the thread that opened the shared one.  Any
+ * thread may queue jobs.  They are run in order and completed in the
+ * main context of the thread that queued them.
+ */
+typedef void (*MafwIradioDbFunc)(gpointer data);
+
+/**
+ * MafwIradioDbPriority:
+ * @MAFW_IRADIO_DB_INTERACTIVE: Requests on single objects, which a user
+ * is likely waiting for
+ * @MAFW_IRADIO_DB_BULK: Browsing and housekeeping
+ */
+typedef enum {
+	MAFW_IRADIO_DB_INTERACTIVE,
+	MAFW_IRADIO_DB_BULK,
+	MAFW_IRADIO_DB_N_PRIORITIES
+} MafwIradioDbPriority;
+
+/**
+ * MafwIradioDbStats:
+ * @jobs: Jobs completed
+ * @wait: Microseconds they waited before being run, in total
+ * @max_wait: The longest of those waits
+ * @latency: Microseconds from queueing to completion, in total
+ * @max_latency: The longest of those
+ */
+typedef struct {
+	guint jobs;
+	gint64 wait;
+	gint64 max_wait;
+	gint64 latency;
+	gint64 max_latency;
+} MafwIradioDbStats;
+
+/* Default limits of a group of writes: milliseconds and writes */
+#define MAFW_IRADIO_DB_GROUP_LATENCY 20
+#define MAFW_IRADIO_DB_GROUP_SIZE 64
+
+void mafw_iradio_db_queue(MafwIradioDbPriority priority,
+			  MafwIradioDbFunc func, MafwIradioDbFunc done,
+			  gpointer data);
+void mafw_iradio_db_queue_write(MafwIradioDbPriority priority,
+				MafwIradioDbFunc func,
+				MafwIradioDbFunc failed, MafwIradioDbFunc done,
+				gpointer data);
+void mafw_iradio_db_run(MafwIradioDbPriority priority, MafwIradioDbFunc func,
+			gpointer data);
+gboolean mafw_iradio_db_interactive_pending(void);
+void mafw_iradio_db_set_group_commit(guint latency, guint size);
+void mafw_iradio_db_flush(void);
+gboolean mafw_iradio_db_is_worker(void);
+gboolean mafw_iradio_db_pending(void);
+void mafw_iradio_db_get_stats(MafwIradioDbPriority priority,
+			      MafwIradioDbStats *result);
+void mafw_iradio_db_reset_stats(void);
+
+gboolean mafw_iradio_db_parse_profile(const gchar *name,
+				      MafwIradioDbProfile *result);
+MafwIradioDbProfile mafw_iradio_db_get_profile(void);
+void mafw_iradio_db_set_profile(MafwIradioDbProfile new_profile);
+void mafw_iradio_db_checkpoint(void);
+
+gint mafw_iradio_db_migrate(const gchar *const *tables);
+
+G_END_DECLS
+
+#endif /* MAFW_IRADIO_DB_H */
+
+/* vi: set noexpandtab ts=8 sw=8 cino=t0,(0: */
@@ -0,0 +1,996 @@
+/*
+ * This file is a part of MAFW
+ *
+ * Copyright (C) 2007, 2008, 2009 Nokia Corporation, all rights reserved.
+ *
+ * Contact: Visa Smolander <visa.smolander@nokia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <libmafw/mafw.h>
+#include <libxml/parser.h>
+#include <libxml/xmlreader.h>
+
+#include "mafw-iradio-source.h"
+#include "mafw-iradio-db.h"
+#include "mafw-iradio-importer.h"
+#include "mafw-iradio-vendor-setup.h"
+
+/*---------------------------------------------------------------------------
+  Bookmark records
+  ---------------------------------------------------------------------------*/
+
+/**
+ * mafw_iradio_bookmark_clear:
+ *
+ * @bookmark: A bookmark
+ *
+ * Frees the strings of @bookmark and resets it for the next entry.
+ */
+void mafw_iradio_bookmark_clear(MafwIradioBookmark *bookmark)
+{
+	g_free(bookmark->title);
+	g_free(bookmark->uri);
+	g_free(bookmark->mime);
+	g_free(bookmark->thumbnail_uri);
+	memset(bookmark, 0, sizeof(*bookmark));
+}
+
+/**
+ * mafw_iradio_bookmark_to_metadata:
+ *
+ * @bookmark: A bookmark read from a station list
+ *
+ * Returns: a new metadata hash table holding the fields of @bookmark.
+ */
+GHashTable *mafw_iradio_bookmark_to_metadata(const MafwIradioBookmark *bookmark)
+{
+	GHashTable *metadata;
+
+	metadata = mafw_metadata_new();
+	if (bookmark->title != NULL)
+		mafw_metadata_add_str(metadata, MAFW_METADATA_KEY_TITLE,
+				       bookmark->title);
+	if (bookmark->has_duration)
+		mafw_metadata_add_int(metadata, MAFW_METADATA_KEY_DURATION,
+				       bookmark->duration);
+	if (bookmark->uri != NULL)
+	{
+		mafw_metadata_add_str(metadata, MAFW_METADATA_KEY_URI,
+				       bookmark->uri);
+		mafw_metadata_add_str(metadata, MAFW_METADATA_KEY_MIME,
+				       bookmark->mime != NULL ?
+				       bookmark->mime :
+				       MAFW_IRADIO_MIME_AUDIO);
+	}
+	if (bookmark->thumbnail_uri != NULL)
+		mafw_metadata_add_str(metadata,
+				       MAFW_METADATA_KEY_THUMBNAIL_URI,
+				       bookmark->thumbnail_uri);
+	return metadata;
+}
+
+/**
+ * Returns a UTF-8 copy of @str.  Playlists written by older tools are
+ * often in Latin-1, which is converted rather than dropped.
+ */
+static gchar *utf8_dup(const gchar *str)
+{
+	if (g_utf8_validate(str, -1, NULL))
+		return g_strdup(str);
+	return g_convert(str, -1, "UTF-8", "ISO-8859-1", NULL, NULL, NULL);
+}
+
+/*---------------------------------------------------------------------------
+  Line based formats
+  ---------------------------------------------------------------------------*/
+
+/**
+ * Opens @path for reading line by line.  No character set conversion is
+ * done, lines are validated one by one instead.
+ */
+static GIOChannel *open_lines(const gchar *path, GError **error)
+{
+	GIOChannel *channel;
+
+	channel = g_io_channel_new_file(path, "r", error);
+	if (channel != NULL)
+		g_io_channel_set_encoding(channel, NULL, NULL);
+	return channel;
+}
+
+/**
+ * Reads an M3U or extended M3U playlist.  An #EXTINF line gives the
+ * duration and the title of the URI on the next non-comment line.
+ */
+static gboolean read_m3u(const gchar *path, MafwIradioBookmarkFunc func,
+			 gpointer user_data, GError **error)
+{
+	MafwIradioBookmark bookmark;
+	GIOChannel *channel;
+	GIOStatus status;
+	gchar *line;
+
+	channel = open_lines(path, error);
+	if (channel == NULL)
+		return FALSE;
+
+	memset(&bookmark, 0, sizeof(bookmark));
+	while ((status = g_io_channel_read_line(channel, &line, NULL, NULL,
+						error)) == G_IO_STATUS_NORMAL)
+	{
+		g_strstrip(line);
+		if (g_str_has_prefix(line, "#EXTINF:"))
+		{
+			gchar *title;
+			gchar *tail;
+			glong duration;
+
+			mafw_iradio_bookmark_clear(&bookmark);
+			duration = strtol(line + 8, &tail, 10);
+			if (tail != line + 8 && duration > 0)
+			{
+				bookmark.duration = duration;
+				bookmark.has_duration = TRUE;
+			}
+			title = strchr(tail, ',');
+			if (title != NULL && title[1] != '\0')
+				bookmark.title = utf8_dup(title + 1);
+		}
+		else if (line[0] != '\0' && line[0] != '#')
+		{
+			bookmark.uri = utf8_dup(line);
+			bookmark.mime = g_strdup(MAFW_IRADIO_MIME_AUDIO);
+			if (bookmark.uri != NULL)
+				func(&bookmark, user_data);
+			mafw_iradio_bookmark_clear(&bookmark);
+		}
+		g_free(line);
+	}
+
+	mafw_iradio_bookmark_clear(&bookmark);
+	g_io_channel_unref(channel);
+	return status == G_IO_STATUS_EOF;
+}
+
+/**
+ * Parses a "KeyN=value" line of a PLS playlist.
+ *
+ * Returns: the entry number N, or 0 if the key is not @name.
+ */
+static guint pls_entry(const gchar *line, const gchar *name,
+		       const gchar **value)
+{
+	gsize len = strlen(name);
+	gchar *tail;
+	guint64 index;
+
+	if (g_ascii_strncasecmp(line, name, len) != 0 ||
+	    !g_ascii_isdigit(line[len]))
+		return 0;
+
+	index = g_ascii_strtoull(line + len, &tail, 10);
+	if (*tail != '=' || index == 0 || index > G_MAXUINT)
+		return 0;
+
+	*value = tail + 1;
+	return index;
+}
+
+/**
+ * Reads a PLS playlist.  The FileN, TitleN and LengthN keys of an entry are
+ * expected to be next to each other, as every known writer puts them, so
+ * that an entry can be handed on as soon as the next one begins.
+ */
+static gboolean read_pls(const gchar *path, MafwIradioBookmarkFunc func,
+			 gpointer user_data, GError **error)
+{
+	MafwIradioBookmark bookmark;
+	GIOChannel *channel;
+	GIOStatus status;
+	guint current = 0;
+	gchar *line;
+
+	channel = open_lines(path, error);
+	if (channel == NULL)
+		return FALSE;
+
+	memset(&bookmark, 0, sizeof(bookmark));
+	while ((status = g_io_channel_read_line(channel, &line, NULL, NULL,
+						error)) == G_IO_STATUS_NORMAL)
+	{
+		const gchar *value;
+		guint index;
+
+		g_strstrip(line);
+		if ((index = pls_entry(line, "File", &value)) == 0 &&
+		    (index = pls_entry(line, "Title", &value)) == 0 &&
+		    (index = pls_entry(line, "Length", &value)) == 0)
+		{
+			g_free(line);
+			continue;
+		}
+
+		if (index != current)
+		{
+			if (bookmark.uri != NULL)
+				func(&bookmark, user_data);
+			mafw_iradio_bookmark_clear(&bookmark);
+			current = index;
+		}
+
+		switch (g_ascii_tolower(line[0]))
+		{
+		case 'f':
+			g_free(bookmark.uri);
+			bookmark.uri = utf8_dup(value);
+			g_free(bookmark.mime);
+			bookmark.mime = g_strdup(MAFW_IRADIO_MIME_AUDIO);
+			break;
+		case 't':
+			g_free(bookmark.title);
+			bookmark.title = utf8_dup(value);
+			break;
+		default:
+			/* -1 marks a stream of unknown length */
+			bookmark.duration = atoi(value);
+			bookmark.has_duration = bookmark.duration > 0;
+			break;
+		}
+		g_free(line);
+	}
+
+	if (bookmark.uri != NULL && status == G_IO_STATUS_EOF)
+		func(&bookmark, user_data);
+	mafw_iradio_bookmark_clear(&bookmark);
+	g_io_channel_unref(channel);
+	return status == G_IO_STATUS_EOF;
+}
+
+/*---------------------------------------------------------------------------
+  XML formats
+  ---------------------------------------------------------------------------*/
+
+static gboolean xml_node_is(xmlTextReaderPtr reader, const gchar *name)
+{
+	const xmlChar *local;
+
+	local = xmlTextReaderConstLocalName(reader);
+	return local != NULL && strcmp((const gchar *)local, name) == 0;
+}
+
+/**
+ * Returns the stripped text content of the reader's current element.
+ */
+static gchar *xml_read_string(xmlTextReaderPtr reader)
+{
+	xmlChar *content;
+	gchar *str;
+
+	content = xmlTextReaderReadString(reader);
+	str = g_strdup(content != NULL ? (const gchar *)content : "");
+	xmlFree(content);
+	return g_strstrip(str);
+}
+
+/**
+ * Returns the value of an attribute of the reader's current element, or
+ * NULL if it is missing or empty.
+ */
+static gchar *xml_get_attribute(xmlTextReaderPtr reader, const gchar *name)
+{
+	xmlChar *value;
+	gchar *str = NULL;
+
+	value = xmlTextReaderGetAttribute(reader, (const xmlChar *)name);
+	if (value != NULL && value[0] != '\0')
+		str = g_strdup((const gchar *)value);
+	xmlFree(value);
+	return str;
+}
+
+static xmlTextReaderPtr xml_open(const gchar *path, GError **error)
+{
+	xmlTextReaderPtr reader;
+
+	reader = xmlReaderForFile(path, NULL, XML_PARSE_NONET);
+	if (reader == NULL)
+		g_set_error(error, MAFW_EXTENSION_ERROR,
+			    MAFW_EXTENSION_ERROR_FAILED,
+			    "Unable to open %s", path);
+	return reader;
+}
+
+static gboolean xml_close(xmlTextReaderPtr reader, gint ret,
+			  const gchar *path, GError **error)
+{
+	xmlFreeTextReader(reader);
+	if (ret < 0)
+	{
+		g_set_error(error, MAFW_EXTENSION_ERROR,
+			    MAFW_EXTENSION_ERROR_FAILED,
+			    "Error while parsing %s", path);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * Reads an XSPF playlist: every <track> with a <location> is a bookmark,
+ * with its <title>, <image> and <duration> given in milliseconds.
+ */
+static gboolean read_xspf(const gchar *path, MafwIradioBookmarkFunc func,
+			  gpointer user_data, GError **error)
+{
+	MafwIradioBookmark bookmark;
+	xmlTextReaderPtr reader;
+	gint track_depth = -1;
+	gint ret;
+
+	reader = xml_open(path, error);
+	if (reader == NULL)
+		return FALSE;
+
+	memset(&bookmark, 0, sizeof(bookmark));
+	while ((ret = xmlTextReaderRead(reader)) == 1)
+	{
+		gint type, depth;
+
+		type = xmlTextReaderNodeType(reader);
+		depth = xmlTextReaderDepth(reader);
+
+		if (type == XML_READER_TYPE_END_ELEMENT)
+		{
+			if (depth == track_depth)
+			{
+				if (bookmark.uri != NULL)
+					func(&bookmark, user_data);
+				mafw_iradio_bookmark_clear(&bookmark);
+				track_depth = -1;
+			}
+		}
+		else if (type != XML_READER_TYPE_ELEMENT)
+		{
+			continue;
+		}
+		else if (track_depth < 0)
+		{
+			if (xml_node_is(reader, "track") &&
+			    !xmlTextReaderIsEmptyElement(reader))
+				track_depth = depth;
+		}
+		else if (depth == track_depth + 1)
+		{
+			if (xml_node_is(reader, "location") &&
+			    bookmark.uri == NULL)
+			{
+				bookmark.uri = xml_read_string(reader);
+				bookmark.mime = g_strdup(
+						MAFW_IRADIO_MIME_AUDIO);
+			}
+			else if (xml_node_is(reader, "title"))
+			{
+				g_free(bookmark.title);
+				bookmark.title = xml_read_string(reader);
+			}
+			else if (xml_node_is(reader, "image"))
+			{
+				g_free(bookmark.thumbnail_uri);
+				bookmark.thumbnail_uri =
+					xml_read_string(reader);
+			}
+			else if (xml_node_is(reader, "duration"))
+			{
+				gchar *duration;
+
+				duration = xml_read_string(reader);
+				bookmark.duration = atoi(duration) / 1000;
+				bookmark.has_duration = bookmark.duration > 0;
+				g_free(duration);
+			}
+		}
+	}
+
+	mafw_iradio_bookmark_clear(&bookmark);
+	return xml_close(reader, ret, path, error);
+}
+
+/**
+ * Reads an OPML station directory, as exported by radio directories.
+ * Every <outline> with an URL attribute is a bookmark; type="link"
+ * outlines point to further directories and are skipped.
+ */
+static gboolean read_opml(const gchar *path, MafwIradioBookmarkFunc func,
+			  gpointer user_data, GError **error)
+{
+	MafwIradioBookmark bookmark;
+	xmlTextReaderPtr reader;
+	gint ret;
+
+	reader = xml_open(path, error);
+	if (reader == NULL)
+		return FALSE;
+
+	memset(&bookmark, 0, sizeof(bookmark));
+	while ((ret = xmlTextReaderRead(reader)) == 1)
+	{
+		gchar *type;
+
+		if (xmlTextReaderNodeType(reader) != XML_READER_TYPE_ELEMENT ||
+		    !xml_node_is(reader, "outline"))
+			continue;
+
+		type = xml_get_attribute(reader, "type");
+		if (type != NULL && g_ascii_strcasecmp(type, "link") == 0)
+		{
+			g_free(type);
+			continue;
+		}
+		g_free(type);
+
+		bookmark.uri = xml_get_attribute(reader, "URL");
+		if (bookmark.uri == NULL)
+			bookmark.uri = xml_get_attribute(reader, "url");
+		if (bookmark.uri == NULL)
+			continue;
+
+		bookmark.mime = g_strdup(MAFW_IRADIO_MIME_AUDIO);
+		bookmark.title = xml_get_attribute(reader, "text");
+		if (bookmark.title == NULL)
+			bookmark.title = xml_get_attribute(reader, "title");
+		bookmark.thumbnail_uri = xml_get_attribute(reader, "image");
+		func(&bookmark, user_data);
+		mafw_iradio_bookmark_clear(&bookmark);
+	}
+
+	return xml_close(reader, ret, path, error);
+}
+
+static gboolean read_confml(const gchar *path, MafwIradioBookmarkFunc func,
+			    gpointer user_data, GError **error)
+{
+	if (!mafw_iradio_read_confml_file(path, func, user_data))
+	{
+		g_set_error(error, MAFW_EXTENSION_ERROR,
+			    MAFW_EXTENSION_ERROR_FAILED,
+			    "No bookmark list in %s", path);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/*---------------------------------------------------------------------------
+  Importer registry
+  ---------------------------------------------------------------------------*/
+
+static const gchar *const confml_extensions[] = { "confml", "xml", NULL };
+static const gchar *const m3u_extensions[] = { "m3u", "m3u8", NULL };
+static const gchar *const pls_extensions[] = { "pls", NULL };
+static const gchar *const xspf_extensions[] = { "xspf", NULL };
+static const gchar *const opml_extensions[] = { "opml", NULL };
+
+static const MafwIradioImporter builtin_importers[] = {
+	{ "confml", confml_extensions, read_confml },
+	{ "m3u", m3u_extensions, read_m3u },
+	{ "pls", pls_extensions, read_pls },
+	{ "xspf", xspf_extensions, read_xspf },
+	{ "opml", opml_extensions, read_opml },
+};
+
+/* Importers registered at runtime, looked up before the built-in ones */
+G_LOCK_DEFINE_STATIC(importers);
+static GSList *importers;
+
+/**
+ * mafw_iradio_importer_register:
+ *
+ * @importer: A station list format, which must stay valid
+ *
+ * Adds a format to the ones known by mafw_iradio_importer_find() and
+ * mafw_iradio_importer_lookup().  It takes precedence over the built-in
+ * formats and the ones registered earlier.
+ */
+void mafw_iradio_importer_register(const MafwIradioImporter *importer)
+{
+	g_return_if_fail(importer != NULL);
+	g_return_if_fail(importer->name != NULL);
+	g_return_if_fail(importer->read != NULL);
+
+	G_LOCK(importers);
+	importers = g_slist_prepend(importers, (gpointer)importer);
+	G_UNLOCK(importers);
+}
+
+/**
+ * Calls @match for the registered and then the built-in importers, until it
+ * returns TRUE.
+ */
+static const MafwIradioImporter *find_importer(
+		gboolean (*match)(const MafwIradioImporter *importer,
+				  const gchar *key),
+		const gchar *key)
+{
+	const MafwIradioImporter *found = NULL;
+	GSList *node;
+	guint i;
+
+	G_LOCK(importers);
+	for (node = importers; node && !found; node = node->next)
+	{
+		if (match(node->data, key))
+			found = node->data;
+	}
+	G_UNLOCK(importers);
+
+	for (i = 0; i < G_N_ELEMENTS(builtin_importers) && !found; i++)
+	{
+		if (match(&builtin_importers[i], key))
+			found = &builtin_importers[i];
+	}
+
+	return found;
+}
+
+static gboolean match_name(const MafwIradioImporter *importer,
+			   const gchar *name)
+{
+	return g_ascii_strcasecmp(importer->name, name) == 0;
+}
+
+static gboolean match_extension(const MafwIradioImporter *importer,
+				const gchar *extension)
+{
+	const gchar *const *ext;
+
+	for (ext = importer->extensions; ext && *ext; ext++)
+	{
+		if (g_ascii_strcasecmp(*ext, extension) == 0)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+/**
+ * mafw_iradio_importer_lookup:
+ *
+ * @name: Name of a format, like "m3u"
+ *
+ * Returns: the importer of the format, or NULL if it is not known.
+ */
+const MafwIradioImporter *mafw_iradio_importer_lookup(const gchar *name)
+{
+	g_return_val_if_fail(name != NULL, NULL);
+
+	return find_importer(match_name, name);
+}
+
+/**
+ * mafw_iradio_importer_find:
+ *
+ * @path: Path of a station list
+ *
+ * Returns: the importer for the extension of @path, or NULL if there is
+ * none.
+ */
+const MafwIradioImporter *mafw_iradio_importer_find(const gchar *path)
+{
+	const gchar *extension;
+
+	g_return_val_if_fail(path != NULL, NULL);
+
+	extension = strrchr(path, '.');
+	if (extension == NULL || strchr(extension, G_DIR_SEPARATOR) != NULL)
+		return NULL;
+
+	return find_importer(match_extension, extension + 1);
+}
+
+/**
+ * mafw_iradio_importer_read:
+ *
+ * @path: Path of a station list
+ * @func: Called once for every bookmark found in the file
+ * @user_data: Passed to @func
+ * @error: Return location for an error, or NULL
+ *
+ * Streams the bookmarks of @path to @func with the importer matching its
+ * extension.
+ *
+ * Returns: FALSE if the format is unknown or the file could not be read.
+ */
+gboolean mafw_iradio_importer_read(const gchar *path,
+				   MafwIradioBookmarkFunc func,
+				   gpointer user_data, GError **error)
+{
+	const MafwIradioImporter *importer;
+
+	g_return_val_if_fail(path != NULL, FALSE);
+	g_return_val_if_fail(func != NULL, FALSE);
+
+	importer = mafw_iradio_importer_find(path);
+	if (importer == NULL)
+	{
+		g_set_error(error, MAFW_EXTENSION_ERROR,
+			    MAFW_EXTENSION_ERROR_FAILED,
+			    "Unsupported station list: %s", path);
+		return FALSE;
+	}
+
+	return importer->read(path, func, user_data, error);
+}
+
+/*---------------------------------------------------------------------------
+  Import into the source
+  ---------------------------------------------------------------------------*/
+
+/**
+ * Bounded queue of bookmarks between the parser thread and the writer.
+ * Slots own their strings; the writer takes a whole run of them per lock.
+ */
+struct bookmark_ring {
+	GMutex lock;
+	GCond not_empty;
+	GCond not_full;
+	MafwIradioBookmark slots[MAFW_IRADIO_IMPORT_QUEUE];
+	guint head;
+	guint length;
+	/* Set by the parser once the whole file has been read */
+	gboolean closed;
+};
+
+struct file_import {
+	const MafwIradioImporter *importer;
+	const gchar *path;
+	struct bookmark_ring ring;
+	gboolean result;
+	GError *error;
+	GCancellable *cancellable;
+
+	MafwIradioBulkWriter *writer;
+	time_t added;
+	guint batch_size;
+	/* Bookmarks of the next transaction, written by write_chunk() */
+	GArray *chunk;
+	guint written;
+	guint count;
+};
+
+static void copy_bookmark(MafwIradioBookmark *copy,
+			  const MafwIradioBookmark *bookmark)
+{
+	copy->title = g_strdup(bookmark->title);
+	copy->uri = g_strdup(bookmark->uri);
+	copy->mime = g_strdup(bookmark->mime);
+	copy->thumbnail_uri = g_strdup(bookmark->thumbnail_uri);
+	copy->duration = bookmark->duration;
+	copy->has_duration = bookmark->has_duration;
+}
+
+/* Parser thread: copies the bookmark into the ring, waiting for room */
+static void queue_bookmark(const MafwIradioBookmark *bookmark,
+			   struct file_import *import)
+{
+	struct bookmark_ring *ring = &import->ring;
+	MafwIradioBookmark copy;
+
+	/* The rest of the file is only read through */
+	if (g_cancellable_is_cancelled(import->cancellable))
+		return;
+
+	copy_bookmark(&copy, bookmark);
+
+	g_mutex_lock(&ring->lock);
+	while (ring->length == MAFW_IRADIO_IMPORT_QUEUE)
+		g_cond_wait(&ring->not_full, &ring->lock);
+	ring->slots[(ring->head + ring->length) %
+		    MAFW_IRADIO_IMPORT_QUEUE] = copy;
+	if (ring->length++ == 0)
+		g_cond_signal(&ring->not_empty);
+	g_mutex_unlock(&ring->lock);
+}
+
+static gpointer parse_thread(struct file_import *import)
+{
+	struct bookmark_ring *ring = &import->ring;
+
+	import->result = import->importer->read(
+				import->path,
+				(MafwIradioBookmarkFunc)queue_bookmark,
+				import, &import->error);
+
+	g_mutex_lock(&ring->lock);
+	ring->closed = TRUE;
+	g_cond_signal(&ring->not_empty);
+	g_mutex_unlock(&ring->lock);
+	return NULL;
+}
+
+/**
+ * Writer: moves every queued bookmark into @batch.
+ *
+ * Returns: the number of bookmarks taken, 0 once the parser is done.
+ */
+static guint dequeue_bookmarks(struct bookmark_ring *ring,
+			       MafwIradioBookmark *batch)
+{
+	guint i, n;
+
+	g_mutex_lock(&ring->lock);
+	while (ring->length == 0 && !ring->closed)
+		g_cond_wait(&ring->not_empty, &ring->lock);
+
+	n = ring->length;
+	for (i = 0; i < n; i++)
+	{
+		batch[i] = ring->slots[ring->head];
+		ring->head = (ring->head + 1) % MAFW_IRADIO_IMPORT_QUEUE;
+	}
+	ring->length = 0;
+	if (n == MAFW_IRADIO_IMPORT_QUEUE)
+		g_cond_signal(&ring->not_full);
+	g_mutex_unlock(&ring->lock);
+
+	return n;
+}
+
+/* Database thread: stores a bookmark in the transaction of the chunk */
+static void import_bookmark(const MafwIradioBookmark *bookmark,
+			    struct file_import *import)
+{
+	GHashTable *metadata;
+
+	metadata = mafw_iradio_bookmark_to_metadata(bookmark);
+	mafw_metadata_add_long(metadata, MAFW_METADATA_KEY_ADDED,
+			       import->added);
+	mafw_iradio_bulk_writer_add(import->writer, metadata);
+	g_hash_table_unref(metadata);
+}
+
+/**
+ * Database thread: stores the rest of the chunk in a transaction of its
+ * own, or part of it if interactive requests are waiting.
+ */
+static void write_chunk(struct file_import *import)
+{
+	guint start = import->written;
+
+	for (; import->written < import->chunk->len; import->written++)
+	{
+		if (g_cancellable_is_cancelled(import->cancellable) ||
+		    (import->written > start &&
+		     mafw_iradio_db_interactive_pending()))
+			break;
+		import_bookmark(&g_array_index(import->chunk,
+					       MafwIradioBookmark,
+					       import->written),
+				import);
+	}
+	mafw_iradio_bulk_writer_flush(import->writer);
+}
+
+/**
+ * Calling thread: has the database thread write the chunk, in bulk jobs
+ * that interactive requests go ahead of, and empties it.
+ */
+static void flush_chunk(struct file_import *import)
+{
+	guint i;
+
+	import->written = 0;
+	while (import->written < import->chunk->len &&
+	       !g_cancellable_is_cancelled(import->cancellable))
+		mafw_iradio_db_run(MAFW_IRADIO_DB_BULK,
+				   (MafwIradioDbFunc)write_chunk, import);
+	for (i = 0; i < import->chunk->len; i++)
+		mafw_iradio_bookmark_clear(&g_array_index(import->chunk,
+							  MafwIradioBookmark,
+							  i));
+	g_array_set_size(import->chunk, 0);
+}
+
+/* Calling thread: adds @bookmark, which it takes, to the chunk */
+static void chunk_bookmark(MafwIradioBookmark *bookmark,
+			   struct file_import *import)
+{
+	g_array_append_vals(import->chunk, bookmark, 1);
+	if (import->chunk->len == import->batch_size)
+		flush_chunk(import);
+}
+
+/* Without a parser thread: collects a copy of @bookmark */
+static void collect_bookmark(const MafwIradioBookmark *bookmark,
+			     struct file_import *import)
+{
+	MafwIradioBookmark copy;
+
+	copy_bookmark(&copy, bookmark);
+	chunk_bookmark(&copy, import);
+}
+
+/**
+ * Parses the file in a thread of its own while the calling thread collects
+ * what has been parsed so far into chunks, which the database thread
+ * writes.
+ */
+static void import_pipelined(struct file_import *import)
+{
+	MafwIradioBookmark batch[MAFW_IRADIO_IMPORT_QUEUE];
+	struct bookmark_ring *ring = &import->ring;
+	GThread *parser;
+	guint i, n;
+
+	memset(ring, 0, sizeof(*ring));
+	g_mutex_init(&ring->lock);
+	g_cond_init(&ring->not_empty);
+	g_cond_init(&ring->not_full);
+	import->chunk = g_array_sized_new(FALSE, FALSE,
+					  sizeof(MafwIradioBookmark),
+					  MIN(import->batch_size,
+					      MAFW_IRADIO_IMPORT_BATCH));
+
+	parser = g_thread_try_new("iradio-import",
+				  (GThreadFunc)parse_thread, import, NULL);
+	if (parser == NULL)
+	{
+		/* Do both in turn then */
+		import->result = import->importer->read(
+				import->path,
+				(MafwIradioBookmarkFunc)collect_bookmark,
+				import, &import->error);
+	}
+	else
+	{
+		while ((n = dequeue_bookmarks(ring, batch)) > 0)
+		{
+			for (i = 0; i < n; i++)
+				chunk_bookmark(&batch[i], import);
+		}
+		g_thread_join(parser);
+	}
+	flush_chunk(import);
+	g_array_free(import->chunk, TRUE);
+
+	g_cond_clear(&ring->not_full);
+	g_cond_clear(&ring->not_empty);
+	g_mutex_clear(&ring->lock);
+}
+
+/**
+ * mafw_iradio_importer_import:
+ *
+ * @importer: Format of the file
+ * @self: The iradio source to import into
+ * @path: Path of a station list
+ * @check_dups: Whether to skip bookmarks whose URI is already stored
+ * @batch_size: Number of objects committed per transaction, 0 for
+ * %MAFW_IRADIO_IMPORT_BATCH
+ * @count: Return location for the number of objects created, or NULL
+ * @cancellable: A #GCancellable, or NULL
+ * @error: Return location for an error, or NULL
+ *
+ * Streams the bookmarks of @path into @self.  Parsing runs in a separate
+ * thread, at most %MAFW_IRADIO_IMPORT_QUEUE bookmarks ahead of the calling
+ * thread.  That one waits while every @batch_size bookmarks are written as
+ * a bulk job on the database thread, see mafw_iradio_db_run().  If the
+ * file turns out to be broken, or @cancellable is cancelled from another
+ * thread, the bookmarks stored before are kept.
+ *
+ * Returns: FALSE if the file could not be read or stored.
+ */
+gboolean mafw_iradio_importer_import(const MafwIradioImporter *importer,
+				     MafwIradioSource *self,
+				     const gchar *path, gboolean check_dups,
+				     guint batch_size, guint *count,
+				     GCancellable *cancellable,
+				     GError **error)
+{
+	struct file_import import;
+	GError *write_error = NULL;
+
+	g_return_val_if_fail(importer != NULL, FALSE);
+	g_return_val_if_fail(MAFW_IS_IRADIO_SOURCE(self), FALSE);
+	g_return_val_if_fail(path != NULL, FALSE);
+
+	/* libxml2 has to be set up before its first use in a thread */
+	xmlInitParser();
+
+	memset(&import, 0, sizeof(import));
+	import.importer = importer;
+	import.path = path;
+	import.writer = mafw_iradio_bulk_writer_new(self, check_dups);
+	import.added = time(NULL);
+	import.batch_size = batch_size ? batch_size : MAFW_IRADIO_IMPORT_BATCH;
+	import.cancellable = cancellable;
+
+	import_pipelined(&import);
+
+	import.count = mafw_iradio_bulk_writer_finish(import.writer,
+						      &write_error);
+	if (count != NULL)
+		*count = import.count;
+
+	if (g_cancellable_set_error_if_cancelled(cancellable, error))
+	{
+		g_clear_error(&import.error);
+		g_clear_error(&write_error);
+		return FALSE;
+	}
+	if (import.error != NULL)
+	{
+		g_propagate_error(error, import.error);
+		g_clear_error(&write_error);
+		return FALSE;
+	}
+	if (write_error != NULL)
+	{
+		g_propagate_error(error, write_error);
+		return FALSE;
+	}
+	if (!import.result)
+	{
+		g_set_error(error, MAFW_EXTENSION_ERROR,
+			    MAFW_EXTENSION_ERROR_FAILED,
+			    "Unable to read %s", path);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * mafw_iradio_import_file:
+ *
+ * @self: The iradio source to import into
+ * @path: Path of a station list in any known format
+ * @batch_size: Number of objects committed per transaction, 0 for
+ * %MAFW_IRADIO_IMPORT_BATCH
+ * @cancellable: A #GCancellable, or NULL
+ * @error: Return location for an error, or NULL
+ *
+ * Imports @path with the importer matching its extension.  Bookmarks whose
+ * URI is already stored are skipped.
+ *
+ * Returns: the number of objects created.
+ */
+guint mafw_iradio_import_file(MafwIradioSource *self, const gchar *path,
+			      guint batch_size, GCancellable *cancellable,
+			      GError **error)
+{
+	const MafwIradioImporter *importer;
+	guint count = 0;
+
+	g_return_val_if_fail(MAFW_IS_IRADIO_SOURCE(self), 0);
+	g_return_val_if_fail(path != NULL, 0);
+
+	importer = mafw_iradio_importer_find(path);
+	if (importer == NULL)
+	{
+		g_set_error(error, MAFW_EXTENSION_ERROR,
+			    MAFW_EXTENSION_ERROR_FAILED,
+			    "Unsupported station list: %s", path);
+		return 0;
+	}
+
+	mafw_iradio_importer_import(importer, self, path, TRUE, batch_size,
+				    &count, cancellable, error);
+	return count;
+}
+
+/* vi: set noexpandtab ts=8 sw=8 cino=t0,(0: */
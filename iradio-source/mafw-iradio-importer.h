@@ -0,0 +1,116 @@
+/*
+ * This file is a part of MAFW
+ *
+ * Copyright (C) 2007, 2008, 2009 Nokia Corporation, all rights reserved.
+ *
+ * Contact: Visa Smolander <visa.smolander@nokia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#ifndef MAFW_IRADIO_IMPORTER_H
+#define MAFW_IRADIO_IMPORTER_H
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "mafw-iradio-source.h"
+
+G_BEGIN_DECLS
+
+/* Dummy MIME types for audio & video */
+#define MAFW_IRADIO_MIME_AUDIO "audio/unknown"
+#define MAFW_IRADIO_MIME_VIDEO "video/unknown"
+
+/* Objects committed per transaction by mafw_iradio_import_file() */
+#define MAFW_IRADIO_IMPORT_BATCH 1000
+/* Bookmarks the import parser may get ahead of the database writes */
+#define MAFW_IRADIO_IMPORT_QUEUE 256
+
+/*----------------------------------------------------------------------------
+  Bookmark records
+  ----------------------------------------------------------------------------*/
+
+/**
+ * MafwIradioBookmark:
+ *
+ * A single bookmark as read from a station list.  Strings are owned by the
+ * importer and are only valid during the #MafwIradioBookmarkFunc call;
+ * fields that were not present in the file are %NULL.
+ */
+typedef struct {
+	gchar *title;
+	gchar *uri;
+	gchar *mime;
+	gchar *thumbnail_uri;
+	gint duration;
+	gboolean has_duration;
+} MafwIradioBookmark;
+
+typedef void (*MafwIradioBookmarkFunc)(const MafwIradioBookmark *bookmark,
+					gpointer user_data);
+
+void mafw_iradio_bookmark_clear(MafwIradioBookmark *bookmark);
+GHashTable *mafw_iradio_bookmark_to_metadata(
+					const MafwIradioBookmark *bookmark);
+
+/*----------------------------------------------------------------------------
+  Importers
+  ----------------------------------------------------------------------------*/
+
+typedef gboolean (*MafwIradioImporterReadFunc)(const gchar *path,
+					       MafwIradioBookmarkFunc func,
+					       gpointer user_data,
+					       GError **error);
+
+/**
+ * MafwIradioImporter:
+ * @name: Name of the format
+ * @extensions: NULL-terminated list of file name extensions, without the dot
+ * @read: Streams the bookmarks of a file to a #MafwIradioBookmarkFunc
+ *
+ * A station list format.  Importers must not keep more than the bookmark
+ * being read in memory, and must be callable from any thread.
+ */
+typedef struct {
+	const gchar *name;
+	const gchar *const *extensions;
+	MafwIradioImporterReadFunc read;
+} MafwIradioImporter;
+
+void mafw_iradio_importer_register(const MafwIradioImporter *importer);
+const MafwIradioImporter *mafw_iradio_importer_lookup(const gchar *name);
+const MafwIradioImporter *mafw_iradio_importer_find(const gchar *path);
+gboolean mafw_iradio_importer_read(const gchar *path,
+				   MafwIradioBookmarkFunc func,
+				   gpointer user_data, GError **error);
+
+gboolean mafw_iradio_importer_import(const MafwIradioImporter *importer,
+				     MafwIradioSource *self,
+				     const gchar *path, gboolean check_dups,
+				     guint batch_size, guint *count,
+				     GCancellable *cancellable,
+				     GError **error);
+guint mafw_iradio_import_file(MafwIradioSource *self, const gchar *path,
+			      guint batch_size, GCancellable *cancellable,
+			      GError **error);
+
+G_END_DECLS
+
+#endif /* MAFW_IRADIO_IMPORTER_H */
+
+/* vi: set noexpandtab ts=8 sw=8 cino=t0,(0: */
@@ -0,0 +1,522 @@
+/*
+ * This file is a part of MAFW
+ *
+ * Copyright (C) 2007, 2008, 2009 Nokia Corporation, all rights reserved.
+ *
+ * Contact: Visa Smolander <visa.smolander@nokia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+/*
+ * Read-only snapshot of the root container, kept in a file next to the
+ * database and mapped into memory, so that the first browse after a start
+ * does not have to wait for SQLite.  The database stays the reference: the
+ * snapshot is only used while the token stored with it matches the one in
+ * the database, and it is thrown away before any change is written.
+ *
+ * File layout, in host byte order:
+ *
+ *   struct snapshot_header
+ *   struct snapshot_record  records[count]    in object id order
+ *   guint32                 by_title[count]   record indices
+ *   gchar                   pool[pool_size]   NUL-terminated strings
+ */
+
+#include <string.h>
+#include <glib/gstdio.h>
+#include <libmafw/mafw.h>
+#include <libmafw/mafw-db.h>
+#include <libmafw/mafw-metadata-serializer.h>
+
+#include "mafw-iradio-source.h"
+#include "mafw-iradio-db.h"
+#include "mafw-iradio-snapshot.h"
+
+#define SNAPSHOT_MAGIC 0x4e535249 /* "IRSN" */
+#define SNAPSHOT_SUFFIX ".iradio-snapshot"
+/* Offset of a key the object does not have */
+#define NO_STRING G_MAXUINT32
+
+struct snapshot_header {
+	guint32 magic;
+	guint32 version;
+	guint64 token;
+	guint32 count;
+	guint32 pool_size;
+};
+
+struct snapshot_record {
+	guint64 id;
+	guint32 title;
+	guint32 uri;
+	guint32 mime;
+	guint32 reserved;
+};
+
+struct _MafwIradioSnapshot {
+	GMappedFile *file;
+	const struct snapshot_header *header;
+	const struct snapshot_record *records;
+	const guint32 *by_title;
+	const gchar *pool;
+};
+
+/**
+ * Returns the path of the snapshot file, next to the database.
+ */
+static gchar *snapshot_path(void)
+{
+	gchar *db, *path;
+
+	db = mafw_iradio_db_path();
+	path = g_strconcat(db, SNAPSHOT_SUFFIX, NULL);
+	g_free(db);
+	return path;
+}
+
+/**
+ * Returns the token of the current snapshot, or 0 if there is none.
+ */
+static guint64 get_token(void)
+{
+	sqlite3_stmt *stmt;
+	guint64 token = 0;
+
+	stmt = mafw_iradio_db_prepare("SELECT token FROM "
+				      IRADIO_SNAPSHOT_TABLE);
+	if (mafw_iradio_db_select(stmt, FALSE) == SQLITE_ROW)
+		token = mafw_db_column_int64(stmt, 0);
+	sqlite3_finalize(stmt);
+	return token;
+}
+
+static void set_token(guint64 token)
+{
+	sqlite3_stmt *stmt;
+
+	mafw_iradio_db_exec("DELETE FROM " IRADIO_SNAPSHOT_TABLE);
+	if (token == 0)
+		return;
+
+	stmt = mafw_iradio_db_prepare("INSERT INTO " IRADIO_SNAPSHOT_TABLE
+			       "(token) VALUES(:token)");
+	mafw_db_bind_int64(stmt, 0, token);
+	if (mafw_iradio_db_change(stmt, FALSE) != SQLITE_DONE)
+		g_critical("Database error");
+	sqlite3_finalize(stmt);
+}
+
+static gboolean valid_string(const struct snapshot_header *header,
+			     guint32 offset)
+{
+	return offset == NO_STRING || offset < header->pool_size;
+}
+
+/**
+ * Maps the snapshot at @path and checks that it is a complete snapshot
+ * made along with @token.
+ */
+static MafwIradioSnapshot *open_snapshot(const gchar *path, guint64 token)
+{
+	const struct snapshot_header *header;
+	MafwIradioSnapshot *snapshot;
+	GMappedFile *file;
+	const gchar *contents;
+	gsize length;
+	guint i;
+
+	file = g_mapped_file_new(path, FALSE, NULL);
+	if (file == NULL)
+		return NULL;
+
+	contents = g_mapped_file_get_contents(file);
+	length = g_mapped_file_get_length(file);
+	header = (const struct snapshot_header *)contents;
+	if (length < sizeof(*header) ||
+	    header->magic != SNAPSHOT_MAGIC ||
+	    header->version != MAFW_IRADIO_SNAPSHOT_VERSION ||
+	    header->token != token ||
+	    header->count > length / sizeof(struct snapshot_record) ||
+	    length != sizeof(*header) +
+		      header->count * (sizeof(struct snapshot_record) +
+				       sizeof(guint32)) +
+		      header->pool_size)
+		goto invalid;
+
+	snapshot = g_new0(MafwIradioSnapshot, 1);
+	snapshot->file = file;
+	snapshot->header = header;
+	snapshot->records = (const struct snapshot_record *)(header + 1);
+	snapshot->by_title = (const guint32 *)
+		(snapshot->records + header->count);
+	snapshot->pool = (const gchar *)(snapshot->by_title + header->count);
+
+	if (header->pool_size > 0 &&
+	    snapshot->pool[header->pool_size - 1] != '\0')
+	{
+		g_free(snapshot);
+		goto invalid;
+	}
+	for (i = 0; i < header->count; i++)
+	{
+		const struct snapshot_record *record = &snapshot->records[i];
+
+		if (!valid_string(header, record->title) ||
+		    !valid_string(header, record->uri) ||
+		    !valid_string(header, record->mime) ||
+		    snapshot->by_title[i] >= header->count)
+		{
+			g_free(snapshot);
+			goto invalid;
+		}
+	}
+
+	return snapshot;
+
+invalid:
+	g_debug("Ignoring stale snapshot %s", path);
+	g_mapped_file_unref(file);
+	return NULL;
+}
+
+/**
+ * mafw_iradio_snapshot_load:
+ *
+ * Returns: the snapshot of the database, or NULL if there is no snapshot
+ * or it does not belong to the current content of the database.
+ */
+MafwIradioSnapshot *mafw_iradio_snapshot_load(void)
+{
+	MafwIradioSnapshot *snapshot;
+	guint64 token;
+	gchar *path;
+
+	token = get_token();
+	if (token == 0)
+		return NULL;
+
+	path = snapshot_path();
+	snapshot = open_snapshot(path, token);
+	g_free(path);
+	return snapshot;
+}
+
+/*---------------------------------------------------------------------------
+  Snapshot generation
+  ---------------------------------------------------------------------------*/
+
+struct snapshot_builder {
+	GArray *records;
+	GString *pool;
+	/* Collation keys of the titles, by record */
+	GPtrArray *title_keys;
+	/* MIME types are few, they are stored once */
+	GHashTable *mimes;
+};
+
+static guint32 pool_add(struct snapshot_builder *builder, const gchar *str)
+{
+	guint32 offset = builder->pool->len;
+
+	g_string_append_len(builder->pool, str, strlen(str) + 1);
+	return offset;
+}
+
+/**
+ * Returns the pool offset of the first value of @key in @metadata.
+ */
+static guint32 add_string(struct snapshot_builder *builder,
+			  GHashTable *metadata, const gchar *key)
+{
+	GValue *value;
+
+	value = mafw_metadata_first(metadata, key);
+	if (value == NULL || !G_VALUE_HOLDS_STRING(value) ||
+	    g_value_get_string(value) == NULL)
+		return NO_STRING;
+	return pool_add(builder, g_value_get_string(value));
+}
+
+static void add_record(struct snapshot_builder *builder, guint64 id,
+		       GHashTable *metadata)
+{
+	struct snapshot_record record;
+	GValue *value;
+	gpointer offset;
+
+	memset(&record, 0, sizeof(record));
+	record.id = id;
+	record.title = add_string(builder, metadata,
+				  MAFW_METADATA_KEY_TITLE);
+	record.uri = add_string(builder, metadata, MAFW_METADATA_KEY_URI);
+	record.mime = NO_STRING;
+
+	value = mafw_metadata_first(metadata, MAFW_METADATA_KEY_MIME);
+	if (value != NULL && G_VALUE_HOLDS_STRING(value) &&
+	    g_value_get_string(value) != NULL)
+	{
+		if (!g_hash_table_lookup_extended(builder->mimes,
+						  g_value_get_string(value),
+						  NULL, &offset))
+		{
+			offset = GUINT_TO_POINTER(pool_add(
+					builder, g_value_get_string(value)));
+			g_hash_table_insert(builder->mimes,
+					    g_value_dup_string(value),
+					    offset);
+		}
+		record.mime = GPOINTER_TO_UINT(offset);
+	}
+
+	g_array_append_val(builder->records, record);
+	g_ptr_array_add(builder->title_keys,
+			record.title != NO_STRING ?
+			g_utf8_collate_key(builder->pool->str + record.title,
+					   -1) : NULL);
+}
+
+/**
+ * Orders records by title like a "+title" browse does: the list to be
+ * sorted is in descending id order, and the sort is stable.  Objects
+ * without a title come last.
+ */
+static gint compare_titles(gconstpointer a, gconstpointer b,
+			   gpointer user_data)
+{
+	struct snapshot_builder *builder = user_data;
+	guint32 ia = *(const guint32 *)a;
+	guint32 ib = *(const guint32 *)b;
+	const gchar *ka = g_ptr_array_index(builder->title_keys, ia);
+	const gchar *kb = g_ptr_array_index(builder->title_keys, ib);
+	gint result;
+
+	if (ka == NULL || kb == NULL)
+		result = (ka == NULL) - (kb == NULL);
+	else
+		result = strcmp(ka, kb);
+	if (result == 0)
+		result = ia < ib ? 1 : ia > ib ? -1 : 0;
+	return result;
+}
+
+/**
+ * Reads the title, URI and MIME type of every object from the database.
+ */
+static void collect_records(struct snapshot_builder *builder)
+{
+	GHashTable *metadata;
+	sqlite3_stmt *stmt;
+	guint64 id = 0;
+	gboolean any = FALSE;
+
+	metadata = mafw_metadata_new();
+	stmt = mafw_iradio_db_prepare("SELECT id, key, value FROM " IRADIO_TABLE
+			       " WHERE key != '' ORDER BY id");
+	while (mafw_iradio_db_select(stmt, FALSE) == SQLITE_ROW)
+	{
+		const gchar *key;
+		GByteArray *bary;
+		GValue *value;
+		gsize b_size = 0;
+
+		if (any && mafw_db_column_int64(stmt, 0) != id)
+		{
+			add_record(builder, id, metadata);
+			g_hash_table_remove_all(metadata);
+		}
+		id = mafw_db_column_int64(stmt, 0);
+		any = TRUE;
+
+		key = mafw_db_column_text(stmt, 1);
+		if (!mafw_iradio_snapshot_has_key(key))
+			continue;
+
+		bary = g_byte_array_new();
+		bary = g_byte_array_append(bary, mafw_db_column_blob(stmt, 2),
+					   sqlite3_column_bytes(stmt, 2));
+		value = mafw_metadata_val_thaw_bary(bary, &b_size);
+		g_hash_table_insert(metadata, g_strdup(key), value);
+		g_byte_array_free(bary, TRUE);
+	}
+	if (any)
+		add_record(builder, id, metadata);
+	sqlite3_finalize(stmt);
+	mafw_metadata_release(metadata);
+}
+
+/**
+ * mafw_iradio_snapshot_update:
+ *
+ * @error: Return location for an error, or NULL
+ *
+ * Writes a new snapshot of the database, which must not be in a
+ * transaction.
+ *
+ * Returns: the new snapshot, or NULL if it could not be written.
+ */
+MafwIradioSnapshot *mafw_iradio_snapshot_update(GError **error)
+{
+	struct snapshot_builder builder;
+	struct snapshot_header header;
+	MafwIradioSnapshot *snapshot = NULL;
+	guint32 *by_title;
+	gchar *contents, *path;
+	gsize length;
+	guint i;
+
+	builder.records = g_array_new(FALSE, FALSE,
+				      sizeof(struct snapshot_record));
+	builder.pool = g_string_new(NULL);
+	builder.title_keys = g_ptr_array_new_with_free_func(g_free);
+	builder.mimes = g_hash_table_new_full(g_str_hash, g_str_equal,
+					      g_free, NULL);
+	collect_records(&builder);
+
+	by_title = g_new(guint32, builder.records->len);
+	for (i = 0; i < builder.records->len; i++)
+		by_title[i] = i;
+	g_qsort_with_data(by_title, builder.records->len, sizeof(guint32),
+			  compare_titles, &builder);
+
+	memset(&header, 0, sizeof(header));
+	header.magic = SNAPSHOT_MAGIC;
+	header.version = MAFW_IRADIO_SNAPSHOT_VERSION;
+	header.token = ((guint64)g_random_int() << 32 | g_random_int()) | 1;
+	header.count = builder.records->len;
+	header.pool_size = builder.pool->len;
+
+	length = sizeof(header) +
+		 header.count * (sizeof(struct snapshot_record) +
+				 sizeof(guint32)) +
+		 header.pool_size;
+	contents = g_malloc(length);
+	memcpy(contents, &header, sizeof(header));
+	memcpy(contents + sizeof(header), builder.records->data,
+	       header.count * sizeof(struct snapshot_record));
+	memcpy(contents + sizeof(header) +
+	       header.count * sizeof(struct snapshot_record),
+	       by_title, header.count * sizeof(guint32));
+	memcpy(contents + length - header.pool_size, builder.pool->str,
+	       header.pool_size);
+
+	/* The file goes first: a crash in between leaves the token in the
+	   database unmatched */
+	path = snapshot_path();
+	if (g_file_set_contents(path, contents, length, error))
+	{
+		set_token(header.token);
+		snapshot = open_snapshot(path, header.token);
+		g_debug("Snapshot of %u objects written to %s", header.count,
+			path);
+	}
+
+	g_free(path);
+	g_free(contents);
+	g_free(by_title);
+	g_hash_table_destroy(builder.mimes);
+	g_ptr_array_free(builder.title_keys, TRUE);
+	g_string_free(builder.pool, TRUE);
+	g_array_free(builder.records, TRUE);
+	return snapshot;
+}
+
+/**
+ * mafw_iradio_snapshot_discard:
+ *
+ * @snapshot: The current snapshot, or NULL
+ *
+ * Invalidates the snapshot before the database is changed, and frees
+ * @snapshot.
+ */
+void mafw_iradio_snapshot_discard(MafwIradioSnapshot *snapshot)
+{
+	gchar *path;
+
+	set_token(0);
+	path = snapshot_path();
+	g_unlink(path);
+	g_free(path);
+
+	if (snapshot != NULL)
+		mafw_iradio_snapshot_free(snapshot);
+}
+
+void mafw_iradio_snapshot_free(MafwIradioSnapshot *snapshot)
+{
+	g_return_if_fail(snapshot != NULL);
+
+	g_mapped_file_unref(snapshot->file);
+	g_free(snapshot);
+}
+
+/*---------------------------------------------------------------------------
+  Lookup
+  ---------------------------------------------------------------------------*/
+
+/**
+ * mafw_iradio_snapshot_has_key:
+ *
+ * @key: A metadata key
+ *
+ * Returns: TRUE if snapshots record @key.
+ */
+gboolean mafw_iradio_snapshot_has_key(const gchar *key)
+{
+	return !strcmp(key, MAFW_METADATA_KEY_TITLE) ||
+	       !strcmp(key, MAFW_METADATA_KEY_URI) ||
+	       !strcmp(key, MAFW_METADATA_KEY_MIME);
+}
+
+guint mafw_iradio_snapshot_count(const MafwIradioSnapshot *snapshot)
+{
+	return snapshot->header->count;
+}
+
+static const gchar *get_string(const MafwIradioSnapshot *snapshot,
+			       guint32 offset)
+{
+	return offset != NO_STRING ? snapshot->pool + offset : NULL;
+}
+
+/**
+ * mafw_iradio_snapshot_get:
+ *
+ * @snapshot: A snapshot
+ * @index: Index of the object, below mafw_iradio_snapshot_count()
+ * @by_title: Whether @index is in title order rather than id order
+ * @entry: Filled with the object
+ */
+void mafw_iradio_snapshot_get(const MafwIradioSnapshot *snapshot,
+			      guint index, gboolean by_title,
+			      MafwIradioSnapshotEntry *entry)
+{
+	const struct snapshot_record *record;
+
+	g_return_if_fail(index < snapshot->header->count);
+
+	if (by_title)
+		index = snapshot->by_title[index];
+	record = &snapshot->records[index];
+
+	entry->id = record->id;
+	entry->title = get_string(snapshot, record->title);
+	entry->uri = get_string(snapshot, record->uri);
+	entry->mime = get_string(snapshot, record->mime);
+}
+
+/* vi: set noexpandtab ts=8 sw=8 cino=t0,(0: */
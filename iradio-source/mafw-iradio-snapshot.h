@@ -0,0 +1,65 @@
+/*
+ * This file is a part of MAFW
+ *
+ * Copyright (C) 2007, 2008, 2009 Nokia Corporation, all rights reserved.
+ *
+ * Contact: Visa Smolander <visa.smolander@nokia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+#ifndef MAFW_IRADIO_SNAPSHOT_H
+#define MAFW_IRADIO_SNAPSHOT_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Bumped whenever the layout of the snapshot file changes */
+#define MAFW_IRADIO_SNAPSHOT_VERSION 1
+
+/**
+ * MafwIradioSnapshotEntry:
+ *
+ * An object as recorded in the snapshot.  The strings point into the
+ * mapped file; keys the object does not have are %NULL.
+ */
+typedef struct {
+	guint64 id;
+	const gchar *title;
+	const gchar *uri;
+	const gchar *mime;
+} MafwIradioSnapshotEntry;
+
+typedef struct _MafwIradioSnapshot MafwIradioSnapshot;
+
+MafwIradioSnapshot *mafw_iradio_snapshot_load(void);
+MafwIradioSnapshot *mafw_iradio_snapshot_update(GError **error);
+void mafw_iradio_snapshot_discard(MafwIradioSnapshot *snapshot);
+void mafw_iradio_snapshot_free(MafwIradioSnapshot *snapshot);
+
+gboolean mafw_iradio_snapshot_has_key(const gchar *key);
+guint mafw_iradio_snapshot_count(const MafwIradioSnapshot *snapshot);
+void mafw_iradio_snapshot_get(const MafwIradioSnapshot *snapshot,
+			      guint index, gboolean by_title,
+			      MafwIradioSnapshotEntry *entry);
+
+G_END_DECLS
+
+#endif /* MAFW_IRADIO_SNAPSHOT_H */
+
+/* vi: set noexpandtab ts=8 sw=8 cino=t0,(0: */
@@ -28,25 +28,46 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <glib/gstdio.h>
+#include <gio/gio.h>
 #include <inttypes.h>
 
 
 #include "config.h"
 #include "mafw-iradio-source.h"
+#include "mafw-iradio-db.h"
 #include "mafw-iradio-vendor-setup.h"
+#include "mafw-iradio-snapshot.h"
 
 #define MAFW_IRADIO_SOURCE_GET_PRIVATE(object)				\
 	(G_TYPE_INSTANCE_GET_PRIVATE ((object), MAFW_TYPE_IRADIO_SOURCE,\
 				      MafwIradioSourcePrivate))
 
-extern const gchar *vendor_setup_path;
-static gboolean load_vendor;
+
+enum {
+	VENDOR_SETUP_DONE,
+	LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL];
+
+/* Database image made by iradio-dbgen, copied on the first start */
+const gchar *db_image_path = IRADIO_DB_IMAGE;
 
 struct _MafwIradioSourcePrivate
 {
+	/* Guards the browse requests, the snapshot and the changes, which
+	   the threads calling the source share */
+	GMutex lock;
+	/* Thread the source was made on, which emits its signals */
+	GThread *thread;
 	guint last_browse_id;
-	GList *browse_requests;
+	/* Browse requests by browse-id */
+	GHashTable *browse_requests;
 	sqlite3_stmt *stmt_object_list;
+	/* Count browses answered in the indices */
+	sqlite3_stmt *stmt_count;
+	sqlite3_stmt *stmt_count_key;
+	sqlite3_stmt *stmt_count_title;
 	sqlite3_stmt *stmt_get_value;
 	sqlite3_stmt *stmt_get_key_value;
 	sqlite3_stmt *stmt_insert;
@@ -54,6 +75,41 @@ struct _MafwIradioSourcePrivate
 	sqlite3_stmt *stmt_delete_object;
 	sqlite3_stmt *stmt_get_max_id;
 	sqlite3_stmt *stmt_check_id;
+	/* Also sees the writes of the open group */
+	sqlite3_stmt *stmt_check_written_id;
+	/* Reads the URI of an object in the write transaction */
+	sqlite3_stmt *stmt_get_uri;
+	sqlite3_stmt *stmt_journal;
+	sqlite3_stmt *stmt_trim_journal;
+	/* Changes journaled, on the database thread */
+	guint journaled;
+	/* Keep IRADIO_TITLES_TABLE and IRADIO_URIS_TABLE up to date */
+	sqlite3_stmt *stmt_set_title;
+	sqlite3_stmt *stmt_add_title;
+	sqlite3_stmt *stmt_set_uri;
+	sqlite3_stmt *stmt_clear_uri;
+	sqlite3_stmt *stmt_find_uri;
+	sqlite3_stmt *stmt_lookup_uri;
+	/* Pages of browse_page() */
+	sqlite3_stmt *stmt_page_by_id;
+	sqlite3_stmt *stmt_page_by_title;
+	MafwIradioVendorSetup *vendor_setup;
+	GFileMonitor *vendor_monitor;
+	guint vendor_reload_id;
+	/* Whether the vendor directory changed while a setup was running */
+	gboolean vendor_rerun;
+	/* Snapshot of the root container, NULL while it is out of date */
+	MafwIradioSnapshot *snapshot;
+	/* Ids in the snapshot by canonical URI, made on the first lookup */
+	GHashTable *snapshot_uris;
+	guint snapshot_id;
+	/* Periodic checkpoint of the relaxed profile */
+	guint checkpoint_id;
+	/* Changes not notified yet, see schedule_changes() */
+	guint changes_outstanding;
+	gboolean container_changed;
+	GHashTable *changed_objects;
+	guint changes_id;
 };
 
 
@@ -71,38 +127,288 @@ struct data_container{
 	GError *error;
 	gpointer user_data;
 	gchar **metadata_keys;
+	/* Metadata to store, or the metadata read */
+	GHashTable *metadata;
 	void (*cb) (); /* generic function pointer */
 	void (*free_data_cb)(struct data_container *data); /* How to free the*/
 							    /* data*/
+	/* The created object was a bookmark of the URI already */
+	gboolean merged;
+	/* Cancels a metadata request, or NULL */
+	GCancellable *cancellable;
 
 };
 
 /**
- * Frees the structure, with its metadata-key list, and with the object-id
+ * Frees the structure, with its metadata-key list, and with the object-id,
+ * and releases the source
  **/
 static void free_data_container_cb (struct data_container *data)
 {
 	g_free(data->object_id);
 	g_strfreev(data->metadata_keys);
+	if (data->cancellable)
+		g_object_unref(data->cancellable);
+	g_object_unref(data->self);
 	g_free(data);
 }
 
 /**
- * Checks the database, whether an object with the gived ID exists or not
+ * Returns a deep copy of @metadata, made with the serializer, for the
+ * database thread to read while the caller may change or free its own
+ **/
+static GHashTable *copy_metadata(GHashTable *metadata)
+{
+	GByteArray *frozen;
+	GHashTable *copy;
+
+	frozen = mafw_metadata_freeze_bary(metadata);
+	copy = mafw_metadata_thaw((const gchar *)frozen->data, frozen->len);
+	g_byte_array_free(frozen, TRUE);
+
+	return copy;
+}
+
+/**
+ * Called when the transaction a write was grouped in could not be committed
+ **/
+static void write_failed(struct data_container *data)
+{
+	if (data->error)
+		return;
+	g_critical("Database error");
+	g_set_error(&data->error, MAFW_EXTENSION_ERROR,
+		    MAFW_EXTENSION_ERROR_FAILED, "Database error");
+}
+
+/* Seconds without changes before the snapshot is written again */
+#define SNAPSHOT_DELAY 5
+
+static gboolean snapshot_update_cb(MafwIradioSource *self)
+{
+	MafwIradioSnapshot *snapshot;
+	GError *error = NULL;
+
+	/* Let the vendor setup and the queued requests finish first */
+	if (self->priv->vendor_setup || mafw_iradio_db_pending())
+		return TRUE;
+
+	g_mutex_lock(&self->priv->lock);
+	/* Put off by a change on another thread meanwhile */
+	if (g_source_is_destroyed(g_main_current_source()))
+	{
+		g_mutex_unlock(&self->priv->lock);
+		return FALSE;
+	}
+	self->priv->snapshot_id = 0;
+	g_mutex_unlock(&self->priv->lock);
+
+	snapshot = mafw_iradio_snapshot_update(&error);
+	if (error)
+	{
+		g_warning("Unable to write snapshot: %s", error->message);
+		g_error_free(error);
+	}
+
+	g_mutex_lock(&self->priv->lock);
+	if (snapshot && self->priv->snapshot_id)
+		/* Out of date already */
+		mafw_iradio_snapshot_discard(snapshot);
+	else
+		self->priv->snapshot = snapshot;
+	g_mutex_unlock(&self->priv->lock);
+	return FALSE;
+}
+
+/**
+ * Writes a new snapshot once the objects have not changed for a while.
+ * Called with the lock held.
+ **/
+static void schedule_snapshot(MafwIradioSource *self)
+{
+	if (self->priv->snapshot_id)
+		g_source_remove(self->priv->snapshot_id);
+	self->priv->snapshot_id = g_timeout_add_seconds(
+					SNAPSHOT_DELAY,
+					(GSourceFunc)snapshot_update_cb, self);
+}
+
+/* Seconds between the checkpoints of the relaxed profile */
+#define CHECKPOINT_INTERVAL 30
+
+static void checkpoint_run(gpointer data)
+{
+	mafw_iradio_db_checkpoint();
+}
+
+static gboolean checkpoint_cb(MafwIradioSource *self)
+{
+	/* Between the transactions of the queued requests */
+	mafw_iradio_db_queue(MAFW_IRADIO_DB_BULK, checkpoint_run, NULL, NULL);
+	return TRUE;
+}
+
+/**
+ * Must be called before the objects are changed, outside of transactions.
+ * Requests are served from the database until a new snapshot is written.
+ **/
+static void invalidate_snapshot(MafwIradioSource *self)
+{
+	g_mutex_lock(&self->priv->lock);
+	if (self->priv->snapshot)
+	{
+		mafw_iradio_snapshot_discard(self->priv->snapshot);
+		self->priv->snapshot = NULL;
+	}
+	if (self->priv->snapshot_uris)
+	{
+		g_hash_table_destroy(self->priv->snapshot_uris);
+		self->priv->snapshot_uris = NULL;
+	}
+	schedule_snapshot(self);
+	g_mutex_unlock(&self->priv->lock);
+}
+
+/* Milliseconds a burst of changes may hold back its signals */
+#define CHANGES_LATENCY 100
+
+/**
+ * Emits container-changed once if objects were created or destroyed, and
+ * metadata-changed once for every other object changed, since the last
+ * time.  Only the thread of the source emits them.
+ **/
+static void emit_changes(MafwIradioSource *self)
+{
+	GHashTable *objects;
+	GHashTableIter iter;
+	gpointer object_id;
+	gboolean container;
+
+	/* The handlers may change objects too */
+	g_mutex_lock(&self->priv->lock);
+	if (self->priv->changes_id)
+	{
+		g_source_remove(self->priv->changes_id);
+		self->priv->changes_id = 0;
+	}
+	objects = self->priv->changed_objects;
+	self->priv->changed_objects = g_hash_table_new_full(g_str_hash,
+							    g_str_equal,
+							    g_free, NULL);
+	container = self->priv->container_changed;
+	self->priv->container_changed = FALSE;
+	g_mutex_unlock(&self->priv->lock);
+
+	g_hash_table_iter_init(&iter, objects);
+	while (g_hash_table_iter_next(&iter, &object_id, NULL))
+		g_signal_emit_by_name(self, "metadata-changed", object_id);
+	g_hash_table_destroy(objects);
+	if (container)
+		g_signal_emit_by_name(self, "container-changed",
+				      MAFW_IRADIO_SOURCE_UUID "::");
+}
+
+static gboolean changes_timeout_cb(MafwIradioSource *self)
+{
+	/* It removes this source */
+	emit_changes(self);
+	return FALSE;
+}
+
+/**
+ * Notifies the changes noted so far once no request changing objects is
+ * outstanding, so that a burst of them is notified together.  A burst that
+ * does not end is still notified every CHANGES_LATENCY milliseconds.
+ **/
+static void schedule_changes(MafwIradioSource *self)
+{
+	MafwIradioSourcePrivate *priv = self->priv;
+	gboolean emit = FALSE;
+
+	g_mutex_lock(&priv->lock);
+	if (priv->container_changed ||
+	    g_hash_table_size(priv->changed_objects))
+	{
+		if (priv->changes_outstanding)
+		{
+			if (!priv->changes_id)
+				priv->changes_id = g_timeout_add(
+					CHANGES_LATENCY,
+					(GSourceFunc)changes_timeout_cb, self);
+		}
+		else if (g_thread_self() == priv->thread)
+			emit = TRUE;
+		else
+		{
+			/* Done on another thread, notified on the source's */
+			if (priv->changes_id)
+				g_source_remove(priv->changes_id);
+			priv->changes_id = g_idle_add(
+					(GSourceFunc)changes_timeout_cb, self);
+		}
+	}
+	g_mutex_unlock(&priv->lock);
+
+	if (emit)
+		emit_changes(self);
+}
+
+static void note_object_changed(MafwIradioSource *self,
+				const gchar *object_id)
+{
+	g_mutex_lock(&self->priv->lock);
+	g_hash_table_add(self->priv->changed_objects, g_strdup(object_id));
+	g_mutex_unlock(&self->priv->lock);
+}
+
+/* Created or destroyed objects are notified by container-changed alone */
+static void note_container_changed(MafwIradioSource *self,
+				   const gchar *object_id)
+{
+	g_mutex_lock(&self->priv->lock);
+	if (object_id)
+		g_hash_table_remove(self->priv->changed_objects, object_id);
+	self->priv->container_changed = TRUE;
+	g_mutex_unlock(&self->priv->lock);
+}
+
+/**
+ * Must be called when a request that changes objects is queued, and
+ * change_done() when it completes.
+ **/
+static void change_queued(MafwIradioSource *self)
+{
+	g_mutex_lock(&self->priv->lock);
+	self->priv->changes_outstanding++;
+	g_mutex_unlock(&self->priv->lock);
+}
+
+static void change_done(MafwIradioSource *self)
+{
+	g_mutex_lock(&self->priv->lock);
+	g_assert(self->priv->changes_outstanding > 0);
+	self->priv->changes_outstanding--;
+	g_mutex_unlock(&self->priv->lock);
+	schedule_changes(self);
+}
+
+/**
+ * Checks the database with @check, whether an object with the gived ID
+ * exists or not
  *
  * Return: TRUE if the id is in the DB
  **/
-static gboolean is_id_stored(MafwIradioSource *self, guint64 id)
+static gboolean is_id_stored(sqlite3_stmt *check, guint64 id)
 {
 	gboolean retval = TRUE;
 	
-	mafw_db_bind_int64(self->priv->stmt_check_id, 0, id);
+	mafw_db_bind_int64(check, 0, id);
 		
-	if (mafw_db_select(self->priv->stmt_check_id, FALSE) != SQLITE_ROW)
+	if (mafw_iradio_db_select(check, FALSE) != SQLITE_ROW)
 	{
 		retval = FALSE;
 	}
-	sqlite3_reset(self->priv->stmt_check_id);
+	sqlite3_reset(check);
 	
 	return retval;
 }
@@ -142,7 +448,7 @@ static guint64 get_next_id(MafwIradioSource *self)
 {
 	guint64 new_id;
 	
-	if (mafw_db_select(self->priv->stmt_get_max_id,
+	if (mafw_iradio_db_select(self->priv->stmt_get_max_id,
 				FALSE) == SQLITE_ROW) {
 		new_id = mafw_db_column_int64(self->priv->
 							stmt_get_max_id, 0);
@@ -183,9 +489,10 @@ static void store_metadata(gchar *key, gpointer value,
 					str_size) != SQLITE_OK)
 			goto out0;
 		
-		if (mafw_db_change(priv->stmt_insert, FALSE) != SQLITE_DONE)
+		if (mafw_iradio_db_change(priv->stmt_insert, FALSE)
+		    != SQLITE_DONE)
 			goto out0;
-		g_assert(mafw_db_nchanges() == 1);
+		g_assert(mafw_iradio_db_nchanges() == 1);
 		sqlite3_reset(priv->stmt_insert);
 	
 	}
@@ -197,7 +504,7 @@ static void store_metadata(gchar *key, gpointer value,
 
 out0:	/* Clean up */
 	sqlite3_reset(priv->stmt_insert);
-	mafw_db_rollback();
+	mafw_iradio_db_rollback();
 	g_critical("Database error");
 	g_set_error(&data->error, MAFW_EXTENSION_ERROR, MAFW_EXTENSION_ERROR_FAILED,
 			"Database error");
@@ -208,966 +515,3151 @@ out0:	/* Clean up */
 }
 
 /**
- * Called in idle, when the object-creation is done. Calls the cb-function,
- * and emits the container-changed signal, with the new object-id
+ * Removes all the metadata_keys for the given object, defined by the key.
+ * The removed metadatas will be re-added. CB for g_hash_table_foreach
  **/
-static gboolean object_creation_done(struct data_container *data)
+static void remove_all_key(gchar *key, gpointer value,
+				struct data_container *data)
 {
-	g_assert(data != NULL);
+	MafwIradioSource *src = MAFW_IRADIO_SOURCE(data->self);
+	mafw_db_bind_int64(src->priv->stmt_delete_keys, 0, data->id);
+	mafw_db_bind_text(src->priv->stmt_delete_keys, 1, key);
+	mafw_iradio_db_delete(src->priv->stmt_delete_keys);
+	sqlite3_reset(src->priv->stmt_delete_keys);
+}
 
-	if (data->cb != NULL)
-	{
-		MafwSourceObjectCreatedCb cb = (MafwSourceObjectCreatedCb)
-								(data->cb);
-		cb(data->self, data->error? NULL: data->object_id,
-		   data->user_data, data->error);
-	}
+/*----------------------------------------------------------------------------
+  Change journal
+  ----------------------------------------------------------------------------*/
 
-	if (!data->error)
-		g_signal_emit_by_name(data->self, "container-changed",
-			MAFW_IRADIO_SOURCE_UUID "::");
-	else
-		g_error_free(data->error);
-	g_free(data->object_id);
-	g_free(data);
-	return FALSE;
-}
+/* Changes kept in the journal, the older ones are dropped at startup and
+   every JOURNAL_TRIM changes */
+#define JOURNAL_SIZE 10000
+#define JOURNAL_TRIM 1000
+#define TRIM_JOURNAL "DELETE FROM " IRADIO_CHANGES_TABLE " WHERE seq <= " \
+	"(SELECT max(seq) FROM " IRADIO_CHANGES_TABLE ") - "		\
+	G_STRINGIFY(JOURNAL_SIZE)
 
+static void add_key(gchar *key, gpointer value, GString *keys)
+{
+	if (keys->len)
+		g_string_append_c(keys, ',');
+	g_string_append(keys, key);
+}
 
 /**
- * Creates a new object, adds it to the DB with its metadatas
+ * Records a change of the object @id in the transaction that makes it.
+ * @metadata holds the keys stored, and @replaced_keys those removed
+ * besides, if any.
+ *
+ * Returns: FALSE on database error, the caller rolls back
  **/
-static void create_object(MafwSource *self, const gchar *parent,
-				GHashTable *metadata, 
-				MafwSourceObjectCreatedCb cb,
-				gpointer user_data)
+static gboolean journal_change(MafwIradioSource *self, guint64 id,
+			       MafwIradioChangeOp op, GHashTable *metadata,
+			       const gchar *const *replaced_keys)
 {
-	guint64 new_id;
-	GError *error = NULL;
-	
-	g_debug("Creating object");
-	
-	g_return_if_fail(MAFW_IS_IRADIO_SOURCE(self));
-	g_return_if_fail(parent);
-	g_return_if_fail(metadata);
-	
-	/* Metadata-URI check */
-	if (!mafw_metadata_first(metadata, MAFW_METADATA_KEY_URI))
+	sqlite3_stmt *stmt = self->priv->stmt_journal;
+	GString *keys = NULL;
+	gint result;
+
+	if (metadata)
 	{
-		g_debug("URI is missing");
-		g_set_error(&error, MAFW_SOURCE_ERROR,
-				MAFW_SOURCE_ERROR_INVALID_OBJECT_ID,
-				"URI is missing");
-		cb(self, NULL, user_data, error);
-		g_error_free(error);
-		return;
+		keys = g_string_new(NULL);
+		g_hash_table_foreach(metadata, (GHFunc)add_key, keys);
+		for (; replaced_keys && *replaced_keys; replaced_keys++)
+		{
+			if (!g_hash_table_lookup(metadata, *replaced_keys))
+				add_key((gchar *)*replaced_keys, NULL, keys);
+		}
 	}
-	
-	/* object-id check */
-	if (strcmp(parent, MAFW_IRADIO_SOURCE_UUID "::"))
+
+	mafw_db_bind_int64(stmt, 0, id);
+	mafw_db_bind_int(stmt, 1, op);
+	/* Left NULL for a destroyed object */
+	if (keys)
+		mafw_db_bind_text(stmt, 2, keys->str);
+	result = mafw_iradio_db_change(stmt, FALSE);
+	sqlite3_reset(stmt);
+	sqlite3_clear_bindings(stmt);
+	if (keys)
+		g_string_free(keys, TRUE);
+
+	if (result == SQLITE_DONE && ++self->priv->journaled % JOURNAL_TRIM == 0)
 	{
-		g_debug("Parent-id can be only " MAFW_IRADIO_SOURCE_UUID
-				"::");
-		g_set_error(&error, MAFW_SOURCE_ERROR,
-				MAFW_SOURCE_ERROR_INVALID_OBJECT_ID,
-				"Parent-id can be only "
-					MAFW_IRADIO_SOURCE_UUID "::");
-		cb(self, NULL, user_data, error);
-		g_error_free(error);
-		return;
+		stmt = self->priv->stmt_trim_journal;
+		result = mafw_iradio_db_delete(stmt);
+		sqlite3_reset(stmt);
 	}
-	
-	new_id = get_next_id(MAFW_IRADIO_SOURCE(self));
-	
-	struct data_container *create_object_data = g_new0(
-						struct data_container, 1);
-	create_object_data->id = new_id;
-	create_object_data->cb = cb;
-	create_object_data->self = self;
-	create_object_data->user_data = user_data;
-	create_object_data->object_id = g_strdup_printf(MAFW_IRADIO_SOURCE_UUID
-					"::%" PRId64,
-					new_id);
-	if (!mafw_db_begin())
-		goto create_object_err0;
-	g_hash_table_foreach(metadata, (GHFunc)store_metadata,
-				create_object_data);
-	if (create_object_data->error)
-		goto create_object_err1;
-	if (!mafw_db_commit())
-		goto create_object_err0;
-	g_idle_add((GSourceFunc)object_creation_done, create_object_data);
-	
-	return;
-	
-create_object_err0:
-	mafw_db_rollback();
-create_object_err1:
-	g_critical("Database error");
-	g_set_error(&error, MAFW_EXTENSION_ERROR,
-				MAFW_EXTENSION_ERROR_FAILED,
-				"Database error");
-	cb(self, NULL, user_data, error);
-	g_error_free(error);
-	free_data_container_cb(create_object_data);
-	return;
+
+	return result == SQLITE_DONE;
 }
 
+/* Ports left out of canonical URIs */
+static const struct {
+	const gchar *scheme;
+	const gchar *port;
+} default_ports[] = {
+	{ "http", "80" },
+	{ "https", "443" },
+	{ "rtsp", "554" },
+	{ "mms", "1755" },
+	{ NULL, NULL }
+};
+
 /**
- * Called in idle, to remove and object, and its metadatas from the DB.
- * The user-given cb will be called, and the container-changed signal
- * will be emmited too, with the root object-id
+ * Appends @length bytes of @part to @result, with the percent-escapes in
+ * upper case, and those of unreserved characters unescaped
  **/
-static gboolean destroy_object_cb(struct data_container *data)
+static void append_unescaped(GString *result, const gchar *part,
+			     gsize length)
 {
-	gint result = SQLITE_OK;
-	GError *err = NULL;
-	MafwIradioSource *src = MAFW_IRADIO_SOURCE(data->self);
-	MafwSourceObjectDestroyedCb cb = (MafwSourceObjectDestroyedCb)data ->
-						cb;
+	const gchar *end = part + length;
+	gint c;
 
-	mafw_db_bind_int64(src->priv->stmt_delete_object, 0, data->id);
-	result = mafw_db_delete(src->priv->stmt_delete_object);
-	sqlite3_reset(src->priv->stmt_delete_object);
-	
-	if (result != SQLITE_DONE) {
-		g_critical("Database error: %d", result);
-		err = g_error_new(MAFW_EXTENSION_ERROR,
-                                             MAFW_EXTENSION_ERROR_FAILED,
-                                             "Database error: %d", result);
+	while (part < end)
+	{
+		if (*part == '%' && end - part > 2 &&
+		    g_ascii_isxdigit(part[1]) && g_ascii_isxdigit(part[2]))
+		{
+			c = g_ascii_xdigit_value(part[1]) * 16 +
+				g_ascii_xdigit_value(part[2]);
+			if (g_ascii_isalnum(c) || strchr("-._~", c))
+				g_string_append_c(result, c);
+			else
+				g_string_append_printf(result, "%%%02X", c);
+			part += 3;
+		}
+		else
+			g_string_append_c(result, *part++);
 	}
-	
-	cb(data->self, data->object_id, data->user_data, err);
-	if (err)
-		g_error_free(err);
-	else
-		g_signal_emit_by_name(data->self, "container-changed",
-					MAFW_IRADIO_SOURCE_UUID "::");
-	
-	g_free(data->object_id);
-	g_free(data);
-	return FALSE;
 }
 
 /**
- * Destroys an object
+ * Lowers the case of the @len bytes at @str, in place.
  **/
-static void destroy_object(MafwSource *self, const gchar *object_id,
-				MafwSourceObjectDestroyedCb cb,
-				gpointer user_data)
+static void ascii_down(gchar *str, gsize len)
 {
-	guint64 id;
-	gboolean parse_err = FALSE;
-	struct data_container *cb_data;
-	GError *error = NULL;
+	gchar *end;
 
-	g_debug("Destroy object");
-	g_return_if_fail(MAFW_IS_IRADIO_SOURCE(self));
-	g_return_if_fail(object_id);
-	g_return_if_fail(g_str_has_prefix(object_id,
-				MAFW_IRADIO_SOURCE_UUID "::"));
-	g_return_if_fail(cb);
+	for (end = str + len; str < end; str++)
+		*str = g_ascii_tolower(*str);
+}
 
-	id = get_id_from_objectid(object_id, &parse_err);
-	if (parse_err)
+/**
+ * Returns the canonical form of @uri, which IRADIO_URIS_TABLE keeps, so
+ * that the spellings of a stream match: without surrounding white space,
+ * with the scheme and the host in lower case, without the default port of
+ * the scheme, with percent-escapes as append_unescaped() leaves them, and
+ * without slashes at the end of the path.
+ **/
+static gchar *canonical_uri(const gchar *uri)
+{
+	GString *result;
+	gchar *stripped;
+	const gchar *scheme_end, *host, *host_end, *port, *path, *path_end;
+	gsize path_start;
+	guint i;
+
+	stripped = g_strstrip(g_strdup(uri));
+	scheme_end = strstr(stripped, "://");
+	if (!scheme_end || scheme_end == stripped)
+		return stripped;
+
+	result = g_string_new(NULL);
+	g_string_append_len(result, stripped, scheme_end - stripped);
+	ascii_down(result->str, result->len);
+	g_string_append(result, "://");
+
+	host = scheme_end + 3;
+	path = host + strcspn(host, "/?#");
+	/* The user name keeps its case */
+	for (port = host; port < path; port++)
+		if (*port == '@')
+			host = port + 1;
+	g_string_append_len(result, scheme_end + 3, host - scheme_end - 3);
+
+	/* The port follows the last colon, unless it is in an IPv6 address */
+	host_end = path;
+	for (port = path; port > host; port--)
+		if (port[-1] == ':' || port[-1] == ']')
+			break;
+	if (port > host && port[-1] == ':')
 	{
-		g_debug("Invalid object-id");
-		g_set_error(&error, MAFW_SOURCE_ERROR,
-				MAFW_SOURCE_ERROR_INVALID_OBJECT_ID,
-				"Invalid object-id");
-		cb(self, object_id, user_data, error);
-		g_error_free(error);
-		return;
+		host_end = port - 1;
+		for (i = 0; default_ports[i].scheme; i++)
+			if (!g_ascii_strncasecmp(stripped,
+						 default_ports[i].scheme,
+						 scheme_end - stripped) &&
+			    !default_ports[i].scheme[scheme_end - stripped] &&
+			    (gsize)(path - port) ==
+			    strlen(default_ports[i].port) &&
+			    !strncmp(port, default_ports[i].port,
+				     path - port))
+				break;
+		if (!default_ports[i].scheme && port < path)
+			/* Kept */
+			host_end = path;
 	}
-	cb_data = g_new0(struct data_container, 1);
-	cb_data->self = self;
-	cb_data->id = id;
-	cb_data->cb = cb;
-	cb_data->user_data = user_data;
-	cb_data->object_id = g_strdup(object_id);
-	g_idle_add((GSourceFunc)destroy_object_cb, (gpointer)cb_data);
-	return;
+	i = result->len;
+	g_string_append_len(result, host, host_end - host);
+	ascii_down(result->str + i, result->len - i);
+
+	path_end = path + strcspn(path, "?#");
+	path_start = result->len;
+	append_unescaped(result, path, path_end - path);
+	while (result->len > path_start && result->str[result->len - 1] == '/')
+		g_string_truncate(result, result->len - 1);
+	append_unescaped(result, path_end, strlen(path_end));
+
+	g_free(stripped);
+	return g_string_free(result, FALSE);
 }
 
 /**
- * Called on idle, after a metadata-change. Calls the user-given cb, and emmits
- * the metadata-changed signal
+ * Returns TRUE if @key is one of @replaced_keys
  **/
-static gboolean set_mdata_cb(struct data_container *data)
+static gboolean key_replaced(const gchar *const *replaced_keys,
+			     const gchar *key)
 {
-	MafwSourceMetadataSetCb cb = (MafwSourceMetadataSetCb)data->cb;
-
-	cb(data->self, data->object_id, NULL,
-			data->user_data, data->error);
-	if (!data->error)
-		g_signal_emit_by_name(data->self, "metadata-changed",
-				data->object_id);
-	else
-		g_error_free(data->error);
-	g_free(data->object_id);
-	g_free(data);
+	for (; replaced_keys && *replaced_keys; replaced_keys++)
+		if (!strcmp(*replaced_keys, key))
+			return TRUE;
 	return FALSE;
 }
 
 /**
- * Removes all the metadata_keys for the given object, defined by the key.
- * The removed metadatas will be re-added. CB for g_hash_table_foreach
+ * Stores the URI of the object @id in IRADIO_URIS_TABLE, see
+ * index_object().  Objects without one are not there.  Storing the URI of
+ * another object fails; the callers look for it with find_duplicate().
  **/
-static void remove_all_key(gchar *key, gpointer value,
-				struct data_container *data)
+static gboolean index_uri(MafwIradioSource *self, guint64 id,
+			  GHashTable *metadata,
+			  const gchar *const *replaced_keys)
 {
-	MafwIradioSource *src = MAFW_IRADIO_SOURCE(data->self);
-	mafw_db_bind_int64(src->priv->stmt_delete_keys, 0, data->id);
-	mafw_db_bind_text(src->priv->stmt_delete_keys, 1, key);
-	mafw_db_delete(src->priv->stmt_delete_keys);
-	sqlite3_reset(src->priv->stmt_delete_keys);
-}
+	sqlite3_stmt *stmt;
+	GValue *value;
+	gchar *uri;
+	gint result;
 
-static void get_keys_cb(gpointer key, gpointer val, GPtrArray *keylist)
-{
-	g_ptr_array_add(keylist, key);
+	value = mafw_metadata_first(metadata, MAFW_METADATA_KEY_URI);
+	if (!value && !key_replaced(replaced_keys, MAFW_METADATA_KEY_URI))
+		return TRUE;
+
+	stmt = self->priv->stmt_clear_uri;
+	mafw_db_bind_int64(stmt, 0, id);
+	result = mafw_iradio_db_change(stmt, FALSE);
+	sqlite3_reset(stmt);
+	if (result != SQLITE_DONE || !value || !G_VALUE_HOLDS_STRING(value))
+		return result == SQLITE_DONE;
+
+	uri = canonical_uri(g_value_get_string(value));
+	stmt = self->priv->stmt_set_uri;
+	mafw_db_bind_int64(stmt, 0, id);
+	mafw_db_bind_text(stmt, 1, uri);
+	result = mafw_iradio_db_change(stmt, FALSE);
+	sqlite3_reset(stmt);
+	g_free(uri);
+
+	return result == SQLITE_DONE;
 }
 
-static void set_metadata_error_reporter(MafwSource *self, const gchar *object_id,
-				GHashTable *metadata,
-				MafwSourceMetadataSetCb cb,
-				gpointer user_data, GQuark domain,
-				gint code, const gchar *string)
+/**
+ * Returns the id of the object other than @id that has the URI of
+ * @metadata, or 0.  It is looked up in the unique index on the writing
+ * connection, which sees the transaction.
+ **/
+static guint64 find_duplicate(MafwIradioSource *self, guint64 id,
+			      GHashTable *metadata)
 {
-	GPtrArray *keylist = g_ptr_array_new();
-	GError *error = NULL;
+	sqlite3_stmt *stmt = self->priv->stmt_find_uri;
+	GValue *value;
+	gchar *uri;
+	guint64 other = 0;
 
-	g_hash_table_foreach(metadata, (GHFunc)get_keys_cb, keylist);
-	g_ptr_array_add(keylist, NULL);
-	g_set_error(&error, domain, code, "%s", string);
-	cb(self,  object_id, (const gchar **)keylist->pdata, user_data, error);
-	g_ptr_array_free(keylist, TRUE);
-	g_error_free(error);
+	value = mafw_metadata_first(metadata, MAFW_METADATA_KEY_URI);
+	if (!value || !G_VALUE_HOLDS_STRING(value))
+		return 0;
+
+	uri = canonical_uri(g_value_get_string(value));
+	mafw_db_bind_text(stmt, 0, uri);
+	if (mafw_iradio_db_select(stmt, FALSE) == SQLITE_ROW)
+		other = mafw_db_column_int64(stmt, 0);
+	sqlite3_reset(stmt);
+	g_free(uri);
+
+	return other != id ? other : 0;
 }
 
 /**
- * Updates the metadata of a given object.
+ * Stores the title of the object @id in IRADIO_TITLES_TABLE, and its URI in
+ * IRADIO_URIS_TABLE, in the transaction that wrote @metadata, replacing
+ * @replaced_keys besides.  Objects without a title are there with an empty
+ * one.  The rows go away with the last bookmark row of the object, by
+ * trigger.
+ *
+ * Returns: FALSE on database error, the caller rolls back
  **/
-static void set_metadata(MafwSource *self, const gchar *object_id,
-				GHashTable *metadata,
-				MafwSourceMetadataSetCb cb,
-				gpointer user_data)
+static gboolean index_object(MafwIradioSource *self, guint64 id,
+			     GHashTable *metadata,
+			     const gchar *const *replaced_keys)
 {
-	guint64 id;
-	struct data_container *data;
-	gboolean parse_err = FALSE;
-	
-	
+	sqlite3_stmt *stmt;
+	GValue *value;
+	const gchar *title = NULL;
+	gint result;
 
-	g_debug("Set metadata for %s", object_id);
-	g_return_if_fail(MAFW_IS_IRADIO_SOURCE(self));
-	g_return_if_fail(object_id);
-	g_return_if_fail(g_str_has_prefix(object_id,
-					MAFW_IRADIO_SOURCE_UUID "::"));
-	g_return_if_fail(cb);
-	g_return_if_fail(metadata);
+	value = mafw_metadata_first(metadata, MAFW_METADATA_KEY_TITLE);
+	if (value && G_VALUE_HOLDS_STRING(value))
+		title = g_value_get_string(value);
+	else if (value || key_replaced(replaced_keys,
+				       MAFW_METADATA_KEY_TITLE))
+		title = "";
 
-	id = get_id_from_objectid(object_id, &parse_err);
-	if (parse_err || !is_id_stored(MAFW_IRADIO_SOURCE(self), id))
+	if (title)
 	{
-		
-		g_debug("Invalid object-id");
-		set_metadata_error_reporter(self, object_id, metadata, cb,
-				user_data, MAFW_SOURCE_ERROR,
-				MAFW_SOURCE_ERROR_INVALID_OBJECT_ID,
-				"Invalid object-id");
-		return;
+		stmt = self->priv->stmt_set_title;
+		mafw_db_bind_int64(stmt, 0, id);
+		mafw_db_bind_text(stmt, 1, title);
 	}
-	
-	data = g_new0(struct data_container, 1);
-	data->id = id;
-	data->object_id = g_strdup(object_id);
-	data->self = self;
-	data->cb = cb;
-	data->user_data = user_data;
-	
-	g_hash_table_foreach(metadata, (GHFunc)remove_all_key, data);
-	if (!mafw_db_begin())
-		goto set_metadata_err0;
-	g_hash_table_foreach(metadata, (GHFunc)store_metadata, data);
-	if (data->error)
-		goto set_metadata_err1;
-	if (!mafw_db_commit())
-		goto set_metadata_err0;
-	g_idle_add((GSourceFunc)set_mdata_cb, data);
-	
-	return;
+	else
+	{
+		/* Untouched, if it has one */
+		stmt = self->priv->stmt_add_title;
+		mafw_db_bind_int64(stmt, 0, id);
+	}
+	result = mafw_iradio_db_change(stmt, FALSE);
+	sqlite3_reset(stmt);
 
-set_metadata_err0:
-	mafw_db_rollback();
-set_metadata_err1:
-	g_debug("Database error at set_metadata");
-	set_metadata_error_reporter(self, object_id, metadata, cb,
-				user_data, MAFW_EXTENSION_ERROR,
-				MAFW_EXTENSION_ERROR_FAILED,
-				"Database error");
-	free_data_container_cb(data);
-	return;
+	return result == SQLITE_DONE &&
+		index_uri(self, id, metadata, replaced_keys);
 }
 
-static guint get_child_count(MafwIradioSourcePrivate *privdat)
+/* A read of the change journal, see mafw_iradio_source_get_changes() */
+struct changes_request {
+	guint64 since;
+	guint64 seq;
+	GPtrArray *changes;
+	GError *error;
+};
+
+/* Runs on the database thread */
+static void get_change_seq_run(struct changes_request *request)
 {
-	guint i = 0;
-	while (mafw_db_select(privdat->stmt_object_list, FALSE) == SQLITE_ROW)
-	{
-		i++;
-	}
-	sqlite3_reset(privdat->stmt_object_list);	
-	return i;
+	sqlite3_stmt *stmt;
+
+	stmt = mafw_iradio_db_prepare_read("SELECT max(seq) FROM "
+					   IRADIO_CHANGES_TABLE);
+	if (mafw_iradio_db_select(stmt, FALSE) == SQLITE_ROW)
+		request->seq = mafw_db_column_int64(stmt, 0);
+	sqlite3_finalize(stmt);
 }
 
 /**
- * Return the asked metadatas on idle
+ * mafw_iradio_source_get_change_seq:
+ * @self: An iradio source
+ *
+ * Reads the journal on the database thread, with mafw_iradio_db_run(), so
+ * it may be called from any thread.
+ *
+ * Returns: the sequence number of the last change committed, or 0
  **/
-static gboolean get_metadata_cb(struct data_container *data)
+guint64 mafw_iradio_source_get_change_seq(MafwIradioSource *self)
 {
-	GHashTable *metadata = NULL;
-	const void *val;
-	GValue *value;
-	GByteArray *bary;
-	GError *err = NULL;
-	gint i = 0;
-	gsize b_size = 0;
-	MafwIradioSourcePrivate *priv;
-	
-	MafwSourceMetadataResultCb cb =
-				(MafwSourceMetadataResultCb)data->cb;
-	
-	priv = MAFW_IRADIO_SOURCE(data->self)->priv;
-	if (data->id == -1)
-	{
-		metadata = mafw_metadata_new();
-		if (data->metadata_keys && data->metadata_keys[i] &&
-			data->metadata_keys[i][0] != '*')
-		{
-			while(data->metadata_keys && data->metadata_keys[i])
-			{
-				if (!strcmp(data->metadata_keys[i],
-						MAFW_METADATA_KEY_MIME))
-				{
-					mafw_metadata_add_str(metadata, 
-						MAFW_METADATA_KEY_MIME,
-						MAFW_METADATA_VALUE_MIME_CONTAINER);
-				} else if (!strcmp(data->metadata_keys[i],
-						MAFW_METADATA_KEY_CHILDCOUNT_1))
-				{
-					mafw_metadata_add_int(metadata, 
-						MAFW_METADATA_KEY_CHILDCOUNT_1,
-						(gint)get_child_count(priv));
-				}
-				i++;
-			}
-		}
-		else
-		{
-			mafw_metadata_add_str(metadata, 
-						MAFW_METADATA_KEY_MIME,
-						MAFW_METADATA_VALUE_MIME_CONTAINER);
-			mafw_metadata_add_int(metadata, 
-						MAFW_METADATA_KEY_CHILDCOUNT_1,
-						(gint)get_child_count(priv));
-			
-		}
-	} else if (is_id_stored(MAFW_IRADIO_SOURCE(data->self), data->id))
-	{
-		metadata = mafw_metadata_new();
-		if (data->metadata_keys && data->metadata_keys[i] &&
-			data->metadata_keys[i][0] != '*')
-		{
-			while(data->metadata_keys && data->metadata_keys[i])
-			{
-				b_size = 0;
-				
-				mafw_db_bind_int64(priv->stmt_get_value, 0,
-								data->id);
-				mafw_db_bind_text(priv->stmt_get_value, 1,
-							data->metadata_keys[i]);
-	
-				if (mafw_db_select(priv->stmt_get_value, FALSE)
-							== SQLITE_ROW)
-				{
-					val = mafw_db_column_blob(
-						priv->stmt_get_value, 0);
-					bary = g_byte_array_new();
-					bary = g_byte_array_append(bary, val,
-						sqlite3_column_bytes(
-							priv->stmt_get_value,
-							0));
-					value = mafw_metadata_val_thaw_bary(
-							bary,
-							&b_size);
-					g_hash_table_insert(metadata,
-						g_strdup(data ->
-							  metadata_keys[i]),
-							value);
-					g_byte_array_free(bary, TRUE);
-				}
-				sqlite3_reset(priv->stmt_get_value);
-				i++;
-			}
-		}
-		else
-		{
-			const gchar *key;
-			
-			mafw_db_bind_int64(priv->stmt_get_key_value, 0,
-								data->id);
+	struct changes_request request = { 0 };
 
-			while (mafw_db_select(priv->stmt_get_key_value, FALSE)
-							== SQLITE_ROW)
-			{
-				b_size = 0;
-				key = mafw_db_column_text(priv ->
-							stmt_get_key_value, 0);
-				val = mafw_db_column_blob(priv ->
-							stmt_get_key_value, 1);
-				bary = g_byte_array_new();
-				bary = g_byte_array_append(bary, val,
-					sqlite3_column_bytes(
-						priv->stmt_get_key_value, 1));
-				value = mafw_metadata_val_thaw_bary(bary,
-						&b_size);
-				g_hash_table_insert(metadata,
-					g_strdup(key), value);
-				g_byte_array_free(bary, TRUE);
-			}
-			sqlite3_reset(priv->stmt_get_key_value);
-		}
+	g_return_val_if_fail(MAFW_IS_IRADIO_SOURCE(self), 0);
+
+	mafw_iradio_db_run(MAFW_IRADIO_DB_INTERACTIVE,
+			   (MafwIradioDbFunc)get_change_seq_run, &request);
+	return request.seq;
+}
+
+/* Runs on the database thread */
+static void get_changes_run(struct changes_request *request)
+{
+	MafwIradioChange *change;
+	sqlite3_stmt *stmt;
+	const gchar *keys;
+
+	stmt = mafw_iradio_db_prepare_read("SELECT min(seq) FROM "
+					   IRADIO_CHANGES_TABLE);
+	if (mafw_iradio_db_select(stmt, FALSE) == SQLITE_ROW &&
+	    sqlite3_column_type(stmt, 0) != SQLITE_NULL &&
+	    request->since + 1 < mafw_db_column_int64(stmt, 0))
+	{
+		sqlite3_finalize(stmt);
+		g_set_error(&request->error, MAFW_EXTENSION_ERROR,
+			    MAFW_EXTENSION_ERROR_FAILED,
+			    "Changes after %" PRIu64 " are not journaled",
+			    request->since);
+		return;
 	}
-	else
+	sqlite3_finalize(stmt);
+
+	request->changes = g_ptr_array_new_with_free_func(
+			(GDestroyNotify)mafw_iradio_change_free);
+	stmt = mafw_iradio_db_prepare_read("SELECT seq, id, op, keys FROM "
+					   IRADIO_CHANGES_TABLE
+					   " WHERE seq > :since ORDER BY seq");
+	mafw_db_bind_int64(stmt, 0, request->since);
+	while (mafw_iradio_db_select(stmt, FALSE) == SQLITE_ROW)
 	{
-		g_debug("Invalid object-id");
-		err = g_error_new(MAFW_SOURCE_ERROR,
-					MAFW_SOURCE_ERROR_INVALID_OBJECT_ID,
-					"Invalid object-id");
+		change = g_new0(MafwIradioChange, 1);
+		change->seq = mafw_db_column_int64(stmt, 0);
+		change->object_id = g_strdup_printf(
+					MAFW_IRADIO_SOURCE_UUID "::%" PRIu64,
+					mafw_db_column_int64(stmt, 1));
+		change->op = mafw_db_column_int(stmt, 2);
+		keys = mafw_db_column_text(stmt, 3);
+		if (keys)
+			change->keys = g_strsplit(keys, ",", 0);
+		g_ptr_array_add(request->changes, change);
 	}
-	cb(data->self, data->object_id, metadata, data->user_data,
-		err);
-	if (err)
-		g_error_free(err);
-	if (data->free_data_cb)
-		data->free_data_cb(data);
-	return FALSE;
+	sqlite3_finalize(stmt);
 }
 
 /**
- * Checks whether the metadata-key list contains the wildcard '*' or not
- * Return: TRUE, if the list contains '*'
+ * mafw_iradio_source_get_changes:
+ * @self: An iradio source
+ * @since: Sequence number of the last change the caller knows of
+ * @error: Return location for an error, or NULL
+ *
+ * Reads the changes committed after @since, so that a client that has
+ * browsed the objects once can keep up with them.  The journal only
+ * keeps the recent changes; if those after @since are gone, the caller
+ * has to browse again.  Like mafw_iradio_source_get_change_seq(), it may
+ * be called from any thread.
+ *
+ * Returns: a #GPtrArray of #MafwIradioChange in order, which frees them,
+ * or %NULL on error
  **/
-static gboolean metadata_keys_contain_wildcard(const gchar *const
-						*metadata_keys)
+GPtrArray *mafw_iradio_source_get_changes(MafwIradioSource *self,
+					  guint64 since, GError **error)
 {
-	gint i;
-	if (!metadata_keys || !metadata_keys[0])
-		return FALSE;
-	for (i = 0; metadata_keys[i]; i++)
-		if (metadata_keys[i][0] == '*')
-			return TRUE;
-	return FALSE;
+	struct changes_request request = { 0 };
+
+	g_return_val_if_fail(MAFW_IS_IRADIO_SOURCE(self), NULL);
+
+	request.since = since;
+	mafw_iradio_db_run(MAFW_IRADIO_DB_INTERACTIVE,
+			   (MafwIradioDbFunc)get_changes_run, &request);
+	if (request.error)
+		g_propagate_error(error, request.error);
+	return request.changes;
+}
+
+void mafw_iradio_change_free(MafwIradioChange *change)
+{
+	g_free(change->object_id);
+	g_strfreev(change->keys);
+	g_free(change);
 }
 
 /**
- * Returns the metadatas of an object
+ * Called in idle, when the object-creation is done. Calls the cb-function,
+ * and notes the change of the container
  **/
-static void get_metadata(MafwSource *self, const gchar *object_id,
-					 const gchar *const *metadata_keys,
-					 MafwSourceMetadataResultCb cb,
-					 gpointer user_data)
+static void object_creation_done(struct data_container *data)
 {
-	guint64 id;
-	struct data_container *data;
-	gboolean parse_err = FALSE;
+	g_assert(data != NULL);
 
-	g_debug("Get metadata for %s", object_id);
-	g_return_if_fail(MAFW_IS_IRADIO_SOURCE(self));
-	g_return_if_fail(object_id);
-	g_return_if_fail(g_str_has_prefix(object_id,
-					MAFW_IRADIO_SOURCE_UUID "::"));
-	g_return_if_fail(cb);
-	g_return_if_fail(metadata_keys && metadata_keys[0]);
-	
-	if (!strcmp(object_id, MAFW_IRADIO_SOURCE_UUID "::"))
-	{/* Return only a statistic */
-		id = -1;
-	}
-	else
+	if (data->cb != NULL)
 	{
-		id = get_id_from_objectid(object_id, &parse_err);
+		MafwSourceObjectCreatedCb cb = (MafwSourceObjectCreatedCb)
+								(data->cb);
+		cb(data->self, data->error? NULL: data->object_id,
+		   data->user_data, data->error);
 	}
 
-	if (parse_err)
-	{
-		GError *error = NULL;
-		g_debug("Invalid object-id");
+	if (data->error)
+		g_error_free(data->error);
+	else if (data->merged)
+		note_object_changed(MAFW_IRADIO_SOURCE(data->self),
+				    data->object_id);
+	else
+		note_container_changed(MAFW_IRADIO_SOURCE(data->self), NULL);
+	change_done(MAFW_IRADIO_SOURCE(data->self));
+	g_hash_table_unref(data->metadata);
+	free_data_container_cb(data);
+}
+
+/**
+ * Adds the new object to the DB with its metadatas, on the database thread
+ **/
+static void create_object_run(struct data_container *data)
+{
+	if (!mafw_iradio_db_begin())
+		goto create_object_err0;
+	data->id = find_duplicate(MAFW_IRADIO_SOURCE(data->self), 0,
+				  data->metadata);
+	data->merged = data->id != 0;
+	/* The id is taken in the transaction, so that it stays free */
+	if (!data->merged)
+		data->id = get_next_id(MAFW_IRADIO_SOURCE(data->self));
+	data->object_id = g_strdup_printf(MAFW_IRADIO_SOURCE_UUID "::%" PRId64,
+					  data->id);
+	/* A bookmark of the URI gets the metadata instead */
+	if (data->merged)
+		g_hash_table_foreach(data->metadata, (GHFunc)remove_all_key,
+				     data);
+	g_hash_table_foreach(data->metadata, (GHFunc)store_metadata, data);
+	if (data->error)
+		return; /* store_metadata() has rolled back */
+	if (!journal_change(MAFW_IRADIO_SOURCE(data->self), data->id,
+			    data->merged ? MAFW_IRADIO_CHANGE_UPDATED
+			    : MAFW_IRADIO_CHANGE_CREATED, data->metadata,
+			    NULL) ||
+	    !index_object(MAFW_IRADIO_SOURCE(data->self), data->id,
+			  data->metadata, NULL) ||
+	    !mafw_iradio_db_commit())
+		goto create_object_err0;
+	return;
+
+create_object_err0:
+	mafw_iradio_db_rollback();
+	g_critical("Database error");
+	g_set_error(&data->error, MAFW_EXTENSION_ERROR,
+		    MAFW_EXTENSION_ERROR_FAILED, "Database error");
+}
+
+
+/**
+ * Creates a new object, adds it to the DB with its metadatas.  If the URI is
+ * bookmarked already, the metadatas are stored over those of that object,
+ * which is returned instead.
+ **/
+static void create_object(MafwSource *self, const gchar *parent,
+				GHashTable *metadata, 
+				MafwSourceObjectCreatedCb cb,
+				gpointer user_data)
+{
+	struct data_container *create_object_data;
+	GError *error = NULL;
+	
+	g_debug("Creating object");
+	
+	g_return_if_fail(MAFW_IS_IRADIO_SOURCE(self));
+	g_return_if_fail(parent);
+	g_return_if_fail(metadata);
+	
+	/* Metadata-URI check */
+	if (!mafw_metadata_first(metadata, MAFW_METADATA_KEY_URI))
+	{
+		g_debug("URI is missing");
 		g_set_error(&error, MAFW_SOURCE_ERROR,
 				MAFW_SOURCE_ERROR_INVALID_OBJECT_ID,
-				"Invalid object-id");
-		cb(self, object_id, NULL, user_data, error);
+				"URI is missing");
+		cb(self, NULL, user_data, error);
+		g_error_free(error);
+		return;
+	}
+	
+	/* object-id check */
+	if (strcmp(parent, MAFW_IRADIO_SOURCE_UUID "::"))
+	{
+		g_debug("Parent-id can be only " MAFW_IRADIO_SOURCE_UUID
+				"::");
+		g_set_error(&error, MAFW_SOURCE_ERROR,
+				MAFW_SOURCE_ERROR_INVALID_OBJECT_ID,
+				"Parent-id can be only "
+					MAFW_IRADIO_SOURCE_UUID "::");
+		cb(self, NULL, user_data, error);
 		g_error_free(error);
 		return;
 	}
-	data = g_new0(struct data_container, 1);
+	
+	create_object_data = g_new0(struct data_container, 1);
+	create_object_data->cb = cb;
+	create_object_data->self = g_object_ref(self);
+	create_object_data->user_data = user_data;
+	create_object_data->metadata = copy_metadata(metadata);
+	invalidate_snapshot(MAFW_IRADIO_SOURCE(self));
+	change_queued(MAFW_IRADIO_SOURCE(self));
+	mafw_iradio_db_queue_write(MAFW_IRADIO_DB_INTERACTIVE,
+				   (MafwIradioDbFunc)create_object_run,
+				   (MafwIradioDbFunc)write_failed,
+				   (MafwIradioDbFunc)object_creation_done,
+				   create_object_data);
+}
+
+/*----------------------------------------------------------------------------
+  Bulk import
+  ----------------------------------------------------------------------------*/
+
+struct _MafwIradioBulkWriter {
+	MafwIradioSource *self;
+	/* Whether objects whose URI is stored are skipped, or merged */
+	gboolean check_dups;
+	guint64 next_id;
+	guint added;
+	guint removed;
+	/* Object-ids of the updated objects, for metadata-changed */
+	GPtrArray *updated;
+	gboolean in_transaction;
+	GError *error;
+};
+
+/**
+ * mafw_iradio_bulk_writer_new:
+ * @self: The iradio source to write to
+ * @check_dups: Whether to skip objects whose URI is already stored, rather
+ * than to store their metadata over that of the stored object
+ *
+ * Creates a writer that inserts many objects into @self in a single
+ * transaction and notifies them together when finished.
+ *
+ * Returns: a new writer, to be released with mafw_iradio_bulk_writer_finish()
+ **/
+MafwIradioBulkWriter *mafw_iradio_bulk_writer_new(MafwIradioSource *self,
+						  gboolean check_dups)
+{
+	MafwIradioBulkWriter *writer;
+
+	g_return_val_if_fail(MAFW_IS_IRADIO_SOURCE(self), NULL);
+
+	writer = g_new0(MafwIradioBulkWriter, 1);
+	writer->self = self;
+	writer->updated = g_ptr_array_new_with_free_func(g_free);
+	writer->check_dups = check_dups;
+
+	return writer;
+}
+
+/**
+ * mafw_iradio_bulk_writer_begin:
+ * @writer: A bulk writer
+ *
+ * Opens the transaction of @writer unless it is open already, so that the
+ * caller can store its own bookkeeping together with the objects.  The
+ * add, update and remove functions call this themselves.
+ *
+ * Returns: FALSE on database error
+ **/
+gboolean mafw_iradio_bulk_writer_begin(MafwIradioBulkWriter *writer)
+{
+	g_return_val_if_fail(writer != NULL, FALSE);
+
+	if (writer->error)
+		return FALSE;
+	if (writer->in_transaction)
+		return TRUE;
+
+	invalidate_snapshot(writer->self);
+	if (!mafw_iradio_db_begin())
+	{
+		g_critical("Database error");
+		g_set_error(&writer->error, MAFW_EXTENSION_ERROR,
+			    MAFW_EXTENSION_ERROR_FAILED, "Database error");
+		return FALSE;
+	}
+	writer->in_transaction = TRUE;
+	writer->next_id = get_next_id(writer->self);
+
+	return TRUE;
+}
+
+/**
+ * Rolls back the transaction of @writer after a database error
+ **/
+static void abort_bulk_writer(MafwIradioBulkWriter *writer)
+{
+	mafw_iradio_db_rollback();
+	writer->in_transaction = FALSE;
+	g_critical("Database error");
+	g_set_error(&writer->error, MAFW_EXTENSION_ERROR,
+		    MAFW_EXTENSION_ERROR_FAILED, "Database error");
+}
+
+/**
+ * Checks that the object @id still exists and has @uri, so that the id of a
+ * destroyed object that has been reused is not mistaken for it.
+ **/
+static gboolean is_object_uri(MafwIradioSource *self, guint64 id,
+			      const GValue *uri)
+{
+	sqlite3_stmt *stmt = self->priv->stmt_get_uri;
+	gchar *serialized_data;
+	gsize str_size = 0;
+	gboolean retval = FALSE;
+
+	serialized_data = mafw_metadata_val_freeze((gpointer)uri, &str_size);
+	mafw_db_bind_int64(stmt, 0, id);
+	if (mafw_iradio_db_select(stmt, FALSE) == SQLITE_ROW &&
+	    sqlite3_column_bytes(stmt, 0) == str_size &&
+	    memcmp(mafw_db_column_blob(stmt, 0), serialized_data,
+		   str_size) == 0)
+		retval = TRUE;
+	sqlite3_reset(stmt);
+	g_free(serialized_data);
+
+	return retval;
+}
+
+/**
+ * Stores @metadata over the object @id in the transaction of @writer, see
+ * mafw_iradio_bulk_writer_update()
+ **/
+static gboolean update_object(MafwIradioBulkWriter *writer, guint64 id,
+			      GHashTable *metadata,
+			      const gchar *const *replaced_keys)
+{
+	struct data_container data;
+
+	memset(&data, 0, sizeof(data));
+	data.self = MAFW_SOURCE(writer->self);
+	data.id = id;
+	if (replaced_keys)
+	{
+		const gchar *const *key;
+
+		for (key = replaced_keys; *key; key++)
+			remove_all_key((gchar *)*key, NULL, &data);
+	}
+	else
+		g_hash_table_foreach(metadata, (GHFunc)remove_all_key, &data);
+
+	g_hash_table_foreach(metadata, (GHFunc)store_metadata, &data);
+	if (data.error)
+	{
+		/* store_metadata() has rolled the transaction back */
+		writer->in_transaction = FALSE;
+		writer->error = data.error;
+		return FALSE;
+	}
+	if (!journal_change(writer->self, id, MAFW_IRADIO_CHANGE_UPDATED,
+			    metadata, replaced_keys) ||
+	    !index_object(writer->self, id, metadata, replaced_keys))
+	{
+		abort_bulk_writer(writer);
+		return FALSE;
+	}
+
+	g_ptr_array_add(writer->updated, g_strdup_printf(
+				MAFW_IRADIO_SOURCE_UUID "::%" PRIu64, id));
+	return TRUE;
+}
+
+/**
+ * mafw_iradio_bulk_writer_add:
+ * @writer: A bulk writer
+ * @metadata: Metadata of the new object, it must contain an URI
+ *
+ * Stores a new object.  The transaction is opened with the first object and
+ * is only committed by mafw_iradio_bulk_writer_flush() or
+ * mafw_iradio_bulk_writer_finish().  An object whose URI is stored already,
+ * in canonical form, is skipped or merged into the stored one, see
+ * mafw_iradio_bulk_writer_new().
+ *
+ * Returns: the id of the new object, or of the one it was merged into, or 0
+ * if it was skipped
+ **/
+guint64 mafw_iradio_bulk_writer_add(MafwIradioBulkWriter *writer,
+				    GHashTable *metadata)
+{
+	struct data_container data;
+	guint64 id;
+
+	g_return_val_if_fail(writer != NULL, 0);
+	g_return_val_if_fail(metadata != NULL, 0);
+
+	if (writer->error)
+		return 0;
+
+	if (!g_hash_table_lookup(metadata, MAFW_METADATA_KEY_URI))
+	{
+		g_debug("URI is missing");
+		return 0;
+	}
+
+	if (!mafw_iradio_bulk_writer_begin(writer))
+		return 0;
+
+	/* Duplicates within the imported data are in the transaction */
+	id = find_duplicate(writer->self, 0, metadata);
+	if (id && writer->check_dups)
+		return 0;
+	if (id)
+		return update_object(writer, id, metadata, NULL) ? id : 0;
+
+	memset(&data, 0, sizeof(data));
+	data.self = MAFW_SOURCE(writer->self);
+	data.id = writer->next_id;
+	g_hash_table_foreach(metadata, (GHFunc)store_metadata, &data);
+	if (data.error)
+	{
+		/* store_metadata() has rolled the transaction back */
+		writer->in_transaction = FALSE;
+		writer->error = data.error;
+		return 0;
+	}
+	if (!journal_change(writer->self, data.id, MAFW_IRADIO_CHANGE_CREATED,
+			    metadata, NULL) ||
+	    !index_object(writer->self, data.id, metadata, NULL))
+	{
+		abort_bulk_writer(writer);
+		return 0;
+	}
+
+	writer->added++;
+	return writer->next_id++;
+}
+
+/**
+ * mafw_iradio_bulk_writer_find:
+ * @writer: A bulk writer
+ * @metadata: Metadata with an URI
+ *
+ * Looks up the object stored with the URI of @metadata, in canonical form,
+ * including the objects written by @writer that are not committed yet.
+ * This is the object mafw_iradio_bulk_writer_add() skips @metadata for.
+ *
+ * Returns: the id of the object, or 0 if there is none
+ **/
+guint64 mafw_iradio_bulk_writer_find(MafwIradioBulkWriter *writer,
+				     GHashTable *metadata)
+{
+	g_return_val_if_fail(writer != NULL, 0);
+	g_return_val_if_fail(metadata != NULL, 0);
+
+	if (writer->error || !mafw_iradio_bulk_writer_begin(writer))
+		return 0;
+	return find_duplicate(writer->self, 0, metadata);
+}
+
+/**
+ * mafw_iradio_bulk_writer_update:
+ * @writer: A bulk writer
+ * @id: Id of the object to update
+ * @metadata: New metadata of the object, with the same URI
+ * @replaced_keys: NULL-terminated list of keys removed from the object
+ * before @metadata is stored, or NULL to replace only the keys in @metadata
+ *
+ * Replaces metadata of an existing object.  Objects that have been destroyed
+ * meanwhile are left alone.
+ *
+ * Returns: TRUE if the object was updated
+ **/
+gboolean mafw_iradio_bulk_writer_update(MafwIradioBulkWriter *writer,
+					guint64 id, GHashTable *metadata,
+					const gchar *const *replaced_keys)
+{
+	g_return_val_if_fail(writer != NULL, FALSE);
+	g_return_val_if_fail(metadata != NULL, FALSE);
+
+	if (!g_hash_table_lookup(metadata, MAFW_METADATA_KEY_URI))
+	{
+		g_debug("URI is missing");
+		return FALSE;
+	}
+
+	if (!mafw_iradio_bulk_writer_begin(writer))
+		return FALSE;
+	if (!is_object_uri(writer->self, id, mafw_metadata_first(
+					metadata, MAFW_METADATA_KEY_URI)))
+		return FALSE;
+
+	return update_object(writer, id, metadata, replaced_keys);
+}
+
+/**
+ * mafw_iradio_bulk_writer_remove:
+ * @writer: A bulk writer
+ * @id: Id of the object to remove
+ * @uri: URI the object is expected to have
+ *
+ * Removes an object with all its metadata.  Objects that have been
+ * destroyed meanwhile are left alone.
+ *
+ * Returns: TRUE if the object was removed
+ **/
+gboolean mafw_iradio_bulk_writer_remove(MafwIradioBulkWriter *writer,
+					guint64 id, const gchar *uri)
+{
+	MafwIradioSourcePrivate *priv;
+	GValue value = { 0, };
+	gboolean found;
+
+	g_return_val_if_fail(writer != NULL, FALSE);
+	g_return_val_if_fail(uri != NULL, FALSE);
+
+	if (!mafw_iradio_bulk_writer_begin(writer))
+		return FALSE;
+
+	g_value_init(&value, G_TYPE_STRING);
+	g_value_set_static_string(&value, uri);
+	found = is_object_uri(writer->self, id, &value);
+	g_value_unset(&value);
+	if (!found)
+		return FALSE;
+
+	priv = writer->self->priv;
+	mafw_db_bind_int64(priv->stmt_delete_object, 0, id);
+	if (mafw_iradio_db_delete(priv->stmt_delete_object) != SQLITE_DONE)
+	{
+		sqlite3_reset(priv->stmt_delete_object);
+		abort_bulk_writer(writer);
+		return FALSE;
+	}
+	sqlite3_reset(priv->stmt_delete_object);
+	if (!journal_change(writer->self, id, MAFW_IRADIO_CHANGE_DESTROYED,
+			    NULL, NULL))
+	{
+		abort_bulk_writer(writer);
+		return FALSE;
+	}
+
+	writer->removed++;
+	return TRUE;
+}
+
+/**
+ * mafw_iradio_bulk_writer_flush:
+ * @writer: A bulk writer
+ *
+ * Commits the objects added to @writer so far, without emitting any signal.
+ * The next object added opens a new transaction, so that callers importing
+ * in several main loop iterations never leave one open in between.
+ *
+ * Returns: FALSE on database error
+ **/
+gboolean mafw_iradio_bulk_writer_flush(MafwIradioBulkWriter *writer)
+{
+	g_return_val_if_fail(writer != NULL, FALSE);
+
+	if (!writer->in_transaction)
+		return writer->error == NULL;
+
+	writer->in_transaction = FALSE;
+	if (!mafw_iradio_db_commit())
+	{
+		mafw_iradio_db_rollback();
+		g_critical("Database error");
+		g_set_error(&writer->error, MAFW_EXTENSION_ERROR,
+			    MAFW_EXTENSION_ERROR_FAILED, "Database error");
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * mafw_iradio_bulk_writer_finish:
+ * @writer: A bulk writer
+ * @error: Return location for a database error, or NULL
+ *
+ * Commits the changes made through @writer, notifies them with the changes
+ * of the requests outstanding, and frees the writer.  On error nothing is
+ * stored since the last mafw_iradio_bulk_writer_flush().
+ *
+ * Returns: the number of objects stored, updated or removed
+ **/
+guint mafw_iradio_bulk_writer_finish(MafwIradioBulkWriter *writer,
+				     GError **error)
+{
+	guint changed;
+	guint i;
+
+	g_return_val_if_fail(writer != NULL, 0);
+
+	if (writer->in_transaction && !mafw_iradio_db_commit())
+	{
+		mafw_iradio_db_rollback();
+		g_critical("Database error");
+		g_set_error(&writer->error, MAFW_EXTENSION_ERROR,
+			    MAFW_EXTENSION_ERROR_FAILED, "Database error");
+	}
+
+	if (writer->error)
+	{
+		changed = 0;
+		g_propagate_error(error, writer->error);
+	}
+	else
+	{
+		changed = writer->added + writer->removed +
+			writer->updated->len;
+		for (i = 0; i < writer->updated->len; i++)
+			note_object_changed(writer->self,
+					    g_ptr_array_index(writer->updated,
+							      i));
+		if (writer->added || writer->removed)
+			note_container_changed(writer->self, NULL);
+		schedule_changes(writer->self);
+	}
+
+	g_ptr_array_free(writer->updated, TRUE);
+	g_free(writer);
+
+	return changed;
+}
+
+/**
+ * Called in idle, when the object and its metadatas are removed from the
+ * DB.  The user-given cb will be called, and the change of the container
+ * noted
+ **/
+static void destroy_object_cb(struct data_container *data)
+{
+	MafwSourceObjectDestroyedCb cb = (MafwSourceObjectDestroyedCb)data ->
+						cb;
+
+	cb(data->self, data->object_id, data->user_data, data->error);
+	if (data->error)
+		g_error_free(data->error);
+	else
+		note_container_changed(MAFW_IRADIO_SOURCE(data->self),
+				       data->object_id);
+	change_done(MAFW_IRADIO_SOURCE(data->self));
+	
+	free_data_container_cb(data);
+}
+
+/**
+ * Removes the object from the DB, on the database thread
+ **/
+static void destroy_object_run(struct data_container *data)
+{
+	gint result = SQLITE_OK;
+	MafwIradioSource *src = MAFW_IRADIO_SOURCE(data->self);
+
+	/* The statement is shared with the bulk writer */
+	if (mafw_iradio_db_begin())
+	{
+		mafw_db_bind_int64(src->priv->stmt_delete_object, 0, data->id);
+		result = mafw_iradio_db_delete(src->priv->stmt_delete_object);
+		sqlite3_reset(src->priv->stmt_delete_object);
+		if (result == SQLITE_DONE && mafw_iradio_db_nchanges() &&
+		    !journal_change(src, data->id,
+				    MAFW_IRADIO_CHANGE_DESTROYED, NULL, NULL))
+			result = SQLITE_ERROR;
+		if (result != SQLITE_DONE || !mafw_iradio_db_commit())
+		{
+			mafw_iradio_db_rollback();
+			if (result == SQLITE_DONE)
+				result = SQLITE_ERROR;
+		}
+	}
+	else
+		result = SQLITE_ERROR;
+	
+	if (result != SQLITE_DONE) {
+		g_critical("Database error: %d", result);
+		data->error = g_error_new(MAFW_EXTENSION_ERROR,
+                                             MAFW_EXTENSION_ERROR_FAILED,
+                                             "Database error: %d", result);
+	}
+}
+
+/**
+ * Destroys an object
+ **/
+static void destroy_object(MafwSource *self, const gchar *object_id,
+				MafwSourceObjectDestroyedCb cb,
+				gpointer user_data)
+{
+	guint64 id;
+	gboolean parse_err = FALSE;
+	struct data_container *cb_data;
+	GError *error = NULL;
+
+	g_debug("Destroy object");
+	g_return_if_fail(MAFW_IS_IRADIO_SOURCE(self));
+	g_return_if_fail(object_id);
+	g_return_if_fail(g_str_has_prefix(object_id,
+				MAFW_IRADIO_SOURCE_UUID "::"));
+	g_return_if_fail(cb);
+
+	id = get_id_from_objectid(object_id, &parse_err);
+	if (parse_err)
+	{
+		g_debug("Invalid object-id");
+		g_set_error(&error, MAFW_SOURCE_ERROR,
+				MAFW_SOURCE_ERROR_INVALID_OBJECT_ID,
+				"Invalid object-id");
+		cb(self, object_id, user_data, error);
+		g_error_free(error);
+		return;
+	}
+	cb_data = g_new0(struct data_container, 1);
+	cb_data->self = g_object_ref(self);
+	cb_data->id = id;
+	cb_data->cb = cb;
+	cb_data->user_data = user_data;
+	cb_data->object_id = g_strdup(object_id);
+	invalidate_snapshot(MAFW_IRADIO_SOURCE(self));
+	change_queued(MAFW_IRADIO_SOURCE(self));
+	mafw_iradio_db_queue(MAFW_IRADIO_DB_INTERACTIVE,
+			     (MafwIradioDbFunc)destroy_object_run,
+			     (MafwIradioDbFunc)destroy_object_cb, cb_data);
+	return;
+}
+
+static void get_keys_cb(gpointer key, gpointer val, GPtrArray *keylist)
+{
+	g_ptr_array_add(keylist, key);
+}
+
+static void set_metadata_error_reporter(MafwSource *self, const gchar *object_id,
+				GHashTable *metadata,
+				MafwSourceMetadataSetCb cb,
+				gpointer user_data, GQuark domain,
+				gint code, const gchar *string)
+{
+	GPtrArray *keylist = g_ptr_array_new();
+	GError *error = NULL;
+
+	g_hash_table_foreach(metadata, (GHFunc)get_keys_cb, keylist);
+	g_ptr_array_add(keylist, NULL);
+	g_set_error(&error, domain, code, "%s", string);
+	cb(self,  object_id, (const gchar **)keylist->pdata, user_data, error);
+	g_ptr_array_free(keylist, TRUE);
+	g_error_free(error);
+}
+
+/**
+ * Called on idle, after a metadata-change. Calls the user-given cb, and notes
+ * the change of the object
+ **/
+static void set_mdata_cb(struct data_container *data)
+{
+	MafwSourceMetadataSetCb cb = (MafwSourceMetadataSetCb)data->cb;
+
+	if (!data->error)
+	{
+		cb(data->self, data->object_id, NULL,
+				data->user_data, NULL);
+		note_object_changed(MAFW_IRADIO_SOURCE(data->self),
+				    data->object_id);
+	}
+	else
+	{
+		set_metadata_error_reporter(data->self, data->object_id,
+				data->metadata, cb, data->user_data,
+				data->error->domain, data->error->code,
+				data->error->message);
+		g_error_free(data->error);
+	}
+	change_done(MAFW_IRADIO_SOURCE(data->self));
+	g_hash_table_unref(data->metadata);
+	free_data_container_cb(data);
+}
+
+/**
+ * Replaces the metadata of the object in the DB, on the database thread
+ **/
+static void set_metadata_run(struct data_container *data)
+{
+	/* The object may have been created earlier in the same group */
+	if (!is_id_stored(MAFW_IRADIO_SOURCE(data->self)->priv->
+			  stmt_check_written_id, data->id))
+	{
+		g_debug("Invalid object-id");
+		g_set_error(&data->error, MAFW_SOURCE_ERROR,
+				MAFW_SOURCE_ERROR_INVALID_OBJECT_ID,
+				"Invalid object-id");
+		return;
+	}
+
+	if (!mafw_iradio_db_begin())
+		goto set_metadata_err0;
+	if (find_duplicate(MAFW_IRADIO_SOURCE(data->self), data->id,
+			   data->metadata))
+	{
+		mafw_iradio_db_rollback();
+		g_debug("URI is bookmarked already");
+		g_set_error(&data->error, MAFW_EXTENSION_ERROR,
+			    MAFW_EXTENSION_ERROR_FAILED,
+			    "URI is bookmarked already");
+		return;
+	}
+	g_hash_table_foreach(data->metadata, (GHFunc)remove_all_key, data);
+	g_hash_table_foreach(data->metadata, (GHFunc)store_metadata, data);
+	if (data->error)
+		goto set_metadata_err1;
+	if (!journal_change(MAFW_IRADIO_SOURCE(data->self), data->id,
+			    MAFW_IRADIO_CHANGE_UPDATED, data->metadata, NULL) ||
+	    !index_object(MAFW_IRADIO_SOURCE(data->self), data->id,
+			  data->metadata, NULL) ||
+	    !mafw_iradio_db_commit())
+		goto set_metadata_err0;
+	return;
+
+set_metadata_err0:
+	mafw_iradio_db_rollback();
+	g_set_error(&data->error, MAFW_EXTENSION_ERROR,
+				MAFW_EXTENSION_ERROR_FAILED,
+				"Database error");
+set_metadata_err1:
+	g_debug("Database error at set_metadata");
+}
+
+/**
+ * Updates the metadata of a given object.
+ **/
+static void set_metadata(MafwSource *self, const gchar *object_id,
+				GHashTable *metadata,
+				MafwSourceMetadataSetCb cb,
+				gpointer user_data)
+{
+	guint64 id;
+	struct data_container *data;
+	gboolean parse_err = FALSE;
+	
+	
+
+	g_debug("Set metadata for %s", object_id);
+	g_return_if_fail(MAFW_IS_IRADIO_SOURCE(self));
+	g_return_if_fail(object_id);
+	g_return_if_fail(g_str_has_prefix(object_id,
+					MAFW_IRADIO_SOURCE_UUID "::"));
+	g_return_if_fail(cb);
+	g_return_if_fail(metadata);
+
+	id = get_id_from_objectid(object_id, &parse_err);
+	if (parse_err)
+	{
+		
+		g_debug("Invalid object-id");
+		set_metadata_error_reporter(self, object_id, metadata, cb,
+				user_data, MAFW_SOURCE_ERROR,
+				MAFW_SOURCE_ERROR_INVALID_OBJECT_ID,
+				"Invalid object-id");
+		return;
+	}
+	
+	data = g_new0(struct data_container, 1);
+	data->id = id;
+	data->object_id = g_strdup(object_id);
+	data->self = g_object_ref(self);
+	data->cb = cb;
+	data->user_data = user_data;
+	data->metadata = copy_metadata(metadata);
+	
+	if (g_hash_table_lookup(metadata, MAFW_METADATA_KEY_TITLE) ||
+	    g_hash_table_lookup(metadata, MAFW_METADATA_KEY_URI) ||
+	    g_hash_table_lookup(metadata, MAFW_METADATA_KEY_MIME))
+		invalidate_snapshot(MAFW_IRADIO_SOURCE(self));
+	change_queued(MAFW_IRADIO_SOURCE(self));
+	mafw_iradio_db_queue_write(MAFW_IRADIO_DB_INTERACTIVE,
+				   (MafwIradioDbFunc)set_metadata_run,
+				   (MafwIradioDbFunc)write_failed,
+				   (MafwIradioDbFunc)set_mdata_cb, data);
+}
+
+static guint get_child_count(MafwIradioSourcePrivate *privdat)
+{
+	guint i = 0;
+
+	/* The worker reads what the requests queued before it wrote */
+	if (!mafw_iradio_db_is_worker())
+	{
+		g_mutex_lock(&privdat->lock);
+		if (privdat->snapshot)
+			i = mafw_iradio_snapshot_count(privdat->snapshot);
+		g_mutex_unlock(&privdat->lock);
+		if (i)
+			return i;
+	}
+	if (mafw_iradio_db_select(privdat->stmt_count, FALSE) == SQLITE_ROW)
+		i = mafw_db_column_int(privdat->stmt_count, 0);
+	sqlite3_reset(privdat->stmt_count);
+	return i;
+}
+
+/**
+ * Reads the asked metadatas into data->metadata, or sets data->error
+ **/
+static void read_metadata(struct data_container *data)
+{
+	GHashTable *metadata = NULL;
+	const void *val;
+	GValue *value;
+	GByteArray *bary;
+	GError *err = NULL;
+	gint i = 0;
+	gsize b_size = 0;
+	MafwIradioSourcePrivate *priv;
+	
+	priv = MAFW_IRADIO_SOURCE(data->self)->priv;
+	mafw_iradio_db_read_begin();
+	if (data->id == -1)
+	{
+		metadata = mafw_metadata_new();
+		if (data->metadata_keys && data->metadata_keys[i] &&
+			data->metadata_keys[i][0] != '*')
+		{
+			while(data->metadata_keys && data->metadata_keys[i])
+			{
+				if (!strcmp(data->metadata_keys[i],
+						MAFW_METADATA_KEY_MIME))
+				{
+					mafw_metadata_add_str(metadata, 
+						MAFW_METADATA_KEY_MIME,
+						MAFW_METADATA_VALUE_MIME_CONTAINER);
+				} else if (!strcmp(data->metadata_keys[i],
+						MAFW_METADATA_KEY_CHILDCOUNT_1))
+				{
+					mafw_metadata_add_int(metadata, 
+						MAFW_METADATA_KEY_CHILDCOUNT_1,
+						(gint)get_child_count(priv));
+				}
+				i++;
+			}
+		}
+		else
+		{
+			mafw_metadata_add_str(metadata, 
+						MAFW_METADATA_KEY_MIME,
+						MAFW_METADATA_VALUE_MIME_CONTAINER);
+			mafw_metadata_add_int(metadata, 
+						MAFW_METADATA_KEY_CHILDCOUNT_1,
+						(gint)get_child_count(priv));
+			
+		}
+	} else if (is_id_stored(priv->stmt_check_id, data->id))
+	{
+		metadata = mafw_metadata_new();
+		if (data->metadata_keys && data->metadata_keys[i] &&
+			data->metadata_keys[i][0] != '*')
+		{
+			while(data->metadata_keys && data->metadata_keys[i])
+			{
+				b_size = 0;
+				
+				mafw_db_bind_int64(priv->stmt_get_value, 0,
+								data->id);
+				mafw_db_bind_text(priv->stmt_get_value, 1,
+							data->metadata_keys[i]);
+	
+				if (mafw_iradio_db_select(priv->stmt_get_value, FALSE)
+							== SQLITE_ROW)
+				{
+					val = mafw_db_column_blob(
+						priv->stmt_get_value, 0);
+					bary = g_byte_array_new();
+					bary = g_byte_array_append(bary, val,
+						sqlite3_column_bytes(
+							priv->stmt_get_value,
+							0));
+					value = mafw_metadata_val_thaw_bary(
+							bary,
+							&b_size);
+					g_hash_table_insert(metadata,
+						g_strdup(data ->
+							  metadata_keys[i]),
+							value);
+					g_byte_array_free(bary, TRUE);
+				}
+				sqlite3_reset(priv->stmt_get_value);
+				i++;
+			}
+		}
+		else
+		{
+			const gchar *key;
+			
+			mafw_db_bind_int64(priv->stmt_get_key_value, 0,
+								data->id);
+
+			while (mafw_iradio_db_select(priv->stmt_get_key_value,
+						     FALSE) == SQLITE_ROW)
+			{
+				b_size = 0;
+				key = mafw_db_column_text(priv ->
+							stmt_get_key_value, 0);
+				val = mafw_db_column_blob(priv ->
+							stmt_get_key_value, 1);
+				bary = g_byte_array_new();
+				bary = g_byte_array_append(bary, val,
+					sqlite3_column_bytes(
+						priv->stmt_get_key_value, 1));
+				value = mafw_metadata_val_thaw_bary(bary,
+						&b_size);
+				g_hash_table_insert(metadata,
+					g_strdup(key), value);
+				g_byte_array_free(bary, TRUE);
+			}
+			sqlite3_reset(priv->stmt_get_key_value);
+		}
+	}
+	else
+	{
+		g_debug("Invalid object-id");
+		err = g_error_new(MAFW_SOURCE_ERROR,
+					MAFW_SOURCE_ERROR_INVALID_OBJECT_ID,
+					"Invalid object-id");
+	}
+	mafw_iradio_db_read_end();
+	data->metadata = metadata;
+	data->error = err;
+}
+
+/**
+ * Reads the metadata of a request on the database thread, unless it has
+ * been cancelled meanwhile
+ **/
+static void get_metadata_run(struct data_container *data)
+{
+	if (!g_cancellable_set_error_if_cancelled(data->cancellable,
+						  &data->error))
+		read_metadata(data);
+}
+
+/**
+ * Return the metadatas read on idle
+ **/
+static void get_metadata_done(struct data_container *data)
+{
+	MafwSourceMetadataResultCb cb =
+				(MafwSourceMetadataResultCb)data->cb;
+
+	/* Cancelled after the read */
+	if (!data->error && g_cancellable_set_error_if_cancelled(
+					data->cancellable, &data->error) &&
+	    data->metadata)
+	{
+		mafw_metadata_release(data->metadata);
+		data->metadata = NULL;
+	}
+	cb(data->self, data->object_id, data->metadata, data->user_data,
+		data->error);
+	data->metadata = NULL;
+	if (data->error)
+	{
+		g_error_free(data->error);
+		data->error = NULL;
+	}
+	if (data->free_data_cb)
+		data->free_data_cb(data);
+}
+
+/**
+ * Return the asked metadatas
+ **/
+static void get_metadata_cb(struct data_container *data)
+{
+	read_metadata(data);
+	get_metadata_done(data);
+}
+
+/**
+ * Checks whether the metadata-key list contains the wildcard '*' or not
+ * Return: TRUE, if the list contains '*'
+ **/
+static gboolean metadata_keys_contain_wildcard(const gchar *const
+						*metadata_keys)
+{
+	gint i;
+	if (!metadata_keys || !metadata_keys[0])
+		return FALSE;
+	for (i = 0; metadata_keys[i]; i++)
+		if (metadata_keys[i][0] == '*')
+			return TRUE;
+	return FALSE;
+}
+
+/**
+ * Returns the metadatas of an object, see
+ * mafw_iradio_source_get_metadata()
+ **/
+static void get_metadata_full(MafwSource *self, const gchar *object_id,
+			      const gchar *const *metadata_keys,
+			      GCancellable *cancellable,
+			      MafwSourceMetadataResultCb cb,
+			      gpointer user_data)
+{
+	guint64 id;
+	struct data_container *data;
+	gboolean parse_err = FALSE;
+
+	g_debug("Get metadata for %s", object_id);
+	g_return_if_fail(MAFW_IS_IRADIO_SOURCE(self));
+	g_return_if_fail(object_id);
+	g_return_if_fail(g_str_has_prefix(object_id,
+					MAFW_IRADIO_SOURCE_UUID "::"));
+	g_return_if_fail(cb);
+	g_return_if_fail(metadata_keys && metadata_keys[0]);
+	
+	if (!strcmp(object_id, MAFW_IRADIO_SOURCE_UUID "::"))
+	{/* Return only a statistic */
+		id = -1;
+	}
+	else
+	{
+		id = get_id_from_objectid(object_id, &parse_err);
+	}
+
+	if (parse_err)
+	{
+		GError *error = NULL;
+		g_debug("Invalid object-id");
+		g_set_error(&error, MAFW_SOURCE_ERROR,
+				MAFW_SOURCE_ERROR_INVALID_OBJECT_ID,
+				"Invalid object-id");
+		cb(self, object_id, NULL, user_data, error);
+		g_error_free(error);
+		return;
+	}
+	data = g_new0(struct data_container, 1);
+
+	data->object_id = g_strdup(object_id);
+	data->self = g_object_ref(self);
+	if (metadata_keys_contain_wildcard(metadata_keys))
+		data->metadata_keys = g_strdupv((gchar**)MAFW_SOURCE_ALL_KEYS);
+	else
+		data->metadata_keys = g_strdupv((gchar**)metadata_keys);
+	data->cb = cb;
+	data->user_data = user_data;
+	data->id = id;
+	data->free_data_cb = free_data_container_cb;
+	if (cancellable)
+		data->cancellable = g_object_ref(cancellable);
+
+	mafw_iradio_db_queue(MAFW_IRADIO_DB_INTERACTIVE,
+			     (MafwIradioDbFunc)get_metadata_run,
+			     (MafwIradioDbFunc)get_metadata_done, data);
+	
+	return;
+}
+
+static void get_metadata(MafwSource *self, const gchar *object_id,
+			 const gchar *const *metadata_keys,
+			 MafwSourceMetadataResultCb cb, gpointer user_data)
+{
+	get_metadata_full(self, object_id, metadata_keys, NULL, cb,
+			  user_data);
+}
+
+/**
+ * mafw_iradio_source_get_metadata:
+ * @self: An iradio source
+ * @object_id: The object to read
+ * @metadata_keys: Keys to read, or %MAFW_SOURCE_ALL_KEYS
+ * @cancellable: A #GCancellable, or NULL
+ * @cb: Called with the metadata
+ * @user_data: Passed to @cb
+ *
+ * Like mafw_source_get_metadata(), but the request can be cancelled.  A
+ * request cancelled before its callback gets G_IO_ERROR_CANCELLED and no
+ * metadata, and it is not read from the database if it has not been yet.
+ **/
+void mafw_iradio_source_get_metadata(MafwIradioSource *self,
+				     const gchar *object_id,
+				     const gchar *const *metadata_keys,
+				     GCancellable *cancellable,
+				     MafwSourceMetadataResultCb cb,
+				     gpointer user_data)
+{
+	get_metadata_full(MAFW_SOURCE(self), object_id, metadata_keys,
+			  cancellable, cb, user_data);
+}
+
+struct browse_data_container {
+	MafwSource *self;
+	MafwSourceBrowseResultCb cb;
+	guint skip_count;
+	guint item_count;
+	gpointer user_data;
+	guint64 current_id;
+	gchar **metadata_keys;
+	guint next_index;
+	gchar **sorting_terms;
+	const gchar **relevant_metadata_keys;
+	MafwFilter *filter;
+	/* Keys read by the scan of the database */
+	gchar **scan_keys;
+	GList *object_list;
+	guint bid;
+	/* Main context of the caller, and the source emitting the results
+	   there, which owns the request */
+	GMainContext *context;
+	GSource *emitter;
+	/* Set by cancel_browse(), the scan stops at the next object */
+	volatile gint cancelled;
+	/* A mafw_iradio_source_count() request, and what it counted */
+	gboolean count_only;
+	guint matches;
+};
+
+struct metadata_data {
+	GHashTable *metadata;
+	guint64 id;
+};
+
+/**
+ * Removes the specified pointer from the list, and releases that data with
+ * its content
+ **/
+static GList *browse_result_free_list_item(GList *list,
+					struct metadata_data *data)
+{
+	GList *new_list;
+	mafw_metadata_release(data->metadata);
+	new_list = g_list_remove(list, data);
+	g_free(data);
+	return new_list;
+}
+
+/**
+ * Frees the given structure with its content
+ **/
+static void free_browse_data(struct browse_data_container *browse_data)
+{
+	if (browse_data->sorting_terms)
+		g_strfreev(browse_data->sorting_terms);
+	if (browse_data->relevant_metadata_keys)
+		g_free(browse_data->relevant_metadata_keys);
+	if (browse_data->filter)
+		mafw_filter_free(browse_data->filter);
+	g_strfreev(browse_data->scan_keys);
+	if (browse_data->metadata_keys)
+		g_strfreev(browse_data->metadata_keys);
+	while (browse_data->object_list)
+	{
+		browse_data->object_list = browse_result_free_list_item(
+				browse_data->object_list,
+				browse_data->object_list->data);
+	}
+
+	g_free(browse_data);
+}
+
+/** 
+ * Removes a browse request from the stored list, and frees it
+ **/
+static void end_browse_request(struct browse_data_container *browse_data)
+{
+	MafwIradioSource *src = MAFW_IRADIO_SOURCE(browse_data->self);
+
+	g_mutex_lock(&src->priv->lock);
+	/* cancel_browse() has removed it already */
+	if (!browse_data->cancelled)
+		g_hash_table_remove(src->priv->browse_requests,
+				    GUINT_TO_POINTER(browse_data->bid));
+	g_mutex_unlock(&src->priv->lock);
+	g_main_context_unref(browse_data->context);
+	free_browse_data(browse_data);
+	g_object_unref(src);
+}
+
+/**
+ * Helper function to sort the items according to the sorting terms
+ **/
+static gint sort_metadata_cb(struct metadata_data *a, struct metadata_data *b,
+				const gchar **sorting_terms)
+{
+	return mafw_metadata_compare(a->metadata, b->metadata, sorting_terms,
+					NULL);
+}
+
+/**
+ * If the result-list was not sorted, and filtered according to the skip and
+ * item count, it does this preparation. After this, it calls the cb function
+ * with the results, one by one.  The request is freed when it returns FALSE.
+ **/
+static gboolean emit_browse_res(struct browse_data_container *browse_data)
+{
+	gchar *current_object_id = NULL;
+	struct metadata_data *current_data = NULL;
+	GHashTable *current_metadata = NULL;
+	/* MafwIradioSourcePrivate *privdat; */
+	
+	if (browse_data->cancelled)
+		return FALSE;
+
+	if (browse_data->count_only)
+	{
+		browse_data->cb(browse_data->self, browse_data->bid,
+				browse_data->matches > browse_data->skip_count
+				? browse_data->matches - browse_data->skip_count
+				: 0, 0, NULL, NULL, browse_data->user_data,
+				NULL);
+		return FALSE;
+	}
+	
+	if (browse_data->sorting_terms)
+	{/* Sort the filtered results at first */
+		browse_data->object_list = g_list_sort_with_data(
+					browse_data->object_list,
+					(GCompareDataFunc)sort_metadata_cb,
+					browse_data->sorting_terms);
+		g_strfreev(browse_data->sorting_terms);
+		browse_data->sorting_terms = NULL;
+		
+		
+	}
+	
+	if (browse_data->skip_count)
+	{
+		if (browse_data->skip_count >= g_list_length(
+						browse_data->object_list))
+		{/* list is not so long...... error */
+			GError *err;
+			g_debug("Skip count filtered all the results");
+			err = g_error_new (MAFW_SOURCE_ERROR,
+					MAFW_SOURCE_ERROR_BROWSE_RESULT_FAILED,
+					"Skip count filtered all the results");
+			
+			browse_data->cb(browse_data->self, browse_data->bid, 0,
+					0, NULL, NULL,
+					browse_data->user_data, err);
+			g_error_free(err);
+			
+			return FALSE;
+		}
+		/* remove not-needed items, according to item_count and
+			skip_count */
+		while (browse_data->skip_count && browse_data->object_list)
+		{
+			browse_data->object_list = browse_result_free_list_item(
+						browse_data->object_list,
+						browse_data->object_list->data);
+			browse_data->skip_count--;
+		}
+	}
+	
+	if (browse_data->item_count &&
+		(g_list_length(browse_data->object_list) >
+				browse_data->item_count))
+	{
+		GList *last_item = g_list_nth(browse_data->object_list, 
+						browse_data->item_count-1);
+		while (last_item->next)
+			browse_data->object_list = browse_result_free_list_item(
+						browse_data->object_list,
+						last_item->next->data);
+		browse_data->item_count = 0;
+	}
+	
+	/* privdat = MAFW_IRADIO_SOURCE(browse_data->self)->priv; */
+	if (browse_data->object_list)
+	{
+		current_data = browse_data->object_list->data;
+	
+		current_object_id = g_strdup_printf(MAFW_IRADIO_SOURCE_UUID
+						"::%" PRId64,
+						current_data->id);
+	
+		if (!browse_data->metadata_keys ||
+						!browse_data->metadata_keys[0])
+		{
+			current_metadata = NULL;
+		}
+		else if (browse_data->metadata_keys[0][0] == '*')
+		{
+			current_metadata = current_data->metadata;
+		}
+		else
+		{/* Filter the metadata */
+			gint i;
+			gpointer metadata_value;
+			current_metadata = g_hash_table_new_full(g_str_hash,
+								g_str_equal,
+								NULL, NULL);
+			for (i=0; browse_data->metadata_keys[i]; i++)
+			{
+				metadata_value = g_hash_table_lookup(
+							current_data->metadata, 
+							browse_data->
+							metadata_keys[i]);
+				if (metadata_value)
+					g_hash_table_insert(current_metadata,
+							(gpointer)browse_data->
+							    metadata_keys[i],
+							metadata_value);
+			}
+			if (g_hash_table_size(current_metadata) ==0)
+			{
+				g_hash_table_destroy(current_metadata);
+				current_metadata = NULL;
+			}
+		}
+	}
+	
+	browse_data->cb(browse_data->self, browse_data->bid,
+			browse_data->object_list?
+				g_list_length(browse_data->object_list)-1:
+						0,
+			browse_data->next_index, current_object_id,
+			current_metadata,
+			browse_data->user_data, NULL);
+	if (current_metadata && current_metadata != current_data->metadata)
+		g_hash_table_destroy(current_metadata);
+	g_free(current_object_id);
+	browse_data->next_index++;
+	
+	if (browse_data->object_list)
+		browse_data->object_list = browse_result_free_list_item(
+							browse_data->
+								object_list,
+							current_data);
+
+	/* Cancelled from the callback */
+	if (browse_data->cancelled)
+		return FALSE;
+
+	return browse_data->object_list != NULL;
+}
+
+/**
+ * Get-metadata-cb, to process the metadata results, and create the
+ * browse-result list. It filters the result, according to the given filter
+ * criteria, and adds the result to a list. Filtering according to the item
+ * count, and skip count, and the sorting is not done here.  A count browse
+ * only counts the results.
+ **/
+static void browse_metadata_cb(MafwSource *self, const gchar *object_id,
+				GHashTable *metadata,
+				struct browse_data_container *browse_data,
+				const GError *error)
+{
+	if (browse_data->count_only)
+	{
+		if (!metadata || !browse_data->filter ||
+		    mafw_metadata_filter(metadata, browse_data->filter, NULL))
+			browse_data->matches++;
+		if (metadata)
+			mafw_metadata_release(metadata);
+	}
+	else if (!metadata || !browse_data->filter ||
+		mafw_metadata_filter(metadata, browse_data->filter,NULL))
+	{ /* Filter passed.... */
+		struct metadata_data *new_metadata = g_new0(
+						struct metadata_data, 1);
+		
+		new_metadata->metadata = metadata;
+		new_metadata->id = browse_data->current_id;
+		browse_data->object_list = g_list_prepend(
+						browse_data->object_list,
+					new_metadata);
+	}
+	else
+	{
+		mafw_metadata_release(metadata);
+	}
+	
+}
+
+/**
+ * Collects the browse results from the snapshot rather than the database,
+ * if it has all the keys the browse needs.  A "+title" sort is taken from
+ * the snapshot as well.
+ *
+ * Returns: FALSE if the database has to be read
+ **/
+static gboolean browse_snapshot(MafwIradioSourcePrivate *privdat,
+				struct browse_data_container *browse_data,
+				const gchar *const *keys)
+{
+	MafwIradioSnapshotEntry entry;
+	gboolean by_title = FALSE;
+	guint i, j, count;
+
+	if (!privdat->snapshot)
+		return FALSE;
+	for (i = 0; keys && keys[i]; i++)
+		if (!mafw_iradio_snapshot_has_key(keys[i]))
+			return FALSE;
+
+	if (browse_data->sorting_terms && browse_data->sorting_terms[0] &&
+	    !browse_data->sorting_terms[1] &&
+	    !strcmp(browse_data->sorting_terms[0],
+		    "+" MAFW_METADATA_KEY_TITLE))
+	{
+		by_title = TRUE;
+		g_strfreev(browse_data->sorting_terms);
+		browse_data->sorting_terms = NULL;
+	}
+
+	count = mafw_iradio_snapshot_count(privdat->snapshot);
+	for (i = 0; i < count; i++)
+	{
+		GHashTable *metadata = NULL;
+
+		/* Results are prepended, so the title order is walked
+		   backwards */
+		mafw_iradio_snapshot_get(privdat->snapshot,
+					 by_title ? count - 1 - i : i,
+					 by_title, &entry);
+		if (keys)
+		{
+			metadata = mafw_metadata_new();
+			for (j = 0; keys[j]; j++)
+			{
+				const gchar *value = NULL;
+
+				if (!strcmp(keys[j], MAFW_METADATA_KEY_TITLE))
+					value = entry.title;
+				else if (!strcmp(keys[j],
+						 MAFW_METADATA_KEY_URI))
+					value = entry.uri;
+				else
+					value = entry.mime;
+				if (value)
+					mafw_metadata_add_str(metadata,
+							       keys[j],
+							       value);
+			}
+		}
+		browse_data->current_id = entry.id;
+		browse_metadata_cb(NULL, NULL, metadata, browse_data, NULL);
+	}
+
+	return TRUE;
+}
+
+/**
+ * Collects the browse results from the database, on the database thread
+ **/
+static void browse_scan(struct browse_data_container *browse_data)
+{
+	MafwIradioSourcePrivate *privdat;
+	struct data_container current_data;
+
+	privdat = MAFW_IRADIO_SOURCE(browse_data->self)->priv;
+
+	/* This will filter the results */
+	memset(&current_data, 0, sizeof current_data);
+	current_data.cb = browse_metadata_cb;
+	current_data.self = browse_data->self;
+	current_data.user_data = browse_data;
+	current_data.metadata_keys = browse_data->scan_keys;
+
+	/* Cancelled while it was queued */
+	if (g_atomic_int_get(&browse_data->cancelled))
+		return;
+
+	mafw_iradio_db_read_begin();
+	while (!g_atomic_int_get(&browse_data->cancelled) &&
+	       mafw_iradio_db_select(privdat->stmt_object_list, FALSE)
+							== SQLITE_ROW)
+	{
+		current_data.id = browse_data->current_id =
+				mafw_db_column_int64(privdat->
+						stmt_object_list,
+						0);
+		if (current_data.metadata_keys)
+			get_metadata_cb(&current_data);
+		else
+		{
+			browse_metadata_cb(NULL, NULL, NULL,
+					   browse_data, NULL);
+		}
+	}
+	sqlite3_reset(privdat->stmt_object_list);
+	mafw_iradio_db_read_end();
 
-	data->object_id = g_strdup(object_id);
-	data->self = self;
-	if (metadata_keys_contain_wildcard(metadata_keys))
-		data->metadata_keys = g_strdupv((gchar**)MAFW_SOURCE_ALL_KEYS);
+	/* Nobody will read what was collected */
+	if (g_atomic_int_get(&browse_data->cancelled))
+	{
+		while (browse_data->object_list)
+			browse_data->object_list =
+				browse_result_free_list_item(
+					browse_data->object_list,
+					browse_data->object_list->data);
+	}
+}
+
+/**
+ * Returns TRUE if the objects matching @filter can be counted in an index,
+ * see browse_count()
+ **/
+static gboolean counted_in_index(const MafwFilter *filter)
+{
+	if (!filter)
+		return TRUE;
+	if (filter->type == mafw_f_exists)
+		return TRUE;
+	/* Objects with no title have an empty one in the index */
+	return filter->type == mafw_f_eq &&
+		!strcmp(filter->key, MAFW_METADATA_KEY_TITLE) &&
+		filter->value[0];
+}
+
+/**
+ * Counts the objects a mafw_iradio_source_count() request matches, on
+ * the database thread.  Filters counted_in_index() can not answer are
+ * evaluated on the metadata of each object.
+ **/
+static void browse_count(struct browse_data_container *browse_data)
+{
+	MafwIradioSourcePrivate *privdat;
+	const MafwFilter *filter = browse_data->filter;
+	sqlite3_stmt *stmt;
+
+	if (!counted_in_index(filter))
+	{
+		browse_scan(browse_data);
+		return;
+	}
+	if (g_atomic_int_get(&browse_data->cancelled))
+		return;
+
+	privdat = MAFW_IRADIO_SOURCE(browse_data->self)->priv;
+	if (!filter)
+		stmt = privdat->stmt_count;
+	else if (filter->type == mafw_f_exists)
+	{
+		stmt = privdat->stmt_count_key;
+		mafw_db_bind_text(stmt, 0, filter->key);
+	}
 	else
-		data->metadata_keys = g_strdupv((gchar**)metadata_keys);
-	data->cb = cb;
-	data->user_data = user_data;
-	data->id = id;
-	data->free_data_cb = free_data_container_cb;
+	{
+		stmt = privdat->stmt_count_title;
+		mafw_db_bind_text(stmt, 0, filter->value);
+	}
+	mafw_iradio_db_read_begin();
+	if (mafw_iradio_db_select(stmt, FALSE) == SQLITE_ROW)
+		browse_data->matches = mafw_db_column_int(stmt, 0);
+	sqlite3_reset(stmt);
+	mafw_iradio_db_read_end();
+}
+
+/**
+ * Starts returning the results in the main context of the caller, unless
+ * the browse was cancelled meanwhile
+ **/
+static void browse_scan_done(struct browse_data_container *browse_data)
+{
+	MafwIradioSourcePrivate *privdat;
+
+	privdat = MAFW_IRADIO_SOURCE(browse_data->self)->priv;
+	mafw_filter_free(browse_data->filter);
+	browse_data->filter = NULL;
+	g_strfreev(browse_data->scan_keys);
+	browse_data->scan_keys = NULL;
+
+	g_mutex_lock(&privdat->lock);
+	if (browse_data->cancelled)
+	{
+		g_mutex_unlock(&privdat->lock);
+		end_browse_request(browse_data);
+		return;
+	}
+	browse_data->emitter = g_idle_source_new();
+	g_source_set_callback(browse_data->emitter,
+			      (GSourceFunc)emit_browse_res, browse_data,
+			      (GDestroyNotify)end_browse_request);
+	g_source_attach(browse_data->emitter, browse_data->context);
+	g_source_unref(browse_data->emitter);
+	g_mutex_unlock(&privdat->lock);
+}
 
-	g_idle_add((GSourceFunc)get_metadata_cb, data);
+/**
+ * Starts a browse, or if @count_only, a count of the objects the browse
+ * would find.
+ **/
+static guint start_browse(MafwSource *self, const gchar *object_id,
+			  gboolean recursive, const MafwFilter *filter,
+			  const gchar *sort_criteria,
+			  const gchar *const *metadata_keys,
+			  guint skip_count, guint item_count,
+			  gboolean count_only,
+			  MafwSourceBrowseResultCb cb, gpointer user_data)
+{
+	struct browse_data_container *browse_data;
+	MafwIradioSourcePrivate *privdat;
+	gboolean from_snapshot;
+	gchar **keys;
+	guint bid;
 	
-	return;
+	g_debug("Browsing %s. Recursive: %d, Filter: %s, Sort criteria: %s,"
+		"Skip: %u, Item count: %u", object_id, recursive,
+		filter != NULL ? "yes" : "no", sort_criteria, skip_count,
+		item_count);
+	
+	g_return_val_if_fail(object_id != NULL, MAFW_SOURCE_INVALID_BROWSE_ID);
+	g_return_val_if_fail(cb != NULL, MAFW_SOURCE_INVALID_BROWSE_ID);
+	g_return_val_if_fail(strcmp(object_id, MAFW_IRADIO_SOURCE_UUID "::")
+					== 0, MAFW_SOURCE_INVALID_BROWSE_ID);
+	
+	privdat = MAFW_IRADIO_SOURCE(self)->priv;
+	
+	browse_data = g_new0(struct browse_data_container, 1);
+	
+	browse_data->filter = mafw_filter_copy(filter);
+	
+	/* A count needs only the keys of the filter */
+	browse_data->count_only = count_only;
+	if (browse_data->count_only)
+		metadata_keys = MAFW_SOURCE_NO_KEYS;
+	else
+		browse_data->sorting_terms =
+				mafw_metadata_sorting_terms(sort_criteria);
+	keys = (gchar**)mafw_metadata_relevant_keys(
+				metadata_keys,
+				browse_data->filter, 
+				(const gchar *const *)browse_data->
+								sorting_terms);
+	if (metadata_keys_contain_wildcard((const gchar**)keys))
+	{
+		g_free(keys);
+		keys = g_strdupv((gchar**)MAFW_SOURCE_ALL_KEYS);
+	}
+	else if (keys)
+	{
+		gchar **temp = keys;
+		keys = g_strdupv(temp);
+		g_free(temp);
+	}
+	browse_data->scan_keys = keys;
+	
+	browse_data->self = g_object_ref(self);
+	browse_data->context = g_main_context_ref_thread_default();
+	browse_data->cb = cb;
+	browse_data->user_data = user_data;
+	browse_data->skip_count = skip_count;
+	browse_data->item_count = item_count;
+	if (metadata_keys)
+	{
+		if (metadata_keys_contain_wildcard(metadata_keys))
+			browse_data->metadata_keys = g_strdupv(
+						(gchar**)MAFW_SOURCE_ALL_KEYS);
+		else
+			browse_data->metadata_keys = g_strdupv(
+							(gchar**)metadata_keys);
+		
+	}
+	else
+	{
+		browse_data->metadata_keys = g_strdupv(
+						(gchar**)MAFW_SOURCE_NO_KEYS);
+		
+	}
+			
+	g_mutex_lock(&privdat->lock);
+	bid = ++privdat->last_browse_id;
+	browse_data->bid = bid;
+	g_debug("New browse-id: %u", bid);
+	g_hash_table_insert(privdat->browse_requests,
+			    GUINT_TO_POINTER(bid), browse_data);
+	if (browse_data->count_only && !filter && privdat->snapshot)
+	{
+		browse_data->matches = mafw_iradio_snapshot_count(
+							privdat->snapshot);
+		from_snapshot = TRUE;
+	}
+	else
+		from_snapshot = browse_snapshot(privdat, browse_data,
+						(const gchar *const *)
+						browse_data->scan_keys);
+	g_mutex_unlock(&privdat->lock);
+
+	/* It may be over by the time these return */
+	if (from_snapshot)
+		browse_scan_done(browse_data);
+	else if (!browse_data->count_only)
+		mafw_iradio_db_queue(MAFW_IRADIO_DB_BULK,
+				     (MafwIradioDbFunc)browse_scan,
+				     (MafwIradioDbFunc)browse_scan_done,
+				     browse_data);
+	else
+		/* One query, unless the filter has to be evaluated */
+		mafw_iradio_db_queue(counted_in_index(filter)
+				     ? MAFW_IRADIO_DB_INTERACTIVE
+				     : MAFW_IRADIO_DB_BULK,
+				     (MafwIradioDbFunc)browse_count,
+				     (MafwIradioDbFunc)browse_scan_done,
+				     browse_data);
+	
+	return bid;
 }
 
-struct browse_data_container {
-	MafwSource *self;
-	MafwSourceBrowseResultCb cb;
-	guint skip_count;
-	guint item_count;
-	gpointer user_data;
-	guint64 current_id;
+static guint browse(MafwSource *self, const gchar *object_id,
+			gboolean recursive, const MafwFilter *filter,
+			const gchar *sort_criteria,
+			const gchar *const *metadata_keys,
+			guint skip_count, guint item_count,
+			MafwSourceBrowseResultCb cb, gpointer user_data)
+{
+	return start_browse(self, object_id, recursive, filter,
+			    sort_criteria, metadata_keys, skip_count,
+			    item_count, FALSE, cb, user_data);
+}
+
+/**
+ * mafw_iradio_source_count:
+ * @self: An iradio source
+ * @filter: Filter of the objects to count, or %NULL
+ * @skip_count: Number of matches not to count
+ * @cb: Called once, with a %NULL object-id and the number of matches
+ * after @skip_count as the remaining count
+ * @user_data: Passed to @cb
+ *
+ * Counts the objects a browse of the root container with @filter would
+ * find.  Without a filter, or with an exists filter or an equality filter
+ * on the title, they are counted in an index without reading any
+ * metadata.  The count may be cancelled like a browse.
+ *
+ * Returns: the browse id of the count
+ **/
+guint mafw_iradio_source_count(MafwIradioSource *self,
+			       const MafwFilter *filter, guint skip_count,
+			       MafwSourceBrowseResultCb cb,
+			       gpointer user_data)
+{
+	g_return_val_if_fail(MAFW_IS_IRADIO_SOURCE(self),
+			     MAFW_SOURCE_INVALID_BROWSE_ID);
+
+	return start_browse(MAFW_SOURCE(self), MAFW_IRADIO_SOURCE_UUID "::",
+			    FALSE, filter, NULL, MAFW_SOURCE_NO_KEYS,
+			    skip_count, MAFW_SOURCE_BROWSE_ALL, TRUE, cb,
+			    user_data);
+}
+
+static gboolean cancel_browse(MafwSource *self, guint browse_id,
+				GError **error)
+{
+	MafwIradioSourcePrivate *privdat;
+	struct browse_data_container *found_item;
+	GSource *emitter = NULL;
+
+	g_debug("Canceling browse: %u", browse_id);
+
+	privdat = MAFW_IRADIO_SOURCE(self)->priv;
+	
+	g_mutex_lock(&privdat->lock);
+	found_item = g_hash_table_lookup(privdat->browse_requests,
+					 GUINT_TO_POINTER(browse_id));
+	if (found_item)
+	{
+		g_atomic_int_set(&found_item->cancelled, TRUE);
+		g_hash_table_remove(privdat->browse_requests,
+				    GUINT_TO_POINTER(browse_id));
+		if (found_item->emitter)
+			emitter = g_source_ref(found_item->emitter);
+	}
+	g_mutex_unlock(&privdat->lock);
+	if (!found_item)
+	{
+		g_debug("Browse id %u does not exist", browse_id);
+		g_set_error(error, MAFW_SOURCE_ERROR,
+				MAFW_SOURCE_ERROR_INVALID_BROWSE_ID,
+				"Browse id %u does not exist", browse_id);
+        
+		return FALSE;
+	}
+
+	/* A running scan frees it when it is done, the emitter once it is
+	   destroyed, which waits for a running result callback */
+	if (emitter)
+	{
+		g_source_destroy(emitter);
+		g_source_unref(emitter);
+	}
+	
+	return TRUE;
+}
+
+/*----------------------------------------------------------------------------
+  Paged browse
+  ----------------------------------------------------------------------------*/
+
+struct page_request {
+	MafwIradioSource *self;
+	MafwIradioBrowseOrder order;
+	/* The last object of the previous page, in @order */
+	gint64 after_id;
+	gchar *after_title;
+	guint count;
 	gchar **metadata_keys;
-	guint next_index;
-	gchar **sorting_terms;
-	const gchar **relevant_metadata_keys;
-	MafwFilter *filter;
-	GList *object_list;
-	guint bid;
-	guint sid;
-	gboolean free_req;
+	MafwIradioSourcePageCb cb;
+	gpointer user_data;
+	GPtrArray *object_ids;
+	GPtrArray *metadata;
+	gchar *next_cursor;
 };
 
-struct metadata_data {
-	GHashTable *metadata;
-	guint64 id;
-};
+/**
+ * Makes the opaque cursor of the page after object @id, which has @title.
+ **/
+static gchar *encode_cursor(MafwIradioBrowseOrder order, guint64 id,
+			    const gchar *title)
+{
+	gchar *plain, *cursor;
+
+	if (order == MAFW_IRADIO_BROWSE_BY_TITLE)
+		plain = g_strdup_printf("t%" PRIu64 "\n%s", id, title);
+	else
+		plain = g_strdup_printf("i%" PRIu64, id);
+	cursor = g_base64_encode((const guchar *)plain, strlen(plain));
+	g_free(plain);
+	return cursor;
+}
+
+/**
+ * Reads where the page after @cursor starts into @request.
+ *
+ * Returns: FALSE if @cursor is not one of the order of @request
+ **/
+static gboolean decode_cursor(struct page_request *request,
+			      const gchar *cursor)
+{
+	gchar *plain, *end;
+	gsize length;
+	gboolean valid;
+
+	plain = (gchar *)g_base64_decode(cursor, &length);
+	plain = g_realloc(plain, length + 1);
+	plain[length] = '\0';
+
+	valid = length > 1 && g_ascii_isdigit(plain[1]) &&
+		plain[0] == (request->order == MAFW_IRADIO_BROWSE_BY_TITLE
+			     ? 't' : 'i');
+	if (valid)
+	{
+		request->after_id = g_ascii_strtoll(plain + 1, &end, 10);
+		if (request->order == MAFW_IRADIO_BROWSE_BY_TITLE)
+		{
+			valid = *end == '\n' &&
+				g_utf8_validate(end + 1, -1, NULL);
+			if (valid)
+			{
+				g_free(request->after_title);
+				request->after_title = g_strdup(end + 1);
+			}
+		}
+		else
+			valid = *end == '\0';
+	}
+	g_free(plain);
+	return valid;
+}
+
+static void free_metadata(GHashTable *metadata)
+{
+	if (metadata)
+		mafw_metadata_release(metadata);
+}
+
+/**
+ * Seeks to the end of the previous page in the index of the order, and
+ * reads the page from there, on the database thread
+ **/
+static void browse_page_run(struct page_request *request)
+{
+	MafwIradioSourcePrivate *priv = request->self->priv;
+	struct data_container data;
+	sqlite3_stmt *stmt;
+	guint64 id, last_id = 0;
+	gchar *last_title = NULL;
+
+	if (request->order == MAFW_IRADIO_BROWSE_BY_TITLE)
+	{
+		stmt = priv->stmt_page_by_title;
+		mafw_db_bind_text(stmt, 0, request->after_title);
+		mafw_db_bind_int64(stmt, 1, request->after_id);
+		mafw_db_bind_int(stmt, 2, request->count + 1);
+	}
+	else
+	{
+		stmt = priv->stmt_page_by_id;
+		mafw_db_bind_int64(stmt, 0, request->after_id);
+		mafw_db_bind_int(stmt, 1, request->count + 1);
+	}
+
+	memset(&data, 0, sizeof(data));
+	data.self = MAFW_SOURCE(request->self);
+	data.metadata_keys = request->metadata_keys;
+
+	/* The page and its metadata come from the same commit */
+	mafw_iradio_db_read_begin();
+	while (mafw_iradio_db_select(stmt, FALSE) == SQLITE_ROW)
+	{
+		if (request->object_ids->len == request->count)
+		{
+			request->next_cursor = encode_cursor(request->order,
+							     last_id,
+							     last_title);
+			break;
+		}
+		id = mafw_db_column_int64(stmt, 0);
+		last_id = id;
+		if (request->order == MAFW_IRADIO_BROWSE_BY_TITLE)
+		{
+			g_free(last_title);
+			last_title = g_strdup(mafw_db_column_text(stmt, 1));
+		}
+
+		g_ptr_array_add(request->object_ids, g_strdup_printf(
+					MAFW_IRADIO_SOURCE_UUID "::%" PRIu64,
+					id));
+		data.id = id;
+		data.metadata = NULL;
+		if (data.metadata_keys)
+			read_metadata(&data);
+		g_clear_error(&data.error);
+		g_ptr_array_add(request->metadata, data.metadata);
+	}
+	sqlite3_reset(stmt);
+	mafw_iradio_db_read_end();
+	g_free(last_title);
+}
 
-/**
- * Removes the specified pointer from the list, and releases that data with
- * its content
- **/
-static GList *browse_result_free_list_item(GList *list,
-					struct metadata_data *data)
+static void browse_page_done(struct page_request *request)
 {
-	GList *new_list;
-	mafw_metadata_release(data->metadata);
-	new_list = g_list_remove(list, data);
-	g_free(data);
-	return new_list;
+	request->cb(request->self, request->object_ids, request->metadata,
+		    request->next_cursor, request->user_data, NULL);
+
+	g_ptr_array_free(request->object_ids, TRUE);
+	g_ptr_array_free(request->metadata, TRUE);
+	g_free(request->next_cursor);
+	g_free(request->after_title);
+	g_strfreev(request->metadata_keys);
+	g_object_unref(request->self);
+	g_free(request);
 }
 
 /**
- * Frees the given structure with its content
+ * mafw_iradio_source_browse_page:
+ * @self: An iradio source
+ * @order: Order of the objects
+ * @cursor: Where the page starts, as passed to the callback of the
+ * previous page, or %NULL for the first page
+ * @count: Objects per page at most
+ * @metadata_keys: Metadata to read of each object, or %NULL for none
+ * @cb: Called with the page
+ * @user_data: Passed to @cb
+ *
+ * Reads a page of the objects.  Unlike the skip and count of browse, the
+ * cursor holds where the previous page ended in @order, and the page is
+ * read from there in an index.  Later pages cost as little as the first,
+ * and objects created or destroyed meanwhile do not shift the pages.  A
+ * cursor that is not valid for @order is reported to @cb, right away,
+ * with %NULL arrays.
  **/
-static void free_browse_data(struct browse_data_container *browse_data)
+void mafw_iradio_source_browse_page(MafwIradioSource *self,
+				    MafwIradioBrowseOrder order,
+				    const gchar *cursor, guint count,
+				    const gchar *const *metadata_keys,
+				    MafwIradioSourcePageCb cb,
+				    gpointer user_data)
 {
-	if (browse_data->sorting_terms)
-		g_strfreev(browse_data->sorting_terms);
-	if (browse_data->relevant_metadata_keys)
-		g_free(browse_data->relevant_metadata_keys);
-	if (browse_data->filter)
-		mafw_filter_free(browse_data->filter);
-	if (browse_data->metadata_keys)
-		g_strfreev(browse_data->metadata_keys);
-	while (browse_data->object_list)
+	struct page_request *request;
+	GError *error = NULL;
+
+	g_return_if_fail(MAFW_IS_IRADIO_SOURCE(self));
+	g_return_if_fail(count > 0);
+	g_return_if_fail(cb != NULL);
+
+	request = g_new0(struct page_request, 1);
+	request->order = order;
+	request->after_id = -1;
+	request->after_title = g_strdup("");
+	if (cursor && !decode_cursor(request, cursor))
 	{
-		browse_data->object_list = browse_result_free_list_item(
-				browse_data->object_list,
-				browse_data->object_list->data);
+		g_debug("Invalid cursor");
+		g_set_error(&error, MAFW_SOURCE_ERROR,
+			    MAFW_SOURCE_ERROR_BROWSE_RESULT_FAILED,
+			    "Invalid cursor");
+		cb(self, NULL, NULL, NULL, user_data, error);
+		g_error_free(error);
+		g_free(request->after_title);
+		g_free(request);
+		return;
 	}
 
-	g_free(browse_data);
+	request->self = g_object_ref(self);
+	request->count = count;
+	request->cb = cb;
+	request->user_data = user_data;
+	if (metadata_keys_contain_wildcard(metadata_keys))
+		request->metadata_keys = g_strdupv(
+					(gchar **)MAFW_SOURCE_ALL_KEYS);
+	else if (metadata_keys && metadata_keys[0])
+		request->metadata_keys = g_strdupv((gchar **)metadata_keys);
+	request->object_ids = g_ptr_array_new_with_free_func(g_free);
+	request->metadata = g_ptr_array_new_with_free_func(
+					(GDestroyNotify)free_metadata);
+
+	mafw_iradio_db_queue(MAFW_IRADIO_DB_INTERACTIVE,
+			     (MafwIradioDbFunc)browse_page_run,
+			     (MafwIradioDbFunc)browse_page_done, request);
 }
 
-/** 
- * Removes a browse request from the stored list
+/*----------------------------------------------------------------------------
+  URI lookup
+  ----------------------------------------------------------------------------*/
+
+struct lookup_request {
+	MafwIradioSource *self;
+	/* As given, and in canonical form */
+	gchar **uris;
+	gchar **canonical;
+	/* Object-ids by the URIs as given */
+	GHashTable *found;
+	MafwIradioSourceLookupCb cb;
+	MafwIradioSourceBulkLookupCb bulk_cb;
+	gpointer user_data;
+};
+
+static void free_ids(GArray *ids)
+{
+	g_array_free(ids, TRUE);
+}
+
+/**
+ * Returns the ids of the objects of the snapshot by canonical URI, made
+ * on the first call.  Called with the lock held.
  **/
-static void remove_browse_request(MafwIradioSource *src,
-				struct browse_data_container *browse_data)
+static GHashTable *get_snapshot_uris(MafwIradioSourcePrivate *priv)
 {
-	src->priv->browse_requests = g_list_remove(src->priv->browse_requests,
-					browse_data);
-	free_browse_data(browse_data);
+	MafwIradioSnapshotEntry entry;
+	GArray *ids;
+	gchar *uri;
+	guint i, count;
+
+	if (priv->snapshot_uris)
+		return priv->snapshot_uris;
+
+	priv->snapshot_uris = g_hash_table_new_full(g_str_hash, g_str_equal,
+						    g_free,
+						    (GDestroyNotify)free_ids);
+	count = mafw_iradio_snapshot_count(priv->snapshot);
+	for (i = 0; i < count; i++)
+	{
+		mafw_iradio_snapshot_get(priv->snapshot, i, FALSE, &entry);
+		if (!entry.uri)
+			continue;
+		uri = canonical_uri(entry.uri);
+		ids = g_hash_table_lookup(priv->snapshot_uris, uri);
+		if (!ids)
+		{
+			ids = g_array_new(FALSE, FALSE, sizeof(guint64));
+			g_hash_table_insert(priv->snapshot_uris, uri, ids);
+		}
+		else
+			g_free(uri);
+		g_array_append_val(ids, entry.id);
+	}
+	return priv->snapshot_uris;
 }
 
 /**
- * Helper function to sort the items according to the sorting terms
+ * Records the objects @ids of the @i-th URI of @request
  **/
-static gint sort_metadata_cb(struct metadata_data *a, struct metadata_data *b,
-				const gchar **sorting_terms)
+static void lookup_found(struct lookup_request *request, guint i,
+			 const guint64 *ids, guint n_ids)
 {
-	return mafw_metadata_compare(a->metadata, b->metadata, sorting_terms,
-					NULL);
+	gchar **object_ids;
+	guint j;
+
+	if (!n_ids)
+		return;
+	object_ids = g_new0(gchar *, n_ids + 1);
+	for (j = 0; j < n_ids; j++)
+		object_ids[j] = g_strdup_printf(MAFW_IRADIO_SOURCE_UUID
+						"::%" PRIu64, ids[j]);
+	g_hash_table_replace(request->found, request->uris[i], object_ids);
 }
 
 /**
- * If the result-list was not sorted, and filtered according to the skip and
- * item count, it does this preparation. After this, it calls the cb function
- * with the results, one by one
+ * Looks the URIs up in the snapshot, if there is one
+ *
+ * Returns: FALSE if the database has to be read
  **/
-static gboolean emit_browse_res(struct browse_data_container *browse_data)
+static gboolean lookup_snapshot(struct lookup_request *request)
 {
-	gchar *current_object_id = NULL;
-	struct metadata_data *current_data = NULL;
-	GHashTable *current_metadata = NULL;
-	/* MafwIradioSourcePrivate *privdat; */
-	
-	if (browse_data->free_req)
+	MafwIradioSourcePrivate *priv = request->self->priv;
+	GHashTable *uris;
+	GArray *ids;
+	guint i;
+
+	g_mutex_lock(&priv->lock);
+	if (!priv->snapshot)
 	{
-		remove_browse_request(MAFW_IRADIO_SOURCE(
-						browse_data->self),
-						browse_data);
+		g_mutex_unlock(&priv->lock);
 		return FALSE;
 	}
-	
-	if (browse_data->sorting_terms)
-	{/* Sort the filtered results at first */
-		browse_data->object_list = g_list_sort_with_data(
-					browse_data->object_list,
-					(GCompareDataFunc)sort_metadata_cb,
-					browse_data->sorting_terms);
-		g_strfreev(browse_data->sorting_terms);
-		browse_data->sorting_terms = NULL;
-		
-		
-	}
-	
-	if (browse_data->skip_count)
-	{
-		if (browse_data->skip_count >= g_list_length(
-						browse_data->object_list))
-		{/* list is not so long...... error */
-			GError *err;
-			g_debug("Skip count filtered all the results");
-			err = g_error_new (MAFW_SOURCE_ERROR,
-					MAFW_SOURCE_ERROR_BROWSE_RESULT_FAILED,
-					"Skip count filtered all the results");
-			
-			browse_data->cb(browse_data->self, browse_data->bid, 0,
-					0, NULL, NULL,
-					browse_data->user_data, err);
-			g_error_free(err);
-			browse_data->free_req = TRUE;
-			
-			return TRUE;
-		}
-		/* remove not-needed items, according to item_count and
-			skip_count */
-		while (browse_data->skip_count && browse_data->object_list)
-		{
-			browse_data->object_list = browse_result_free_list_item(
-						browse_data->object_list,
-						browse_data->object_list->data);
-			browse_data->skip_count--;
-		}
-	}
-	
-	if (browse_data->item_count &&
-		(g_list_length(browse_data->object_list) >
-				browse_data->item_count))
+	uris = get_snapshot_uris(priv);
+	for (i = 0; request->uris[i]; i++)
 	{
-		GList *last_item = g_list_nth(browse_data->object_list, 
-						browse_data->item_count-1);
-		while (last_item->next)
-			browse_data->object_list = browse_result_free_list_item(
-						browse_data->object_list,
-						last_item->next->data);
-		browse_data->item_count = 0;
+		ids = g_hash_table_lookup(uris, request->canonical[i]);
+		if (ids)
+			lookup_found(request, i, (guint64 *)ids->data,
+				     ids->len);
 	}
-	
-	/* privdat = MAFW_IRADIO_SOURCE(browse_data->self)->priv; */
-	if (browse_data->object_list)
+	g_mutex_unlock(&priv->lock);
+	return TRUE;
+}
+
+/**
+ * Looks the URIs up in the index of IRADIO_URIS_TABLE, on the database
+ * thread
+ **/
+static void lookup_run(struct lookup_request *request)
+{
+	sqlite3_stmt *stmt = request->self->priv->stmt_lookup_uri;
+	GArray *ids;
+	guint64 id;
+	guint i;
+
+	ids = g_array_new(FALSE, FALSE, sizeof(guint64));
+	mafw_iradio_db_read_begin();
+	for (i = 0; request->uris[i]; i++)
 	{
-		current_data = browse_data->object_list->data;
-	
-		current_object_id = g_strdup_printf(MAFW_IRADIO_SOURCE_UUID
-						"::%" PRId64,
-						current_data->id);
-	
-		if (!browse_data->metadata_keys ||
-						!browse_data->metadata_keys[0])
-		{
-			current_metadata = NULL;
-		}
-		else if (browse_data->metadata_keys[0][0] == '*')
+		mafw_db_bind_text(stmt, 0, request->canonical[i]);
+		while (mafw_iradio_db_select(stmt, FALSE) == SQLITE_ROW)
 		{
-			current_metadata = current_data->metadata;
-		}
-		else
-		{/* Filter the metadata */
-			gint i;
-			gpointer metadata_value;
-			current_metadata = g_hash_table_new_full(g_str_hash,
-								g_str_equal,
-								NULL, NULL);
-			for (i=0; browse_data->metadata_keys[i]; i++)
-			{
-				metadata_value = g_hash_table_lookup(
-							current_data->metadata, 
-							browse_data->
-							metadata_keys[i]);
-				if (metadata_value)
-					g_hash_table_insert(current_metadata,
-							(gpointer)browse_data->
-							    metadata_keys[i],
-							metadata_value);
-			}
-			if (g_hash_table_size(current_metadata) ==0)
-			{
-				g_hash_table_destroy(current_metadata);
-				current_metadata = NULL;
-			}
+			id = mafw_db_column_int64(stmt, 0);
+			g_array_append_val(ids, id);
 		}
+		sqlite3_reset(stmt);
+		lookup_found(request, i, (guint64 *)ids->data, ids->len);
+		g_array_set_size(ids, 0);
 	}
-	
-	browse_data->cb(browse_data->self, browse_data->bid,
-			browse_data->object_list?
-				g_list_length(browse_data->object_list)-1:
-						0,
-			browse_data->next_index, current_object_id,
-			current_metadata,
-			browse_data->user_data, NULL);
-	if (current_metadata && current_metadata != current_data->metadata)
-		g_hash_table_destroy(current_metadata);
-	g_free(current_object_id);
-	browse_data->next_index++;
-	
-	if (browse_data->object_list)
-		browse_data->object_list = browse_result_free_list_item(
-							browse_data->
-								object_list,
-							current_data);
+	mafw_iradio_db_read_end();
+	g_array_free(ids, TRUE);
+}
 
-	if (browse_data->object_list)
-		return TRUE;
+static void lookup_done(struct lookup_request *request)
+{
+	if (request->cb)
+		request->cb(request->self, request->uris[0],
+			    g_hash_table_lookup(request->found,
+						request->uris[0]),
+			    request->user_data, NULL);
+	else
+		request->bulk_cb(request->self, request->found,
+				 request->user_data, NULL);
+
+	g_hash_table_destroy(request->found);
+	g_strfreev(request->uris);
+	g_strfreev(request->canonical);
+	g_object_unref(request->self);
+	g_free(request);
+}
 
-	browse_data->free_req = TRUE;
-	
-	return TRUE;
+static gboolean lookup_idle(struct lookup_request *request)
+{
+	lookup_done(request);
+	return FALSE;
 }
 
 /**
- * Get-metadata-cb, to process the metadata results, and create the
- * browse-result list. It filters the result, according to the given filter
- * criteria, and adds the result to a list. Filtering according to the item
- * count, and skip count, and the sorting is not done here
+ * Answers @request from the snapshot, or queues it
  **/
-static void browse_metadata_cb(MafwSource *self, const gchar *object_id,
-				GHashTable *metadata,
-				struct browse_data_container *browse_data,
-				const GError *error)
+static void lookup(MafwIradioSource *self, struct lookup_request *request,
+		   const gchar *const *uris)
 {
-	if (!metadata || !browse_data->filter ||
-		mafw_metadata_filter(metadata, browse_data->filter,NULL))
-	{ /* Filter passed.... */
-		struct metadata_data *new_metadata = g_new0(
-						struct metadata_data, 1);
-		
-		new_metadata->metadata = metadata;
-		new_metadata->id = browse_data->current_id;
-		browse_data->object_list = g_list_prepend(
-						browse_data->object_list,
-					new_metadata);
-	}
-	else
+	GSource *source;
+	guint i;
+
+	request->self = g_object_ref(self);
+	request->uris = g_strdupv((gchar **)uris);
+	request->canonical = g_new0(gchar *, g_strv_length(request->uris) + 1);
+	for (i = 0; uris[i]; i++)
+		request->canonical[i] = canonical_uri(uris[i]);
+	request->found = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+					       (GDestroyNotify)g_strfreev);
+
+	if (lookup_snapshot(request))
 	{
-		mafw_metadata_release(metadata);
+		/* Called back from the main loop all the same */
+		source = g_idle_source_new();
+		g_source_set_callback(source, (GSourceFunc)lookup_idle,
+				      request, NULL);
+		g_source_attach(source, g_main_context_get_thread_default());
+		g_source_unref(source);
 	}
-	
+	else
+		mafw_iradio_db_queue(MAFW_IRADIO_DB_INTERACTIVE,
+				     (MafwIradioDbFunc)lookup_run,
+				     (MafwIradioDbFunc)lookup_done, request);
 }
 
-static guint browse(MafwSource *self, const gchar *object_id,
-			gboolean recursive, const MafwFilter *filter,
-			const gchar *sort_criteria,
-			const gchar *const *metadata_keys,
-			guint skip_count, guint item_count,
-			MafwSourceBrowseResultCb cb, gpointer user_data)
+/**
+ * mafw_iradio_source_lookup_uri:
+ * @self: An iradio source
+ * @uri: A stream URI
+ * @cb: Called with the objects bookmarking @uri
+ * @user_data: Passed to @cb
+ *
+ * Finds the bookmark of @uri, without browsing.  URIs match in canonical
+ * form: spellings of a stream such as "http://Host:80/x/" and
+ * "http://host/x" are the same.  The object is found in an index, or in
+ * memory while the snapshot of the source is loaded.
+ **/
+void mafw_iradio_source_lookup_uri(MafwIradioSource *self, const gchar *uri,
+				   MafwIradioSourceLookupCb cb,
+				   gpointer user_data)
+{
+	struct lookup_request *request;
+	const gchar *uris[] = { uri, NULL };
+
+	g_return_if_fail(MAFW_IS_IRADIO_SOURCE(self));
+	g_return_if_fail(uri != NULL);
+	g_return_if_fail(cb != NULL);
+
+	request = g_new0(struct lookup_request, 1);
+	request->cb = cb;
+	request->user_data = user_data;
+	lookup(self, request, uris);
+}
+
+/**
+ * mafw_iradio_source_lookup_uris:
+ * @self: An iradio source
+ * @uris: Stream URIs
+ * @cb: Called with the objects bookmarking them
+ * @user_data: Passed to @cb
+ *
+ * Finds the bookmarks of all @uris at once, as
+ * mafw_iradio_source_lookup_uri() does.
+ **/
+void mafw_iradio_source_lookup_uris(MafwIradioSource *self,
+				    const gchar *const *uris,
+				    MafwIradioSourceBulkLookupCb cb,
+				    gpointer user_data)
+{
+	struct lookup_request *request;
+
+	g_return_if_fail(MAFW_IS_IRADIO_SOURCE(self));
+	g_return_if_fail(uris != NULL);
+	g_return_if_fail(cb != NULL);
+
+	request = g_new0(struct lookup_request, 1);
+	request->bulk_cb = cb;
+	request->user_data = user_data;
+	lookup(self, request, uris);
+}
+
+/**
+ * Returns TRUE if the database has a @type called @name, a table, an index
+ * or a trigger.
+ **/
+static gboolean schema_has(const gchar *type, const gchar *name)
+{
+	sqlite3_stmt *stmt;
+	gboolean exists;
+
+	stmt = mafw_iradio_db_prepare("SELECT 1 FROM sqlite_master "
+			       "WHERE type = :type AND name = :name");
+	mafw_db_bind_text(stmt, 0, type);
+	mafw_db_bind_text(stmt, 1, name);
+	exists = mafw_iradio_db_select(stmt, FALSE) == SQLITE_ROW;
+	sqlite3_finalize(stmt);
+	return exists;
+}
+
+/**
+ * Returns TRUE if the database has a table called @name.
+ **/
+static gboolean table_exists(const gchar *name)
+{
+	return schema_has("table", name);
+}
+
+/**
+ * Fills the new, empty tables from the database image made by iradio-dbgen
+ * at build time, which saves parsing the vendor files on the first start.
+ * The image carries the vendor file state too, so the vendor setup finds
+ * the database already synchronized.
+ **/
+static void import_db_image(void)
 {
-	struct browse_data_container *browse_data;
-	MafwIradioSourcePrivate *privdat;
-	struct data_container current_data;
-	
-	g_debug("Browsing %s. Recursive: %d, Filter: %s, Sort criteria: %s,"
-		"Skip: %u, Item count: %u", object_id, recursive,
-		filter != NULL ? "yes" : "no", sort_criteria, skip_count,
-		item_count);
-	
-	g_return_val_if_fail(object_id != NULL, MAFW_SOURCE_INVALID_BROWSE_ID);
-	g_return_val_if_fail(cb != NULL, MAFW_SOURCE_INVALID_BROWSE_ID);
-	g_return_val_if_fail(strcmp(object_id, MAFW_IRADIO_SOURCE_UUID "::")
-					== 0, MAFW_SOURCE_INVALID_BROWSE_ID);
-	
-	privdat = MAFW_IRADIO_SOURCE(self)->priv;
-	
-	memset(&current_data, 0, sizeof current_data);
+	sqlite3_stmt *stmt;
+	gint result;
 
-	browse_data = g_new0(struct browse_data_container, 1);
-	current_data.user_data = browse_data;
-	
-	browse_data->filter = mafw_filter_copy(filter);
-	
-	privdat->last_browse_id++;
-	browse_data->bid = privdat->last_browse_id;
-	
-	g_debug("New browse-id: %u", browse_data->bid);
-	
-	/* This will filter the results */
-	current_data.cb = browse_metadata_cb;
-	current_data.self = self;
-	browse_data->sorting_terms =
-				mafw_metadata_sorting_terms(sort_criteria);
-	current_data.metadata_keys = (gchar**)mafw_metadata_relevant_keys(
-				metadata_keys,
-				browse_data->filter, 
-				(const gchar *const *)browse_data->
-								sorting_terms);
-	if (metadata_keys_contain_wildcard(
-				(const gchar**)current_data.metadata_keys))
-	{
-		g_free(current_data.metadata_keys);
-		current_data.metadata_keys = g_strdupv(
-						(gchar**)MAFW_SOURCE_ALL_KEYS);
-	}
-	else if (current_data.metadata_keys)
+	if (!g_file_test(db_image_path, G_FILE_TEST_IS_REGULAR))
+		return;
+
+	stmt = mafw_iradio_db_prepare("ATTACH DATABASE :path AS image");
+	mafw_db_bind_text(stmt, 0, db_image_path);
+	result = mafw_iradio_db_change(stmt, FALSE);
+	sqlite3_finalize(stmt);
+	if (result != SQLITE_DONE)
 	{
-		gchar **temp = current_data.metadata_keys;
-		current_data.metadata_keys = g_strdupv(temp);
-		g_free(temp);
+		g_warning("Unable to attach %s", db_image_path);
+		return;
 	}
-	
-	while (mafw_db_select(privdat->stmt_object_list, FALSE) == SQLITE_ROW)
+
+	if (mafw_iradio_db_begin())
 	{
-		current_data.id = browse_data->current_id =
-					mafw_db_column_int64(privdat->
-							stmt_object_list,
-							0);
-		if (current_data.metadata_keys)
-			get_metadata_cb(&current_data);
-		else
+		if (mafw_iradio_db_exec("INSERT INTO " IRADIO_TABLE
+				 " SELECT id, key, value FROM image."
+				 IRADIO_TABLE) == SQLITE_OK &&
+		    mafw_iradio_db_exec("INSERT INTO " IRADIO_VENDOR_FILES_TABLE
+				 " SELECT file, mtime, digest FROM image."
+				 IRADIO_VENDOR_FILES_TABLE) == SQLITE_OK &&
+		    mafw_iradio_db_exec("INSERT INTO " IRADIO_VENDOR_TABLE
+				 "(uri, file, id, hash)"
+				 " SELECT uri, file, id, hash FROM image."
+				 IRADIO_VENDOR_TABLE) == SQLITE_OK)
 		{
-			browse_metadata_cb(NULL, NULL, NULL, browse_data, NULL);
+			if (mafw_iradio_db_commit())
+				g_debug("Bookmarks copied from %s",
+					db_image_path);
+			else
+				mafw_iradio_db_rollback();
 		}
-	}
-	sqlite3_reset(privdat->stmt_object_list);
-	mafw_filter_free(browse_data->filter);
-	browse_data->filter = NULL;
-	g_strfreev(current_data.metadata_keys);
-	current_data.metadata_keys = NULL;
-	
-	browse_data->self = self;
-	browse_data->cb = cb;
-	browse_data->user_data = user_data;
-	browse_data->skip_count = skip_count;
-	browse_data->item_count = item_count;
-	if (metadata_keys)
-	{
-		if (metadata_keys_contain_wildcard(metadata_keys))
-			browse_data->metadata_keys = g_strdupv(
-						(gchar**)MAFW_SOURCE_ALL_KEYS);
 		else
-			browse_data->metadata_keys = g_strdupv(
-							(gchar**)metadata_keys);
-		
+		{
+			/* The vendor setup will parse the files instead */
+			g_warning("Unable to copy bookmarks from %s",
+				  db_image_path);
+			mafw_iradio_db_rollback();
+		}
 	}
-	else
+
+	mafw_iradio_db_exec("DETACH DATABASE image");
+}
+
+/* Tables moved out of the shared database by mafw_iradio_db_migrate() */
+static const gchar *const migrated_tables[] = {
+	IRADIO_TABLE,
+	IRADIO_VENDOR_FILES_TABLE,
+	IRADIO_VENDOR_TABLE,
+	IRADIO_SNAPSHOT_TABLE,
+	IRADIO_CHANGES_TABLE,
+	NULL
+};
+
+/**
+ * Stores the string values of @key of the stored objects with @query,
+ * which takes the value, normalized with @normalize if given, and the id
+ **/
+static void index_values(const gchar *key, const gchar *query,
+			 gchar *(*normalize)(const gchar *value))
+{
+	sqlite3_stmt *stmt, *update;
+	GHashTable *metadata;
+	GByteArray *bary;
+	GValue *value;
+	gchar *normalized;
+	gsize size;
+
+	stmt = mafw_iradio_db_prepare("SELECT id, value FROM " IRADIO_TABLE
+				      " WHERE key = :key");
+	mafw_db_bind_text(stmt, 0, key);
+	update = mafw_iradio_db_prepare(query);
+	metadata = mafw_metadata_new();
+	while (mafw_iradio_db_select(stmt, FALSE) == SQLITE_ROW)
 	{
-		browse_data->metadata_keys = g_strdupv(
-						(gchar**)MAFW_SOURCE_NO_KEYS);
-		
+		bary = g_byte_array_new();
+		bary = g_byte_array_append(bary, mafw_db_column_blob(stmt, 1),
+					   sqlite3_column_bytes(stmt, 1));
+		size = 0;
+		g_hash_table_insert(metadata, g_strdup(key),
+				    mafw_metadata_val_thaw_bary(bary, &size));
+		g_byte_array_free(bary, TRUE);
+		value = mafw_metadata_first(metadata, key);
+		if (value && G_VALUE_HOLDS_STRING(value))
+		{
+			normalized = normalize ? normalize(
+					g_value_get_string(value)) : NULL;
+			mafw_db_bind_text(update, 0, normalized ? normalized :
+					  g_value_get_string(value));
+			mafw_db_bind_int64(update, 1,
+					   mafw_db_column_int64(stmt, 0));
+			mafw_iradio_db_change(update, FALSE);
+			sqlite3_reset(update);
+			g_free(normalized);
+		}
+		g_hash_table_remove_all(metadata);
 	}
-			
-	browse_data->sid = g_idle_add((GSourceFunc)emit_browse_res,
-						browse_data);
-	
-	privdat->browse_requests = g_list_prepend(privdat->browse_requests,
-					browse_data);
-	
-	return browse_data->bid;
+	mafw_metadata_release(metadata);
+	sqlite3_finalize(update);
+	sqlite3_finalize(stmt);
 }
 
 /**
- * Helper function to find a browse request's data
+ * Fills IRADIO_TITLES_TABLE from the stored objects, for a database made
+ * before it or copied into place.
  **/
-static gint find_browse_request(struct browse_data_container *a,
-				gconstpointer b)
+static void index_titles(void)
 {
-	return !(a->bid == GPOINTER_TO_UINT(b));
+	if (!mafw_iradio_db_begin())
+		return;
+	if (mafw_iradio_db_exec("INSERT OR IGNORE INTO " IRADIO_TITLES_TABLE
+				"(id, title) SELECT DISTINCT id, '' FROM "
+				IRADIO_TABLE " WHERE key != ''") != SQLITE_OK)
+	{
+		mafw_iradio_db_rollback();
+		return;
+	}
+	index_values(MAFW_METADATA_KEY_TITLE, "UPDATE " IRADIO_TITLES_TABLE
+		     " SET title = :title WHERE id = :id", NULL);
+	if (!mafw_iradio_db_commit())
+		mafw_iradio_db_rollback();
 }
 
-static gboolean cancel_browse(MafwSource *self, guint browse_id,
-				GError **error)
-{
-	
-	GList *found_request;
-	MafwIradioSourcePrivate *privdat;
-	struct browse_data_container *found_item;
+/* Objects bookmarking the URI of an older one */
+#define DUPLICATE_IDS "SELECT id FROM " IRADIO_URIS_TABLE " WHERE id NOT IN " \
+	"(SELECT min(id) FROM " IRADIO_URIS_TABLE " GROUP BY uri)"
 
-	g_debug("Canceling browse: %u", browse_id);
+/**
+ * Fills IRADIO_URIS_TABLE with canonical URIs, for a database made before
+ * it or copied into place, and puts the unique index on them.  Of the
+ * objects that bookmark the same stream, the oldest is kept and the others
+ * are destroyed.  The vendor bookmarks of those point to the one kept.
+ **/
+static void index_uris(void)
+{
+	gchar *query;
 
-	privdat = MAFW_IRADIO_SOURCE(self)->priv;
-	
-	found_request = g_list_find_custom(privdat->browse_requests,
-					GUINT_TO_POINTER(browse_id),
-					(GCompareFunc)find_browse_request);
-	if (!found_request)
+	if (!mafw_iradio_db_begin())
+		return;
+	mafw_iradio_db_exec("DELETE FROM " IRADIO_URIS_TABLE);
+	index_values(MAFW_METADATA_KEY_URI, "INSERT OR REPLACE INTO "
+		     IRADIO_URIS_TABLE "(uri, id) VALUES(:uri, :id)",
+		     canonical_uri);
+
+	/* The kept object may be one the user created */
+	mafw_iradio_db_exec("UPDATE " IRADIO_VENDOR_TABLE " SET id = "
+			    "(SELECT min(kept.id) FROM " IRADIO_URIS_TABLE
+			    " dup, " IRADIO_URIS_TABLE " kept WHERE dup.id = "
+			    IRADIO_VENDOR_TABLE ".id AND kept.uri = dup.uri), "
+			    "owned = 0 WHERE id IN (" DUPLICATE_IDS ")");
+	query = g_strdup_printf("INSERT INTO " IRADIO_CHANGES_TABLE "(id, op) "
+				"SELECT id, %d FROM (" DUPLICATE_IDS ")",
+				MAFW_IRADIO_CHANGE_DESTROYED);
+	mafw_iradio_db_exec(query);
+	g_free(query);
+	mafw_iradio_db_exec("DELETE FROM " IRADIO_TABLE " WHERE id IN ("
+			    DUPLICATE_IDS ")");
+	if (mafw_iradio_db_nchanges())
 	{
-		g_debug("Browse id %u does not exist", browse_id);
-		g_set_error(error, MAFW_SOURCE_ERROR,
-				MAFW_SOURCE_ERROR_INVALID_BROWSE_ID,
-				"Browse id %u does not exist", browse_id);
-        
-		return FALSE;
+		g_debug("Duplicate bookmarks destroyed");
+		/* The snapshot has them */
+		mafw_iradio_db_exec("DELETE FROM " IRADIO_SNAPSHOT_TABLE);
 	}
 
-	found_item = found_request->data;
-	g_source_remove(found_item->sid);
-	
-	
-	found_item->free_req = TRUE;
-	
-	return TRUE;
+	mafw_iradio_db_exec("DROP INDEX IF EXISTS " IRADIO_URIS_TABLE "_uri");
+	if (mafw_iradio_db_exec("CREATE UNIQUE INDEX " IRADIO_URIS_TABLE
+				"_canonical ON " IRADIO_URIS_TABLE "(uri)")
+	    != SQLITE_OK || !mafw_iradio_db_commit())
+		mafw_iradio_db_rollback();
 }
 
+/* Columns of IRADIO_VENDOR_TABLE.  Several vendor files may list the same
+   URI, so the key is the pair.  Objects the vendor setup found stored
+   already are not owned, and outlive the bookmark. */
+#define VENDOR_TABLE_COLUMNS "(\n"				\
+	"uri		TEXT		NOT NULL,\n"		\
+	"file		TEXT		NOT NULL,\n"		\
+	"id		INTEGER		NOT NULL,\n"		\
+	"hash		TEXT		NOT NULL,\n"		\
+	"owned		INTEGER		NOT NULL DEFAULT 1,\n"	\
+	"PRIMARY KEY(file, uri))"
+
 /**
- * Creates the DB-table for the source
+ * Rebuilds IRADIO_VENDOR_TABLE of a database made when it was keyed on the
+ * URI alone.  The rows keep their column order.
  **/
-static void init_db(void)
+static void rekey_vendor_table(void)
 {
-	sqlite3_stmt *db_check = mafw_db_prepare(
-		"SELECT name FROM sqlite_master WHERE type = 'table' AND "
-		"name = '" IRADIO_TABLE "'");
+	sqlite3_stmt *stmt;
+	gboolean keyed = FALSE;
+
+	stmt = mafw_iradio_db_prepare("PRAGMA table_info("
+				      IRADIO_VENDOR_TABLE ")");
+	while (mafw_iradio_db_select(stmt, FALSE) == SQLITE_ROW)
+		if (!strcmp(mafw_db_column_text(stmt, 1), "file"))
+			keyed = mafw_db_column_int64(stmt, 5) > 0;
+	sqlite3_finalize(stmt);
+	if (keyed || !mafw_iradio_db_begin())
+		return;
 
-	if (mafw_db_select(db_check, FALSE) == SQLITE_ROW)
-	{
-		load_vendor = FALSE;
-	}
-	else
-	{
-		load_vendor = TRUE;
-	}
+	g_debug("Rekeying " IRADIO_VENDOR_TABLE);
+	if (mafw_iradio_db_exec("ALTER TABLE " IRADIO_VENDOR_TABLE
+				" RENAME TO " IRADIO_VENDOR_TABLE "_old")
+	    != SQLITE_OK ||
+	    mafw_iradio_db_exec("CREATE TABLE " IRADIO_VENDOR_TABLE
+				VENDOR_TABLE_COLUMNS) != SQLITE_OK ||
+	    mafw_iradio_db_exec("INSERT INTO " IRADIO_VENDOR_TABLE
+				"(uri, file, id, hash)"
+				" SELECT uri, file, id, hash FROM "
+				IRADIO_VENDOR_TABLE "_old") != SQLITE_OK ||
+	    mafw_iradio_db_exec("DROP TABLE " IRADIO_VENDOR_TABLE "_old")
+	    != SQLITE_OK || !mafw_iradio_db_commit())
+		mafw_iradio_db_rollback();
+}
+
+/**
+ * Adds the owned column to IRADIO_VENDOR_TABLE of a database made without
+ * it.  The objects of the rows there are taken for the vendor's own, as
+ * they were.
+ **/
+static void add_owned_column(void)
+{
+	sqlite3_stmt *stmt;
+	gboolean found = FALSE;
+
+	stmt = mafw_iradio_db_prepare("PRAGMA table_info("
+				      IRADIO_VENDOR_TABLE ")");
+	while (mafw_iradio_db_select(stmt, FALSE) == SQLITE_ROW)
+		if (!strcmp(mafw_db_column_text(stmt, 1), "owned"))
+			found = TRUE;
+	sqlite3_finalize(stmt);
+	if (found)
+		return;
+
+	g_debug("Adding owned to " IRADIO_VENDOR_TABLE);
+	mafw_iradio_db_exec("ALTER TABLE " IRADIO_VENDOR_TABLE " ADD COLUMN "
+			    "owned INTEGER NOT NULL DEFAULT 1");
+}
 
-	sqlite3_finalize(db_check);
+/**
+ * Creates the DB-tables for the source, and fills them on the first start,
+ * from the prebuilt image if @seed.
+ *
+ * Returns: FALSE if the bookmarks of the shared database could not be moved
+ * into the private one, which is left to try again on the next start.
+ **/
+static gboolean init_tables(gboolean seed)
+{
+	gboolean first_start, titles_indexed, uris_indexed;
+	gint moved = 0;
+
+	first_start = !table_exists(IRADIO_TABLE);
 
 	/*
 	 * TABLE iradiobookmarks:
 	 * * id				integer			AUTOINCREMENT
 	 * * objectid			string			NOT NULL UNIQUE
 	 */
-	mafw_db_exec(
+	mafw_iradio_db_exec(
 		"CREATE TABLE IF NOT EXISTS " IRADIO_TABLE "(\n"
 		"id		INTEGER		NOT NULL,\n"
 		"key		TEXT		NOT NULL,\n"
 		"value		BLOB		)");
+
+	/*
+	 * TABLE iradiovendorfiles:
+	 * * file			string			PRIMARY KEY
+	 * * mtime			integer
+	 * * digest			string			SHA-256
+	 */
+	mafw_iradio_db_exec(
+		"CREATE TABLE IF NOT EXISTS " IRADIO_VENDOR_FILES_TABLE "(\n"
+		"file		TEXT		PRIMARY KEY,\n"
+		"mtime		INTEGER		NOT NULL,\n"
+		"digest		TEXT		NOT NULL)");
+
+	/*
+	 * TABLE iradiovendorbookmarks:
+	 * * uri			string			PRIMARY KEY(file, uri)
+	 * * file			string			vendor file
+	 * * id				integer			object id
+	 * * hash			string			content hash
+	 * * owned			integer			created by the vendor setup
+	 */
+	mafw_iradio_db_exec("CREATE TABLE IF NOT EXISTS " IRADIO_VENDOR_TABLE
+			    VENDOR_TABLE_COLUMNS);
+	rekey_vendor_table();
+	add_owned_column();
+
+	/*
+	 * TABLE iradiosnapshot:
+	 * * token			integer			of the snapshot file
+	 */
+	mafw_iradio_db_exec(
+		"CREATE TABLE IF NOT EXISTS " IRADIO_SNAPSHOT_TABLE "(\n"
+		"token		INTEGER		NOT NULL)");
+
+	/*
+	 * TABLE iradiochanges:
+	 * * seq			integer			AUTOINCREMENT
+	 * * id				integer			object id
+	 * * op				integer			MafwIradioChangeOp
+	 * * keys			string			comma-separated
+	 */
+	mafw_iradio_db_exec(
+		"CREATE TABLE IF NOT EXISTS " IRADIO_CHANGES_TABLE "(\n"
+		"seq		INTEGER		PRIMARY KEY AUTOINCREMENT,\n"
+		"id		INTEGER		NOT NULL,\n"
+		"op		INTEGER		NOT NULL,\n"
+		"keys		TEXT		)");
+
+	/*
+	 * TABLE iradiotitles:
+	 * * id				integer			PRIMARY KEY
+	 * * title			string			'' if none
+	 */
+	titles_indexed = table_exists(IRADIO_TITLES_TABLE);
+	mafw_iradio_db_exec(
+		"CREATE TABLE IF NOT EXISTS " IRADIO_TITLES_TABLE "(\n"
+		"id		INTEGER		PRIMARY KEY,\n"
+		"title		TEXT		NOT NULL)");
+	mafw_iradio_db_exec("CREATE INDEX IF NOT EXISTS " IRADIO_TITLES_TABLE
+			    "_order ON " IRADIO_TITLES_TABLE "(title, id)");
+	mafw_iradio_db_exec("CREATE TRIGGER IF NOT EXISTS " IRADIO_TITLES_TABLE
+			    "_delete AFTER DELETE ON " IRADIO_TABLE " WHEN NOT "
+			    "EXISTS (SELECT 1 FROM " IRADIO_TABLE
+			    " WHERE id = old.id) BEGIN DELETE FROM "
+			    IRADIO_TITLES_TABLE " WHERE id = old.id; END");
+
+	/*
+	 * TABLE iradiouris:
+	 * * id				integer			PRIMARY KEY
+	 * * uri			string			canonical, UNIQUE
+	 */
+	uris_indexed = schema_has("index", IRADIO_URIS_TABLE "_canonical");
+	mafw_iradio_db_exec(
+		"CREATE TABLE IF NOT EXISTS " IRADIO_URIS_TABLE "(\n"
+		"id		INTEGER		PRIMARY KEY,\n"
+		"uri		TEXT		NOT NULL)");
+	mafw_iradio_db_exec("CREATE TRIGGER IF NOT EXISTS " IRADIO_URIS_TABLE
+			    "_delete AFTER DELETE ON " IRADIO_TABLE " WHEN NOT "
+			    "EXISTS (SELECT 1 FROM " IRADIO_TABLE
+			    " WHERE id = old.id) BEGIN DELETE FROM "
+			    IRADIO_URIS_TABLE " WHERE id = old.id; END");
+
+	mafw_iradio_db_exec("CREATE INDEX IF NOT EXISTS " IRADIO_TABLE "_id ON "
+			    IRADIO_TABLE "(id, key)");
+
+	/* Bookmarks kept in the shared database so far move along */
+	if (first_start && mafw_iradio_db_is_private())
+		moved = mafw_iradio_db_migrate(migrated_tables);
+	if (moved < 0)
+	{
+		/* So that the next start is a first one again, and indexes
+		   the titles of what it moves */
+		mafw_iradio_db_exec("DROP TABLE " IRADIO_TABLE);
+		mafw_iradio_db_exec("DROP TABLE " IRADIO_TITLES_TABLE);
+		return FALSE;
+	}
+	if (first_start && moved == 0 && seed)
+		import_db_image();
+
+	/* The vendor file date used to be stored with an empty key; it is
+	   kept in the vendor file table now */
+	mafw_iradio_db_exec("DELETE FROM " IRADIO_TABLE " WHERE key = ''");
+	if (!titles_indexed)
+		index_titles();
+	if (!uris_indexed)
+		index_uris();
+
+	mafw_iradio_db_exec(TRIM_JOURNAL);
+	return TRUE;
+}
+
+/**
+ * Opens the database of the source
+ **/
+static void init_db(void)
+{
+	MafwIradioDbProfile profile;
+	const gchar *name;
+
+	name = g_getenv(MAFW_IRADIO_DB_PROFILE_ENV);
+	if (name && !mafw_iradio_db_is_private())
+		g_warning(MAFW_IRADIO_DB_PROFILE_ENV " is ignored without "
+			  MAFW_IRADIO_DB_ENV);
+	else if (name && !mafw_iradio_db_parse_profile(name, &profile))
+		g_warning("Unknown database profile: %s", name);
+	else if (name)
+		mafw_iradio_db_set_profile(profile);
+
+	if (!init_tables(TRUE))
+	{
+		/* Never seeded over the bookmarks left behind */
+		g_warning("Unable to move the bookmarks to " MAFW_IRADIO_DB_ENV
+			  ", keeping them in the shared database");
+		mafw_iradio_db_use_shared();
+		init_tables(FALSE);
+	}
 }
 
 
@@ -1177,116 +3669,199 @@ static void init_db(void)
 
 G_DEFINE_TYPE(MafwIradioSource, mafw_iradio_source, MAFW_TYPE_SOURCE);
 
-static void set_vendorfile_date(MafwIradioSource *self, time_t mod_time)
+/* Seconds without changes in the vendor directory before it is resynced */
+#define VENDOR_RELOAD_DELAY 2
+
+static void vendor_setup_done(MafwIradioSource *self, guint changed,
+			      gpointer user_data);
+
+/**
+ * Starts synchronizing the database with the vendor directory in the
+ * background.  Requests are served from the objects stored so far until
+ * vendor-setup-done is emitted.
+ **/
+static void start_vendor_setup(MafwIradioSource *self)
+{
+	self->priv->vendor_setup = mafw_iradio_vendor_setup_start(
+					self, vendor_setup_done, NULL);
+}
+
+/**
+ * Called when the asynchronous vendor setup has synchronized the database
+ * with the vendor files.  Changes seen meanwhile are picked up by another
+ * run.
+ **/
+static void vendor_setup_done(MafwIradioSource *self, guint changed,
+			      gpointer user_data)
 {
-	guint64 new_id;
-	sqlite3_stmt *stmt_vendofile_setdate;
+	self->priv->vendor_setup = NULL;
+	g_signal_emit(self, signals[VENDOR_SETUP_DONE], 0, changed);
+
+	if (self->priv->vendor_rerun)
+	{
+		self->priv->vendor_rerun = FALSE;
+		start_vendor_setup(self);
+	}
+}
+
+static gboolean vendor_reload_cb(MafwIradioSource *self)
+{
+	self->priv->vendor_reload_id = 0;
+
+	if (self->priv->vendor_setup)
+		self->priv->vendor_rerun = TRUE;
+	else
+		start_vendor_setup(self);
+
+	return FALSE;
+}
+
+/**
+ * Called by the file monitor of the vendor directory.  A package update
+ * touches several files in a row, so the resync waits until the directory
+ * has been quiet for a while.
+ **/
+static void vendor_dir_changed(GFileMonitor *monitor, GFile *file,
+			       GFile *other_file, GFileMonitorEvent event,
+			       MafwIradioSource *self)
+{
+	if (event == G_FILE_MONITOR_EVENT_ATTRIBUTE_CHANGED ||
+	    event == G_FILE_MONITOR_EVENT_PRE_UNMOUNT ||
+	    event == G_FILE_MONITOR_EVENT_UNMOUNTED)
+		return;
+
+	if (self->priv->vendor_reload_id)
+		g_source_remove(self->priv->vendor_reload_id);
+	self->priv->vendor_reload_id = g_timeout_add_seconds(
+						VENDOR_RELOAD_DELAY,
+						(GSourceFunc)vendor_reload_cb,
+						self);
+}
 
-	new_id = get_next_id(self);
-	stmt_vendofile_setdate = mafw_db_prepare("INSERT "
-					"INTO " IRADIO_TABLE "("
-						"id, key, value) "
-					"VALUES(:id, '', :value)");
-	g_assert(mafw_db_begin());
-	mafw_db_bind_int64(stmt_vendofile_setdate, 0, new_id);
-	mafw_db_bind_blob(stmt_vendofile_setdate, 1, &mod_time,
-				sizeof(time_t));
+/**
+ * Watches the vendor directory, so that updated bookmark bundles are
+ * imported without restarting the source.
+ **/
+static void watch_vendor_dir(MafwIradioSource *self)
+{
+	GError *error = NULL;
+	GFile *dir;
+
+	dir = g_file_new_for_path(vendor_setup_path);
+	self->priv->vendor_monitor = g_file_monitor_directory(
+					dir, G_FILE_MONITOR_NONE, NULL, &error);
+	g_object_unref(dir);
+
+	if (self->priv->vendor_monitor == NULL)
+	{
+		g_debug("Unable to watch %s: %s", vendor_setup_path,
+			error->message);
+		g_error_free(error);
+		return;
+	}
 
-	if (mafw_db_change(stmt_vendofile_setdate, FALSE) != SQLITE_DONE)
-		g_assert_not_reached();
-	g_assert(mafw_db_nchanges() == 1);
-	g_assert(mafw_db_commit());
-	sqlite3_finalize(stmt_vendofile_setdate);
+	g_signal_connect(self->priv->vendor_monitor, "changed",
+			 G_CALLBACK(vendor_dir_changed), self);
 }
 
 static void mafw_iradio_source_init(MafwIradioSource *self)
 {
 	g_return_if_fail(MAFW_IS_IRADIO_SOURCE(self));
 	self->priv = MAFW_IRADIO_SOURCE_GET_PRIVATE(self);
+	g_mutex_init(&self->priv->lock);
+	self->priv->thread = g_thread_self();
 
-	self->priv->stmt_object_list = mafw_db_prepare("SELECT DISTINCT id "
+	/* Clients read the last commit, not what an import is writing */
+	self->priv->stmt_object_list = mafw_iradio_db_prepare_read(
+					"SELECT DISTINCT id "
 					"FROM " IRADIO_TABLE " WHERE key != ''");
-	self->priv->stmt_get_value = mafw_db_prepare("SELECT value FROM "
+	self->priv->stmt_count = mafw_iradio_db_prepare_read(
+					"SELECT COUNT(DISTINCT id) "
+					"FROM " IRADIO_TABLE " WHERE key != ''");
+	self->priv->stmt_count_key = mafw_iradio_db_prepare_read(
+					"SELECT COUNT(DISTINCT id) "
+					"FROM " IRADIO_TABLE " WHERE key = :key "
+					"AND key != ''");
+	self->priv->stmt_count_title = mafw_iradio_db_prepare_read(
+					"SELECT COUNT(*) FROM "
+					IRADIO_TITLES_TABLE " WHERE title = :title");
+	self->priv->stmt_get_value = mafw_iradio_db_prepare_read(
+					"SELECT value FROM "
 					IRADIO_TABLE " WHERE id = :id AND "
 							"key = :key AND key != ''");
-	self->priv->stmt_get_key_value = mafw_db_prepare("SELECT key, value "
+	self->priv->stmt_get_key_value = mafw_iradio_db_prepare_read(
+					"SELECT key, value "
 					"FROM " IRADIO_TABLE " WHERE id = :id AND key != ''");
-	self->priv->stmt_insert = mafw_db_prepare("INSERT "
+	self->priv->stmt_check_id = mafw_iradio_db_prepare_read(
+					"SELECT id FROM "
+					IRADIO_TABLE " WHERE id = :id");
+	self->priv->stmt_check_written_id = mafw_iradio_db_prepare(
+					"SELECT id FROM "
+					IRADIO_TABLE " WHERE id = :id");
+	self->priv->stmt_insert = mafw_iradio_db_prepare("INSERT "
 					"INTO " IRADIO_TABLE "(id, "
 						"key, value) "
 					"VALUES(:id, :key, :value)");
-	self->priv->stmt_delete_keys = mafw_db_prepare("DELETE FROM "
+	self->priv->stmt_delete_keys = mafw_iradio_db_prepare("DELETE FROM "
 					IRADIO_TABLE " WHERE id = :id AND "
 					"key = :key");
-	self->priv->stmt_delete_object = mafw_db_prepare("DELETE FROM "
+	self->priv->stmt_delete_object = mafw_iradio_db_prepare("DELETE FROM "
 						IRADIO_TABLE " WHERE id = :id");
-	self->priv->stmt_get_max_id = mafw_db_prepare("SELECT max(id) "
+	self->priv->stmt_get_max_id = mafw_iradio_db_prepare("SELECT max(id) "
 						"as maxid FROM " IRADIO_TABLE);
-	self->priv->stmt_check_id = mafw_db_prepare("SELECT id FROM "
-						IRADIO_TABLE " WHERE id = :id");
-
-	if (load_vendor)
-	{
-		struct stat vendorstat;
-		gchar *vendorfile = g_strdup_printf("%s/%s", vendor_setup_path,
-							VENDOR_FILENAME);
-
-		mafw_iradio_vendor_setup(self, FALSE);
-		if (g_stat(vendorfile, &vendorstat) != 0)
-		{
-			g_free(vendorfile);
-			return;
-		}
-		set_vendorfile_date(self, vendorstat.st_mtime);
-		load_vendor = FALSE;
-		g_free(vendorfile);
-	}
-	else
-	{
-		const void *val;
-		time_t last_mod = 0;
-		struct stat vendorstat;
-		gchar *vendorfile = g_strdup_printf("%s/%s", vendor_setup_path,
-							VENDOR_FILENAME);
-		sqlite3_stmt *stmt_vendorfile_date;
-
-		if (g_stat(vendorfile, &vendorstat) != 0)
-		{
-			g_debug("Vendor file not found: %s", vendorfile);
-			g_free(vendorfile);
-			return;
-		}
-
-		stmt_vendorfile_date = mafw_db_prepare("SELECT "
-					"value FROM "
-					IRADIO_TABLE " WHERE key = ''");
-		g_assert(stmt_vendorfile_date);
-		if (mafw_db_select(stmt_vendorfile_date, FALSE) == SQLITE_ROW)
-		{
-			val = mafw_db_column_blob(stmt_vendorfile_date, 0);
-			if (val)
-				last_mod = *(time_t*)val;
-			else
-				last_mod = 0;
-		}
-		else
-		{
-			last_mod = 0;
-		}
-
-		g_free(vendorfile);
-		sqlite3_finalize(stmt_vendorfile_date);
-
-		if (vendorstat.st_mtime != last_mod)
-		{/* New vendor file.... db should be updated */
-			g_debug("Updating");
-			mafw_iradio_vendor_setup(self, TRUE);
-			if (last_mod != 0)
-				mafw_db_exec("DELETE FROM " IRADIO_TABLE 
-						" WHERE key = ''");
-			set_vendorfile_date(self, vendorstat.st_mtime);
-		}
-	}
+	self->priv->stmt_get_uri = mafw_iradio_db_prepare("SELECT value FROM "
+						IRADIO_TABLE " WHERE id = :id "
+						"AND key = '" MAFW_METADATA_KEY_URI
+						"'");
+	self->priv->stmt_journal = mafw_iradio_db_prepare("INSERT INTO "
+					IRADIO_CHANGES_TABLE "(id, op, keys) "
+					"VALUES(:id, :op, :keys)");
+	self->priv->stmt_trim_journal = mafw_iradio_db_prepare(TRIM_JOURNAL);
+	self->priv->stmt_set_title = mafw_iradio_db_prepare("INSERT OR "
+					"REPLACE INTO " IRADIO_TITLES_TABLE
+					"(id, title) VALUES(:id, :title)");
+	self->priv->stmt_add_title = mafw_iradio_db_prepare("INSERT OR "
+					"IGNORE INTO " IRADIO_TITLES_TABLE
+					"(id, title) VALUES(:id, '')");
+	self->priv->stmt_set_uri = mafw_iradio_db_prepare("INSERT INTO "
+					IRADIO_URIS_TABLE "(id, uri) "
+					"VALUES(:id, :uri)");
+	self->priv->stmt_clear_uri = mafw_iradio_db_prepare("DELETE FROM "
+					IRADIO_URIS_TABLE " WHERE id = :id");
+	self->priv->stmt_find_uri = mafw_iradio_db_prepare("SELECT id FROM "
+					IRADIO_URIS_TABLE " WHERE uri = :uri");
+	self->priv->stmt_lookup_uri = mafw_iradio_db_prepare_read(
+					"SELECT id FROM " IRADIO_URIS_TABLE
+					" WHERE uri = :uri ORDER BY id");
+	/* One row past the page tells whether another one follows */
+	self->priv->stmt_page_by_id = mafw_iradio_db_prepare_read(
+					"SELECT DISTINCT id FROM " IRADIO_TABLE
+					" WHERE id > :id AND key != '' "
+					"ORDER BY id LIMIT :count");
+	self->priv->stmt_page_by_title = mafw_iradio_db_prepare_read(
+					"SELECT id, title FROM "
+					IRADIO_TITLES_TABLE " WHERE title >= "
+					":title AND (title > :title OR id > "
+					":id) ORDER BY title, id LIMIT :count");
+
+	self->priv->browse_requests = g_hash_table_new(g_direct_hash,
+						       g_direct_equal);
+	self->priv->changed_objects = g_hash_table_new_full(g_str_hash,
+							    g_str_equal,
+							    g_free, NULL);
+
+	self->priv->snapshot = mafw_iradio_snapshot_load();
+	if (!self->priv->snapshot)
+		schedule_snapshot(self);
+
+	if (mafw_iradio_db_is_private() && mafw_iradio_db_get_profile() ==
+	    MAFW_IRADIO_DB_RELAXED)
+		self->priv->checkpoint_id = g_timeout_add_seconds(
+					CHECKPOINT_INTERVAL,
+					(GSourceFunc)checkpoint_cb, self);
+
+	start_vendor_setup(self);
+	watch_vendor_dir(self);
 }
 
 static void dispose(GObject *object)
@@ -1298,14 +3873,72 @@ static void dispose(GObject *object)
 	klass = MAFW_IRADIO_SOURCE_GET_CLASS(object);
 	
 	parent_class = g_type_class_peek_parent(klass);
+
+	if (self->priv->vendor_monitor)
+	{
+		g_file_monitor_cancel(self->priv->vendor_monitor);
+		g_object_unref(self->priv->vendor_monitor);
+		self->priv->vendor_monitor = NULL;
+	}
+	if (self->priv->vendor_reload_id)
+	{
+		g_source_remove(self->priv->vendor_reload_id);
+		self->priv->vendor_reload_id = 0;
+	}
+
+	if (self->priv->snapshot_id)
+	{
+		g_source_remove(self->priv->snapshot_id);
+		self->priv->snapshot_id = 0;
+	}
+	if (self->priv->snapshot)
+	{
+		mafw_iradio_snapshot_free(self->priv->snapshot);
+		self->priv->snapshot = NULL;
+	}
+	if (self->priv->snapshot_uris)
+	{
+		g_hash_table_destroy(self->priv->snapshot_uris);
+		self->priv->snapshot_uris = NULL;
+	}
+
+	if (self->priv->vendor_setup)
+	{
+		/* The state of unfinished files is not stored, so they
+		   are processed again next time */
+		mafw_iradio_vendor_setup_cancel(self->priv->vendor_setup);
+		self->priv->vendor_setup = NULL;
+	}
 	
-	while (self->priv->browse_requests)
+	/* Browse requests hold the source, so none is left */
+	if (self->priv->browse_requests)
 	{
-		g_source_remove(((struct browse_data_container *)
-				(self->priv->browse_requests->data))->sid);
-		remove_browse_request(MAFW_IRADIO_SOURCE(self),
-					self->priv->browse_requests->data);
+		g_hash_table_destroy(self->priv->browse_requests);
+		self->priv->browse_requests = NULL;
 	}
+
+	if (self->priv->checkpoint_id)
+	{
+		g_source_remove(self->priv->checkpoint_id);
+		self->priv->checkpoint_id = 0;
+	}
+
+	/* Requests hold the source, so nothing is left to notify */
+	if (self->priv->changes_id)
+	{
+		g_source_remove(self->priv->changes_id);
+		self->priv->changes_id = 0;
+	}
+	if (self->priv->changed_objects)
+	{
+		g_hash_table_destroy(self->priv->changed_objects);
+		self->priv->changed_objects = NULL;
+	}
+
+	/* Nothing queued is lost at shutdown */
+	mafw_iradio_db_flush();
+	if (mafw_iradio_db_get_profile() == MAFW_IRADIO_DB_RELAXED)
+		mafw_iradio_db_checkpoint();
 	
 	sqlite3_finalize(self->priv->stmt_object_list);
 	sqlite3_finalize(self->priv->stmt_get_value);
@@ -1315,10 +3948,36 @@ static void dispose(GObject *object)
 	sqlite3_finalize(self->priv->stmt_delete_object);
 	sqlite3_finalize(self->priv->stmt_get_max_id);
 	sqlite3_finalize(self->priv->stmt_check_id);
+	sqlite3_finalize(self->priv->stmt_check_written_id);
+	sqlite3_finalize(self->priv->stmt_get_uri);
+	sqlite3_finalize(self->priv->stmt_journal);
+	sqlite3_finalize(self->priv->stmt_trim_journal);
+	sqlite3_finalize(self->priv->stmt_set_title);
+	sqlite3_finalize(self->priv->stmt_add_title);
+	sqlite3_finalize(self->priv->stmt_set_uri);
+	sqlite3_finalize(self->priv->stmt_clear_uri);
+	sqlite3_finalize(self->priv->stmt_find_uri);
+	sqlite3_finalize(self->priv->stmt_lookup_uri);
+	sqlite3_finalize(self->priv->stmt_page_by_id);
+	sqlite3_finalize(self->priv->stmt_page_by_title);
+	sqlite3_finalize(self->priv->stmt_count);
+	sqlite3_finalize(self->priv->stmt_count_key);
+	sqlite3_finalize(self->priv->stmt_count_title);
 	
 	G_OBJECT_CLASS(parent_class)->dispose(object);
 }
 
+static void finalize(GObject *object)
+{
+	MafwIradioSource *self = MAFW_IRADIO_SOURCE(object);
+	GObjectClass *parent_class;
+
+	parent_class = g_type_class_peek_parent(
+				MAFW_IRADIO_SOURCE_GET_CLASS(object));
+	g_mutex_clear(&self->priv->lock);
+	parent_class->finalize(object);
+}
+
 static void mafw_iradio_source_class_init(MafwIradioSourceClass *klass)
 {
 	GObjectClass *gobject_class = G_OBJECT_CLASS(klass);
@@ -1332,9 +3991,27 @@ static void mafw_iradio_source_class_init(MafwIradioSourceClass *klass)
 	source_class->cancel_browse = cancel_browse;
 	
 	gobject_class->dispose = dispose;
+	gobject_class->finalize = finalize;
 	
 	g_type_class_add_private(source_class,
 					sizeof(MafwIradioSourcePrivate));
+
+	/**
+	 * MafwIradioSource::vendor-setup-done:
+	 * @self: The emitting source
+	 * @changed: Number of objects created, updated or removed
+	 *
+	 * Emitted when the database has been synchronized with a new or
+	 * modified vendor file in the background.  It is not emitted if
+	 * the file was not modified since the last start.
+	 */
+	signals[VENDOR_SETUP_DONE] =
+		g_signal_new("vendor-setup-done",
+			     G_TYPE_FROM_CLASS(klass),
+			     G_SIGNAL_RUN_LAST,
+			     0, NULL, NULL,
+			     g_cclosure_marshal_VOID__UINT,
+			     G_TYPE_NONE, 1, G_TYPE_UINT);
 	
 	init_db();
 }
@@ -22,6 +22,7 @@
  *
  */
 
+#include <gio/gio.h>
 #include <libmafw/mafw-source.h>
 
 #ifndef MAFW_IRADIO_SOURCE_H
@@ -34,6 +35,15 @@ G_BEGIN_DECLS
 #define MAFW_IRADIO_SOURCE_PLUGIN_NAME "MAFW-IRadio-Source"
 
 #define IRADIO_TABLE "iradiobookmarks"
+#define IRADIO_VENDOR_TABLE "iradiovendorbookmarks"
+#define IRADIO_VENDOR_FILES_TABLE "iradiovendorfiles"
+#define IRADIO_SNAPSHOT_TABLE "iradiosnapshot"
+#define IRADIO_CHANGES_TABLE "iradiochanges"
+#define IRADIO_TITLES_TABLE "iradiotitles"
+#define IRADIO_URIS_TABLE "iradiouris"
+
+/* Prebuilt bookmark database, see iradio-dbgen */
+extern const gchar *db_image_path;
 
 /*----------------------------------------------------------------------------
   GObject type conversion macros
@@ -76,6 +86,13 @@ struct _MafwIradioSourceClass {
 	MafwSourceClass parent_class;
 };
 
+/*
+ * The requests of MafwSource (create, destroy, get and set metadata,
+ * browse and its cancellation) may be made from any thread.  Their
+ * callbacks are called in the thread-default main context of the caller,
+ * the signals in the default main context.
+ */
+
 /*----------------------------------------------------------------------------
   Public API
   ----------------------------------------------------------------------------*/
@@ -83,6 +100,153 @@ struct _MafwIradioSourceClass {
 GObject *mafw_iradio_source_new(void);
 GType mafw_iradio_source_get_type(void);
 
+void mafw_iradio_source_get_metadata(MafwIradioSource *self,
+				     const gchar *object_id,
+				     const gchar *const *metadata_keys,
+				     GCancellable *cancellable,
+				     MafwSourceMetadataResultCb cb,
+				     gpointer user_data);
+
+/*----------------------------------------------------------------------------
+  Change journal
+  ----------------------------------------------------------------------------*/
+
+typedef enum {
+	MAFW_IRADIO_CHANGE_CREATED,
+	MAFW_IRADIO_CHANGE_UPDATED,
+	MAFW_IRADIO_CHANGE_DESTROYED
+} MafwIradioChangeOp;
+
+/**
+ * MafwIradioChange:
+ * @seq: Sequence number of the change
+ * @object_id: The object changed
+ * @op: What happened to it
+ * @keys: Metadata keys stored or replaced, %NULL if it was destroyed
+ */
+typedef struct {
+	guint64 seq;
+	gchar *object_id;
+	MafwIradioChangeOp op;
+	gchar **keys;
+} MafwIradioChange;
+
+guint64 mafw_iradio_source_get_change_seq(MafwIradioSource *self);
+GPtrArray *mafw_iradio_source_get_changes(MafwIradioSource *self,
+					  guint64 since, GError **error);
+void mafw_iradio_change_free(MafwIradioChange *change);
+
+/*----------------------------------------------------------------------------
+  Paged browse
+  ----------------------------------------------------------------------------*/
+
+/**
+ * MafwIradioBrowseOrder:
+ * @MAFW_IRADIO_BROWSE_BY_ID: In the order the objects were created
+ * @MAFW_IRADIO_BROWSE_BY_TITLE: By title, byte-wise, then by creation.
+ * Objects without a title come first.
+ */
+typedef enum {
+	MAFW_IRADIO_BROWSE_BY_ID,
+	MAFW_IRADIO_BROWSE_BY_TITLE
+} MafwIradioBrowseOrder;
+
+/**
+ * MafwIradioSourcePageCb:
+ * @self: The source
+ * @object_ids: Object-ids of the page, in order, %NULL on error
+ * @metadata: Metadata of each, in the same order, or %NULL entries if no
+ * keys were asked
+ * @next_cursor: Where the next page starts, %NULL after the last page
+ * @user_data: As given
+ * @error: Set if the page could not be read
+ *
+ * The arrays and the cursor belong to the caller of the callback.
+ */
+typedef void (*MafwIradioSourcePageCb)(MafwIradioSource *self,
+				       GPtrArray *object_ids,
+				       GPtrArray *metadata,
+				       const gchar *next_cursor,
+				       gpointer user_data,
+				       const GError *error);
+
+void mafw_iradio_source_browse_page(MafwIradioSource *self,
+				    MafwIradioBrowseOrder order,
+				    const gchar *cursor, guint count,
+				    const gchar *const *metadata_keys,
+				    MafwIradioSourcePageCb cb,
+				    gpointer user_data);
+
+/*----------------------------------------------------------------------------
+  Counting
+  ----------------------------------------------------------------------------*/
+
+guint mafw_iradio_source_count(MafwIradioSource *self,
+			       const MafwFilter *filter, guint skip_count,
+			       MafwSourceBrowseResultCb cb,
+			       gpointer user_data);
+
+/*----------------------------------------------------------------------------
+  URI lookup
+  ----------------------------------------------------------------------------*/
+
+/**
+ * MafwIradioSourceLookupCb:
+ * @self: The source
+ * @uri: The URI looked up
+ * @object_ids: The object bookmarking it, %NULL if there is none
+ * @user_data: As given
+ * @error: Set if the lookup failed
+ */
+typedef void (*MafwIradioSourceLookupCb)(MafwIradioSource *self,
+					 const gchar *uri,
+					 const gchar *const *object_ids,
+					 gpointer user_data,
+					 const GError *error);
+
+/**
+ * MafwIradioSourceBulkLookupCb:
+ * @self: The source
+ * @found: Object-ids as string arrays, by the URIs that are bookmarked, as
+ * given
+ * @user_data: As given
+ * @error: Set if the lookup failed
+ */
+typedef void (*MafwIradioSourceBulkLookupCb)(MafwIradioSource *self,
+					     GHashTable *found,
+					     gpointer user_data,
+					     const GError *error);
+
+void mafw_iradio_source_lookup_uri(MafwIradioSource *self, const gchar *uri,
+				   MafwIradioSourceLookupCb cb,
+				   gpointer user_data);
+void mafw_iradio_source_lookup_uris(MafwIradioSource *self,
+				    const gchar *const *uris,
+				    MafwIradioSourceBulkLookupCb cb,
+				    gpointer user_data);
+
+/*----------------------------------------------------------------------------
+  Bulk import
+  ----------------------------------------------------------------------------*/
+
+typedef struct _MafwIradioBulkWriter MafwIradioBulkWriter;
+
+MafwIradioBulkWriter *mafw_iradio_bulk_writer_new(MafwIradioSource *self,
+						  gboolean check_dups);
+gboolean mafw_iradio_bulk_writer_begin(MafwIradioBulkWriter *writer);
+guint64 mafw_iradio_bulk_writer_add(MafwIradioBulkWriter *writer,
+				    GHashTable *metadata);
+guint64 mafw_iradio_bulk_writer_find(MafwIradioBulkWriter *writer,
+				     GHashTable *metadata);
+gboolean mafw_iradio_bulk_writer_update(MafwIradioBulkWriter *writer,
+					guint64 id, GHashTable *metadata,
+					const gchar *const *replaced_keys);
+gboolean mafw_iradio_bulk_writer_remove(MafwIradioBulkWriter *writer,
+					guint64 id, const gchar *uri);
+gboolean mafw_iradio_bulk_writer_flush(MafwIradioBulkWriter *writer);
+guint mafw_iradio_bulk_writer_finish(MafwIradioBulkWriter *writer,
+				     GError **error);
+
 G_END_DECLS
 
 #endif /* MAFW_IRADIO_SOURCE_H */
@@ -22,14 +22,18 @@
  *
  */
 
+#include <stdio.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
 #include <libmafw/mafw.h>
 #include <libmafw/mafw-db.h>
 #include <libmafw/mafw-metadata-serializer.h>
 #include <libxml/parser.h>
-#include <libxml/tree.h>
+#include <libxml/xmlreader.h>
 #include <string.h>
 
 #include "mafw-iradio-source.h"
+#include "mafw-iradio-db.h"
 #include "mafw-iradio-vendor-setup.h"
 
 /*---------------------------------------------------------------------------
@@ -38,6 +42,8 @@
 
 /** The CONFML file that is parsed by this parser */
 const gchar *vendor_setup_path="/usr/share/pre-installed/mafw-iradio-source-bookmarks/";
+/* Directory the vendor icons are installed to, if not vendor_setup_path */
+const gchar *vendor_icon_path;
 
 /* XML nodes that the parser recognizes from the CONFML file format */
 #define NODE_CONFIGURATION "configuration"
@@ -52,386 +58,1388 @@ const gchar *vendor_setup_path="/usr/share/pre-installed/mafw-iradio-source-book
 #define NODE_LOCALPATH "localPath"
 #define NODE_TARGETPATH "targetPath"
 
-/* Dummy MIME types for audio & video */
-#define MIME_AUDIO "audio/unknown"
-#define MIME_VIDEO "video/unknown"
-
 /*---------------------------------------------------------------------------
-  Bookmark insertion
+  Bookmark hashing
   ---------------------------------------------------------------------------*/
 
-static void mafw_iradio_vendor_bookmark_created(MafwSource *self,
-						 const gchar *object_id,
-						 gpointer user_data,
-						 const GError *error)
+/**
+ * Feeds a bookmark field to @checksum, keeping NULL distinct from "".
+ */
+static void checksum_field(GChecksum *checksum, const gchar *field)
 {
-	if (error != NULL)
-	{
-		g_warning("Unable to create object from vendor bookmarks: %s",
-			  error->message);
-	}
+	if (field != NULL)
+		g_checksum_update(checksum, (const guchar *)field,
+				  strlen(field) + 1);
 	else
-	{
-		g_warning("Object created: %s", object_id);
-	}
+		g_checksum_update(checksum, (const guchar *)"\377", 1);
 }
 
 /**
- * mafw_iradio_create_bookmark_object:
+ * mafw_iradio_bookmark_hash:
  *
- * @self: An iradio source that the object is created to
- * @metadata: Metadata for the created item
+ * @bookmark: A bookmark read from a vendor file
  *
- * Creates a new object into the iradio source's database to be available for
- * browsing & metadata fetching.
+ * Returns: a newly allocated hash of the fields of @bookmark, which tells
+ * whether it has changed between two versions of the vendor file.
  */
-static void mafw_iradio_create_bookmark_object(MafwSource* self,
-						GHashTable* metadata,
-						gboolean check_dups)
+static gchar *mafw_iradio_bookmark_hash(const MafwIradioBookmark *bookmark)
 {
-	time_t curtime = time(NULL);
+	GChecksum *checksum;
+	gchar *duration = NULL;
+	gchar *hash;
 
-	g_assert(self != NULL);
-	g_assert(metadata != NULL);
+	if (bookmark->has_duration)
+		duration = g_strdup_printf("%d", bookmark->duration);
 
-	mafw_metadata_add_long(metadata, MAFW_METADATA_KEY_ADDED,
-					       curtime);
-	if (check_dups)
-	{
-		gpointer value;
-		
-		value = g_hash_table_lookup(metadata, MAFW_METADATA_KEY_URI);
-		if (value)
-		{
-			gchar *serialized_data;
-			gsize str_size = 0;
-			sqlite3_stmt *stmt_dupfind = mafw_db_prepare("SELECT "
-					"id FROM "
-					IRADIO_TABLE " WHERE key = '" 
-					MAFW_METADATA_KEY_URI "' AND value = :value");
-		
-			serialized_data = mafw_metadata_val_freeze(value, &str_size);
-			mafw_db_bind_blob(stmt_dupfind, 0, serialized_data,
-					str_size);
-			g_assert(stmt_dupfind);
-			if (mafw_db_select(stmt_dupfind, FALSE) == SQLITE_ROW)
-			{
-				sqlite3_finalize(stmt_dupfind);
-				g_free(serialized_data);
-				return;
-			}
-			sqlite3_finalize(stmt_dupfind);
-			g_free(serialized_data);
+	checksum = g_checksum_new(G_CHECKSUM_SHA256);
+	checksum_field(checksum, bookmark->title);
+	checksum_field(checksum, bookmark->uri);
+	checksum_field(checksum, bookmark->mime);
+	checksum_field(checksum, bookmark->thumbnail_uri);
+	checksum_field(checksum, duration);
+	hash = g_strdup(g_checksum_get_string(checksum));
+	g_checksum_free(checksum);
+	g_free(duration);
 
-		}
-	}
-	
-	mafw_source_create_object(self,
-				   MAFW_IRADIO_SOURCE_UUID "::",
-				   metadata,
-				   NULL,
-				   mafw_iradio_vendor_bookmark_created);
+	return hash;
 }
 
 /*---------------------------------------------------------------------------
   Bookmark entry parsing
   ---------------------------------------------------------------------------*/
 
+/**
+ * Checks the local name of the reader's current node, ignoring case just
+ * like the CONFML customization tool does.
+ */
+static gboolean confml_node_is(xmlTextReaderPtr reader, const gchar *name)
+{
+	const xmlChar *local;
+
+	local = xmlTextReaderConstLocalName(reader);
+	return local != NULL &&
+		g_ascii_strcasecmp((const gchar *)local, name) == 0;
+}
+
+/**
+ * Returns the text content of the reader's current element as a newly
+ * allocated string.  Only the element's own subtree is expanded.
+ */
+static gchar *confml_read_string(xmlTextReaderPtr reader)
+{
+	xmlChar *content;
+	gchar *str;
+
+	content = xmlTextReaderReadString(reader);
+	str = g_strdup(content != NULL ? (const gchar *)content : "");
+	xmlFree(content);
+	return str;
+}
+
 /**
  * mafw_iradio_parse_bookmark_icon:
  *
- * @self: An iradio source that receives the parsed bookmark
- * @metadata: A GHashTable containing the bookmark item's metadata
+ * @bookmark: The bookmark being read
+ * @localpath: Content of an <Icon>'s <localPath> node
  *
- * Parses a single bookmark's icon node, makes up a URI for the icon and
- * inserts the data into @metadata.
+ * Makes up a URI for the icon and stores it in @bookmark.
  */
-static void mafw_iradio_parse_bookmark_icon(MafwSource* self,
-					     GHashTable* metadata,
-					     xmlNode* root)
+static void mafw_iradio_parse_bookmark_icon(MafwIradioBookmark *bookmark,
+					     const gchar *localpath)
 {
-	xmlNode* current;
-	gchar* icon = NULL;
+	g_free(bookmark->thumbnail_uri);
+	bookmark->thumbnail_uri = NULL;
 
-	current = root->children;
-	while (current != NULL)
+	/* If the icon tag was empty, don't create thumbnail_uri metadata */
+	if (strlen(localpath) != 0)
+	{
+		gchar** array;
+		int last;
+
+		/* Split the icon path to directories and get the last entry
+		   (i.e. the file name) from the array. */
+		array = g_strsplit(localpath, "/", -1);
+		last = g_strv_length(array) - 1;
+
+		/* Construct a valid URI for the thumbnail icon file */
+		bookmark->thumbnail_uri = g_strdup_printf(
+						"file://%s/%s",
+						vendor_icon_path ?
+						vendor_icon_path :
+						vendor_setup_path,
+						array[last]);
+		g_debug("THUMBNAIL_URI: %s", bookmark->thumbnail_uri);
+		g_strfreev(array);
+	}
+}
+
+/**
+ * mafw_iradio_parse_bookmark_field:
+ *
+ * @bookmark: The bookmark being read
+ * @reader: A reader positioned on a child element of the bookmark
+ *
+ * Reads a single <Name>, <URI> or <Duration> node into @bookmark.
+ */
+static void mafw_iradio_parse_bookmark_field(MafwIradioBookmark *bookmark,
+					      xmlTextReaderPtr reader)
+{
+	if (confml_node_is(reader, NODE_NAME))
 	{
-		if (g_ascii_strcasecmp((const gchar*) current->name,
-					NODE_LOCALPATH) == 0)
+		g_free(bookmark->title);
+		bookmark->title = confml_read_string(reader);
+		g_debug("TITLE: %s", bookmark->title);
+	}
+	else if (confml_node_is(reader, NODE_DURATION))
+	{
+		gchar *durationstr;
+		gchar *strtail = NULL;
+		gint duration;
+
+		durationstr = confml_read_string(reader);
+		duration = strtol(durationstr, &strtail, 10);
+		g_debug("Duration: %d", duration);
+		if (!strtail || strtail[0] == 0)
 		{
-			xmlChar* localpath;
+			bookmark->duration = duration;
+			bookmark->has_duration = TRUE;
+		}
+		g_free(durationstr);
+	}
+	else if (confml_node_is(reader, NODE_URI))
+	{
+		g_free(bookmark->uri);
+		bookmark->uri = confml_read_string(reader);
+		g_debug("URI: %s", bookmark->uri);
+	}
+}
 
-			localpath = xmlNodeGetContent(current);
-			if (localpath != NULL &&
-			    strlen((const gchar*) localpath) != 0)
-			{
-				gchar** array;
-				int last;
+/*---------------------------------------------------------------------------
+  CONFML file parsing
+  ---------------------------------------------------------------------------*/
 
-				/* Split the icon path to directories */
-				array = g_strsplit((const gchar*) localpath,
-						   "/", -1);
+struct _MafwIradioConfmlReader {
+	xmlTextReaderPtr reader;
+	gchar *path;
+	MafwIradioBookmark bookmark;
+	/* Number of <configuration>/<data> ancestors of the current node */
+	gint path_depth;
+	/* Depth of <mafw-iradio-source-bookmarks>, -1 until it is found */
+	gint list_depth;
+	gboolean in_bookmark;
+	gboolean in_icon;
+	gboolean done;
+	gboolean error;
+};
 
-				/* Get the last entry (i.e. the file name) from
-				   the array. */
-				last = g_strv_length(array) - 1;
-				icon = g_strdup(array[last]);
+/**
+ * mafw_iradio_confml_reader_new:
+ *
+ * @path: Path of a .confml file
+ *
+ * Opens a .confml file that should contain vendor-specific custom bookmarks
+ * for reading with mafw_iradio_confml_reader_next().  The file is streamed
+ * through an xmlTextReader, so only the bookmark being read is kept in memory
+ * no matter how large the file is.
+ *
+ * The format is roughly like this:
+ * <configuration ...>
+ *  <data>
+ *   <mafw-iradio-source-bookmarks>
+ *    [<IRadioChannel>|<VideoBookmark>]
+ *     <Name>...</Name>
+ *     <URI>...</URI>
+ *     <Icon>
+ *      <targetPath>...</targetPath>
+ *      <localPath>...</localPath>
+ *     </Icon>
+ *    [</IRadioChannel>|</VideoBookmark>]
+ *    ...
+ *   </mafw-iradio-source-bookmarks>
+ *  </data>
+ * </configuration ...>
+ *
+ * Returns: a new reader, or NULL if the file cannot be opened.
+ */
+MafwIradioConfmlReader *mafw_iradio_confml_reader_new(const gchar *path)
+{
+	MafwIradioConfmlReader *reader;
+	xmlTextReaderPtr xml_reader;
 
-				g_strfreev(array);
-			}
-			else
-			{
-				/* Don't do anything if the tag is empty */
-				icon = NULL;
-			}
+	g_assert(path != NULL);
 
-			xmlFree(localpath);
-		}
+	/* This initializes the library and checks for potential ABI mismatches
+	   between the version it was compiled for and the actual shared lib */
+	LIBXML_TEST_VERSION
 
-		current = current->next;
+	xml_reader = xmlReaderForFile(path, NULL, XML_PARSE_NONET);
+	if (xml_reader == NULL)
+	{
+		g_debug("Unable to open confml file %s", path);
+		return NULL;
 	}
 
-	/* If the icon tag was empty, don't create thumbnail_uri metadata */
-	if (icon != NULL)
-	{
-		gchar* thumbnail_uri;
+	reader = g_new0(MafwIradioConfmlReader, 1);
+	reader->reader = xml_reader;
+	reader->path = g_strdup(path);
+	reader->list_depth = -1;
 
-		/* Construct a valid URI for the thumbnail icon file */
-		thumbnail_uri = g_strdup_printf("file://%s/%s",
-						vendor_setup_path, icon);
-		g_debug("THUMBNAIL_URI: %s", thumbnail_uri);
-		mafw_metadata_add_str(metadata,
-				       MAFW_METADATA_KEY_THUMBNAIL_URI,
-				       thumbnail_uri);
-		g_free(icon);
-		g_free(thumbnail_uri);
-	}
+	return reader;
 }
 
 /**
- * mafw_iradio_parse_bookmark:
+ * mafw_iradio_confml_reader_next:
  *
- * @self: An iradio source that receives the parsed bookmark
- * @root: Either a <IRadioChannel> or a <VideoBookmark> node
- * 
+ * @reader: A confml reader
  *
- * Parses a single bookmark node and inserts it into the iradio source (@self)
- * along with some metadata values (Name, URI & Icon).
+ * Reads the next bookmark from the file.  The returned bookmark is owned by
+ * @reader and is overwritten by the next call.
+ *
+ * Returns: the next bookmark, or NULL at the end of the bookmark list.
  */
-static void mafw_iradio_parse_bookmark(MafwSource* self, xmlNode* root,
-					gboolean check_dups)
+const MafwIradioBookmark *mafw_iradio_confml_reader_next(
+					MafwIradioConfmlReader *reader)
 {
-	GHashTable* metadata;
-	xmlNode* current;
+	xmlTextReaderPtr xml_reader;
+	gint ret;
 
-	g_assert(self != NULL);
-	g_assert(root != NULL);
+	g_assert(reader != NULL);
 
-	metadata = mafw_metadata_new();
+	mafw_iradio_bookmark_clear(&reader->bookmark);
+	if (reader->done)
+		return NULL;
 
-	current = root->children;
-	while (current != NULL)
+	xml_reader = reader->reader;
+	while ((ret = xmlTextReaderRead(xml_reader)) == 1)
 	{
-		if (g_ascii_strcasecmp((const gchar*) current->name,
-				       NODE_NAME) == 0)
+		gint type, depth;
+
+		type = xmlTextReaderNodeType(xml_reader);
+		depth = xmlTextReaderDepth(xml_reader);
+
+		if (type == XML_READER_TYPE_END_ELEMENT)
 		{
-			xmlChar* title;
-
-			title = xmlNodeGetContent(current);
-			g_debug("TITLE: %s", title);
-			mafw_metadata_add_str(metadata,
-					       MAFW_METADATA_KEY_TITLE,
-					       (const gchar *)title);
-			xmlFree(title);
+			if (reader->in_bookmark &&
+			    depth == reader->list_depth + 1)
+			{
+				reader->in_bookmark = FALSE;
+				return &reader->bookmark;
+			}
+			else if (reader->in_icon &&
+				 depth == reader->list_depth + 2)
+			{
+				reader->in_icon = FALSE;
+			}
+			else if (reader->list_depth >= 0 &&
+				 depth == reader->list_depth)
+			{
+				/* Only the first bookmark list is used */
+				break;
+			}
+			else if (reader->list_depth < 0 &&
+				 depth == reader->path_depth - 1)
+			{
+				reader->path_depth--;
+			}
+			continue;
 		}
-		else if (g_ascii_strcasecmp((const gchar*) current->name,
-				       NODE_DURATION) == 0)
+		else if (type != XML_READER_TYPE_ELEMENT)
 		{
-			xmlChar* durationstr;
-			gint duration;
-			gchar *strtail = NULL;
-
-			durationstr = xmlNodeGetContent(current);
-			duration = strtol((const char*)durationstr, &strtail, 10);
-			g_debug("Duration: %d", duration);
-			if (!strtail || strtail[0] == 0)
-				mafw_metadata_add_int(metadata,
-					       MAFW_METADATA_KEY_DURATION,
-					       duration);
-			xmlFree(durationstr);
+			continue;
 		}
-		else if (g_ascii_strcasecmp((const gchar *)current->name,
-					NODE_URI) == 0)
-		{
-			const gchar* mime;
-			xmlChar* uri;
 
-			uri = xmlNodeGetContent(current);
-			g_debug("URI: %s", uri);
+		if (reader->list_depth < 0)
+		{
+			/* Skip inside until we find the actual channel
+			   nodes */
+			if (depth != reader->path_depth)
+				continue;
+			if (confml_node_is(xml_reader, NODE_CONFIGURATION) ||
+			    confml_node_is(xml_reader, NODE_DATA))
+			{
+				if (!xmlTextReaderIsEmptyElement(xml_reader))
+					reader->path_depth++;
+			}
+			else if (confml_node_is(xml_reader,
+						NODE_IRADIO_BOOKMARKS))
+			{
+				reader->list_depth = depth;
+				if (xmlTextReaderIsEmptyElement(xml_reader))
+					break;
+			}
+		}
+		else if (depth == reader->list_depth + 1)
+		{
+			/* Now we should be inside a node that contains IRadio
+			   channels and video bookmarks */
+			if (!confml_node_is(xml_reader, NODE_CHANNEL) &&
+			    !confml_node_is(xml_reader, NODE_VIDEO))
+				continue;
 
 			/* Dumbest way for putting a mime type here, but this
 			   is enough for FMP. Besides, the customization tool
 			   (that produces .confml files) doesn't support mime
 			   type setting. */
-			if (strcmp((const gchar*) root->name,
+			if (strcmp((const gchar *)
+				   xmlTextReaderConstLocalName(xml_reader),
 				   NODE_CHANNEL) == 0)
-			{
-				mime = "audio/unknown";
-			}
+				reader->bookmark.mime =
+					g_strdup(MAFW_IRADIO_MIME_AUDIO);
 			else
-			{
-				mime = "video/unknown";
-			}
-			g_debug("MIME: %s", mime);
-
-			mafw_metadata_add_str(metadata,
-					       MAFW_METADATA_KEY_URI,
-					       (const gchar *)uri);
-			mafw_metadata_add_str(metadata,
-					       MAFW_METADATA_KEY_MIME,
-					       (const gchar *)mime);
-			xmlFree(uri);
+				reader->bookmark.mime =
+					g_strdup(MAFW_IRADIO_MIME_VIDEO);
+			g_debug("MIME: %s", reader->bookmark.mime);
+
+			if (xmlTextReaderIsEmptyElement(xml_reader))
+				return &reader->bookmark;
+			reader->in_bookmark = TRUE;
 		}
-		else if (g_ascii_strcasecmp((const gchar *)current->name,
-					NODE_ICON) == 0)
+		else if (reader->in_bookmark &&
+			 depth == reader->list_depth + 2)
+		{
+			if (confml_node_is(xml_reader, NODE_ICON))
+				reader->in_icon = !xmlTextReaderIsEmptyElement(
+								xml_reader);
+			else
+				mafw_iradio_parse_bookmark_field(
+						&reader->bookmark, xml_reader);
+		}
+		else if (reader->in_icon && depth == reader->list_depth + 3 &&
+			 confml_node_is(xml_reader, NODE_LOCALPATH))
 		{
 			/* Parse an icon entry */
-			mafw_iradio_parse_bookmark_icon(self, metadata,
-							 current);
+			gchar *localpath;
+
+			localpath = confml_read_string(xml_reader);
+			mafw_iradio_parse_bookmark_icon(&reader->bookmark,
+							localpath);
+			g_free(localpath);
 		}
+	}
 
-		current = current->next;
+	if (ret < 0)
+	{
+		g_warning("Error while parsing confml file %s", reader->path);
+		reader->error = TRUE;
 	}
 
-	/* Create an object to the IRadio database */
-	mafw_iradio_create_bookmark_object(self, metadata, check_dups);
+	mafw_iradio_bookmark_clear(&reader->bookmark);
+	reader->done = TRUE;
+	return NULL;
+}
+
+/**
+ * mafw_iradio_confml_reader_close:
+ *
+ * @reader: A confml reader
+ *
+ * Frees @reader.
+ *
+ * Returns: TRUE if the bookmark list was found in the file and read without
+ * errors, otherwise FALSE.
+ */
+gboolean mafw_iradio_confml_reader_close(MafwIradioConfmlReader *reader)
+{
+	gboolean found;
+
+	g_assert(reader != NULL);
+
+	found = reader->list_depth >= 0 && !reader->error;
+	mafw_iradio_bookmark_clear(&reader->bookmark);
+	xmlFreeTextReader(reader->reader);
+	g_free(reader->path);
+	g_free(reader);
 
-	/* Get rid of the metadata now that the stuff has been uploaded */
-	g_hash_table_unref(metadata);
+	return found;
+}
+
+/**
+ * mafw_iradio_read_confml_file:
+ *
+ * @path: Path of a .confml file
+ * @func: Called once for every bookmark found in the file
+ * @user_data: Passed to @func
+ *
+ * Reads a whole .confml file with a #MafwIradioConfmlReader and hands the
+ * bookmarks to @func one at a time.
+ *
+ * Returns: TRUE if the bookmark list was found, otherwise FALSE.
+ */
+gboolean mafw_iradio_read_confml_file(const gchar *path,
+				       MafwIradioBookmarkFunc func,
+				       gpointer user_data)
+{
+	MafwIradioConfmlReader *reader;
+	const MafwIradioBookmark *bookmark;
+
+	g_assert(func != NULL);
+
+	reader = mafw_iradio_confml_reader_new(path);
+	if (reader == NULL)
+		return FALSE;
+
+	while ((bookmark = mafw_iradio_confml_reader_next(reader)) != NULL)
+		func(bookmark, user_data);
+
+	return mafw_iradio_confml_reader_close(reader);
 }
 
 /*---------------------------------------------------------------------------
-  CONFML file parsing
+  Vendor setup
   ---------------------------------------------------------------------------*/
 
+/* Bookmarks handed from a parser thread to the writer at a time */
+#define VENDOR_SETUP_BATCH 64
+
+/* Keys that come from the vendor file, replaced when a bookmark changes */
+static const gchar *const vendor_keys[] = {
+	MAFW_METADATA_KEY_TITLE,
+	MAFW_METADATA_KEY_DURATION,
+	MAFW_METADATA_KEY_URI,
+	MAFW_METADATA_KEY_MIME,
+	MAFW_METADATA_KEY_THUMBNAIL_URI,
+	NULL
+};
+
+/* A bookmark of a vendor file, as stored by the previous setup */
+struct vendor_entry {
+	gchar *uri;
+	/* Object created from the bookmark, 0 if it is new */
+	guint64 id;
+	/* Whether the setup created the object, rather than found it */
+	gboolean owned;
+	gchar *hash;
+	/* Metadata to store if the bookmark is new or has changed */
+	GHashTable *metadata;
+	/* Whether the bookmark is still in the vendor file */
+	gboolean seen;
+};
+
+/* A bookmark read by a parser thread */
+struct vendor_record {
+	MafwIradioBookmark bookmark;
+	gchar *hash;
+};
+
+/* A vendor file that is new or has been modified since the last setup */
+struct vendor_file {
+	/* Name of the file within vendor_setup_path */
+	gchar *name;
+	gchar *path;
+	time_t mtime;
+	/* Digest stored by the previous setup, NULL for a new file */
+	gchar *digest;
+	/* Set by the parser thread before the file's last batch */
+	gchar *new_digest;
+	gboolean unchanged;
+	gboolean failed;
+	/* Bookmarks stored from the file by URI, NULL for a new file, whose
+	 * bookmarks are imported as they are read */
+	GHashTable *entries;
+	/* Entries with metadata to store, in file order */
+	GQueue changes;
+};
+
+/* Passed from a parser thread to the writer; records are NULL once the
+ * whole file has been read */
+struct vendor_batch {
+	struct vendor_file *file;
+	GPtrArray *records;
+	/* Records stored so far */
+	guint written;
+};
+
+/* Dispatches the batches queued by the parser threads */
+struct vendor_source {
+	GSource source;
+	MafwIradioVendorSetup *setup;
+};
+
+struct _MafwIradioVendorSetup {
+	MafwIradioSource *self;
+	MafwIradioBulkWriter *writer;
+	GThreadPool *pool;
+	GAsyncQueue *queue;
+	GMainContext *context;
+	GSource *source;
+	GList *files;
+	/* Number of files whose last batch has not been written yet */
+	guint pending;
+	/* Names of the files that have been removed since the last setup */
+	GSList *vanished;
+	/* Batch written by the job on the database thread, NULL for the
+	   last job, see vendor_setup_write() */
+	struct vendor_batch *batch;
+	gboolean busy;
+	volatile gint cancelled;
+	sqlite3_stmt *stmt_set_bookmark;
+	time_t added;
+	MafwIradioVendorSetupDoneCb done_cb;
+	gpointer user_data;
+};
+
+static void vendor_entry_free(struct vendor_entry *entry)
+{
+	g_free(entry->uri);
+	g_free(entry->hash);
+	if (entry->metadata)
+		g_hash_table_unref(entry->metadata);
+	g_free(entry);
+}
+
+static void vendor_record_free(struct vendor_record *record)
+{
+	mafw_iradio_bookmark_clear(&record->bookmark);
+	g_free(record->hash);
+	g_free(record);
+}
+
+static void vendor_file_free(struct vendor_file *file)
+{
+	g_free(file->name);
+	g_free(file->path);
+	g_free(file->digest);
+	g_free(file->new_digest);
+	if (file->entries)
+		g_hash_table_destroy(file->entries);
+	g_queue_clear(&file->changes);
+	g_free(file);
+}
+
+static void vendor_batch_free(struct vendor_batch *batch)
+{
+	if (batch->records)
+		g_ptr_array_free(batch->records, TRUE);
+	g_free(batch);
+}
+
 /**
- * mafw_iradio_parse_xml_customization:
- *
- * @self: An iradio source that should receive the bookmarks from the XML tree
- * @root: The root node of an XML tree that has been read from a .confml file
- *
- * Parses an XML node tree that should contain vendor-specific custom bookmarks
- * (in .confml format) that are then inserted to the iradio source's database.
+ * Tells whether @name looks like a vendor bookmark file.
+ */
+static gboolean is_vendor_file(const gchar *name)
+{
+	static const gchar *const suffixes[] = { ".confml", ".xml", NULL };
+	gsize len, suffix_len;
+	guint i;
+
+	len = strlen(name);
+	for (i = 0; suffixes[i]; i++)
+	{
+		suffix_len = strlen(suffixes[i]);
+		if (len > suffix_len &&
+		    g_ascii_strcasecmp(name + len - suffix_len,
+				       suffixes[i]) == 0)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/**
+ * Loads the modification time and the digest every vendor file had when it
+ * was last imported, into a hash table of #vendor_file keyed by name.
+ */
+static GHashTable *load_vendor_files(void)
+{
+	GHashTable *files;
+	sqlite3_stmt *stmt;
+
+	files = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+				      (GDestroyNotify)vendor_file_free);
+	stmt = mafw_iradio_db_prepare("SELECT file, mtime, digest FROM "
+			       IRADIO_VENDOR_FILES_TABLE);
+	while (mafw_iradio_db_select(stmt, FALSE) == SQLITE_ROW)
+	{
+		struct vendor_file *file;
+
+		file = g_new0(struct vendor_file, 1);
+		file->name = g_strdup(mafw_db_column_text(stmt, 0));
+		file->mtime = mafw_db_column_int64(stmt, 1);
+		file->digest = g_strdup(mafw_db_column_text(stmt, 2));
+		g_queue_init(&file->changes);
+		g_hash_table_insert(files, file->name, file);
+	}
+	sqlite3_finalize(stmt);
+
+	return files;
+}
+
+/**
+ * Loads the bookmarks that were imported from the vendor file @name into a
+ * hash table keyed by URI.
+ */
+static GHashTable *load_vendor_entries(const gchar *name)
+{
+	GHashTable *entries;
+	sqlite3_stmt *stmt;
+
+	entries = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+					(GDestroyNotify)vendor_entry_free);
+	stmt = mafw_iradio_db_prepare("SELECT uri, id, hash, owned FROM "
+			       IRADIO_VENDOR_TABLE " WHERE file = :file");
+	mafw_db_bind_text(stmt, 0, name);
+	while (mafw_iradio_db_select(stmt, FALSE) == SQLITE_ROW)
+	{
+		struct vendor_entry *entry;
+
+		entry = g_new0(struct vendor_entry, 1);
+		entry->uri = g_strdup(mafw_db_column_text(stmt, 0));
+		entry->id = mafw_db_column_int64(stmt, 1);
+		entry->hash = g_strdup(mafw_db_column_text(stmt, 2));
+		entry->owned = mafw_db_column_int64(stmt, 3) != 0;
+		g_hash_table_insert(entries, entry->uri, entry);
+	}
+	sqlite3_finalize(stmt);
+
+	return entries;
+}
+
+/**
+ * Records that the bookmark with @uri in @file has been stored as object @id,
+ * which the setup created if @owned.
+ */
+static void store_vendor_bookmark(MafwIradioVendorSetup *setup,
+				  struct vendor_file *file, const gchar *uri,
+				  guint64 id, const gchar *hash,
+				  gboolean owned)
+{
+	if (setup->stmt_set_bookmark == NULL)
+		setup->stmt_set_bookmark = mafw_iradio_db_prepare(
+				"INSERT OR REPLACE INTO " IRADIO_VENDOR_TABLE
+				"(uri, file, id, hash, owned) "
+				"VALUES(:uri, :file, :id, :hash, :owned)");
+
+	mafw_db_bind_text(setup->stmt_set_bookmark, 0, uri);
+	mafw_db_bind_text(setup->stmt_set_bookmark, 1, file->name);
+	mafw_db_bind_int64(setup->stmt_set_bookmark, 2, id);
+	mafw_db_bind_text(setup->stmt_set_bookmark, 3, hash);
+	mafw_db_bind_int64(setup->stmt_set_bookmark, 4, owned);
+	if (mafw_iradio_db_change(setup->stmt_set_bookmark, FALSE)
+	    != SQLITE_DONE)
+		g_critical("Database error");
+	sqlite3_reset(setup->stmt_set_bookmark);
+}
+
+static void delete_vendor_bookmark(struct vendor_file *file, const gchar *uri)
+{
+	sqlite3_stmt *stmt;
+
+	stmt = mafw_iradio_db_prepare("DELETE FROM " IRADIO_VENDOR_TABLE
+			       " WHERE file = :file AND uri = :uri");
+	mafw_db_bind_text(stmt, 0, file->name);
+	mafw_db_bind_text(stmt, 1, uri);
+	if (mafw_iradio_db_delete(stmt) != SQLITE_DONE)
+		g_critical("Database error");
+	sqlite3_finalize(stmt);
+}
+
+/**
+ * Removes the object of @entry, whose row is gone, if the setup created it
+ * and no other vendor file lists it.  Otherwise the files still listing it
+ * own it from now on.
+ */
+static void release_vendor_object(MafwIradioVendorSetup *setup,
+				  struct vendor_entry *entry)
+{
+	sqlite3_stmt *stmt;
+	gint listed;
+
+	if (!entry->owned)
+		return;
+
+	stmt = mafw_iradio_db_prepare("UPDATE " IRADIO_VENDOR_TABLE
+				      " SET owned = 1 WHERE id = :id");
+	mafw_db_bind_int64(stmt, 0, entry->id);
+	if (mafw_iradio_db_change(stmt, FALSE) != SQLITE_DONE)
+		g_critical("Database error");
+	listed = mafw_iradio_db_nchanges();
+	sqlite3_finalize(stmt);
+
+	if (listed == 0)
+		mafw_iradio_bulk_writer_remove(setup->writer, entry->id,
+					       entry->uri);
+}
+
+/**
+ * Stores the modification time and the digest of @file, in the transaction
+ * of the setup's writer.
+ */
+static void store_vendor_file(MafwIradioVendorSetup *setup,
+			      struct vendor_file *file)
+{
+	sqlite3_stmt *stmt;
+
+	if (!mafw_iradio_bulk_writer_begin(setup->writer))
+		return;
+
+	stmt = mafw_iradio_db_prepare("INSERT OR REPLACE INTO "
+				      IRADIO_VENDOR_FILES_TABLE
+				      "(file, mtime, digest) "
+				      "VALUES(:file, :mtime, :digest)");
+	mafw_db_bind_text(stmt, 0, file->name);
+	mafw_db_bind_int64(stmt, 1, file->mtime);
+	mafw_db_bind_text(stmt, 2, file->new_digest);
+	if (mafw_iradio_db_change(stmt, FALSE) != SQLITE_DONE)
+		g_critical("Database error");
+	sqlite3_finalize(stmt);
+}
+
+/**
+ * Removes the objects created from the vendor file @name, which is gone, and
+ * forgets about the file.
+ */
+static void remove_vendor_file(MafwIradioVendorSetup *setup, const gchar *name)
+{
+	struct vendor_entry *entry;
+	GHashTableIter iter;
+	GHashTable *entries;
+	sqlite3_stmt *stmt;
+
+	g_debug("Vendor file %s has been removed", name);
+	if (!mafw_iradio_bulk_writer_begin(setup->writer))
+		return;
+
+	entries = load_vendor_entries(name);
+	stmt = mafw_iradio_db_prepare("DELETE FROM " IRADIO_VENDOR_TABLE
+			       " WHERE file = :file");
+	mafw_db_bind_text(stmt, 0, name);
+	if (mafw_iradio_db_delete(stmt) != SQLITE_DONE)
+		g_critical("Database error");
+	sqlite3_finalize(stmt);
+
+	g_hash_table_iter_init(&iter, entries);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&entry))
+		release_vendor_object(setup, entry);
+	g_hash_table_destroy(entries);
+
+	stmt = mafw_iradio_db_prepare("DELETE FROM " IRADIO_VENDOR_FILES_TABLE
+			       " WHERE file = :file");
+	mafw_db_bind_text(stmt, 0, name);
+	if (mafw_iradio_db_delete(stmt) != SQLITE_DONE)
+		g_critical("Database error");
+	sqlite3_finalize(stmt);
+}
+
+/**
+ * Commits what @setup has written, frees it and returns the number of
+ * objects created, updated or removed.  The parser threads are stopped
+ * first if they are still running.  The job on the database thread must
+ * have run; if its done function is still to come, that one frees @setup
+ * itself.
+ */
+static guint vendor_setup_free(MafwIradioVendorSetup *setup)
+{
+	struct vendor_batch *batch;
+	GError *error = NULL;
+	guint changed;
+
+	g_atomic_int_set(&setup->cancelled, TRUE);
+	g_thread_pool_free(setup->pool, TRUE, TRUE);
+	while ((batch = g_async_queue_try_pop(setup->queue)) != NULL)
+		vendor_batch_free(batch);
+	g_async_queue_unref(setup->queue);
+
+	g_source_destroy(setup->source);
+	g_source_unref(setup->source);
+	g_main_context_unref(setup->context);
+
+	if (setup->batch)
+		vendor_batch_free(setup->batch);
+	g_list_free_full(setup->files, (GDestroyNotify)vendor_file_free);
+	g_slist_free_full(setup->vanished, g_free);
+	if (setup->stmt_set_bookmark)
+		sqlite3_finalize(setup->stmt_set_bookmark);
+
+	changed = mafw_iradio_bulk_writer_finish(setup->writer, &error);
+	if (error != NULL)
+	{
+		g_warning("Unable to store vendor bookmarks: %s",
+			  error->message);
+		g_error_free(error);
+	}
+	if (!setup->busy)
+		g_free(setup);
+
+	return changed;
+}
+
+/**
+ * Hands a batch over to the writer in the main context.
+ */
+static void vendor_setup_push(MafwIradioVendorSetup *setup,
+			      struct vendor_file *file, GPtrArray *records)
+{
+	struct vendor_batch *batch;
+
+	batch = g_new0(struct vendor_batch, 1);
+	batch->file = file;
+	batch->records = records;
+	g_async_queue_push(setup->queue, batch);
+	g_main_context_wakeup(setup->context);
+}
+
+/**
+ * Hashes @path and stores the digest into @file.
  *
- * The format is roughly like this:
- * <configuration ...>
- *  <data>
- *   <mafw-iradio-source-bookmarks>
- *    [<IRadioChannel>|<VideoBookmark>]
- *     <Name>...</Name>
- *     <URI>...</URI>
- *     <Icon>
- *      <targetPath>...</targetPath>
- *      <localPath>...</localPath>
- *     </Icon>
- *    [</IRadioChannel>|</VideoBookmark>]
- *    ...
- *   </mafw-iradio-source-bookmarks>
- *  </data>
- * </configuration ...>
+ * Returns: FALSE if the file could not be read.
  */
-static gboolean mafw_iradio_parse_confml(MafwSource* self, xmlNode* root,
-						gboolean check_dups)
+static gboolean vendor_file_digest(struct vendor_file *file)
 {
-	xmlNode* current;
-	gboolean result = FALSE;
+	GChecksum *checksum;
+	guchar buf[8192];
+	gboolean retval;
+	gsize len;
+	FILE *fp;
+
+	fp = g_fopen(file->path, "rb");
+	if (fp == NULL)
+		return FALSE;
 
-	g_assert(root != NULL);
+	checksum = g_checksum_new(G_CHECKSUM_SHA256);
+	while ((len = fread(buf, 1, sizeof(buf), fp)) > 0)
+		g_checksum_update(checksum, buf, len);
+	retval = !ferror(fp);
+	fclose(fp);
 
-	/* Skip inside until we find the actual channel nodes */
-	current = root;
-	while (current != NULL)
+	file->new_digest = g_strdup(g_checksum_get_string(checksum));
+	g_checksum_free(checksum);
+
+	return retval;
+}
+
+/**
+ * Runs in a parser thread: hashes @file and, unless its digest is the same
+ * as last time, reads its bookmarks and passes them to the writer in
+ * batches.
+ */
+static void vendor_setup_parse(struct vendor_file *file,
+			       MafwIradioVendorSetup *setup)
+{
+	MafwIradioConfmlReader *reader;
+	const MafwIradioBookmark *bookmark;
+	struct vendor_record *record;
+	GPtrArray *records;
+
+	if (!vendor_file_digest(file))
+	{
+		file->failed = TRUE;
+		goto out;
+	}
+
+	if (file->digest != NULL && strcmp(file->digest,
+					   file->new_digest) == 0)
+	{
+		/* Only the modification time has changed */
+		file->unchanged = TRUE;
+		goto out;
+	}
+
+	reader = mafw_iradio_confml_reader_new(file->path);
+	if (reader == NULL)
 	{
-		if (g_ascii_strcasecmp((const gchar *)current->name,
-					NODE_CONFIGURATION) == 0
-		    || g_ascii_strcasecmp((const gchar *)current->name,
-			    NODE_DATA) == 0)
+		file->failed = TRUE;
+		goto out;
+	}
+
+	records = g_ptr_array_new_with_free_func(
+					(GDestroyNotify)vendor_record_free);
+	while (!g_atomic_int_get(&setup->cancelled) &&
+	       (bookmark = mafw_iradio_confml_reader_next(reader)) != NULL)
+	{
+		/* The URI identifies the bookmark between setups */
+		if (bookmark->uri == NULL)
 		{
-			/* Skip to node's children and continue the search */
-			current = current->children;
+			g_debug("URI is missing");
 			continue;
 		}
-		else if (g_ascii_strcasecmp((const gchar *)current->name,
-					     NODE_IRADIO_BOOKMARKS) == 0)
+
+		record = g_new0(struct vendor_record, 1);
+		record->bookmark.title = g_strdup(bookmark->title);
+		record->bookmark.uri = g_strdup(bookmark->uri);
+		record->bookmark.mime = g_strdup(bookmark->mime);
+		record->bookmark.thumbnail_uri =
+			g_strdup(bookmark->thumbnail_uri);
+		record->bookmark.duration = bookmark->duration;
+		record->bookmark.has_duration = bookmark->has_duration;
+		record->hash = mafw_iradio_bookmark_hash(bookmark);
+		g_ptr_array_add(records, record);
+
+		if (records->len == VENDOR_SETUP_BATCH)
 		{
-			/* Skip to node's children and stop searching */
-			current = current->children;
-			result = TRUE;
-			break;
+			vendor_setup_push(setup, file, records);
+			records = g_ptr_array_new_with_free_func(
+					(GDestroyNotify)vendor_record_free);
 		}
+	}
+	if (!mafw_iradio_confml_reader_close(reader))
+		file->failed = TRUE;
 
-		current = current->next;
+	if (records->len > 0)
+		vendor_setup_push(setup, file, records);
+	else
+		g_ptr_array_free(records, TRUE);
+
+out:
+	vendor_setup_push(setup, file, NULL);
+}
+
+/**
+ * Handles a bookmark read from a vendor file.  A new file's bookmarks are
+ * imported right away, otherwise they are compared against the bookmark
+ * stored with the same URI and queued if they are new or have changed.
+ */
+static void vendor_setup_bookmark(MafwIradioVendorSetup *setup,
+				  struct vendor_file *file,
+				  struct vendor_record *record)
+{
+	const MafwIradioBookmark *bookmark = &record->bookmark;
+	struct vendor_entry *entry;
+	GHashTable *metadata;
+	gboolean owned;
+	guint64 id;
+
+	metadata = mafw_iradio_bookmark_to_metadata(bookmark);
+
+	if (file->entries == NULL)
+	{
+		mafw_metadata_add_long(metadata, MAFW_METADATA_KEY_ADDED,
+				       setup->added);
+		id = mafw_iradio_bulk_writer_add(setup->writer, metadata);
+		owned = id != 0;
+		if (id == 0)
+			id = mafw_iradio_bulk_writer_find(setup->writer,
+							  metadata);
+		if (id)
+			store_vendor_bookmark(setup, file, bookmark->uri, id,
+					      record->hash, owned);
+		g_hash_table_unref(metadata);
+		return;
+	}
+
+	entry = g_hash_table_lookup(file->entries, bookmark->uri);
+	if (entry == NULL)
+	{
+		mafw_metadata_add_long(metadata, MAFW_METADATA_KEY_ADDED,
+				       setup->added);
+		entry = g_new0(struct vendor_entry, 1);
+		entry->uri = g_strdup(bookmark->uri);
+		entry->hash = record->hash;
+		entry->metadata = metadata;
+		record->hash = NULL;
+		g_hash_table_insert(file->entries, entry->uri, entry);
+		g_queue_push_tail(&file->changes, entry);
+	}
+	else if (!entry->seen && strcmp(entry->hash, record->hash) != 0)
+	{
+		g_free(entry->hash);
+		entry->hash = record->hash;
+		entry->metadata = metadata;
+		record->hash = NULL;
+		g_queue_push_tail(&file->changes, entry);
+	}
+	else
+	{
+		/* Unchanged, or a duplicate within the file */
+		g_hash_table_unref(metadata);
 	}
+	entry->seen = TRUE;
+}
+
+/**
+ * Applies the differences between @file and the previous setup: adds the
+ * new bookmarks, updates the changed ones and removes those that are gone,
+ * if the setup created them.  Objects destroyed by the user are not
+ * brought back.
+ */
+static void vendor_setup_apply(MafwIradioVendorSetup *setup,
+			       struct vendor_file *file)
+{
+	struct vendor_entry *entry;
+	GHashTableIter iter;
 
-	/* Now we should be inside a node that contains IRadio channels and
-	   video bookmarks */
-	while (current != NULL)
+	while ((entry = g_queue_pop_head(&file->changes)) != NULL)
 	{
-		if (g_ascii_strcasecmp((const gchar *)current->name,
-					NODE_CHANNEL) == 0 ||
-		    g_ascii_strcasecmp((const gchar *)current->name,
-			    NODE_VIDEO) == 0)
+		if (entry->id == 0)
+		{
+			entry->id = mafw_iradio_bulk_writer_add(
+						setup->writer, entry->metadata);
+			entry->owned = entry->id != 0;
+			/* Bookmarks stored already are taken over as they
+			   are, so that later versions of the file update
+			   them, but they are not removed with it */
+			if (entry->id == 0)
+				entry->id = mafw_iradio_bulk_writer_find(
+						setup->writer, entry->metadata);
+			if (entry->id == 0)
+				continue;
+		}
+		else
 		{
-			/* Parse the node as audio */
-			mafw_iradio_parse_bookmark(self, current, check_dups);
+			mafw_iradio_bulk_writer_update(setup->writer, entry->id,
+						       entry->metadata,
+						       vendor_keys);
 		}
+		store_vendor_bookmark(setup, file, entry->uri, entry->id,
+				      entry->hash, entry->owned);
+	}
 
-		current = current->next;
+	g_hash_table_iter_init(&iter, file->entries);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&entry))
+	{
+		if (entry->seen)
+			continue;
+		delete_vendor_bookmark(file, entry->uri);
+		release_vendor_object(setup, entry);
 	}
+}
 
-	return result;
+/**
+ * Called once the last batch of @file has been written.  The changes of a
+ * modified file are applied together with its new state in one transaction.
+ */
+static void vendor_setup_file_done(MafwIradioVendorSetup *setup,
+				   struct vendor_file *file)
+{
+	if (file->failed)
+	{
+		/* Keep the previous state, the file is tried again next
+		   time */
+		g_warning("Unable to import vendor file %s", file->path);
+		return;
+	}
+
+	if (file->unchanged)
+		g_debug("Vendor file %s is unchanged", file->path);
+	else if (file->entries)
+		vendor_setup_apply(setup, file);
+	store_vendor_file(setup, file);
+	mafw_iradio_bulk_writer_flush(setup->writer);
+}
+
+/**
+ * Runs on the database thread: writes the batch of @setup, or once every
+ * file has been handled, forgets the files that are gone.  Every batch of
+ * a new file is committed on its own, and no transaction is left open
+ * between jobs.  The job stops early when interactive requests are
+ * waiting, and vendor_setup_written() queues the rest again.
+ */
+static void vendor_setup_write(MafwIradioVendorSetup *setup)
+{
+	struct vendor_batch *batch = setup->batch;
+	guint start;
+
+	if (batch == NULL)
+	{
+		start = 0;
+		while (setup->vanished && !g_atomic_int_get(&setup->cancelled))
+		{
+			if (start++ > 0 && mafw_iradio_db_interactive_pending())
+				break;
+			remove_vendor_file(setup, setup->vanished->data);
+			g_free(setup->vanished->data);
+			setup->vanished = g_slist_delete_link(setup->vanished,
+							      setup->vanished);
+		}
+	}
+	else if (batch->records)
+	{
+		for (start = batch->written;
+		     batch->written < batch->records->len &&
+			     !g_atomic_int_get(&setup->cancelled);
+		     batch->written++)
+		{
+			if (batch->written > start &&
+			    mafw_iradio_db_interactive_pending())
+				break;
+			vendor_setup_bookmark(setup, batch->file,
+					      g_ptr_array_index(batch->records,
+								batch->written));
+		}
+	}
+	else if (!g_atomic_int_get(&setup->cancelled))
+		vendor_setup_file_done(setup, batch->file);
+
+	mafw_iradio_bulk_writer_flush(setup->writer);
+}
+
+static void vendor_setup_written(MafwIradioVendorSetup *setup);
+
+static void vendor_setup_queue(MafwIradioVendorSetup *setup)
+{
+	setup->busy = TRUE;
+	mafw_iradio_db_queue(MAFW_IRADIO_DB_BULK,
+			     (MafwIradioDbFunc)vendor_setup_write,
+			     (MafwIradioDbFunc)vendor_setup_written, setup);
 }
 
 /**
- * mafw_iradio_parse_bookmark_file:
+ * Called in the setup's main context once vendor_setup_write() has run.
+ * After the last job, the setup is over.
+ */
+static void vendor_setup_written(MafwIradioVendorSetup *setup)
+{
+	MafwIradioVendorSetupDoneCb done_cb;
+	MafwIradioSource *self;
+	gpointer user_data;
+	guint changed;
+
+	setup->busy = FALSE;
+	if (g_atomic_int_get(&setup->cancelled))
+	{
+		/* mafw_iradio_vendor_setup_cancel() has freed the rest */
+		g_free(setup);
+		return;
+	}
+
+	/* The rest of a job that made way for interactive requests */
+	if (setup->batch != NULL ?
+	    setup->batch->records != NULL &&
+	    setup->batch->written < setup->batch->records->len :
+	    setup->vanished != NULL)
+	{
+		vendor_setup_queue(setup);
+		return;
+	}
+
+	if (setup->batch != NULL)
+	{
+		if (setup->batch->records == NULL)
+			setup->pending--;
+		vendor_batch_free(setup->batch);
+		setup->batch = NULL;
+		/* vendor_source_ready() tells what comes next */
+		return;
+	}
+
+	self = setup->self;
+	done_cb = setup->done_cb;
+	user_data = setup->user_data;
+	changed = vendor_setup_free(setup);
+	g_debug("%u objects changed by vendor bookmarks", changed);
+	done_cb(self, changed, user_data);
+}
+
+/**
+ * Queues the next batch from the parser threads, or the last job once
+ * every file has been handled, as a bulk job on the database thread.  One
+ * job is queued at a time, so that they run in order.
+ */
+static gboolean vendor_setup_dispatch(MafwIradioVendorSetup *setup)
+{
+	setup->batch = g_async_queue_try_pop(setup->queue);
+	if (setup->batch == NULL && setup->pending > 0)
+		return TRUE;
+
+	vendor_setup_queue(setup);
+	return TRUE;
+}
+
+static gboolean vendor_source_ready(GSource *source)
+{
+	MafwIradioVendorSetup *setup = ((struct vendor_source *)source)->setup;
+
+	return !setup->busy && (setup->pending == 0 ||
+				g_async_queue_length(setup->queue) > 0);
+}
+
+static gboolean vendor_source_prepare(GSource *source, gint *timeout)
+{
+	*timeout = -1;
+	return vendor_source_ready(source);
+}
+
+static gboolean vendor_source_dispatch(GSource *source, GSourceFunc callback,
+				       gpointer user_data)
+{
+	return vendor_setup_dispatch(((struct vendor_source *)source)->setup);
+}
+
+static GSourceFuncs vendor_source_funcs = {
+	vendor_source_prepare,
+	vendor_source_ready,
+	vendor_source_dispatch,
+	NULL
+};
+
+/**
+ * Lists the vendor files that are new or have been modified since the last
+ * setup, and the ones that have been removed.
+ */
+static void scan_vendor_files(MafwIradioVendorSetup *setup)
+{
+	struct vendor_file *file;
+	struct stat vendorstat;
+	GHashTableIter iter;
+	GHashTable *known;
+	const gchar *name;
+	GDir *dir;
+
+	known = load_vendor_files();
+	dir = g_dir_open(vendor_setup_path, 0, NULL);
+	while (dir && (name = g_dir_read_name(dir)) != NULL)
+	{
+		gchar *path;
+
+		if (!is_vendor_file(name))
+			continue;
+		path = g_build_filename(vendor_setup_path, name, NULL);
+		if (g_stat(path, &vendorstat) != 0 ||
+		    !S_ISREG(vendorstat.st_mode))
+		{
+			g_free(path);
+			continue;
+		}
+
+		file = g_hash_table_lookup(known, name);
+		if (file != NULL)
+		{
+			g_hash_table_steal(known, name);
+			if (file->mtime == vendorstat.st_mtime)
+			{
+				vendor_file_free(file);
+				g_free(path);
+				continue;
+			}
+			file->entries = load_vendor_entries(name);
+		}
+		else
+		{
+			file = g_new0(struct vendor_file, 1);
+			file->name = g_strdup(name);
+			g_queue_init(&file->changes);
+		}
+		file->path = path;
+		file->mtime = vendorstat.st_mtime;
+		setup->files = g_list_prepend(setup->files, file);
+	}
+	if (dir)
+		g_dir_close(dir);
+
+	g_hash_table_iter_init(&iter, known);
+	while (g_hash_table_iter_next(&iter, (gpointer *)&name, NULL))
+		setup->vanished = g_slist_prepend(setup->vanished,
+						  g_strdup(name));
+	g_hash_table_destroy(known);
+}
+
+/**
+ * mafw_iradio_vendor_setup_start:
+ *
+ * @self: An iradio source that gets its default bookmarks from custom files
+ * @done_cb: Called once the database has been synchronized with the files
+ * @user_data: Passed to @done_cb
+ *
+ * Synchronizes the bookmarks of @self with every .confml and .xml file in
+ * the vendor directory, so that the source can serve requests meanwhile.
+ * Files with the same modification time as last time are not looked at.
+ * The others are hashed and parsed concurrently by a thread pool, while
+ * their bookmarks are written by bulk jobs on the database thread, queued
+ * one after the other from the calling thread's main context.  A file with
+ * the same digest as last time is not parsed, and for a modified one only
+ * the bookmarks that were added, changed or removed are written.
+ *
+ * Returns: a handle that can be passed to mafw_iradio_vendor_setup_cancel()
+ * until @done_cb has been called, or NULL if there is nothing to do.
+ */
+MafwIradioVendorSetup *mafw_iradio_vendor_setup_start(
+					MafwIradioSource *self,
+					MafwIradioVendorSetupDoneCb done_cb,
+					gpointer user_data)
+{
+	MafwIradioVendorSetup *setup;
+	GList *node;
+
+	g_assert(self != NULL);
+	g_assert(done_cb != NULL);
+
+	setup = g_new0(MafwIradioVendorSetup, 1);
+	scan_vendor_files(setup);
+	if (setup->files == NULL && setup->vanished == NULL)
+	{
+		g_debug("Vendor files are up to date");
+		g_free(setup);
+		return NULL;
+	}
+
+	/* libxml2 must be initialized before it is used from threads */
+	xmlInitParser();
+
+	setup->self = self;
+	setup->writer = mafw_iradio_bulk_writer_new(self, TRUE);
+	setup->queue = g_async_queue_new();
+	setup->context = g_main_context_ref_thread_default();
+	setup->added = time(NULL);
+	setup->done_cb = done_cb;
+	setup->user_data = user_data;
+
+	setup->source = g_source_new(&vendor_source_funcs,
+				     sizeof(struct vendor_source));
+	((struct vendor_source *)setup->source)->setup = setup;
+	g_source_set_priority(setup->source, G_PRIORITY_LOW);
+	g_source_attach(setup->source, setup->context);
+
+	setup->pool = g_thread_pool_new((GFunc)vendor_setup_parse, setup,
+					g_get_num_processors(), FALSE, NULL);
+	for (node = setup->files; node; node = node->next)
+	{
+		setup->pending++;
+		g_thread_pool_push(setup->pool, node->data, NULL);
+	}
+
+	return setup;
+}
+
+/**
+ * mafw_iradio_vendor_setup_cancel:
+ *
+ * @setup: A running vendor setup
+ *
+ * Stops the setup.  Bookmarks already committed from new files are kept,
+ * but the state of unfinished files is not stored and the done callback is
+ * not called.
+ */
+void mafw_iradio_vendor_setup_cancel(MafwIradioVendorSetup *setup)
+{
+	g_assert(setup != NULL);
+
+	/* A job being written stops at the next bookmark */
+	g_atomic_int_set(&setup->cancelled, TRUE);
+	if (setup->busy)
+		mafw_iradio_db_flush();
+	vendor_setup_free(setup);
+}
+
+/**
+ * mafw_iradio_parse_confml_file:
  *
  * @self: An iradio source that receives the bookmarks from the parsed file
+ * @check_dups: Whether to skip bookmarks whose URI is already stored
  *
- * Reads a .confml file (essentially XML) and parses the file's contents into
- * an XML node tree. That node tree is then fed to mafw_iradio_parse_confml().
+ * Imports a .confml file into @self, parsing it in a thread while the
+ * bookmarks read so far are being written.
  *
  * Returns: TRUE if successful, otherwise FALSE.
  */
 gboolean mafw_iradio_parse_confml_file(MafwIradioSource* self,
 					const gchar* path, gboolean check_dups)
 {
+	GError *error = NULL;
 	gboolean result;
-	xmlNode* root;
-	xmlDoc* doc;
+	guint count = 0;
 
 	g_assert(self != NULL);
 	g_assert(path != NULL);
 
-	/* This initializes the library and checks for potential ABI mismatches
-	   between the version it was compiled for and the actual shared lib */
-	LIBXML_TEST_VERSION
-
-	/* Parse the file into an xmlNode tree. */
-	doc = xmlReadFile(path, NULL, 0);
-	if (doc == NULL)
+	result = mafw_iradio_importer_import(
+				mafw_iradio_importer_lookup("confml"),
+				self, path, check_dups, 0, &count, NULL,
+				&error);
+	if (!result)
 	{
-		g_debug("Unable to parse confml file %s", path);
-		result = FALSE;
+		g_warning("Unable to import %s: %s", path, error->message);
+		g_error_free(error);
 	}
-	else
-	{
-		root = xmlDocGetRootElement(doc);
-		result = mafw_iradio_parse_confml(MAFW_SOURCE(self), root,
-							check_dups);
-		xmlFreeDoc(doc);
-	}
-
-	xmlCleanupParser();
+	g_debug("%u objects created from %s", count, path);
 
 	return result;
 }
@@ -439,19 +1447,33 @@ gboolean mafw_iradio_parse_confml_file(MafwIradioSource* self,
 /**
  * mafw_iradio_vendor_setup:
  *
- * @self: An iradio source that gets its default bookmarks from a custom file
+ * @self: An iradio source that gets its default bookmarks from custom files
+ * @check_dups: Whether to skip bookmarks whose URI is already stored
  *
- * Performs first-boot customization for the iradio source. Basically, this
- * reads a file that contains bookmarks, inserts them to the source's database
- * and sets a gconf key so that customization is done exactly once during the
- * plugin's lifetime.
+ * Imports every .confml and .xml file of the vendor directory one after the
+ * other, without keeping any state.  mafw_iradio_vendor_setup_start() is
+ * what the source uses.
  */
 void mafw_iradio_vendor_setup(MafwIradioSource* self, gboolean check_dups)
 {
-	gchar *fname = g_strdup_printf("%s/%s", vendor_setup_path,
-					VENDOR_FILENAME);
+	const gchar *name;
+	GDir *dir;
 
 	g_assert(self != NULL);
-	mafw_iradio_parse_confml_file(self, fname, check_dups);
-	g_free(fname);
+
+	dir = g_dir_open(vendor_setup_path, 0, NULL);
+	if (dir == NULL)
+		return;
+
+	while ((name = g_dir_read_name(dir)) != NULL)
+	{
+		gchar *path;
+
+		if (!is_vendor_file(name))
+			continue;
+		path = g_build_filename(vendor_setup_path, name, NULL);
+		mafw_iradio_parse_confml_file(self, path, check_dups);
+		g_free(path);
+	}
+	g_dir_close(dir);
 }
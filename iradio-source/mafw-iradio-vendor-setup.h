@@ -25,9 +25,44 @@
 #ifndef MAFW_IRADIO_VENDOR_SETUP_H
 #define MAFW_IRADIO_VENDOR_SETUP_H
 
-#define VENDOR_FILENAME "bookmarks.xml"
+#include "mafw-iradio-importer.h"
+
+/* Directory of the vendor bookmark files */
+extern const gchar *vendor_setup_path;
+/* Directory of the vendor icons, or NULL if it is vendor_setup_path */
+extern const gchar *vendor_icon_path;
+
+/*----------------------------------------------------------------------------
+  Streaming bookmark reader
+  ----------------------------------------------------------------------------*/
+
+typedef struct _MafwIradioConfmlReader MafwIradioConfmlReader;
+
+MafwIradioConfmlReader *mafw_iradio_confml_reader_new(const gchar *path);
+const MafwIradioBookmark *mafw_iradio_confml_reader_next(
+					MafwIradioConfmlReader *reader);
+gboolean mafw_iradio_confml_reader_close(MafwIradioConfmlReader *reader);
+
+gboolean mafw_iradio_read_confml_file(const gchar *path,
+				       MafwIradioBookmarkFunc func,
+				       gpointer user_data);
+
+/*----------------------------------------------------------------------------
+  Vendor setup
+  ----------------------------------------------------------------------------*/
+
 gboolean mafw_iradio_parse_confml_file(MafwIradioSource* self,
 					const gchar* path, gboolean check_dups);
 void mafw_iradio_vendor_setup(MafwIradioSource* self, gboolean check_dups);
 
+typedef struct _MafwIradioVendorSetup MafwIradioVendorSetup;
+typedef void (*MafwIradioVendorSetupDoneCb)(MafwIradioSource *self,
+					    guint changed, gpointer user_data);
+
+MafwIradioVendorSetup *mafw_iradio_vendor_setup_start(
+					MafwIradioSource *self,
+					MafwIradioVendorSetupDoneCb done_cb,
+					gpointer user_data);
+void mafw_iradio_vendor_setup_cancel(MafwIradioVendorSetup *setup);
+
 #endif
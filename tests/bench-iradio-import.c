@@ -0,0 +1,227 @@
+/*
+ * This file is a part of MAFW
+ *
+ * Copyright (C) 2007, 2008, 2009 Nokia Corporation, all rights reserved.
+ *
+ * Contact: Visa Smolander <visa.smolander@nokia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+/*
+ * Import benchmark.  Every measurement runs in a forked child so that the
+ * reported peak RSS belongs to that run alone.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <libmafw/mafw.h>
+#include <libxml/parser.h>
+
+#include "iradio-source/mafw-iradio-source.h"
+#include "iradio-source/mafw-iradio-importer.h"
+#include "iradio-source/mafw-iradio-vendor-setup.h"
+
+static const guint sizes[] = { 100, 1000, 10000, 100000 };
+
+/* Station list layouts; the entry format gets the station number as %1$u */
+static const struct {
+	const gchar *name;
+	const gchar *header;
+	const gchar *entry;
+	const gchar *footer;
+} formats[] = {
+	{ "confml",
+	  "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+	  "<configuration xmlns=\"http://www.s60.com/xml/confml/2\">\n"
+	  "<data>\n<mafw-iradio-source-bookmarks>\n",
+	  "<IRadioChannel>\n"
+	  "<Name>Regional station %1$u</Name>\n"
+	  "<URI>http://stream%1$u.example.com/live.mp3</URI>\n"
+	  "<Icon><targetPath>BUILD:///icons</targetPath>"
+	  "<localPath>icons/station%1$u.png</localPath></Icon>\n"
+	  "</IRadioChannel>\n",
+	  "</mafw-iradio-source-bookmarks>\n</data>\n</configuration>\n" },
+	{ "m3u",
+	  "#EXTM3U\n",
+	  "#EXTINF:-1,Regional station %1$u\n"
+	  "http://stream%1$u.example.com/live.mp3\n",
+	  "" },
+	{ "pls",
+	  "[playlist]\n",
+	  "File%1$u=http://stream%1$u.example.com/live.mp3\n"
+	  "Title%1$u=Regional station %1$u\n"
+	  "Length%1$u=-1\n",
+	  "Version=2\n" },
+	{ "xspf",
+	  "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+	  "<playlist version=\"1\" xmlns=\"http://xspf.org/ns/0/\">\n"
+	  "<trackList>\n",
+	  "<track><location>http://stream%1$u.example.com/live.mp3"
+	  "</location><title>Regional station %1$u</title>"
+	  "<image>http://example.com/station%1$u.png</image></track>\n",
+	  "</trackList>\n</playlist>\n" },
+	{ "opml",
+	  "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+	  "<opml version=\"1.0\">\n<body>\n",
+	  "<outline type=\"audio\" text=\"Regional station %1$u\" "
+	  "URL=\"http://stream%1$u.example.com/live.mp3\" "
+	  "image=\"http://example.com/station%1$u.png\"/>\n",
+	  "</body>\n</opml>\n" },
+};
+
+static gchar *bench_dir;
+
+/* Writes a station list of format @format with @count bookmarks */
+static gchar *write_list(guint format, guint count)
+{
+	gchar *path;
+	FILE *f;
+	guint i;
+
+	path = g_strdup_printf("%s/bench-%u.%s", bench_dir, count,
+			       formats[format].name);
+	f = fopen(path, "w");
+	g_assert(f != NULL);
+
+	fputs(formats[format].header, f);
+	for (i = 1; i <= count; i++)
+		fprintf(f, formats[format].entry, i);
+	fputs(formats[format].footer, f);
+	fclose(f);
+
+	return path;
+}
+
+static void count_bookmark(const MafwIradioBookmark *bookmark,
+			   guint *count)
+{
+	(*count)++;
+}
+
+/* Child: streams @path through the importer of its format */
+static guint run_stream(const gchar *path)
+{
+	guint count = 0;
+
+	mafw_iradio_importer_read(path, (MafwIradioBookmarkFunc)
+				  count_bookmark, &count, NULL);
+	return count;
+}
+
+/* Child: imports @path into an empty database */
+static guint run_import(const gchar *path)
+{
+	MafwIradioSource *source;
+	gchar *db;
+	guint count;
+
+	db = g_strdup_printf("%s/bench.db", bench_dir);
+	g_unlink(db);
+	g_setenv("MAFW_DB", db, TRUE);
+	/* Keep the vendor setup out of the measurement */
+	vendor_setup_path = "/nonexistent";
+
+	source = MAFW_IRADIO_SOURCE(mafw_iradio_source_new());
+	count = mafw_iradio_import_file(source, path, 0, NULL, NULL);
+	g_object_unref(source);
+	g_unlink(db);
+	g_free(db);
+	return count;
+}
+
+/* Child: builds the whole DOM, like the importer used to */
+static guint run_dom(const gchar *path)
+{
+	xmlDoc *doc;
+
+	doc = xmlReadFile(path, NULL, 0);
+	if (doc == NULL)
+		return 0;
+	xmlFreeDoc(doc);
+	return 1;
+}
+
+static void measure(const gchar *label, guint (*run)(const gchar *path),
+		    const gchar *path, guint entries)
+{
+	struct rusage usage;
+	struct stat st;
+	gint64 start, elapsed;
+	gint status;
+	pid_t pid;
+
+	start = g_get_monotonic_time();
+	pid = fork();
+	g_assert(pid >= 0);
+	if (pid == 0)
+		_exit(run(path) > 0 || entries == 0 ? 0 : 1);
+
+	g_assert(wait4(pid, &status, 0, &usage) == pid);
+	elapsed = MAX(g_get_monotonic_time() - start, 1);
+	g_assert(g_stat(path, &st) == 0);
+	printf("%-8s %8u entries %10ld bytes %9.1f ms %10.0f entries/s "
+	       "%8ld kB peak RSS%s\n",
+	       label, entries, (long)st.st_size, elapsed / 1000.0,
+	       entries * 1000000.0 / elapsed, usage.ru_maxrss,
+	       WIFEXITED(status) && WEXITSTATUS(status) == 0 ? "" :
+	       " (FAILED)");
+}
+
+int main(int argc, char **argv)
+{
+	guint i, j;
+
+#if !GLIB_CHECK_VERSION(2,35,0)
+	g_type_init();
+#endif
+	bench_dir = g_strdup_printf("%s/iradio-bench-XXXXXX",
+				    g_get_tmp_dir());
+	g_assert(g_mkdtemp(bench_dir) != NULL);
+
+	for (i = 0; i < G_N_ELEMENTS(formats); i++)
+	{
+		printf("%s import:\n", formats[i].name);
+		for (j = 0; j < G_N_ELEMENTS(sizes); j++)
+		{
+			gchar *path = write_list(i, sizes[j]);
+
+			measure("stream", run_stream, path, sizes[j]);
+			if (i == 0)
+				measure("dom", run_dom, path, sizes[j]);
+			measure("import", run_import, path, sizes[j]);
+			g_unlink(path);
+			g_free(path);
+		}
+	}
+
+	g_rmdir(bench_dir);
+	g_free(bench_dir);
+	return 0;
+}
+
+/* vi: set noexpandtab ts=8 sw=8 cino=t0,(0: */
@@ -0,0 +1,203 @@
+/*
+ * This file is a part of MAFW
+ *
+ * Copyright (C) 2007, 2008, 2009 Nokia Corporation, all rights reserved.
+ *
+ * Contact: Visa Smolander <visa.smolander@nokia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+
+/*
+ * Write benchmark: throughput of create_object() and set_metadata() on the
+ * private database under each durability profile.  Every profile runs in
+ * a forked child, on a database of its own.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <libmafw/mafw.h>
+
+#include "iradio-source/mafw-iradio-source.h"
+#include "iradio-source/mafw-iradio-vendor-setup.h"
+#include "iradio-source/mafw-iradio-db.h"
+
+static const guint sizes[] = { 100, 1000, 10000 };
+
+static const gchar *const profiles[] = { "strict", "balanced", "relaxed" };
+
+static gchar *bench_dir;
+static GMainLoop *loop;
+static gchar **object_ids;
+static guint pending;
+static gboolean failed;
+
+static void object_created(MafwSource *self, const gchar *object_id,
+			   gpointer user_data, const GError *error)
+{
+	if (error)
+		failed = TRUE;
+	else
+		object_ids[GPOINTER_TO_UINT(user_data)] = g_strdup(object_id);
+	if (--pending == 0)
+		g_main_loop_quit(loop);
+}
+
+static void metadata_set(MafwSource *self, const gchar *object_id,
+			 const gchar **failed_keys, gpointer user_data,
+			 const GError *error)
+{
+	if (error)
+		failed = TRUE;
+	if (--pending == 0)
+		g_main_loop_quit(loop);
+}
+
+static void report(const gchar *op, guint count, gint64 elapsed)
+{
+	elapsed = MAX(elapsed, 1);
+	printf("%-8s %-6s %8u ops %9.1f ms %10.0f ops/s\n",
+	       g_getenv(MAFW_IRADIO_DB_PROFILE_ENV), op, count,
+	       elapsed / 1000.0, count * 1000000.0 / elapsed);
+}
+
+/* Child: creates @count objects, then retitles each of them */
+static void run(guint count)
+{
+	MafwIradioSource *source;
+	GHashTable *metadata;
+	gint64 start;
+	gchar *str;
+	guint i;
+
+	source = MAFW_IRADIO_SOURCE(mafw_iradio_source_new());
+	loop = g_main_loop_new(NULL, FALSE);
+	object_ids = g_new0(gchar *, count + 1);
+
+	start = g_get_monotonic_time();
+	for (i = 0; i < count; i++)
+	{
+		metadata = mafw_metadata_new();
+		str = g_strdup_printf("http://stream%u.example.com/live.mp3",
+				      i);
+		mafw_metadata_add_str(metadata, MAFW_METADATA_KEY_URI, str);
+		g_free(str);
+		str = g_strdup_printf("Regional station %u", i);
+		mafw_metadata_add_str(metadata, MAFW_METADATA_KEY_TITLE, str);
+		g_free(str);
+		mafw_source_create_object(MAFW_SOURCE(source),
+					  MAFW_IRADIO_SOURCE_UUID "::",
+					  metadata, object_created,
+					  GUINT_TO_POINTER(i));
+		mafw_metadata_release(metadata);
+	}
+	pending = count;
+	g_main_loop_run(loop);
+	report("create", count, g_get_monotonic_time() - start);
+
+	start = g_get_monotonic_time();
+	for (i = 0; i < count && object_ids[i]; i++)
+	{
+		metadata = mafw_metadata_new();
+		str = g_strdup_printf("Renamed station %u", i);
+		mafw_metadata_add_str(metadata, MAFW_METADATA_KEY_TITLE, str);
+		g_free(str);
+		mafw_source_set_metadata(MAFW_SOURCE(source), object_ids[i],
+					 metadata, metadata_set, NULL);
+		mafw_metadata_release(metadata);
+	}
+	pending = i;
+	if (pending)
+		g_main_loop_run(loop);
+	report("set", i, g_get_monotonic_time() - start);
+
+	/* Shutting down includes the final flush and checkpoint */
+	g_object_unref(source);
+	g_strfreev(object_ids);
+	g_main_loop_unref(loop);
+	_exit(failed ? 1 : 0);
+}
+
+static void measure(const gchar *profile, guint count)
+{
+	gchar *db, *path;
+	gint status;
+	pid_t pid;
+
+	db = g_strdup_printf("%s/bench.db", bench_dir);
+	pid = fork();
+	g_assert(pid >= 0);
+	if (pid == 0)
+	{
+		g_setenv(MAFW_IRADIO_DB_ENV, db, TRUE);
+		g_setenv(MAFW_IRADIO_DB_PROFILE_ENV, profile, TRUE);
+		/* Keep the vendor setup and the image out of it */
+		vendor_setup_path = "/nonexistent";
+		db_image_path = "/nonexistent";
+		run(count);
+	}
+
+	g_assert(waitpid(pid, &status, 0) == pid);
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		printf("%-8s %8u ops FAILED\n", profile, count);
+
+	path = g_strconcat(db, "-wal", NULL);
+	g_unlink(path);
+	g_free(path);
+	path = g_strconcat(db, "-shm", NULL);
+	g_unlink(path);
+	g_free(path);
+	path = g_strconcat(db, ".iradio-snapshot", NULL);
+	g_unlink(path);
+	g_free(path);
+	g_unlink(db);
+	g_free(db);
+}
+
+int main(int argc, char **argv)
+{
+	guint i, j;
+
+#if !GLIB_CHECK_VERSION(2,35,0)
+	g_type_init();
+#endif
+	bench_dir = g_strdup_printf("%s/iradio-bench-XXXXXX",
+				    g_get_tmp_dir());
+	g_assert(g_mkdtemp(bench_dir) != NULL);
+
+	for (i = 0; i < G_N_ELEMENTS(sizes); i++)
+	{
+		printf("%u objects:\n", sizes[i]);
+		for (j = 0; j < G_N_ELEMENTS(profiles); j++)
+			measure(profiles[j], sizes[i]);
+	}
+
+	g_rmdir(bench_dir);
+	g_free(bench_dir);
+	return 0;
+}
+
+/* vi: set noexpandtab ts=8 sw=8 cino=t0,(0: */
@@ -35,9 +35,13 @@
 #include <sys/stat.h>
 #include <glib/gstdio.h>
 #include <utime.h>
+#include <sys/wait.h>
+#include <signal.h>
 
 #include "iradio-source/mafw-iradio-source.h"
 #include "iradio-source/mafw-iradio-vendor-setup.h"
+#include "iradio-source/mafw-iradio-db.h"
+#include "iradio-source/mafw-iradio-snapshot.h"
 
 #define ADDED_ITEM_NR 20
 
@@ -117,6 +121,7 @@ START_TEST(test_add_remove)
 {
 	MafwIradioSource *radio_src;
 	GHashTable *mdat;
+	gchar *n_uri;
 	gint i;
 	
 	radio_src = MAFW_IRADIO_SOURCE(mafw_iradio_source_new());
@@ -156,6 +161,11 @@ START_TEST(test_add_remove)
 	/* This should not fail.... */
 	for (i =0; i < ADDED_ITEM_NR; i++)
 	{
+		/* The same URI would be merged into the first object */
+		g_hash_table_remove(mdat, MAFW_METADATA_KEY_URI);
+		n_uri = g_strdup_printf("mms://test.uri/test%d.wav", i);
+		mafw_metadata_add_str(mdat, MAFW_METADATA_KEY_URI, n_uri);
+		g_free(n_uri);
 		mafw_source_create_object(MAFW_SOURCE(radio_src),
 						MAFW_IRADIO_SOURCE_UUID "::",
 						mdat, obi_created, NULL);
@@ -963,6 +973,28 @@ static gchar * uri_path(gchar *filename)
    return uri;
 }
 				       
+static void vendor_setup_done(MafwIradioSource *source, guint added,
+			      guint *added_out)
+{
+	*added_out = added;
+	checkmore_stop_loop();
+}
+
+/* Waits until @source has imported the vendor bookmarks in the background */
+static guint wait_vendor_setup(MafwIradioSource *source)
+{
+	guint added = G_MAXUINT;
+	gulong handler;
+
+	handler = g_signal_connect(source, "vendor-setup-done",
+				   G_CALLBACK(vendor_setup_done), &added);
+	checkmore_spin_loop(-1);
+	g_signal_handler_disconnect(source, handler);
+	fail_if(added == G_MAXUINT, "Vendor setup did not finish");
+
+	return added;
+}
+
 START_TEST(test_confml_parse)
 {
 	MafwIradioSource* source;
@@ -981,6 +1013,7 @@ START_TEST(test_confml_parse)
 	/* Parse the test content into the database */
 	uri = uri_path("bookmarks.xml");
 	ref_time = time(NULL);
+	fail_unless(wait_vendor_setup(source) == 6);
 
 	/* Browse for the test content */
 	mafw_source_browse(MAFW_SOURCE(source),
@@ -1033,6 +1066,8 @@ START_TEST(test_confml_parse)
 	fail_if(source == NULL, "Unable to create an IRadio source again");
 
 	ref_time = time(NULL);
+	/* The content is the same, so the destroyed bookmark stays away */
+	fail_unless(wait_vendor_setup(source) == 0);
 
 	memset(&browse_results, 0, sizeof(gboolean) * 6);
 	/* Browse for the test content */
@@ -1045,11 +1080,11 @@ START_TEST(test_confml_parse)
 			    0,
 			    MAFW_SOURCE_BROWSE_ALL,
 			    confml_browse_result,
-			    NULL);
+			    (gpointer)source);
 
 	checkmore_spin_loop(-1);
 
-	fail_unless(_customization_browse_results == 6,
+	fail_unless(_customization_browse_results == 5,
 		    "Not enough browse results for customization: %d",
 		    _customization_browse_results);
 	g_object_unref(source);
@@ -1058,6 +1093,2274 @@ START_TEST(test_confml_parse)
 }
 END_TEST
 
+/* Writes a vendor file with the given title/URI pairs into @dir */
+static void write_vendor_file(const gchar *dir, const gchar *name,
+			      const gchar *const *stations, time_t mtime)
+{
+	struct utimbuf newmodtime;
+	GString *contents;
+	gchar *path;
+
+	contents = g_string_new("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+				"<configuration><data>\n"
+				"<mafw-iradio-source-bookmarks>\n");
+	for (; *stations; stations += 2)
+		g_string_append_printf(contents,
+				       "<IRadioChannel><Name>%s</Name>"
+				       "<URI>%s</URI></IRadioChannel>\n",
+				       stations[0], stations[1]);
+	g_string_append(contents, "</mafw-iradio-source-bookmarks>\n"
+			"</data></configuration>\n");
+
+	path = g_strdup_printf("%s/%s", dir, name);
+	fail_unless(g_file_set_contents(path, contents->str, -1, NULL));
+	newmodtime.actime = mtime;
+	newmodtime.modtime = mtime;
+	fail_if(g_utime(path, &newmodtime) != 0);
+	g_string_free(contents, TRUE);
+	g_free(path);
+}
+
+static void collect_browse_result(MafwSource *self, guint browse_id,
+				  gint remaining_count, guint index,
+				  const gchar *object_id, GHashTable *metadata,
+				  gpointer user_data, const GError *error)
+{
+	GHashTable *objects = user_data;
+	GValue *value;
+
+	fail_unless(error == NULL);
+	if (object_id)
+	{
+		value = mafw_metadata_first(metadata,
+					     MAFW_METADATA_KEY_TITLE);
+		g_hash_table_insert(objects, g_value_dup_string(value),
+				    g_strdup(object_id));
+	}
+	if (remaining_count == 0)
+		checkmore_stop_loop();
+}
+
+/* Returns the object-ids of the root's children by title */
+static GHashTable *browse_titles(MafwIradioSource *source)
+{
+	GHashTable *objects;
+
+	objects = g_hash_table_new_full(g_str_hash, g_str_equal,
+					g_free, g_free);
+	mafw_source_browse(MAFW_SOURCE(source),
+			    MAFW_IRADIO_SOURCE_UUID "::",
+			    FALSE,
+			    NULL,
+			    NULL,
+			    MAFW_SOURCE_ALL_KEYS,
+			    0,
+			    MAFW_SOURCE_BROWSE_ALL,
+			    collect_browse_result,
+			    objects);
+	checkmore_spin_loop(-1);
+
+	return objects;
+}
+
+START_TEST(test_vendor_resync)
+{
+	static const gchar *const first[] = {
+		"Station A", "http://a.example.com/live",
+		"Station B", "http://b.example.com/live",
+		"Station C", "http://c.example.com/live",
+		NULL
+	};
+	static const gchar *const second[] = {
+		"Station A2", "http://a.example.com/live",
+		"Station C", "http://c.example.com/live",
+		"Station D", "http://d.example.com/live",
+		NULL
+	};
+	static const gchar *const operator[] = {
+		"Operator 1", "http://operator.example.com/1",
+		"Operator 2", "http://operator.example.com/2",
+		NULL
+	};
+	MafwIradioSource *source;
+	GHashTable *before, *after;
+	time_t mtime;
+	gchar *dir, *path;
+
+	unlink("test-iradiosource.db");
+	dir = g_strdup_printf("%s/iradio-test-XXXXXX", g_get_tmp_dir());
+	fail_if(g_mkdtemp(dir) == NULL);
+	vendor_setup_path = dir;
+	mtime = time(NULL) - 60;
+
+	write_vendor_file(dir, "bookmarks.xml", first, mtime);
+	source = MAFW_IRADIO_SOURCE(mafw_iradio_source_new());
+	fail_unless(wait_vendor_setup(source) == 3);
+	before = browse_titles(source);
+	fail_unless(g_hash_table_size(before) == 3);
+	g_object_unref(source);
+
+	/* A renamed, B removed and D added: one change each */
+	write_vendor_file(dir, "bookmarks.xml", second, mtime + 5);
+	source = MAFW_IRADIO_SOURCE(mafw_iradio_source_new());
+	fail_unless(wait_vendor_setup(source) == 3);
+	after = browse_titles(source);
+	fail_unless(g_hash_table_size(after) == 3);
+	fail_unless(g_hash_table_lookup(after, "Station D") != NULL);
+	fail_unless(strcmp(g_hash_table_lookup(after, "Station A2"),
+			   g_hash_table_lookup(before, "Station A")) == 0);
+	fail_unless(strcmp(g_hash_table_lookup(after, "Station C"),
+			   g_hash_table_lookup(before, "Station C")) == 0);
+	g_object_unref(source);
+	g_hash_table_destroy(before);
+
+	/* Touched, but identical */
+	write_vendor_file(dir, "bookmarks.xml", second, mtime + 10);
+	source = MAFW_IRADIO_SOURCE(mafw_iradio_source_new());
+	fail_unless(wait_vendor_setup(source) == 0);
+	before = browse_titles(source);
+	fail_unless(g_hash_table_size(before) == 3);
+	fail_unless(strcmp(g_hash_table_lookup(after, "Station D"),
+			   g_hash_table_lookup(before, "Station D")) == 0);
+	g_object_unref(source);
+	g_hash_table_destroy(before);
+	g_hash_table_destroy(after);
+
+	/* Another bundle is added and the first one is removed */
+	write_vendor_file(dir, "operator.confml", operator, mtime);
+	path = g_strdup_printf("%s/%s", dir, "bookmarks.xml");
+	g_unlink(path);
+	g_free(path);
+	source = MAFW_IRADIO_SOURCE(mafw_iradio_source_new());
+	fail_unless(wait_vendor_setup(source) == 5);
+	after = browse_titles(source);
+	fail_unless(g_hash_table_size(after) == 2);
+	fail_unless(g_hash_table_lookup(after, "Operator 1") != NULL);
+	fail_unless(g_hash_table_lookup(after, "Operator 2") != NULL);
+	g_object_unref(source);
+	g_hash_table_destroy(after);
+
+	path = g_strdup_printf("%s/%s", dir, "operator.confml");
+	g_unlink(path);
+	g_rmdir(dir);
+	g_free(path);
+	g_free(dir);
+}
+END_TEST
+
+START_TEST(test_vendor_hot_reload)
+{
+	static const gchar *const stations[] = {
+		"Station A", "http://a.example.com/live",
+		NULL
+	};
+	static const gchar *const bundle[] = {
+		"Region 1", "http://region.example.com/1",
+		"Region 2", "http://region.example.com/2",
+		NULL
+	};
+	MafwIradioSource *source;
+	GHashTable *objects;
+	gchar *dir, *path;
+
+	unlink("test-iradiosource.db");
+	dir = g_strdup_printf("%s/iradio-test-XXXXXX", g_get_tmp_dir());
+	fail_if(g_mkdtemp(dir) == NULL);
+	vendor_setup_path = dir;
+
+	write_vendor_file(dir, "bookmarks.xml", stations, time(NULL) - 60);
+	source = MAFW_IRADIO_SOURCE(mafw_iradio_source_new());
+	fail_unless(wait_vendor_setup(source) == 1);
+
+	/* A new bundle is picked up while the source is running */
+	write_vendor_file(dir, "region.confml", bundle, time(NULL) - 30);
+	fail_unless(wait_vendor_setup(source) == 2);
+	objects = browse_titles(source);
+	fail_unless(g_hash_table_size(objects) == 3);
+	g_hash_table_destroy(objects);
+
+	/* And so is its removal */
+	path = g_strdup_printf("%s/%s", dir, "region.confml");
+	g_unlink(path);
+	g_free(path);
+	fail_unless(wait_vendor_setup(source) == 2);
+	objects = browse_titles(source);
+	fail_unless(g_hash_table_size(objects) == 1);
+	g_hash_table_destroy(objects);
+	g_object_unref(source);
+
+	path = g_strdup_printf("%s/%s", dir, "bookmarks.xml");
+	g_unlink(path);
+	g_rmdir(dir);
+	g_free(path);
+	g_free(dir);
+}
+END_TEST
+
+START_TEST(test_import_playlists)
+{
+	MafwIradioSource *source;
+	GHashTable *objects;
+	GError *error = NULL;
+	gchar *dir, *m3u, *pls, *bad;
+
+	unlink("test-iradiosource.db");
+	dir = g_strdup_printf("%s/iradio-test-XXXXXX", g_get_tmp_dir());
+	fail_if(g_mkdtemp(dir) == NULL);
+	vendor_setup_path = dir;
+
+	m3u = g_strdup_printf("%s/%s", dir, "stations.m3u");
+	fail_unless(g_file_set_contents(m3u,
+		"#EXTM3U\n"
+		"#EXTINF:-1,Station A\n"
+		"http://a.example.com/live\n"
+		"\n"
+		"#EXTINF:-1,Station B\n"
+		"http://b.example.com/live\n", -1, NULL));
+	pls = g_strdup_printf("%s/%s", dir, "stations.PLS");
+	fail_unless(g_file_set_contents(pls,
+		"[playlist]\n"
+		"File1=http://b.example.com/live\n"
+		"Title1=Station B\n"
+		"File2=http://c.example.com/live\n"
+		"Title2=Station C\n"
+		"Length2=-1\n"
+		"NumberOfEntries=2\n"
+		"Version=2\n", -1, NULL));
+	bad = g_strdup_printf("%s/%s", dir, "stations.wpl");
+
+	fail_unless(mafw_iradio_importer_find(m3u) ==
+		    mafw_iradio_importer_lookup("m3u"));
+	fail_unless(mafw_iradio_importer_find(pls) ==
+		    mafw_iradio_importer_lookup("pls"));
+	fail_unless(mafw_iradio_importer_find(bad) == NULL);
+
+	source = MAFW_IRADIO_SOURCE(mafw_iradio_source_new());
+	fail_unless(mafw_iradio_import_file(source, m3u, 0, NULL, &error) == 2);
+	fail_unless(error == NULL);
+	/* Station B is already there */
+	fail_unless(mafw_iradio_import_file(source, pls, 1, NULL, &error) == 1);
+	fail_unless(error == NULL);
+	fail_unless(mafw_iradio_import_file(source, bad, 0, NULL, &error) == 0);
+	fail_unless(error != NULL);
+	g_clear_error(&error);
+
+	objects = browse_titles(source);
+	fail_unless(g_hash_table_size(objects) == 3);
+	fail_unless(g_hash_table_lookup(objects, "Station A") != NULL);
+	fail_unless(g_hash_table_lookup(objects, "Station C") != NULL);
+	g_hash_table_destroy(objects);
+	g_object_unref(source);
+
+	g_unlink(m3u);
+	g_unlink(pls);
+	g_rmdir(dir);
+	g_free(m3u);
+	g_free(pls);
+	g_free(bad);
+	g_free(dir);
+}
+END_TEST
+
+START_TEST(test_import_pipelined)
+{
+	MafwIradioSource *source;
+	GHashTable *objects;
+	GString *contents;
+	GError *error = NULL;
+	gchar *dir, *path;
+	guint count, i;
+
+	unlink("test-iradiosource.db");
+	dir = g_strdup_printf("%s/iradio-test-XXXXXX", g_get_tmp_dir());
+	fail_if(g_mkdtemp(dir) == NULL);
+	vendor_setup_path = dir;
+
+	/* More bookmarks than the parser may queue up */
+	count = 3 * MAFW_IRADIO_IMPORT_QUEUE + 7;
+	contents = g_string_new("#EXTM3U\n");
+	for (i = 0; i < count; i++)
+		g_string_append_printf(contents, "#EXTINF:-1,Station %u\n"
+				       "http://%u.example.com/live\n", i, i);
+	/* Including a duplicate */
+	g_string_append(contents, "http://0.example.com/live\n");
+	path = g_strdup_printf("%s/%s", dir, "large.m3u");
+	fail_unless(g_file_set_contents(path, contents->str, -1, NULL));
+	g_string_free(contents, TRUE);
+
+	source = MAFW_IRADIO_SOURCE(mafw_iradio_source_new());
+	fail_unless(mafw_iradio_import_file(source, path, 100, NULL, &error) ==
+		    count);
+	fail_unless(error == NULL);
+
+	objects = browse_titles(source);
+	fail_unless(g_hash_table_size(objects) == count);
+	g_hash_table_destroy(objects);
+	g_object_unref(source);
+
+	g_unlink(path);
+	g_rmdir(dir);
+	g_free(path);
+	g_free(dir);
+}
+END_TEST
+
+START_TEST(test_db_image)
+{
+	static const gchar *const stations[] = {
+		"Station A", "http://a.example.com/live",
+		"Station B", "http://b.example.com/live",
+		NULL
+	};
+	MafwIradioSource *source;
+	GHashTable *objects;
+	gchar *dir, *path, *image;
+	gint status;
+	pid_t pid;
+
+	unlink("test-iradiosource.db");
+	dir = g_strdup_printf("%s/iradio-test-XXXXXX", g_get_tmp_dir());
+	fail_if(g_mkdtemp(dir) == NULL);
+	vendor_setup_path = dir;
+	write_vendor_file(dir, "bookmarks.xml", stations, time(NULL) - 60);
+
+	/* Build the image like iradio-dbgen, in a process of its own
+	   because the database can't be switched once it is open */
+	image = g_strdup_printf("%s/%s", dir, "image.db");
+	pid = fork();
+	fail_if(pid < 0);
+	if (pid == 0)
+	{
+		g_setenv("MAFW_DB", image, TRUE);
+		db_image_path = "/nonexistent";
+		source = MAFW_IRADIO_SOURCE(mafw_iradio_source_new());
+		_exit(wait_vendor_setup(source) == 2 ? 0 : 1);
+	}
+	fail_unless(waitpid(pid, &status, 0) == pid);
+	fail_unless(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+	/* The first start takes the bookmarks from the image, and
+	   finds the vendor file already synchronized */
+	db_image_path = image;
+	source = MAFW_IRADIO_SOURCE(mafw_iradio_source_new());
+	objects = browse_titles(source);
+	fail_unless(g_hash_table_size(objects) == 2);
+	fail_unless(g_hash_table_lookup(objects, "Station A") != NULL);
+	fail_unless(g_hash_table_lookup(objects, "Station B") != NULL);
+	g_hash_table_destroy(objects);
+	g_object_unref(source);
+
+	path = g_strdup_printf("%s/%s", dir, "bookmarks.xml");
+	g_unlink(path);
+	g_unlink(image);
+	g_rmdir(dir);
+	g_free(path);
+	g_free(image);
+	g_free(dir);
+}
+END_TEST
+
+static void private_created(MafwSource *self, const gchar *object_id,
+			    gpointer user_data, const GError *error)
+{
+	fail_if(error != NULL);
+	checkmore_stop_loop();
+}
+
+START_TEST(test_private_db)
+{
+	static const gchar *const stations[] = {
+		"Station A", "http://a.example.com/live",
+		"Station B", "http://b.example.com/live",
+		NULL
+	};
+	MafwIradioSource *source;
+	GHashTable *objects, *metadata;
+	gchar *dir, *path, *db;
+	gint status;
+	pid_t pid;
+
+	unlink("test-iradiosource.db");
+	dir = g_strdup_printf("%s/iradio-test-XXXXXX", g_get_tmp_dir());
+	fail_if(g_mkdtemp(dir) == NULL);
+	vendor_setup_path = dir;
+	db_image_path = "/nonexistent";
+	write_vendor_file(dir, "bookmarks.xml", stations, time(NULL) - 60);
+
+	/* Fill the shared database first, in a process of its own
+	   because the database can't be switched once it is open */
+	pid = fork();
+	fail_if(pid < 0);
+	if (pid == 0)
+	{
+		source = MAFW_IRADIO_SOURCE(mafw_iradio_source_new());
+		_exit(wait_vendor_setup(source) == 2 ? 0 : 1);
+	}
+	fail_unless(waitpid(pid, &status, 0) == pid);
+	fail_unless(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+	/* The bookmarks and the vendor file state move to the private
+	   database, and leave the shared one */
+	db = g_strdup_printf("%s/%s", dir, "iradio.db");
+	g_setenv(MAFW_IRADIO_DB_ENV, db, TRUE);
+	source = MAFW_IRADIO_SOURCE(mafw_iradio_source_new());
+	fail_unless(mafw_iradio_db_is_private());
+	fail_unless(wait_vendor_setup(source) == 0);
+	objects = browse_titles(source);
+	fail_unless(g_hash_table_size(objects) == 2);
+	fail_unless(g_hash_table_lookup(objects, "Station A") != NULL);
+	fail_unless(g_hash_table_lookup(objects, "Station B") != NULL);
+	g_hash_table_destroy(objects);
+	fail_unless(mafw_db_try_prepare("SELECT * FROM " IRADIO_TABLE)
+		    == NULL);
+
+	/* The database thread stores the metadata as it was requested */
+	metadata = mafw_metadata_new();
+	mafw_metadata_add_str(metadata, MAFW_METADATA_KEY_URI,
+			      "http://c.example.com/live");
+	mafw_metadata_add_str(metadata, MAFW_METADATA_KEY_TITLE, "Station C");
+	mafw_source_create_object(MAFW_SOURCE(source),
+				  MAFW_IRADIO_SOURCE_UUID "::", metadata,
+				  private_created, NULL);
+	g_hash_table_remove(metadata, MAFW_METADATA_KEY_TITLE);
+	mafw_metadata_release(metadata);
+	checkmore_spin_loop(-1);
+	objects = browse_titles(source);
+	fail_unless(g_hash_table_lookup(objects, "Station C") != NULL);
+	g_hash_table_destroy(objects);
+	g_object_unref(source);
+	g_unsetenv(MAFW_IRADIO_DB_ENV);
+
+	path = g_strdup_printf("%s/%s", dir, "bookmarks.xml");
+	g_unlink(path);
+	g_free(path);
+	path = g_strconcat(db, "-wal", NULL);
+	g_unlink(path);
+	g_free(path);
+	path = g_strconcat(db, "-shm", NULL);
+	g_unlink(path);
+	g_free(path);
+	g_unlink(db);
+	g_rmdir(dir);
+	g_free(db);
+	g_free(dir);
+}
+END_TEST
+
+START_TEST(test_failed_migration)
+{
+	static const gchar *const stations[] = {
+		"Station A", "http://a.example.com/live",
+		"Station B", "http://b.example.com/live",
+		NULL
+	};
+	MafwIradioSource *source;
+	GHashTable *objects;
+	sqlite3 *private;
+	sqlite3_stmt *stmt;
+	gchar *dir, *path, *db;
+	gint status;
+	pid_t pid;
+
+	unlink("test-iradiosource.db");
+	dir = g_strdup_printf("%s/iradio-test-XXXXXX", g_get_tmp_dir());
+	fail_if(g_mkdtemp(dir) == NULL);
+	vendor_setup_path = dir;
+	db_image_path = "/nonexistent";
+	write_vendor_file(dir, "bookmarks.xml", stations, time(NULL) - 60);
+
+	/* The shared database gets a journal row that the private one
+	   refuses */
+	pid = fork();
+	fail_if(pid < 0);
+	if (pid == 0)
+	{
+		source = MAFW_IRADIO_SOURCE(mafw_iradio_source_new());
+		if (wait_vendor_setup(source) != 2)
+			_exit(1);
+		mafw_db_exec("DROP TABLE " IRADIO_CHANGES_TABLE);
+		mafw_db_exec("CREATE TABLE " IRADIO_CHANGES_TABLE
+			     "(seq, id, op, keys)");
+		mafw_db_exec("INSERT INTO " IRADIO_CHANGES_TABLE
+			     " VALUES(1, NULL, 0, NULL)");
+		_exit(0);
+	}
+	fail_unless(waitpid(pid, &status, 0) == pid);
+	fail_unless(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+	/* The source stays with the shared database then */
+	db = g_strdup_printf("%s/%s", dir, "iradio.db");
+	g_setenv(MAFW_IRADIO_DB_ENV, db, TRUE);
+	source = MAFW_IRADIO_SOURCE(mafw_iradio_source_new());
+	fail_if(mafw_iradio_db_is_private());
+	objects = browse_titles(source);
+	fail_unless(g_hash_table_size(objects) == 2);
+	g_hash_table_destroy(objects);
+	g_object_unref(source);
+	g_unsetenv(MAFW_IRADIO_DB_ENV);
+
+	/* And the private one is tried again on the next start */
+	fail_unless(sqlite3_open(db, &private) == SQLITE_OK);
+	fail_unless(sqlite3_prepare_v2(private, "SELECT 1 FROM sqlite_master"
+				       " WHERE name = '" IRADIO_TABLE "'", -1,
+				       &stmt, NULL) == SQLITE_OK);
+	fail_unless(sqlite3_step(stmt) == SQLITE_DONE);
+	sqlite3_finalize(stmt);
+	sqlite3_close(private);
+
+	path = g_strdup_printf("%s/%s", dir, "bookmarks.xml");
+	g_unlink(path);
+	g_free(path);
+	path = g_strconcat(db, "-wal", NULL);
+	g_unlink(path);
+	g_free(path);
+	path = g_strconcat(db, "-shm", NULL);
+	g_unlink(path);
+	g_free(path);
+	g_unlink(db);
+	g_rmdir(dir);
+	g_free(db);
+	g_free(dir);
+}
+END_TEST
+
+/* Adds @count bookmarks through @writer, numbering them from @first */
+static void add_stations(MafwIradioBulkWriter *writer, guint first,
+			 guint count)
+{
+	GHashTable *metadata;
+	gchar *title, *uri;
+	guint i;
+
+	for (i = first; i < first + count; i++)
+	{
+		title = g_strdup_printf("Station %u", i);
+		uri = g_strdup_printf("http://%u.example.com/live", i);
+		metadata = mafw_metadata_new();
+		mafw_metadata_add_str(metadata, MAFW_METADATA_KEY_TITLE,
+				      title);
+		mafw_metadata_add_str(metadata, MAFW_METADATA_KEY_URI, uri);
+		fail_if(mafw_iradio_bulk_writer_add(writer, metadata) == 0);
+		mafw_metadata_release(metadata);
+		g_free(title);
+		g_free(uri);
+	}
+}
+
+START_TEST(test_browse_during_import)
+{
+	MafwIradioBulkWriter *writer;
+	MafwIradioSource *source;
+	GHashTable *objects;
+	gint64 start, idle, busy;
+	gchar *dir, *db, *path;
+
+	unlink("test-iradiosource.db");
+	dir = g_strdup_printf("%s/iradio-test-XXXXXX", g_get_tmp_dir());
+	fail_if(g_mkdtemp(dir) == NULL);
+	vendor_setup_path = dir;
+	db_image_path = "/nonexistent";
+	db = g_strdup_printf("%s/%s", dir, "iradio.db");
+	g_setenv(MAFW_IRADIO_DB_ENV, db, TRUE);
+
+	source = MAFW_IRADIO_SOURCE(mafw_iradio_source_new());
+	writer = mafw_iradio_bulk_writer_new(source, FALSE);
+	add_stations(writer, 0, 10);
+	fail_unless(mafw_iradio_bulk_writer_finish(writer, NULL) == 10);
+
+	start = g_get_monotonic_time();
+	objects = browse_titles(source);
+	idle = g_get_monotonic_time() - start;
+	fail_unless(g_hash_table_size(objects) == 10);
+	g_hash_table_destroy(objects);
+
+	/* Browse in the middle of an import of over 10000 rows: clients
+	   get the last commit, as fast as before */
+	writer = mafw_iradio_bulk_writer_new(source, FALSE);
+	add_stations(writer, 10, 5000);
+	start = g_get_monotonic_time();
+	objects = browse_titles(source);
+	busy = g_get_monotonic_time() - start;
+	fail_unless(g_hash_table_size(objects) == 10);
+	g_hash_table_destroy(objects);
+	fail_if(busy > 5 * idle + 50000,
+		"Browse took %" G_GINT64_FORMAT " us during the import, "
+		"%" G_GINT64_FORMAT " us before", busy, idle);
+
+	fail_unless(mafw_iradio_bulk_writer_finish(writer, NULL) == 5000);
+	objects = browse_titles(source);
+	fail_unless(g_hash_table_size(objects) == 5010);
+	g_hash_table_destroy(objects);
+	g_object_unref(source);
+	g_unsetenv(MAFW_IRADIO_DB_ENV);
+
+	path = g_strconcat(db, "-wal", NULL);
+	g_unlink(path);
+	g_free(path);
+	path = g_strconcat(db, "-shm", NULL);
+	g_unlink(path);
+	g_free(path);
+	g_unlink(db);
+	g_rmdir(dir);
+	g_free(db);
+	g_free(dir);
+}
+END_TEST
+
+START_TEST(test_vendor_takeover)
+{
+	static const gchar *const first[] = {
+		"Station 1", "http://1.example.com/live",
+		NULL
+	};
+	static const gchar *const second[] = {
+		"Station 1 (vendor)", "http://1.example.com/live",
+		NULL
+	};
+	static const gchar *const third[] = {
+		"Station 2", "http://2.example.com/live",
+		NULL
+	};
+	MafwIradioBulkWriter *writer;
+	MafwIradioSource *source;
+	GHashTable *before, *after;
+	time_t mtime;
+	gchar *dir, *path;
+
+	unlink("test-iradiosource.db");
+	dir = g_strdup_printf("%s/iradio-test-XXXXXX", g_get_tmp_dir());
+	fail_if(g_mkdtemp(dir) == NULL);
+	vendor_setup_path = dir;
+	mtime = time(NULL) - 60;
+
+	source = MAFW_IRADIO_SOURCE(mafw_iradio_source_new());
+	writer = mafw_iradio_bulk_writer_new(source, FALSE);
+	add_stations(writer, 1, 1);
+	fail_unless(mafw_iradio_bulk_writer_finish(writer, NULL) == 1);
+	before = browse_titles(source);
+	g_object_unref(source);
+
+	/* The vendor file lists the stored bookmark: it is kept as it is */
+	write_vendor_file(dir, "bookmarks.xml", first, mtime);
+	source = MAFW_IRADIO_SOURCE(mafw_iradio_source_new());
+	fail_unless(wait_vendor_setup(source) == 0);
+	g_object_unref(source);
+
+	/* But it follows the next version of the file */
+	write_vendor_file(dir, "bookmarks.xml", second, mtime + 5);
+	source = MAFW_IRADIO_SOURCE(mafw_iradio_source_new());
+	fail_unless(wait_vendor_setup(source) == 1);
+	after = browse_titles(source);
+	fail_unless(g_hash_table_size(after) == 1);
+	fail_unless(strcmp(g_hash_table_lookup(after, "Station 1 (vendor)"),
+			   g_hash_table_lookup(before, "Station 1")) == 0);
+	g_object_unref(source);
+	g_hash_table_destroy(after);
+
+	/* Nor is it removed with the file, being the user's */
+	write_vendor_file(dir, "bookmarks.xml", third, mtime + 10);
+	source = MAFW_IRADIO_SOURCE(mafw_iradio_source_new());
+	fail_unless(wait_vendor_setup(source) == 1);
+	after = browse_titles(source);
+	fail_unless(g_hash_table_size(after) == 2);
+	fail_unless(strcmp(g_hash_table_lookup(after, "Station 1 (vendor)"),
+			   g_hash_table_lookup(before, "Station 1")) == 0);
+	g_object_unref(source);
+	g_hash_table_destroy(after);
+
+	path = g_strdup_printf("%s/%s", dir, "bookmarks.xml");
+	g_unlink(path);
+	source = MAFW_IRADIO_SOURCE(mafw_iradio_source_new());
+	wait_vendor_setup(source);
+	after = browse_titles(source);
+	fail_unless(g_hash_table_size(after) == 1);
+	fail_unless(g_hash_table_lookup(after, "Station 1 (vendor)") != NULL);
+	g_object_unref(source);
+	g_hash_table_destroy(before);
+	g_hash_table_destroy(after);
+
+	g_rmdir(dir);
+	g_free(path);
+	g_free(dir);
+}
+END_TEST
+
+START_TEST(test_vendor_shared_uri)
+{
+	static const gchar *const first[] = {
+		"Shared", "http://shared.example.com/live",
+		"Station A", "http://a.example.com/live",
+		NULL
+	};
+	static const gchar *const second[] = {
+		"Station A", "http://a.example.com/live",
+		NULL
+	};
+	static const gchar *const other[] = {
+		"Shared", "http://shared.example.com/live",
+		NULL
+	};
+	MafwIradioSource *source;
+	GHashTable *objects;
+	time_t mtime;
+	gchar *dir, *path;
+
+	unlink("test-iradiosource.db");
+	dir = g_strdup_printf("%s/iradio-test-XXXXXX", g_get_tmp_dir());
+	fail_if(g_mkdtemp(dir) == NULL);
+	vendor_setup_path = dir;
+	mtime = time(NULL) - 60;
+
+	/* Both files list one stream, which makes one object */
+	write_vendor_file(dir, "bookmarks.xml", first, mtime);
+	write_vendor_file(dir, "operator.confml", other, mtime);
+	source = MAFW_IRADIO_SOURCE(mafw_iradio_source_new());
+	fail_unless(wait_vendor_setup(source) == 2);
+	g_object_unref(source);
+
+	/* One of them drops it, the other one keeps it */
+	write_vendor_file(dir, "bookmarks.xml", second, mtime + 5);
+	source = MAFW_IRADIO_SOURCE(mafw_iradio_source_new());
+	fail_unless(wait_vendor_setup(source) == 0);
+	objects = browse_titles(source);
+	fail_unless(g_hash_table_size(objects) == 2);
+	fail_unless(g_hash_table_lookup(objects, "Shared") != NULL);
+	g_object_unref(source);
+	g_hash_table_destroy(objects);
+
+	/* Until that one is gone too */
+	path = g_strdup_printf("%s/%s", dir, "operator.confml");
+	g_unlink(path);
+	g_free(path);
+	source = MAFW_IRADIO_SOURCE(mafw_iradio_source_new());
+	fail_unless(wait_vendor_setup(source) == 1);
+	objects = browse_titles(source);
+	fail_unless(g_hash_table_size(objects) == 1);
+	fail_unless(g_hash_table_lookup(objects, "Station A") != NULL);
+	g_object_unref(source);
+	g_hash_table_destroy(objects);
+
+	path = g_strdup_printf("%s/%s", dir, "bookmarks.xml");
+	g_unlink(path);
+	g_rmdir(dir);
+	g_free(path);
+	g_free(dir);
+}
+END_TEST
+
+/* Callbacks of test_worker_ordering() log themselves here */
+static GString *order_log;
+static GThread *order_thread;
+
+static void order_created(MafwSource *self, const gchar *object_id,
+			  gpointer user_data, const GError *error)
+{
+	fail_if(error != NULL);
+	*(gchar **)user_data = g_strdup(object_id);
+	checkmore_stop_loop();
+}
+
+static void order_set(MafwSource *self, const gchar *object_id,
+		      const gchar **failed_keys, gpointer user_data,
+		      const GError *error)
+{
+	fail_if(error != NULL);
+	fail_unless(g_thread_self() == order_thread);
+	g_string_append_c(order_log, 's');
+}
+
+static void order_got(MafwSource *self, const gchar *object_id,
+		      GHashTable *metadata, gpointer user_data,
+		      const GError *error)
+{
+	fail_unless(g_thread_self() == order_thread);
+	if (user_data)
+	{
+		fail_if(error != NULL);
+		fail_if(strcmp(g_value_get_string(mafw_metadata_first(
+				metadata, MAFW_METADATA_KEY_TITLE)),
+			       user_data) != 0);
+		mafw_metadata_release(metadata);
+		g_string_append_c(order_log, 'g');
+	}
+	else
+	{
+		fail_if(error == NULL);
+		g_string_append_c(order_log, 'e');
+		checkmore_stop_loop();
+	}
+}
+
+static void order_destroyed(MafwSource *self, const gchar *object_id,
+			    gpointer user_data, const GError *error)
+{
+	fail_if(error != NULL);
+	fail_unless(g_thread_self() == order_thread);
+	g_string_append_c(order_log, 'd');
+}
+
+static void order_changed(MafwIradioSource *source, const gchar *object_id,
+			  gpointer what)
+{
+	fail_unless(g_thread_self() == order_thread);
+	g_string_append_c(order_log, GPOINTER_TO_INT(what));
+}
+
+#define DISPATCH_BURST 2000
+
+static void dispatch_nop(gpointer data)
+{
+}
+
+static void dispatch_done(gpointer data)
+{
+	static gint next;
+
+	fail_unless(GPOINTER_TO_INT(data) == next,
+		    "Completed %d before %d", GPOINTER_TO_INT(data), next);
+	if (++next == DISPATCH_BURST)
+		checkmore_stop_loop();
+}
+
+START_TEST(test_dispatch_queue)
+{
+	gint i;
+
+	/* A burst of requests completes in order from the dispatch queue,
+	   each once */
+	for (i = 0; i < DISPATCH_BURST; i++)
+		mafw_iradio_db_queue(MAFW_IRADIO_DB_INTERACTIVE, dispatch_nop,
+				     dispatch_done, GINT_TO_POINTER(i));
+	mafw_iradio_db_queue(MAFW_IRADIO_DB_BULK, dispatch_nop, NULL, NULL);
+	checkmore_spin_loop(-1);
+	checkmore_spin_loop(100);
+}
+END_TEST
+
+static GMutex priority_gate;
+static gint priority_blocked;
+
+static void priority_block(gpointer data)
+{
+	g_atomic_int_set(&priority_blocked, 1);
+	g_mutex_lock(&priority_gate);
+	g_mutex_unlock(&priority_gate);
+}
+
+static void priority_run(gpointer what)
+{
+	g_string_append_c(order_log, GPOINTER_TO_INT(what));
+}
+
+/* A bulk job, in capitals if it should make way for interactive ones */
+static void priority_yield(gpointer what)
+{
+	g_string_append_c(order_log, mafw_iradio_db_interactive_pending() ?
+			  g_ascii_toupper(GPOINTER_TO_INT(what)) :
+			  GPOINTER_TO_INT(what));
+}
+
+static void priority_done(gpointer data)
+{
+	checkmore_stop_loop();
+}
+
+START_TEST(test_priority_classes)
+{
+	MafwIradioSource *source;
+	MafwIradioDbStats interactive, bulk;
+	gchar *dir, *db, *path;
+	gint i;
+
+	unlink("test-iradiosource.db");
+	dir = g_strdup_printf("%s/iradio-test-XXXXXX", g_get_tmp_dir());
+	fail_if(g_mkdtemp(dir) == NULL);
+	vendor_setup_path = dir;
+	db_image_path = "/nonexistent";
+	db = g_strdup_printf("%s/%s", dir, "iradio.db");
+	g_setenv(MAFW_IRADIO_DB_ENV, db, TRUE);
+	source = MAFW_IRADIO_SOURCE(mafw_iradio_source_new());
+	fail_unless(mafw_iradio_db_is_private());
+	mafw_iradio_db_flush();
+	mafw_iradio_db_reset_stats();
+
+	/* While the worker is held up, bulk jobs are queued, then
+	   interactive ones, which overtake them, but only so many in a row */
+	order_log = g_string_new(NULL);
+	g_mutex_lock(&priority_gate);
+	mafw_iradio_db_queue(MAFW_IRADIO_DB_BULK, priority_block, NULL, NULL);
+	while (!g_atomic_int_get(&priority_blocked))
+		g_usleep(1000);
+	for (i = 0; i < 10; i++)
+		mafw_iradio_db_queue(MAFW_IRADIO_DB_BULK, priority_yield,
+				     i == 9 ? priority_done : NULL,
+				     GINT_TO_POINTER('b'));
+	for (i = 0; i < 20; i++)
+		mafw_iradio_db_queue(MAFW_IRADIO_DB_INTERACTIVE,
+				     priority_run, NULL,
+				     GINT_TO_POINTER('i'));
+	/* Only jobs on the database thread are told to make way */
+	fail_if(mafw_iradio_db_interactive_pending());
+	g_mutex_unlock(&priority_gate);
+	checkmore_spin_loop(-1);
+	fail_if(strcmp(order_log->str,
+		       "iiiiiiiiB" "iiiiiiiiB" "iiii" "bbbbbbbb") != 0,
+		"Run in the order %s", order_log->str);
+
+	/* Each class is accounted by itself, the flushes maybe too */
+	mafw_iradio_db_get_stats(MAFW_IRADIO_DB_INTERACTIVE, &interactive);
+	mafw_iradio_db_get_stats(MAFW_IRADIO_DB_BULK, &bulk);
+	fail_unless(interactive.jobs >= 20, "%u", interactive.jobs);
+	fail_unless(bulk.jobs >= 11, "%u", bulk.jobs);
+	fail_unless(interactive.max_wait <= interactive.max_latency);
+	fail_unless(bulk.max_wait <= bulk.max_latency);
+	fail_unless(interactive.max_wait < bulk.max_wait);
+
+	g_string_free(order_log, TRUE);
+	g_object_unref(source);
+	g_unsetenv(MAFW_IRADIO_DB_ENV);
+
+	path = g_strconcat(db, "-wal", NULL);
+	g_unlink(path);
+	g_free(path);
+	path = g_strconcat(db, "-shm", NULL);
+	g_unlink(path);
+	g_free(path);
+	g_unlink(db);
+	g_rmdir(dir);
+	g_free(db);
+	g_free(dir);
+}
+END_TEST
+
+START_TEST(test_worker_ordering)
+{
+	MafwIradioSource *source;
+	GHashTable *metadata;
+	gchar *dir, *db, *path, *object_id = NULL;
+
+	unlink("test-iradiosource.db");
+	dir = g_strdup_printf("%s/iradio-test-XXXXXX", g_get_tmp_dir());
+	fail_if(g_mkdtemp(dir) == NULL);
+	vendor_setup_path = dir;
+	db_image_path = "/nonexistent";
+	db = g_strdup_printf("%s/%s", dir, "iradio.db");
+	g_setenv(MAFW_IRADIO_DB_ENV, db, TRUE);
+	source = MAFW_IRADIO_SOURCE(mafw_iradio_source_new());
+
+	metadata = mafw_metadata_new();
+	mafw_metadata_add_str(metadata, MAFW_METADATA_KEY_URI,
+			      "http://a.example.com/live");
+	mafw_metadata_add_str(metadata, MAFW_METADATA_KEY_TITLE, "Old");
+	mafw_source_create_object(MAFW_SOURCE(source),
+				  MAFW_IRADIO_SOURCE_UUID "::", metadata,
+				  order_created, &object_id);
+	mafw_metadata_release(metadata);
+	checkmore_spin_loop(-1);
+	fail_unless(object_id != NULL);
+
+	/* Requests queued back to back are served and completed in order,
+	   in the main context of the caller */
+	order_log = g_string_new(NULL);
+	order_thread = g_thread_self();
+	g_signal_connect(source, "metadata-changed",
+			 G_CALLBACK(order_changed), GINT_TO_POINTER('m'));
+	g_signal_connect(source, "container-changed",
+			 G_CALLBACK(order_changed), GINT_TO_POINTER('c'));
+	metadata = mafw_metadata_new();
+	mafw_metadata_add_str(metadata, MAFW_METADATA_KEY_TITLE, "New");
+	mafw_source_set_metadata(MAFW_SOURCE(source), object_id, metadata,
+				 order_set, NULL);
+	mafw_metadata_release(metadata);
+	mafw_source_get_metadata(MAFW_SOURCE(source), object_id,
+				 MAFW_SOURCE_LIST(MAFW_METADATA_KEY_TITLE),
+				 order_got, (gpointer)"New");
+	mafw_source_destroy_object(MAFW_SOURCE(source), object_id,
+				   order_destroyed, NULL);
+	mafw_source_get_metadata(MAFW_SOURCE(source), object_id,
+				 MAFW_SOURCE_LIST(MAFW_METADATA_KEY_TITLE),
+				 order_got, NULL);
+	checkmore_spin_loop(-1);
+	/* The changes are notified once the burst is over, without the
+	   metadata-changed of the destroyed object */
+	fail_if(strcmp(order_log->str, "sgdce") != 0,
+		"Completed in the order %s", order_log->str);
+
+	g_string_free(order_log, TRUE);
+	g_object_unref(source);
+	g_unsetenv(MAFW_IRADIO_DB_ENV);
+	g_free(object_id);
+
+	path = g_strconcat(db, "-wal", NULL);
+	g_unlink(path);
+	g_free(path);
+	path = g_strconcat(db, "-shm", NULL);
+	g_unlink(path);
+	g_free(path);
+	g_unlink(db);
+	g_rmdir(dir);
+	g_free(db);
+	g_free(dir);
+}
+END_TEST
+
+/* Database file of test_group_commit() */
+static const gchar *group_db;
+static guint group_acked;
+
+/* Counts the objects committed, on a connection of its own */
+static gint count_committed(const gchar *path)
+{
+	sqlite3 *db;
+	sqlite3_stmt *stmt;
+	gint count = -1;
+
+	fail_unless(sqlite3_open(path, &db) == SQLITE_OK);
+	fail_unless(sqlite3_prepare_v2(db, "SELECT count(DISTINCT id) FROM "
+				       IRADIO_TABLE, -1, &stmt, NULL)
+		    == SQLITE_OK);
+	if (sqlite3_step(stmt) == SQLITE_ROW)
+		count = sqlite3_column_int(stmt, 0);
+	sqlite3_finalize(stmt);
+	sqlite3_close(db);
+	return count;
+}
+
+static void group_created(MafwSource *self, const gchar *object_id,
+			  gpointer user_data, const GError *error)
+{
+	fail_if(error != NULL);
+	/* Acknowledged only once it is stored */
+	group_acked++;
+	fail_unless(count_committed(group_db) >= group_acked);
+	if (group_acked == GPOINTER_TO_UINT(user_data))
+		checkmore_stop_loop();
+}
+
+static void group_renamed(MafwSource *self, const gchar *object_id,
+			  const gchar **failed_keys, gpointer user_data,
+			  const GError *error)
+{
+	fail_if(error != NULL);
+	fail_if(failed_keys != NULL);
+	checkmore_stop_loop();
+}
+
+START_TEST(test_group_commit)
+{
+	MafwIradioSource *source;
+	GHashTable *metadata;
+	gchar *dir, *db, *path, *uri;
+	gint64 start;
+	guint i;
+
+	unlink("test-iradiosource.db");
+	dir = g_strdup_printf("%s/iradio-test-XXXXXX", g_get_tmp_dir());
+	fail_if(g_mkdtemp(dir) == NULL);
+	vendor_setup_path = dir;
+	db_image_path = "/nonexistent";
+	db = g_strdup_printf("%s/%s", dir, "iradio.db");
+	g_setenv(MAFW_IRADIO_DB_ENV, db, TRUE);
+	source = MAFW_IRADIO_SOURCE(mafw_iradio_source_new());
+
+	/* The writes wait for each other, and are acknowledged together */
+	mafw_iradio_db_set_group_commit(200, 100);
+	group_db = db;
+	group_acked = 0;
+	start = g_get_monotonic_time();
+	for (i = 0; i < 10; i++)
+	{
+		uri = g_strdup_printf("http://%u.example.com/live", i);
+		metadata = mafw_metadata_new();
+		mafw_metadata_add_str(metadata, MAFW_METADATA_KEY_URI, uri);
+		mafw_source_create_object(MAFW_SOURCE(source),
+					  MAFW_IRADIO_SOURCE_UUID "::",
+					  metadata, group_created,
+					  GUINT_TO_POINTER(10));
+		mafw_metadata_release(metadata);
+		g_free(uri);
+	}
+	checkmore_spin_loop(-1);
+	fail_unless(group_acked == 10);
+	fail_if(g_get_monotonic_time() - start < 150000);
+
+	/* Flushing, as dispose does, stores a write at once */
+	metadata = mafw_metadata_new();
+	mafw_metadata_add_str(metadata, MAFW_METADATA_KEY_URI,
+			      "http://last.example.com/live");
+	mafw_source_create_object(MAFW_SOURCE(source),
+				  MAFW_IRADIO_SOURCE_UUID "::", metadata,
+				  group_created, GUINT_TO_POINTER(11));
+	mafw_metadata_release(metadata);
+	mafw_iradio_db_flush();
+	fail_unless(count_committed(db) == 11);
+	checkmore_spin_loop(-1);
+	fail_unless(group_acked == 11);
+
+	/* A transaction of this thread ends the open group early */
+	metadata = mafw_metadata_new();
+	mafw_metadata_add_str(metadata, MAFW_METADATA_KEY_URI,
+			      "http://waiter.example.com/live");
+	mafw_source_create_object(MAFW_SOURCE(source),
+				  MAFW_IRADIO_SOURCE_UUID "::", metadata,
+				  group_created, GUINT_TO_POINTER(12));
+	mafw_metadata_release(metadata);
+	g_usleep(50000);
+	start = g_get_monotonic_time();
+	fail_unless(mafw_iradio_db_begin());
+	fail_unless(g_get_monotonic_time() - start < 100000);
+	fail_unless(count_committed(db) == 12);
+	fail_unless(mafw_iradio_db_commit());
+	checkmore_spin_loop(-1);
+	fail_unless(group_acked == 12);
+
+	/* A write finds an object created earlier in its group */
+	metadata = mafw_metadata_new();
+	mafw_metadata_add_str(metadata, MAFW_METADATA_KEY_URI,
+			      "http://renamed.example.com/live");
+	mafw_source_create_object(MAFW_SOURCE(source),
+				  MAFW_IRADIO_SOURCE_UUID "::", metadata,
+				  group_created, NULL);
+	mafw_metadata_release(metadata);
+	metadata = mafw_metadata_new();
+	mafw_metadata_add_str(metadata, MAFW_METADATA_KEY_TITLE, "Renamed");
+	mafw_source_set_metadata(MAFW_SOURCE(source),
+				 MAFW_IRADIO_SOURCE_UUID "::13", metadata,
+				 group_renamed, NULL);
+	mafw_metadata_release(metadata);
+	checkmore_spin_loop(-1);
+	fail_unless(group_acked == 13);
+
+	g_object_unref(source);
+	g_unsetenv(MAFW_IRADIO_DB_ENV);
+	mafw_iradio_db_set_group_commit(MAFW_IRADIO_DB_GROUP_LATENCY,
+					MAFW_IRADIO_DB_GROUP_SIZE);
+
+	path = g_strconcat(db, "-wal", NULL);
+	g_unlink(path);
+	g_free(path);
+	path = g_strconcat(db, "-shm", NULL);
+	g_unlink(path);
+	g_free(path);
+	g_unlink(db);
+	g_rmdir(dir);
+	g_free(db);
+	g_free(dir);
+}
+END_TEST
+
+static void collect_sorted_result(MafwSource *self, guint browse_id,
+				  gint remaining_count, guint index,
+				  const gchar *object_id, GHashTable *metadata,
+				  gpointer user_data, const GError *error)
+{
+	GPtrArray *titles = user_data;
+
+	fail_unless(error == NULL);
+	if (object_id)
+		g_ptr_array_add(titles, g_value_dup_string(
+				mafw_metadata_first(metadata,
+						    MAFW_METADATA_KEY_TITLE)));
+	if (remaining_count == 0)
+		checkmore_stop_loop();
+}
+
+/* Browses the root sorted by title and checks the titles against @expected */
+static void check_sorted_titles(MafwIradioSource *source,
+				const gchar *const *expected)
+{
+	static const gchar *const keys[] = {
+		MAFW_METADATA_KEY_TITLE, MAFW_METADATA_KEY_URI, NULL
+	};
+	GPtrArray *titles;
+	guint i;
+
+	titles = g_ptr_array_new_with_free_func(g_free);
+	mafw_source_browse(MAFW_SOURCE(source), MAFW_IRADIO_SOURCE_UUID "::",
+			   FALSE, NULL, "+" MAFW_METADATA_KEY_TITLE, keys, 0,
+			   MAFW_SOURCE_BROWSE_ALL, collect_sorted_result,
+			   titles);
+	checkmore_spin_loop(-1);
+
+	fail_unless(titles->len == g_strv_length((gchar **)expected));
+	for (i = 0; i < titles->len; i++)
+		fail_unless(!strcmp(g_ptr_array_index(titles, i),
+				    expected[i]));
+	g_ptr_array_free(titles, TRUE);
+}
+
+/* Writes in flight in the crashing process of test_crash_recovery() */
+#define CRASH_INFLIGHT 8
+
+static gint crash_pipe;
+static guint crash_created;
+
+static void crash_created_cb(MafwSource *self, const gchar *object_id,
+			     gpointer user_data, const GError *error);
+
+static void crash_create(MafwSource *source, guint n)
+{
+	GHashTable *metadata;
+	gchar *title, *uri;
+
+	title = g_strdup_printf("Station %u", n);
+	uri = g_strdup_printf("http://%u.example.com/live", n);
+	metadata = mafw_metadata_new();
+	mafw_metadata_add_str(metadata, MAFW_METADATA_KEY_TITLE, title);
+	mafw_metadata_add_str(metadata, MAFW_METADATA_KEY_URI, uri);
+	mafw_source_create_object(source, MAFW_IRADIO_SOURCE_UUID "::",
+				  metadata, crash_created_cb, NULL);
+	mafw_metadata_release(metadata);
+	g_free(title);
+	g_free(uri);
+}
+
+static void crash_created_cb(MafwSource *self, const gchar *object_id,
+			     gpointer user_data, const GError *error)
+{
+	if (error)
+		_exit(1);
+	/* Tell the parent what is acknowledged, and write on */
+	crash_created++;
+	if (write(crash_pipe, &crash_created, sizeof(crash_created))
+	    != sizeof(crash_created))
+		_exit(1);
+	crash_create(self, crash_created + CRASH_INFLIGHT);
+}
+
+START_TEST(test_crash_recovery)
+{
+	MafwIradioSource *source;
+	GHashTable *objects;
+	sqlite3 *conn;
+	sqlite3_stmt *stmt;
+	gchar *dir, *db, *path;
+	guint acked, i;
+	gint fds[2], status;
+	pid_t pid;
+
+	unlink("test-iradiosource.db");
+	dir = g_strdup_printf("%s/iradio-test-XXXXXX", g_get_tmp_dir());
+	fail_if(g_mkdtemp(dir) == NULL);
+	vendor_setup_path = dir;
+	db_image_path = "/nonexistent";
+	db = g_strdup_printf("%s/%s", dir, "iradio.db");
+	g_setenv(MAFW_IRADIO_DB_ENV, db, TRUE);
+	g_setenv(MAFW_IRADIO_DB_PROFILE_ENV, "balanced", TRUE);
+
+	/* Kill a process in the middle of its writes */
+	fail_if(pipe(fds) != 0);
+	pid = fork();
+	fail_if(pid < 0);
+	if (pid == 0)
+	{
+		close(fds[0]);
+		crash_pipe = fds[1];
+		source = MAFW_IRADIO_SOURCE(mafw_iradio_source_new());
+		fail_unless(mafw_iradio_db_get_profile() ==
+			    MAFW_IRADIO_DB_BALANCED);
+		for (i = 1; i <= CRASH_INFLIGHT; i++)
+			crash_create(MAFW_SOURCE(source), i);
+		checkmore_spin_loop(-1);
+		_exit(1);
+	}
+	close(fds[1]);
+	acked = 0;
+	while (acked < 500)
+		fail_unless(read(fds[0], &acked, sizeof(acked)) ==
+			    sizeof(acked));
+	kill(pid, SIGKILL);
+	fail_unless(waitpid(pid, &status, 0) == pid);
+	fail_unless(WIFSIGNALED(status));
+	while (read(fds[0], &acked, sizeof(acked)) == sizeof(acked));
+	close(fds[0]);
+
+	/* Nothing acknowledged is lost, and no object is half-written */
+	fail_unless(sqlite3_open(db, &conn) == SQLITE_OK);
+	fail_unless(sqlite3_prepare_v2(conn, "PRAGMA integrity_check", -1,
+				       &stmt, NULL) == SQLITE_OK);
+	fail_unless(sqlite3_step(stmt) == SQLITE_ROW);
+	fail_unless(!strcmp((const gchar *)sqlite3_column_text(stmt, 0),
+			    "ok"));
+	sqlite3_finalize(stmt);
+	fail_unless(sqlite3_prepare_v2(conn, "SELECT count(*) FROM "
+				       "(SELECT id FROM " IRADIO_TABLE " "
+				       "WHERE key != '' GROUP BY id "
+				       "HAVING count(*) != 2)", -1,
+				       &stmt, NULL) == SQLITE_OK);
+	fail_unless(sqlite3_step(stmt) == SQLITE_ROW);
+	fail_unless(sqlite3_column_int(stmt, 0) == 0);
+	sqlite3_finalize(stmt);
+	sqlite3_close(conn);
+	fail_unless(count_committed(db) >= acked);
+
+	/* And the source starts on it */
+	source = MAFW_IRADIO_SOURCE(mafw_iradio_source_new());
+	objects = browse_titles(source);
+	fail_unless(g_hash_table_size(objects) >= acked);
+	fail_unless(g_hash_table_lookup(objects, "Station 1") != NULL);
+	g_hash_table_destroy(objects);
+	g_object_unref(source);
+	g_unsetenv(MAFW_IRADIO_DB_PROFILE_ENV);
+	g_unsetenv(MAFW_IRADIO_DB_ENV);
+
+	path = g_strconcat(db, "-wal", NULL);
+	g_unlink(path);
+	g_free(path);
+	path = g_strconcat(db, "-shm", NULL);
+	g_unlink(path);
+	g_free(path);
+	path = g_strconcat(db, ".iradio-snapshot", NULL);
+	g_unlink(path);
+	g_free(path);
+	g_unlink(db);
+	g_rmdir(dir);
+	g_free(db);
+	g_free(dir);
+}
+END_TEST
+
+static guint containers_changed;
+static guint objects_changed;
+
+static void count_container_changed(MafwIradioSource *source,
+				    const gchar *object_id, gpointer udata)
+{
+	fail_if(strcmp(object_id, MAFW_IRADIO_SOURCE_UUID "::") != 0);
+	containers_changed++;
+}
+
+static void count_metadata_changed(MafwIradioSource *source,
+				   const gchar *object_id, GPtrArray *udata)
+{
+	fail_if(strcmp(object_id, udata->pdata[0]) != 0);
+	objects_changed++;
+}
+
+static void coalesce_created(MafwSource *self, const gchar *object_id,
+			     gpointer user_data, const GError *error)
+{
+	fail_if(error != NULL);
+	g_ptr_array_add(user_data, g_strdup(object_id));
+}
+
+static void coalesce_set(MafwSource *self, const gchar *object_id,
+			 const gchar **failed_keys, gpointer user_data,
+			 const GError *error)
+{
+	fail_if(error != NULL);
+}
+
+static void coalesce_destroyed(MafwSource *self, const gchar *object_id,
+			       gpointer user_data, const GError *error)
+{
+	fail_if(error != NULL);
+	checkmore_stop_loop();
+}
+
+/* Creates @count objects back to back and waits for them */
+static void coalesce_create(MafwIradioSource *source, guint count,
+			    GPtrArray *object_ids)
+{
+	GHashTable *metadata;
+	gchar *uri;
+	guint i;
+
+	for (i = 0; i < count; i++)
+	{
+		uri = g_strdup_printf("http://%u.example.com/live",
+				      object_ids->len + i);
+		metadata = mafw_metadata_new();
+		mafw_metadata_add_str(metadata, MAFW_METADATA_KEY_URI, uri);
+		mafw_source_create_object(MAFW_SOURCE(source),
+					  MAFW_IRADIO_SOURCE_UUID "::",
+					  metadata, coalesce_created,
+					  object_ids);
+		mafw_metadata_release(metadata);
+		g_free(uri);
+	}
+	count += object_ids->len;
+	while (object_ids->len < count)
+		g_main_context_iteration(NULL, TRUE);
+}
+
+START_TEST(test_coalesced_signals)
+{
+	MafwIradioSource *source;
+	GPtrArray *object_ids;
+	GHashTable *metadata;
+	gint64 start;
+	guint i;
+
+	unlink("test-iradiosource.db");
+	vendor_setup_path = "/nonexistent";
+	db_image_path = "/nonexistent";
+	source = MAFW_IRADIO_SOURCE(mafw_iradio_source_new());
+	object_ids = g_ptr_array_new_with_free_func(g_free);
+	g_signal_connect(source, "container-changed",
+			 G_CALLBACK(count_container_changed), NULL);
+	g_signal_connect(source, "metadata-changed",
+			 G_CALLBACK(count_metadata_changed), object_ids);
+
+	/* A bulk of creations changes the container once, or once per
+	   100 ms if it takes longer */
+	containers_changed = objects_changed = 0;
+	start = g_get_monotonic_time();
+	coalesce_create(source, 300, object_ids);
+	fail_unless(containers_changed >= 1);
+	fail_unless(containers_changed <=
+		    1 + (g_get_monotonic_time() - start) / 100000,
+		    "%u container-changed", containers_changed);
+	fail_unless(objects_changed == 0);
+
+	/* Repeated changes of an object are notified once */
+	containers_changed = objects_changed = 0;
+	metadata = mafw_metadata_new();
+	mafw_metadata_add_str(metadata, MAFW_METADATA_KEY_TITLE, "Title");
+	for (i = 0; i < 50; i++)
+		mafw_source_set_metadata(MAFW_SOURCE(source),
+					 object_ids->pdata[i % 2], metadata,
+					 coalesce_set, NULL);
+
+	/* And not at all if it is destroyed in the meantime */
+	mafw_source_destroy_object(MAFW_SOURCE(source), object_ids->pdata[1],
+				   coalesce_destroyed, NULL);
+	mafw_metadata_release(metadata);
+	checkmore_spin_loop(-1);
+	fail_unless(objects_changed == 1, "%u metadata-changed",
+		    objects_changed);
+	fail_unless(containers_changed == 1);
+
+	/* A single request is notified when it completes */
+	containers_changed = objects_changed = 0;
+	coalesce_create(source, 1, object_ids);
+	fail_unless(containers_changed == 1);
+
+	g_ptr_array_free(object_ids, TRUE);
+	g_object_unref(source);
+}
+END_TEST
+
+static void check_change(GPtrArray *changes, guint i, const gchar *object_id,
+			 MafwIradioChangeOp op, const gchar *keys)
+{
+	MafwIradioChange *change = g_ptr_array_index(changes, i);
+	gchar *joined;
+
+	fail_if(strcmp(change->object_id, object_id) != 0);
+	fail_unless(change->op == op);
+	if (!keys)
+	{
+		fail_unless(change->keys == NULL);
+		return;
+	}
+	joined = g_strjoinv(",", change->keys);
+	fail_if(strcmp(joined, keys) != 0, "Keys %s", joined);
+	g_free(joined);
+}
+
+START_TEST(test_change_journal)
+{
+	MafwIradioBulkWriter *writer;
+	MafwIradioSource *source;
+	GPtrArray *object_ids, *changes;
+	GHashTable *metadata;
+	GError *error = NULL;
+	guint64 seq;
+
+	unlink("test-iradiosource.db");
+	vendor_setup_path = "/nonexistent";
+	db_image_path = "/nonexistent";
+	source = MAFW_IRADIO_SOURCE(mafw_iradio_source_new());
+	object_ids = g_ptr_array_new_with_free_func(g_free);
+	fail_unless(mafw_iradio_source_get_change_seq(source) == 0);
+
+	coalesce_create(source, 2, object_ids);
+	seq = mafw_iradio_source_get_change_seq(source);
+	metadata = mafw_metadata_new();
+	mafw_metadata_add_str(metadata, MAFW_METADATA_KEY_TITLE, "Title");
+	mafw_source_set_metadata(MAFW_SOURCE(source), object_ids->pdata[0],
+				 metadata, coalesce_set, NULL);
+	mafw_metadata_release(metadata);
+	mafw_source_destroy_object(MAFW_SOURCE(source), object_ids->pdata[1],
+				   coalesce_destroyed, NULL);
+	checkmore_spin_loop(-1);
+
+	/* Every change is journaled, in order */
+	changes = mafw_iradio_source_get_changes(source, 0, &error);
+	fail_if(error != NULL);
+	fail_unless(changes->len == 4);
+	check_change(changes, 0, object_ids->pdata[0],
+		     MAFW_IRADIO_CHANGE_CREATED, MAFW_METADATA_KEY_URI);
+	check_change(changes, 1, object_ids->pdata[1],
+		     MAFW_IRADIO_CHANGE_CREATED, MAFW_METADATA_KEY_URI);
+	check_change(changes, 2, object_ids->pdata[0],
+		     MAFW_IRADIO_CHANGE_UPDATED, MAFW_METADATA_KEY_TITLE);
+	check_change(changes, 3, object_ids->pdata[1],
+		     MAFW_IRADIO_CHANGE_DESTROYED, NULL);
+	fail_unless(((MafwIradioChange *)changes->pdata[3])->seq ==
+		    mafw_iradio_source_get_change_seq(source));
+	g_ptr_array_free(changes, TRUE);
+
+	/* A client that knows of the creations gets the rest */
+	changes = mafw_iradio_source_get_changes(source, seq, &error);
+	fail_if(error != NULL);
+	fail_unless(changes->len == 2);
+	fail_unless(((MafwIradioChange *)changes->pdata[0])->seq > seq);
+	g_ptr_array_free(changes, TRUE);
+	changes = mafw_iradio_source_get_changes(
+			source, mafw_iradio_source_get_change_seq(source),
+			&error);
+	fail_unless(changes->len == 0);
+	g_ptr_array_free(changes, TRUE);
+
+	/* Changes that are no longer journaled are an error */
+	mafw_iradio_db_exec("DELETE FROM " IRADIO_CHANGES_TABLE
+			    " WHERE seq <= 2");
+	changes = mafw_iradio_source_get_changes(source, 1, &error);
+	fail_unless(changes == NULL);
+	fail_unless(error != NULL);
+	g_clear_error(&error);
+	changes = mafw_iradio_source_get_changes(source, 2, &error);
+	fail_if(error != NULL);
+	fail_unless(changes->len == 2);
+	g_ptr_array_free(changes, TRUE);
+
+	/* The journal is kept at its size while the source runs */
+	seq = mafw_iradio_source_get_change_seq(source);
+	writer = mafw_iradio_bulk_writer_new(source, FALSE);
+	add_stations(writer, 100, 11000);
+	fail_unless(mafw_iradio_bulk_writer_finish(writer, NULL) == 11000);
+	changes = mafw_iradio_source_get_changes(source, seq, &error);
+	fail_unless(changes == NULL);
+	fail_unless(error != NULL);
+	g_clear_error(&error);
+
+	g_ptr_array_free(object_ids, TRUE);
+	g_object_unref(source);
+}
+END_TEST
+
+static guint cancel_results;
+
+static void cancel_browse_result(MafwSource *source, guint browse_id,
+				 gint remaining, guint index,
+				 const gchar *object_id, GHashTable *metadata,
+				 gpointer user_data, const GError *error)
+{
+	fail_if(error != NULL);
+	cancel_results++;
+	/* Cancelled from the callback, after the third result */
+	if (cancel_results == 3)
+	{
+		fail_unless(mafw_source_cancel_browse(source, browse_id,
+						      NULL));
+		checkmore_stop_loop();
+	}
+	fail_if(cancel_results > 3);
+}
+
+static void cancel_got(MafwSource *source, const gchar *object_id,
+		       GHashTable *metadata, gpointer user_data,
+		       const GError *error)
+{
+	gboolean *cancelled = user_data;
+
+	*cancelled = g_error_matches(error, G_IO_ERROR,
+				     G_IO_ERROR_CANCELLED);
+	fail_unless(*cancelled ? metadata == NULL : metadata != NULL);
+	checkmore_stop_loop();
+}
+
+START_TEST(test_cancel_requests)
+{
+	MafwIradioBulkWriter *writer;
+	MafwIradioSource *source;
+	GCancellable *cancellable;
+	GError *error = NULL;
+	gboolean cancelled;
+	gchar *dir, *m3u;
+	guint bid;
+
+	unlink("test-iradiosource.db");
+	dir = g_strdup_printf("%s/iradio-test-XXXXXX", g_get_tmp_dir());
+	fail_if(g_mkdtemp(dir) == NULL);
+	vendor_setup_path = "/nonexistent";
+	db_image_path = "/nonexistent";
+	source = MAFW_IRADIO_SOURCE(mafw_iradio_source_new());
+	writer = mafw_iradio_bulk_writer_new(source, FALSE);
+	add_stations(writer, 0, 200);
+	fail_unless(mafw_iradio_bulk_writer_finish(writer, NULL) == 200);
+
+	/* A browse cancelled before its scan is done returns nothing */
+	cancel_results = 0;
+	bid = mafw_source_browse(MAFW_SOURCE(source),
+				 MAFW_IRADIO_SOURCE_UUID "::", FALSE, NULL,
+				 NULL, MAFW_SOURCE_ALL_KEYS, 0,
+				 MAFW_SOURCE_BROWSE_ALL,
+				 cancel_browse_result, NULL);
+	fail_unless(mafw_source_cancel_browse(MAFW_SOURCE(source), bid,
+					      NULL));
+	mafw_iradio_db_flush();
+	checkmore_spin_loop(100);
+	fail_unless(cancel_results == 0);
+	/* And it is gone */
+	fail_if(mafw_source_cancel_browse(MAFW_SOURCE(source), bid, &error));
+	fail_unless(error != NULL);
+	g_clear_error(&error);
+
+	/* Nor anything after it is cancelled from its callback */
+	bid = mafw_source_browse(MAFW_SOURCE(source),
+				 MAFW_IRADIO_SOURCE_UUID "::", FALSE, NULL,
+				 NULL, MAFW_SOURCE_ALL_KEYS, 0,
+				 MAFW_SOURCE_BROWSE_ALL,
+				 cancel_browse_result, NULL);
+	checkmore_spin_loop(-1);
+	checkmore_spin_loop(100);
+	fail_unless(cancel_results == 3);
+	fail_if(mafw_source_cancel_browse(MAFW_SOURCE(source), bid, NULL));
+
+	/* A cancelled import stores nothing more */
+	m3u = g_strdup_printf("%s/%s", dir, "stations.m3u");
+	fail_unless(g_file_set_contents(m3u,
+		"#EXTM3U\n"
+		"#EXTINF:-1,Station A\n"
+		"http://a.example.com/live\n", -1, NULL));
+	cancellable = g_cancellable_new();
+	g_cancellable_cancel(cancellable);
+	fail_unless(mafw_iradio_import_file(source, m3u, 0, cancellable,
+					    &error) == 0);
+	fail_unless(g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED));
+	g_clear_error(&error);
+	g_object_unref(cancellable);
+	fail_unless(mafw_iradio_source_get_change_seq(source) == 200);
+
+	/* So does a metadata request, which is not read */
+	cancellable = g_cancellable_new();
+	mafw_iradio_source_get_metadata(source, MAFW_IRADIO_SOURCE_UUID "::1",
+					MAFW_SOURCE_ALL_KEYS, cancellable,
+					cancel_got, &cancelled);
+	g_cancellable_cancel(cancellable);
+	cancelled = FALSE;
+	checkmore_spin_loop(-1);
+	fail_unless(cancelled);
+	mafw_iradio_source_get_metadata(source, MAFW_IRADIO_SOURCE_UUID "::1",
+					MAFW_SOURCE_ALL_KEYS, cancellable,
+					cancel_got, &cancelled);
+	checkmore_spin_loop(-1);
+	fail_unless(cancelled);
+	g_object_unref(cancellable);
+	mafw_iradio_source_get_metadata(source, MAFW_IRADIO_SOURCE_UUID "::1",
+					MAFW_SOURCE_ALL_KEYS, NULL,
+					cancel_got, &cancelled);
+	checkmore_spin_loop(-1);
+	fail_if(cancelled);
+
+	g_object_unref(source);
+	g_unlink(m3u);
+	g_rmdir(dir);
+	g_free(m3u);
+	g_free(dir);
+}
+END_TEST
+
+struct threaded_client {
+	MafwSource *source;
+	GMainContext *context;
+	GThread *thread;
+	gchar *object_id;
+	guint64 seq;
+	guint results;
+	gboolean waiting;
+	gint done;
+};
+
+static GThread *threaded_main_thread;
+static guint threaded_signals;
+
+static void threaded_wait(struct threaded_client *client)
+{
+	client->waiting = TRUE;
+	while (client->waiting)
+		g_main_context_iteration(client->context, TRUE);
+}
+
+static void threaded_created(MafwSource *source, const gchar *object_id,
+			     gpointer user_data, const GError *error)
+{
+	struct threaded_client *client = user_data;
+
+	fail_if(error != NULL);
+	fail_unless(g_thread_self() == client->thread);
+	client->object_id = g_strdup(object_id);
+	client->waiting = FALSE;
+}
+
+static void threaded_got(MafwSource *source, const gchar *object_id,
+			 GHashTable *metadata, gpointer user_data,
+			 const GError *error)
+{
+	struct threaded_client *client = user_data;
+	GValue *title;
+
+	fail_if(error != NULL);
+	fail_unless(g_thread_self() == client->thread);
+	title = mafw_metadata_first(metadata, MAFW_METADATA_KEY_TITLE);
+	fail_unless(title && !strcmp(g_value_get_string(title), "Threaded"));
+	mafw_metadata_release(metadata);
+	client->waiting = FALSE;
+}
+
+static void threaded_browsed(MafwSource *source, guint browse_id,
+			     gint remaining, guint index,
+			     const gchar *object_id, GHashTable *metadata,
+			     gpointer user_data, const GError *error)
+{
+	struct threaded_client *client = user_data;
+
+	fail_if(error != NULL);
+	fail_unless(g_thread_self() == client->thread);
+	if (object_id)
+		client->results++;
+	if (!remaining)
+		client->waiting = FALSE;
+}
+
+static void threaded_changed(MafwSource *source, const gchar *object_id,
+			     gpointer unused)
+{
+	fail_unless(g_thread_self() == threaded_main_thread);
+	threaded_signals++;
+}
+
+static gpointer threaded_client_main(struct threaded_client *client)
+{
+	GHashTable *metadata;
+
+	client->context = g_main_context_new();
+	g_main_context_push_thread_default(client->context);
+	client->thread = g_thread_self();
+
+	metadata = mafw_metadata_new();
+	mafw_metadata_add_str(metadata, MAFW_METADATA_KEY_URI,
+			      "http://a.example.com/live");
+	mafw_metadata_add_str(metadata, MAFW_METADATA_KEY_TITLE, "Threaded");
+	mafw_source_create_object(client->source,
+				  MAFW_IRADIO_SOURCE_UUID "::", metadata,
+				  threaded_created, client);
+	mafw_metadata_release(metadata);
+	threaded_wait(client);
+	client->seq = mafw_iradio_source_get_change_seq(
+				MAFW_IRADIO_SOURCE(client->source));
+
+	mafw_source_get_metadata(client->source, client->object_id,
+				 MAFW_SOURCE_LIST(MAFW_METADATA_KEY_TITLE),
+				 threaded_got, client);
+	threaded_wait(client);
+
+	mafw_source_browse(client->source, MAFW_IRADIO_SOURCE_UUID "::",
+			   FALSE, NULL, NULL, MAFW_SOURCE_ALL_KEYS, 0,
+			   MAFW_SOURCE_BROWSE_ALL, threaded_browsed, client);
+	threaded_wait(client);
+
+	g_main_context_pop_thread_default(client->context);
+	g_main_context_unref(client->context);
+	g_atomic_int_set(&client->done, TRUE);
+	g_main_context_wakeup(NULL);
+	return NULL;
+}
+
+START_TEST(test_threaded_requests)
+{
+	struct threaded_client client;
+	GThread *thread;
+
+	unlink("test-iradiosource.db");
+	vendor_setup_path = "/nonexistent";
+	db_image_path = "/nonexistent";
+	memset(&client, 0, sizeof(client));
+	client.source = MAFW_SOURCE(mafw_iradio_source_new());
+	threaded_main_thread = g_thread_self();
+	threaded_signals = 0;
+	g_signal_connect(client.source, "container-changed",
+			 G_CALLBACK(threaded_changed), NULL);
+
+	/* A client on a thread of its own is served by the main loop, and
+	   called back in its own main context */
+	thread = g_thread_new("client", (GThreadFunc)threaded_client_main,
+			      &client);
+	while (!g_atomic_int_get(&client.done))
+		g_main_context_iteration(NULL, TRUE);
+	g_thread_join(thread);
+	fail_unless(client.results == 1, "%u results", client.results);
+	/* The journal is read for it by the main loop too */
+	fail_unless(client.seq > 0);
+
+	/* While the signals are emitted in the main context */
+	checkmore_spin_loop(100);
+	fail_unless(threaded_signals == 1);
+
+	g_free(client.object_id);
+	g_object_unref(client.source);
+}
+END_TEST
+
+static void shared_job(gint *ran)
+{
+	fail_unless(g_thread_self() == threaded_main_thread);
+	(*ran)++;
+}
+
+static gpointer shared_client_main(gint *ran)
+{
+	mafw_iradio_db_queue(MAFW_IRADIO_DB_BULK, (MafwIradioDbFunc)shared_job,
+			     NULL, ran);
+	return NULL;
+}
+
+START_TEST(test_shared_flush)
+{
+	MafwSource *source;
+	GThread *thread;
+	gint ran = 0;
+
+	unlink("test-iradiosource.db");
+	vendor_setup_path = "/nonexistent";
+	db_image_path = "/nonexistent";
+	source = MAFW_SOURCE(mafw_iradio_source_new());
+	threaded_main_thread = g_thread_self();
+
+	/* The job of another thread waits for the main loop, unless the
+	   shared database is flushed */
+	thread = g_thread_new("client", (GThreadFunc)shared_client_main, &ran);
+	g_thread_join(thread);
+	fail_unless(ran == 0);
+	mafw_iradio_db_flush();
+	fail_unless(ran == 1);
+	fail_if(mafw_iradio_db_pending());
+
+	g_object_unref(source);
+}
+END_TEST
+
+static gint counted;
+
+static void count_res(MafwSource *self, guint browse_id, gint remaining,
+		      guint index, const gchar *object_id,
+		      GHashTable *metadata, gpointer user_data,
+		      const GError *error)
+{
+	fail_if(error != NULL);
+	fail_if(index != 0);
+	fail_if(object_id != NULL);
+	fail_if(metadata != NULL);
+	fail_if(counted != -1, "More than one result");
+	counted = remaining;
+	checkmore_stop_loop();
+}
+
+/* Returns the number of objects matching @filter, after @skip */
+static gint count_objects(MafwIradioSource *source, const gchar *filter,
+			  guint skip)
+{
+	MafwFilter *parsed;
+
+	parsed = filter ? mafw_filter_parse(filter) : NULL;
+	counted = -1;
+	fail_if(mafw_iradio_source_count(source, parsed, skip, count_res, NULL)
+		== MAFW_SOURCE_INVALID_BROWSE_ID);
+	checkmore_spin_loop(-1);
+	/* Nothing follows */
+	checkmore_spin_loop(100);
+	if (parsed)
+		mafw_filter_free(parsed);
+	return counted;
+}
+
+START_TEST(test_count_browse)
+{
+	MafwIradioBulkWriter *writer;
+	MafwIradioSource *source;
+	GHashTable *objects;
+
+	unlink("test-iradiosource.db");
+	vendor_setup_path = "/nonexistent";
+	db_image_path = "/nonexistent";
+	source = MAFW_IRADIO_SOURCE(mafw_iradio_source_new());
+	fail_unless(count_objects(source, NULL, 0) == 0);
+
+	writer = mafw_iradio_bulk_writer_new(source, FALSE);
+	add_stations(writer, 0, 5);
+	fail_unless(mafw_iradio_bulk_writer_finish(writer, NULL) == 5);
+
+	/* Counted in the indices */
+	fail_unless(count_objects(source, NULL, 0) == 5);
+	fail_unless(count_objects(source, NULL, 2) == 3);
+	fail_unless(count_objects(source, NULL, 7) == 0);
+	fail_unless(count_objects(source, "(" MAFW_METADATA_KEY_URI "?)",
+				  0) == 5);
+	fail_unless(count_objects(source, "(" MAFW_METADATA_KEY_MIME "?)",
+				  0) == 0);
+	fail_unless(count_objects(source,
+				  "(" MAFW_METADATA_KEY_TITLE "=Station 3)",
+				  0) == 1);
+
+	/* And by evaluating the filter */
+	fail_unless(count_objects(source,
+				  "(!(" MAFW_METADATA_KEY_TITLE "=Station 3))",
+				  0) == 4);
+
+	/* Any item count of a browse asks for the objects */
+	objects = g_hash_table_new_full(g_str_hash, g_str_equal,
+					g_free, g_free);
+	mafw_source_browse(MAFW_SOURCE(source), MAFW_IRADIO_SOURCE_UUID "::",
+			   FALSE, NULL, NULL, MAFW_SOURCE_ALL_KEYS, 0,
+			   G_MAXUINT, collect_browse_result, objects);
+	checkmore_spin_loop(-1);
+	fail_unless(g_hash_table_size(objects) == 5);
+	g_hash_table_destroy(objects);
+
+	g_object_unref(source);
+}
+END_TEST
+
+static gint looked_up;
+static guint64 looked_up_id;
+
+static void lookup_res(MafwIradioSource *self, const gchar *uri,
+		       const gchar *const *object_ids, gpointer user_data,
+		       const GError *error)
+{
+	fail_if(error != NULL);
+	fail_unless(!strcmp(uri, user_data));
+	looked_up = object_ids ? g_strv_length((gchar **)object_ids) : 0;
+	if (object_ids)
+		looked_up_id = g_ascii_strtoull(strstr(object_ids[0], "::") + 2,
+						NULL, 10);
+	checkmore_stop_loop();
+}
+
+static void bulk_lookup_res(MafwIradioSource *self, GHashTable *found,
+			    gpointer user_data, const GError *error)
+{
+	fail_if(error != NULL);
+	fail_unless(g_hash_table_size(found) == 1);
+	fail_unless(g_hash_table_lookup(found, "http://1.example.com/live")
+		    != NULL);
+	looked_up = g_hash_table_size(found);
+	checkmore_stop_loop();
+}
+
+/* Returns how many objects bookmark @uri */
+static gint lookup_objects(MafwIradioSource *source, const gchar *uri)
+{
+	looked_up = -1;
+	mafw_iradio_source_lookup_uri(source, uri, lookup_res, (gpointer)uri);
+	checkmore_spin_loop(-1);
+	return looked_up;
+}
+
+START_TEST(test_lookup_uri)
+{
+	static const gchar *const uris[] = {
+		"http://1.example.com/live", "http://9.example.com/live", NULL
+	};
+	MafwIradioBulkWriter *writer;
+	MafwIradioSource *source;
+	MafwIradioSnapshot *snapshot;
+	gint pass;
+
+	unlink("test-iradiosource.db");
+	vendor_setup_path = "/nonexistent";
+	db_image_path = "/nonexistent";
+	source = MAFW_IRADIO_SOURCE(mafw_iradio_source_new());
+	writer = mafw_iradio_bulk_writer_new(source, FALSE);
+	add_stations(writer, 0, 5);
+	fail_unless(mafw_iradio_bulk_writer_finish(writer, NULL) == 5);
+
+	/* From the index, then from the snapshot */
+	for (pass = 0; pass < 2; pass++)
+	{
+		fail_unless(lookup_objects(source,
+					   "http://3.example.com/live") == 1);
+		fail_unless(lookup_objects(source,
+					   " HTTP://3.Example.COM/live") == 1);
+		fail_unless(lookup_objects(source,
+					   "http://3.example.com/LIVE") == 0);
+		mafw_iradio_source_lookup_uris(source, uris, bulk_lookup_res,
+					       NULL);
+		checkmore_spin_loop(-1);
+		fail_unless(looked_up == 1);
+
+		g_object_unref(source);
+		snapshot = mafw_iradio_snapshot_update(NULL);
+		fail_if(snapshot == NULL);
+		mafw_iradio_snapshot_free(snapshot);
+		source = MAFW_IRADIO_SOURCE(mafw_iradio_source_new());
+	}
+
+	/* Destroyed objects are not found */
+	fail_unless(lookup_objects(source, "http://3.example.com/live") == 1);
+	writer = mafw_iradio_bulk_writer_new(source, FALSE);
+	fail_unless(mafw_iradio_bulk_writer_remove(writer, looked_up_id,
+					"http://3.example.com/live"));
+	fail_unless(mafw_iradio_bulk_writer_finish(writer, NULL) == 1);
+	fail_unless(lookup_objects(source, "http://3.example.com/live") == 0);
+
+	g_object_unref(source);
+}
+END_TEST
+
+static void dedup_set(MafwSource *self, const gchar *object_id,
+		      const gchar **failed_keys, gpointer user_data,
+		      const GError *error)
+{
+	fail_unless((error != NULL) == GPOINTER_TO_INT(user_data));
+	checkmore_stop_loop();
+}
+
+static void dedup_got(MafwSource *self, const gchar *object_id,
+		      GHashTable *metadata, gpointer user_data,
+		      const GError *error)
+{
+	fail_if(error != NULL);
+	fail_if(strcmp(g_value_get_string(mafw_metadata_first(
+			metadata, MAFW_METADATA_KEY_TITLE)), user_data) != 0);
+	mafw_metadata_release(metadata);
+	checkmore_stop_loop();
+}
+
+/* Creates an object bookmarking @uri and returns its id */
+static gchar *dedup_create(MafwIradioSource *source, const gchar *uri,
+			   const gchar *title)
+{
+	GHashTable *metadata;
+	gchar *object_id = NULL;
+
+	metadata = mafw_metadata_new();
+	mafw_metadata_add_str(metadata, MAFW_METADATA_KEY_URI, uri);
+	mafw_metadata_add_str(metadata, MAFW_METADATA_KEY_TITLE, title);
+	mafw_source_create_object(MAFW_SOURCE(source),
+				  MAFW_IRADIO_SOURCE_UUID "::", metadata,
+				  order_created, &object_id);
+	mafw_metadata_release(metadata);
+	checkmore_spin_loop(-1);
+	fail_if(object_id == NULL);
+	return object_id;
+}
+
+START_TEST(test_uri_dedup)
+{
+	MafwIradioBulkWriter *writer;
+	MafwIradioSource *source;
+	GHashTable *metadata;
+	gchar *first, *second;
+	guint64 id;
+
+	unlink("test-iradiosource.db");
+	vendor_setup_path = "/nonexistent";
+	db_image_path = "/nonexistent";
+	source = MAFW_IRADIO_SOURCE(mafw_iradio_source_new());
+
+	/* Spellings of the same URI are merged into one object */
+	first = dedup_create(source, "HTTP://Example.COM:80/%7estation/",
+			     "Old");
+	second = dedup_create(source, "http://example.com/~station", "New");
+	fail_if(strcmp(first, second) != 0);
+	g_free(second);
+	mafw_source_get_metadata(MAFW_SOURCE(source), first,
+				 MAFW_SOURCE_LIST(MAFW_METADATA_KEY_TITLE),
+				 dedup_got, (gpointer)"New");
+	checkmore_spin_loop(-1);
+	fail_unless(count_objects(source, NULL, 0) == 1);
+
+	/* But an object may not take the URI of another */
+	second = dedup_create(source, "http://example.com:8000/station",
+			      "Other");
+	fail_if(strcmp(first, second) == 0);
+	metadata = mafw_metadata_new();
+	mafw_metadata_add_str(metadata, MAFW_METADATA_KEY_URI,
+			      "http://example.com/~station/");
+	mafw_source_set_metadata(MAFW_SOURCE(source), second, metadata,
+				 dedup_set, GINT_TO_POINTER(TRUE));
+	checkmore_spin_loop(-1);
+	mafw_metadata_release(metadata);
+	fail_unless(lookup_objects(source,
+				   "http://example.com:8000/station") == 1);
+
+	/* Bulk writers skip or merge them */
+	id = g_ascii_strtoull(strstr(first, "::") + 2, NULL, 10);
+	metadata = mafw_metadata_new();
+	mafw_metadata_add_str(metadata, MAFW_METADATA_KEY_URI,
+			      "http://EXAMPLE.com/~station");
+	writer = mafw_iradio_bulk_writer_new(source, TRUE);
+	fail_unless(mafw_iradio_bulk_writer_add(writer, metadata) == 0);
+	fail_unless(mafw_iradio_bulk_writer_finish(writer, NULL) == 0);
+	writer = mafw_iradio_bulk_writer_new(source, FALSE);
+	fail_unless(mafw_iradio_bulk_writer_add(writer, metadata) == id);
+	fail_unless(mafw_iradio_bulk_writer_finish(writer, NULL) == 1);
+	mafw_metadata_release(metadata);
+	fail_unless(count_objects(source, NULL, 0) == 2);
+
+	g_free(first);
+	g_free(second);
+	g_object_unref(source);
+}
+END_TEST
+
+static gchar *page_titles;
+static gchar *page_cursor;
+
+static void got_page(MafwIradioSource *self, GPtrArray *object_ids,
+		     GPtrArray *metadata, const gchar *next_cursor,
+		     gpointer user_data, const GError *error)
+{
+	GString *titles;
+	GValue *title;
+	guint i;
+
+	g_free(page_titles);
+	g_free(page_cursor);
+	page_titles = NULL;
+	page_cursor = g_strdup(next_cursor);
+	if (!error)
+	{
+		fail_unless(object_ids->len == metadata->len);
+		titles = g_string_new(NULL);
+		for (i = 0; i < metadata->len; i++)
+		{
+			title = mafw_metadata_first(
+				g_ptr_array_index(metadata, i),
+				MAFW_METADATA_KEY_TITLE);
+			g_string_append_printf(titles, "%s%s", i ? "," : "",
+					       g_value_get_string(title));
+		}
+		page_titles = g_string_free(titles, FALSE);
+		checkmore_stop_loop();
+	}
+}
+
+/* Reads the page at @cursor and checks its titles */
+static void check_page(MafwIradioSource *source, const gchar *cursor,
+		       const gchar *titles)
+{
+	gchar *at;
+
+	at = g_strdup(cursor);
+	mafw_iradio_source_browse_page(source, MAFW_IRADIO_BROWSE_BY_TITLE,
+				       at, 2,
+				       MAFW_SOURCE_LIST(MAFW_METADATA_KEY_TITLE),
+				       got_page, NULL);
+	checkmore_spin_loop(-1);
+	fail_unless(page_titles && !strcmp(page_titles, titles),
+		    "%s", page_titles);
+	g_free(at);
+}
+
+START_TEST(test_paged_browse)
+{
+	MafwIradioBulkWriter *writer;
+	MafwIradioSource *source;
+	GHashTable *metadata;
+
+	unlink("test-iradiosource.db");
+	vendor_setup_path = "/nonexistent";
+	db_image_path = "/nonexistent";
+	source = MAFW_IRADIO_SOURCE(mafw_iradio_source_new());
+	writer = mafw_iradio_bulk_writer_new(source, FALSE);
+	add_stations(writer, 0, 5);
+	fail_unless(mafw_iradio_bulk_writer_finish(writer, NULL) == 5);
+
+	check_page(source, NULL, "Station 0,Station 1");
+	fail_if(page_cursor == NULL);
+
+	/* An object before the cursor does not shift the next page */
+	writer = mafw_iradio_bulk_writer_new(source, FALSE);
+	metadata = mafw_metadata_new();
+	mafw_metadata_add_str(metadata, MAFW_METADATA_KEY_TITLE, "Station 0");
+	mafw_metadata_add_str(metadata, MAFW_METADATA_KEY_URI,
+			      "http://0.example.org/live");
+	fail_if(mafw_iradio_bulk_writer_add(writer, metadata) == 0);
+	mafw_metadata_release(metadata);
+	fail_unless(mafw_iradio_bulk_writer_finish(writer, NULL) == 1);
+	check_page(source, page_cursor, "Station 2,Station 3");
+	check_page(source, page_cursor, "Station 4");
+	fail_unless(page_cursor == NULL);
+
+	/* The namesake sorts after the first one */
+	check_page(source, NULL, "Station 0,Station 0");
+
+	/* Cursors are checked */
+	mafw_iradio_source_browse_page(source, MAFW_IRADIO_BROWSE_BY_ID,
+				       "bogus", 2, NULL, got_page, NULL);
+	fail_unless(page_titles == NULL);
+
+	g_free(page_cursor);
+	page_cursor = NULL;
+	g_object_unref(source);
+}
+END_TEST
+
+START_TEST(test_snapshot)
+{
+	static const gchar *const three[] = {
+		"Station A", "Station B", "Station C", NULL
+	};
+	static const gchar *const four[] = {
+		"Station A", "Station B", "Station C", "Station D", NULL
+	};
+	MafwIradioSnapshotEntry entry;
+	MafwIradioSnapshot *snapshot;
+	MafwIradioSource *source;
+	gchar *dir, *path;
+
+	unlink("test-iradiosource.db");
+	dir = g_strdup_printf("%s/iradio-test-XXXXXX", g_get_tmp_dir());
+	fail_if(g_mkdtemp(dir) == NULL);
+	vendor_setup_path = dir;
+
+	path = g_strdup_printf("%s/%s", dir, "stations.m3u");
+	fail_unless(g_file_set_contents(path,
+		"#EXTINF:-1,Station C\nhttp://c.example.com/live\n"
+		"#EXTINF:-1,Station A\nhttp://a.example.com/live\n"
+		"#EXTINF:-1,Station B\nhttp://b.example.com/live\n",
+		-1, NULL));
+	source = MAFW_IRADIO_SOURCE(mafw_iradio_source_new());
+	fail_unless(mafw_iradio_import_file(source, path, 0, NULL, NULL) == 3);
+	g_object_unref(source);
+
+	/* Normally written a few seconds after the last change */
+	snapshot = mafw_iradio_snapshot_update(NULL);
+	fail_if(snapshot == NULL);
+	fail_unless(mafw_iradio_snapshot_count(snapshot) == 3);
+	mafw_iradio_snapshot_get(snapshot, 0, TRUE, &entry);
+	fail_unless(!strcmp(entry.title, "Station A"));
+	fail_unless(!strcmp(entry.uri, "http://a.example.com/live"));
+	mafw_iradio_snapshot_get(snapshot, 0, FALSE, &entry);
+	fail_unless(!strcmp(entry.title, "Station C"));
+	mafw_iradio_snapshot_free(snapshot);
+
+	/* A new source answers from the snapshot */
+	source = MAFW_IRADIO_SOURCE(mafw_iradio_source_new());
+	check_sorted_titles(source, three);
+
+	/* Changes are browsed from the database until the next snapshot */
+	fail_unless(g_file_set_contents(path,
+		"#EXTINF:-1,Station D\nhttp://d.example.com/live\n",
+		-1, NULL));
+	fail_unless(mafw_iradio_import_file(source, path, 0, NULL, NULL) == 1);
+	snapshot = mafw_iradio_snapshot_load();
+	fail_unless(snapshot == NULL);
+	check_sorted_titles(source, four);
+	g_object_unref(source);
+
+	g_unlink(path);
+	g_rmdir(dir);
+	g_free(path);
+	g_free(dir);
+}
+END_TEST
+
 /*---------------------------------------------------------------------------
  Main
  ----------------------------------------------------------------------------*/
@@ -1086,6 +3389,31 @@ int main(void)
 	tc = tcase_create("Customization");
 	if (1)	suite_add_tcase(suite, tc);
 	tcase_add_test(tc, test_confml_parse);
+	tcase_add_test(tc, test_vendor_resync);
+	tcase_add_test(tc, test_vendor_hot_reload);
+	tcase_add_test(tc, test_import_playlists);
+	tcase_add_test(tc, test_import_pipelined);
+	tcase_add_test(tc, test_db_image);
+	tcase_add_test(tc, test_private_db);
+	tcase_add_test(tc, test_failed_migration);
+	tcase_add_test(tc, test_browse_during_import);
+	tcase_add_test(tc, test_vendor_takeover);
+	tcase_add_test(tc, test_vendor_shared_uri);
+	tcase_add_test(tc, test_worker_ordering);
+	tcase_add_test(tc, test_dispatch_queue);
+	tcase_add_test(tc, test_priority_classes);
+	tcase_add_test(tc, test_group_commit);
+	tcase_add_test(tc, test_crash_recovery);
+	tcase_add_test(tc, test_coalesced_signals);
+	tcase_add_test(tc, test_change_journal);
+	tcase_add_test(tc, test_cancel_requests);
+	tcase_add_test(tc, test_threaded_requests);
+	tcase_add_test(tc, test_shared_flush);
+	tcase_add_test(tc, test_paged_browse);
+	tcase_add_test(tc, test_count_browse);
+	tcase_add_test(tc, test_lookup_uri);
+	tcase_add_test(tc, test_uri_dedup);
+	tcase_add_test(tc, test_snapshot);
 	tcase_set_timeout(tc, 60); /* With valgrind, it could need more time */
 
         return checkmore_run(srunner_create(suite), FALSE);